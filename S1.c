@@ -13,51 +13,65 @@
 #include <errno.h>
 #include <time.h>
 
+#include "dfs_backend.h"
+#include "dfs_cluster.h"
+#include "dfs_meta.h"
+#include "dfs_watch.h"
+#include "dfs_durable.h"
+#include "dfs_net.h"
+#include "dfs_pack.h"
+#include "dfs_stripe.h"
+#include "dfs_admit.h"
+#include "dfs_lane.h"
+#include "dfs_rate.h"
+#include "dfs_metrics.h"
+#include "dfs_trace.h"
+#include "dfs_fs.h"
+#include "dfs_record.h"
+#include "dfs_selftest.h"
+#include "dfs_log.h"
+#include "dfs_fault.h"
+#include "dfs_probe.h"
+
 #define PORT 7777
 #define BUFFER_SIZE 1024
-#define MAX_CLIENTS 10
+#define MAX_CLIENTS SOMAXCONN // listen backlog
 #define SERVER_PORT_2 7778
 #define SERVER_PORT_3 7779
 #define SERVER_PORT_4 7780
 
-// Establishes connection to another server (S2, S3, S4) based on provided port
-int connect_to_server(int SERVER_PORT)
-{
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0)
-    {
-        perror("Socket creation failed");
-        exit(1);
-    }
+// payload bytes and time of the last transfer through a relay, read by selftest
+long relay_bytes, relay_us;
 
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+// set while a framed command is served: its client reads the size in front of a download
+// exactly, so the download need not pause after it
+int client_framed;
 
-    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+// Establishes connection to another server (S2, S3, S4) based on provided port.
+// Returns -1 when the server is down or its circuit breaker is open, so a dead
+// backend fails the request instead of killing the client's handler.
+int connect_to_server(int SERVER_PORT)
+{
+    if (SERVER_PORT < 0)
     {
-        perror("Connection failed");
-        exit(1);
+        return -1;
     }
-
-    return sock;
+    return dfs_backend_connect(SERVER_PORT);
 }
 
-// // this sets the S1 folder path usually under the HOME directory eg. home/patel4xa/S1
-void create_path_if_not_exist(const char *path)
+// Reads and drops an upload the client is still sending, keeping the session in sync
+void discard_upload(int client_socket, int remaining)
 {
-    char temp[512];
-    strcpy(temp, path);
-    char *p = temp + 1; // skip first slash
-    while ((p = strchr(p, '/')) != NULL)
+    char buffer[BUFFER_SIZE];
+    while (remaining > 0)
     {
-        *p = '\0';
-        mkdir(temp, 0777);
-        *p = '/';
-        p++;
+        int bytes = dfs_recv(client_socket, buffer, remaining < BUFFER_SIZE ? remaining : BUFFER_SIZE, 0);
+        if (bytes <= 0)
+        {
+            break;
+        }
+        remaining -= bytes;
     }
-    mkdir(temp, 0777); // Create final directory
 }
 
 /**
@@ -80,180 +94,77 @@ void get_s1_folder_path(char *base_path)
     }
 }
 
-// check whether path exist return 2 for direcotory, return 1 for file, otherwise 0
-int check_path_exists(const char *path)
-{
-    struct stat path_stat;
-    // Check if path exists using stat
-    if (stat(path, &path_stat) != 0)
-    {
-        return 0;
-    }
-    // Check if it's a directory
-    if (S_ISDIR(path_stat.st_mode))
-    {
-        return 2;
-    }
-    return 1;
-}
-
-// Lists all files from a given directory filtered by file extension, results sorted alphabetically
-char *list_all_files(const char *path, const char *extension, char *result, size_t result_size)
-{
-    char command[1024];
-    // Clear the result buffer
-    memset(result, 0, result_size);
-
-    // Validate inputs
-    if (path == NULL || result == NULL || result_size <= 0)
-    {
-        return NULL;
-    }
-
-    // Check if directory exists
-    struct stat st;
-    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
-    {
-        return NULL;
-    }
-
-    // Build the find command
-    if (extension != NULL)
-    {
-        // Filter by extension
-        snprintf(command, sizeof(command), "find \"%s\" -type f -name \"*%s\"", path, extension);
-    }
-    else
-    {
-        // All files
-        snprintf(command, sizeof(command), "find \"%s\" -type f", path);
-    }
-    // Execute the command
-    FILE *fp = popen(command, "r");
-    if (fp == NULL)
-    {
-        perror("popen failed");
-        return NULL;
-    }
-    // Store all filenames in an array for sorting
-    char filenames[1000][256];
-    int file_count = 0;
-    char line[1024];
-    // read each and extract names
-    while (fgets(line, sizeof(line), fp) != NULL && file_count < 1000)
-    {
-        line[strcspn(line, "\n")] = 0;
-
-        const char *filename = strrchr(line, '/'); // Extract just the filename (not the full path)
-        if (filename)
-        {
-            filename++; // Skip the '/'
-        }
-        else
-        {
-            filename = line;
-        }
-        // Store the filename
-        strncpy(filenames[file_count], filename, 255);
-        filenames[file_count][255] = '\0';
-        file_count++;
-    }
-    pclose(fp);
-    // Sort the filenames
-    for (int i = 0; i < file_count - 1; i++)
-    {
-        for (int j = 0; j < file_count - i - 1; j++)
-        {
-            if (strcasecmp(filenames[j], filenames[j + 1]) > 0)
-            {
-                // Swap filenames
-                char temp[256];
-                strcpy(temp, filenames[j]);
-                strcpy(filenames[j], filenames[j + 1]);
-                strcpy(filenames[j + 1], temp);
-            }
-        }
-    }
-    // Now add the sorted filenames to the result
-    size_t current_size = 0;
-    for (int i = 0; i < file_count; i++)
-    {
-        size_t needed = strlen(filenames[i]) + 1; // +1 for newline
-        if (current_size + needed >= result_size - 1)
-        {
-            break;
-        }
-        // Append the filename and a newline
-        strcat(result, filenames[i]);
-        strcat(result, "\n");
-
-        current_size += needed;
-    }
-    return result;
-}
-
-// Converts '~S1/' notation to actual directory path
-void sanitize_path(char *resolved_path, const char *raw_path, const char *base_dir)
-{
-    if (strncmp(raw_path, "~S1/", 4) == 0)
-    {
-        snprintf(resolved_path, 512, "%s/%s", base_dir, raw_path + 4);
-    }
-    else
-    {
-        snprintf(resolved_path, 512, "%s", raw_path);
-    }
-}
-
 // forward the .zip , .pdf, .txt file to their respective server
-void file_forwader(int sock, char command[], int filesize, int client_socket, char *server_name)
+void file_forwader(int sock, char command[], int filesize, int client_socket, char *server_name, int port)
 {
+    dfs_backend_begin(port);
 
-    // Forward the command
-    send(sock, command, strlen(command), 0);
-    usleep(100000); // Delay for safety
-
-    // Forward file size
-    send(sock, &filesize, sizeof(int), 0);
-    usleep(100000);
+    // Forward the command as a frame, so the node reads it apart from the file size right behind it
+    dfs_trace_send_frame(sock, command);
+    dfs_send_all(sock, &filesize, sizeof(int));
 
     // Receive and forward the entire file
     char buffer[BUFFER_SIZE];
     int bytes_received, total_received = 0;
+    long relay_started = dfs_trace_now();
+    long payload_started = dfs_now_us();
 
     while (total_received < filesize)
     {
-        bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
+        // never past the upload, a pipelining client's next command follows it
+        int want = filesize - total_received < BUFFER_SIZE ? filesize - total_received : BUFFER_SIZE;
+        bytes_received = dfs_recv(client_socket, buffer, want, 0);
         if (bytes_received <= 0)
         {
-            printf("Error receiving file from W25client\n");
+            dfs_log(DFS_LOG_ERROR, "Error receiving file from W25client");
             close(sock);
+            dfs_backend_end(port, 1); // the client went away, not the node
             return;
         }
 
         // Forward data to specific server
-        int sent = send(sock, buffer, bytes_received, 0);
-        if (sent < bytes_received)
+        DFS_PROBE3(relay_chunk, port, bytes_received, 0);
+        dfs_lane_transfer(bytes_received);
+        dfs_rate_bytes(bytes_received);
+        if (dfs_send_all(sock, buffer, bytes_received) < 0)
         {
-            printf("Error forwarding data to %s\n", server_name);
-            // close(sock);
+            dfs_log(DFS_LOG_ERROR, "Error forwarding data to %s", server_name);
+            total_received += bytes_received;
+            discard_upload(client_socket, filesize - total_received);
+            close(sock);
+            dfs_backend_end(port, 0);
+            dfs_send(client_socket, "Error storing file on server", 28, 0);
             return;
         }
 
         total_received += bytes_received;
     }
 
-    // Get confirmation from server
+    relay_bytes = total_received;
+    relay_us = dfs_now_us() - payload_started;
+    char detail[64];
+    snprintf(detail, sizeof(detail), "%d bytes to port %d", total_received, port);
+    dfs_trace_span("relay upload", relay_started, detail);
+
+    // Get confirmation from server, bounded by the io timeout of the socket. The node
+    // answers with an error when it, or a replica down its chain, did not store the file.
     char response[BUFFER_SIZE];
     memset(response, 0, BUFFER_SIZE);
-    recv(sock, response, BUFFER_SIZE, 0);
-    printf("%s response: %s\n", server_name, response);
+    int answered = dfs_recv(sock, response, BUFFER_SIZE - 1, 0) > 0;
+    int stored = answered && strncmp(response, "Error", 5) != 0;
+    dfs_log(DFS_LOG_INFO, "%s response: %s", server_name, answered ? response : "(none)");
 
     // Close connection to server
     close(sock);
+    dfs_backend_end(port, answered);
 
+    if (!stored)
+    {
+        dfs_send(client_socket, "Error storing file on server", 28, 0);
+        return;
+    }
     // Inform client that the upload was successful
-    send(client_socket, "File uploaded successfully", 26, 0);
+    dfs_send(client_socket, "File uploaded successfully", 26, 0);
 }
 
 /* OPTION 2 - Upload file feature ----------------------------------------------------------------*/
@@ -262,14 +173,20 @@ void upload_handler(int client_socket, char *filename, char *dest_path, char com
     char *ext = strrchr(filename, '.');
     if (!ext)
     {
-        printf("Invalid file extension.\n");
+        dfs_log(DFS_LOG_WARN, "Invalid file extension.");
         return;
     }
 
     // Receive file size
     int filesize;
-    recv(client_socket, &filesize, sizeof(int), 0);
-    printf("Receiving file: %s (%d bytes)\n", filename, filesize);
+    if (dfs_recv_all(client_socket, &filesize, sizeof(int)) < 0)
+    {
+        dfs_log(DFS_LOG_ERROR, "No file size for %s", filename);
+        return;
+    }
+    dfs_log(DFS_LOG_INFO, "Receiving file: %s (%d bytes)", filename, filesize);
+    dfs_lane_size(filesize);
+    dfs_record_size(filesize);
 
     char full_path[512];
 
@@ -277,108 +194,252 @@ void upload_handler(int client_socket, char *filename, char *dest_path, char com
     {
         // Save in ~/S1/...
         snprintf(full_path, sizeof(full_path), "%s/%s", dest_path, filename);
-        create_path_if_not_exist(dest_path);
+        dfs_fs_mkdirs(dest_path);
 
-        FILE *fp = fopen(full_path, "wb");
-        if (fp == NULL)
+        // small files are appended to the pack store instead of getting a file of their own
+        char *packed = dfs_pack_wanted(filesize) ? malloc(filesize + 1) : NULL;
+        FILE *fp = NULL;
+        char tmp_path[600];
+        if (packed == NULL)
         {
-            perror("File open failed");
-            return;
+            // written aside and renamed into place once complete and on disk
+            fp = dfs_durable_open(full_path, tmp_path, sizeof(tmp_path));
+            if (fp == NULL)
+            {
+                perror("File open failed");
+                discard_upload(client_socket, filesize);
+                dfs_send(client_socket, "Error storing file", 18, 0);
+                return;
+            }
         }
 
         int bytes_received, total_received = 0;
+        unsigned long long hash = DFS_META_HASH_INIT;
         char buffer[BUFFER_SIZE];
         while (total_received < filesize)
         {
-            bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
-            fwrite(buffer, 1, bytes_received, fp);
+            int want = filesize - total_received < BUFFER_SIZE ? filesize - total_received : BUFFER_SIZE;
+            bytes_received = dfs_recv(client_socket, buffer, want, 0);
+            if (bytes_received <= 0)
+            {
+                break;
+            }
+            if (packed != NULL)
+            {
+                memcpy(packed + total_received, buffer, bytes_received);
+            }
+            else
+            {
+                fwrite(buffer, 1, bytes_received, fp);
+                dfs_fault_disk(bytes_received);
+                DFS_PROBE2(disk_write, full_path, bytes_received);
+            }
+            hash = dfs_meta_hash(hash, buffer, bytes_received);
             total_received += bytes_received;
+            dfs_lane_transfer(bytes_received);
+            dfs_rate_bytes(bytes_received);
         }
 
-        fclose(fp);
-        printf("File saved to %s\n", full_path);
-        send(client_socket, "File uploaded successfully", 26, 0);
+        if (total_received < filesize)
+        {
+            // never leave a truncated copy behind
+            if (fp != NULL)
+            {
+                dfs_durable_abort(fp, tmp_path);
+            }
+            free(packed);
+            dfs_log(DFS_LOG_ERROR, "Upload of %s failed after %d of %d bytes, nothing stored", filename, total_received,
+                    filesize);
+            dfs_send(client_socket, "Error storing file", 18, 0);
+            return;
+        }
+        int stored = 1;
+        if (packed != NULL && dfs_pack_put(full_path, packed, total_received) == 0)
+        {
+            remove(full_path); // an older copy that was stored as a regular file
+            dfs_log(DFS_LOG_INFO, "File packed as %s", full_path);
+        }
+        else if (packed != NULL)
+        {
+            // the pack index is full, fall back to a regular file
+            dfs_fault_disk(total_received);
+            stored = dfs_durable_write(full_path, packed, total_received) == 0;
+            if (stored)
+            {
+                dfs_log(DFS_LOG_INFO, "File saved to %s", full_path);
+            }
+        }
+        else
+        {
+            stored = dfs_durable_commit(fp, tmp_path, full_path) == 0;
+            if (stored)
+            {
+                dfs_pack_remove(full_path); // an older packed copy
+                dfs_log(DFS_LOG_INFO, "File saved to %s", full_path);
+            }
+        }
+        free(packed);
+        if (!stored)
+        {
+            dfs_log(DFS_LOG_ERROR, "Failed to store %s", full_path);
+            dfs_send(client_socket, "Error storing file", 18, 0);
+            return;
+        }
+        dfs_meta_put(full_path, total_received, hash);
+        dfs_send(client_socket, "File uploaded successfully", 26, 0);
     }
     else if (strcmp(ext, ".pdf") == 0)
     {
 
+        // writes always enter the chain at its head (instance 0)
         int sock = connect_to_server(SERVER_PORT_2);
         if (sock < 0)
         {
-            printf("Failed to connect to S2\n");
+            dfs_log(DFS_LOG_ERROR, "Failed to connect to S2");
+            discard_upload(client_socket, filesize);
+            dfs_send(client_socket, "Error: S2 is unavailable", 24, 0);
             return;
         }
 
-        file_forwader(sock, command, filesize, client_socket, "S2");
+        file_forwader(sock, command, filesize, client_socket, "S2", SERVER_PORT_2);
     }
     else if (strcmp(ext, ".txt") == 0)
     {
+        // writes always enter the chain at its head (instance 0)
         int sock = connect_to_server(SERVER_PORT_3);
         if (sock < 0)
         {
-            printf("Failed to connect to S2\n");
+            dfs_log(DFS_LOG_ERROR, "Failed to connect to S3");
+            discard_upload(client_socket, filesize);
+            dfs_send(client_socket, "Error: S3 is unavailable", 24, 0);
             return;
         }
 
-        file_forwader(sock, command, filesize, client_socket, "S3");
+        file_forwader(sock, command, filesize, client_socket, "S3", SERVER_PORT_3);
     }
     else if (strcmp(ext, ".zip") == 0)
     {
+        // large zips are striped over all S4 instances instead of landing on one disk
+        if (dfs_stripe_wanted(filesize))
+        {
+            char raw_dest[512];
+            sscanf(command, "%*s %*s %511s", raw_dest);
+            dfs_stripe_upload(client_socket, filename, raw_dest, filesize, SERVER_PORT_4);
+            return;
+        }
+
+        // writes always enter the chain at its head (instance 0)
         int sock = connect_to_server(SERVER_PORT_4);
         if (sock < 0)
         {
-            printf("Failed to connect to S2\n");
+            dfs_log(DFS_LOG_ERROR, "Failed to connect to S4");
+            discard_upload(client_socket, filesize);
+            dfs_send(client_socket, "Error: S4 is unavailable", 24, 0);
             return;
         }
 
-        file_forwader(sock, command, filesize, client_socket, "S4");
+        file_forwader(sock, command, filesize, client_socket, "S4", SERVER_PORT_4);
     }
     else
     {
-        printf("Forwarding %s to appropriate server based on extension\n", filename);
+        dfs_log(DFS_LOG_INFO, "Forwarding %s to appropriate server based on extension", filename);
     }
 }
 
-// Forwards file download requests to the appropriate server and sends file to client
-void download_request_forwader(int server_socket, char buffer[], int client_socket, char *servername)
+// Forwards file download requests to the appropriate server and sends file to client.
+// The request goes to the best replica (hedged to a second one if it is slow) and is
+// abandoned at the request deadline instead of blocking the client forever.
+void download_request_forwader(int base_port, char buffer[], int client_socket, char *servername)
 {
-    send(server_socket, buffer, strlen(buffer), 0);
-
     // Receive file size from the server
-    int filesize;
-    recv(server_socket, &filesize, sizeof(int), 0);
-    printf("Receiving file: %s (%d bytes)\n", " ", filesize);
-
-    // Send file size to client
-    send(client_socket, &filesize, sizeof(int), 0);
-    usleep(100000);
+    int filesize = 0;
+    size_t header_len = 0;
+    int port;
+    int server_socket = dfs_backend_request(base_port, buffer, &filesize, sizeof(int), sizeof(int),
+                                            &header_len, &port);
+    if (server_socket < 0)
+    {
+        dfs_log(DFS_LOG_ERROR, "No %s replica answered the download request", servername);
+        dfs_send(client_socket, &(int){0}, sizeof(int), 0);
+        return;
+    }
+    int ok = 1;
+    dfs_log(DFS_LOG_INFO, "Receiving file: %s (%d bytes) from %s on port %d", " ", filesize, servername, port);
+    dfs_lane_size(filesize);
+    dfs_record_size(filesize);
 
     // Receive and forward the entire file
     char input_buffer[BUFFER_SIZE]; // Change to use BUFFER_SIZE, not filesize
     int bytes_received, total_received = 0;
 
+    // a small zip may be the manifest of a striped object, look at it before forwarding
+    struct dfs_manifest manifest;
+    if (base_port == SERVER_PORT_4 && filesize > 0 && filesize <= DFS_MANIFEST_MAX)
+    {
+        ok = dfs_recv_all(server_socket, input_buffer, filesize) == 0;
+        if (ok && dfs_stripe_parse_manifest(input_buffer, filesize, &manifest))
+        {
+            close(server_socket);
+            dfs_backend_end(port, 1);
+            char command[20], file_path[512];
+            sscanf(buffer, "%19s %511s", command, file_path);
+            dfs_record_size(manifest.size);
+            dfs_stripe_download(client_socket, file_path, &manifest, base_port);
+            return;
+        }
+        total_received = ok ? filesize : 0;
+    }
+
+    // Send file size to client
+    long relay_started = dfs_trace_now();
+    dfs_send(client_socket, &filesize, sizeof(int), 0);
+    if (!client_framed)
+    {
+        usleep(100000);
+    }
+    long payload_started = dfs_now_us();
+    if (total_received > 0)
+    {
+        dfs_send_all(client_socket, input_buffer, total_received);
+    }
+
     while (total_received < filesize)
     {
-        bytes_received = recv(server_socket, input_buffer, BUFFER_SIZE, 0);
+        bytes_received = dfs_recv(server_socket, input_buffer, BUFFER_SIZE, 0);
         if (bytes_received <= 0)
         {
-            printf("Error receiving file from server\n");
+            dfs_log(DFS_LOG_ERROR, "Error receiving file from server");
+            ok = 0;
             break;
         }
 
         // Forward data to client
-        int sent = send(client_socket, input_buffer, bytes_received, 0);
-        if (sent < bytes_received)
+        DFS_PROBE3(relay_chunk, port, bytes_received, 1);
+        dfs_lane_transfer(bytes_received);
+        dfs_rate_bytes(bytes_received);
+        if (dfs_send_all(client_socket, input_buffer, bytes_received) < 0)
         {
-            printf("Error forwarding data to client\n");
+            dfs_log(DFS_LOG_ERROR, "Error forwarding data to client");
             break;
         }
 
         total_received += bytes_received;
     }
 
+    relay_bytes = total_received;
+    relay_us = dfs_now_us() - payload_started;
+    char detail[64];
+    snprintf(detail, sizeof(detail), "%d bytes from port %d", total_received, port);
+    dfs_trace_span("relay download", relay_started, detail);
+
     // Don't wait for an additional response after file transfer
     close(server_socket);
+    dfs_backend_end(port, ok);
+    if (!ok)
+    {
+        // the client cannot be resynchronised after a short transfer, end its session
+        shutdown(client_socket, SHUT_RDWR);
+    }
 }
 
 /* OPTION 3 - Download file feature ----------------------------------------------------------------*/
@@ -390,24 +451,40 @@ void download_handler(int client_socket, char buffer[])
     char *ext = strrchr(file_path, '.');
     if (!ext)
     {
-        printf("Invalid file extension in download command.\n");
-        send(client_socket, "Invalid file extension", 22, 0);
+        dfs_log(DFS_LOG_WARN, "Invalid file extension in download command.");
+        dfs_send(client_socket, "Invalid file extension", 22, 0);
         return;
     }
 
     char base_path[512];
     get_s1_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, file_path, base_path);
+    dfs_fs_resolve(resolved_path, file_path, base_path);
 
-    if (strcmp(ext, ".c") == 0)
+    int packed_size;
+    char *packed = strcmp(ext, ".c") == 0 ? dfs_pack_load(resolved_path, &packed_size) : NULL;
+    if (packed != NULL)
+    {
+        // packed file, already read with a single pread
+        dfs_send(client_socket, &packed_size, sizeof(int), 0);
+        if (!client_framed)
+        {
+            usleep(100000);
+        }
+        dfs_record_size(packed_size);
+        dfs_rate_bytes(packed_size);
+        dfs_send_all(client_socket, packed, packed_size);
+        free(packed);
+        dfs_log(DFS_LOG_INFO, "File '%s' sent to client successfully.", resolved_path);
+    }
+    else if (strcmp(ext, ".c") == 0)
     {
         // For .c files stored locally
         FILE *fp = fopen(resolved_path, "rb");
         if (fp == NULL)
         {
-            printf("Cannot open file %s\n", resolved_path);
-            send(client_socket, &(int){0}, sizeof(int), 0);
+            dfs_log(DFS_LOG_ERROR, "Cannot open file %s", resolved_path);
+            dfs_send(client_socket, &(int){0}, sizeof(int), 0);
             return;
         }
 
@@ -417,53 +494,75 @@ void download_handler(int client_socket, char buffer[])
         rewind(fp);
 
         // Send file size
-        send(client_socket, &filesize, sizeof(int), 0);
-        usleep(100000);
+        dfs_send(client_socket, &filesize, sizeof(int), 0);
+        if (!client_framed)
+        {
+            usleep(100000);
+        }
+        dfs_lane_size(filesize);
+        dfs_record_size(filesize);
 
         // Send file content
         char filebuffer[BUFFER_SIZE];
         int bytes;
         while ((bytes = fread(filebuffer, 1, BUFFER_SIZE, fp)) > 0)
         {
-            send(client_socket, filebuffer, bytes, 0);
+            dfs_fault_disk(bytes);
+            DFS_PROBE2(disk_read, resolved_path, bytes);
+            dfs_lane_transfer(bytes);
+            dfs_rate_bytes(bytes);
+            if (dfs_send_all(client_socket, filebuffer, bytes) < 0)
+            {
+                break;
+            }
         }
 
         fclose(fp);
-        printf("File '%s' sent to client successfully.\n", resolved_path);
+        dfs_log(DFS_LOG_INFO, "File '%s' sent to client successfully.", resolved_path);
     }
     else if (strcmp(ext, ".pdf") == 0)
     {
-        int sock = connect_to_server(SERVER_PORT_2);
-        download_request_forwader(sock, buffer, client_socket, "S2");
+        download_request_forwader(SERVER_PORT_2, buffer, client_socket, "S2");
     }
     else if (strcmp(ext, ".txt") == 0)
     {
-        int sock = connect_to_server(SERVER_PORT_3);
-        download_request_forwader(sock, buffer, client_socket, "S3");
+        download_request_forwader(SERVER_PORT_3, buffer, client_socket, "S3");
     }
     else if (strcmp(ext, ".zip") == 0)
     {
-        int sock = connect_to_server(SERVER_PORT_4);
-        download_request_forwader(sock, buffer, client_socket, "S4");
+        download_request_forwader(SERVER_PORT_4, buffer, client_socket, "S4");
     }
     else
     {
-        printf("Unsupported file extension: %s\n", ext);
-        send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
+        dfs_log(DFS_LOG_WARN, "Unsupported file extension: %s", ext);
+        dfs_send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
     }
 }
 
 // this fucntion forwards file removal requests to respective servers
-void remove_request_forwader(int sock, char buffer[], int client_socket, char *servername)
+void remove_request_forwader(int port, char buffer[], int client_socket, char *servername)
 {
+    int sock = connect_to_server(port);
+    if (sock < 0)
+    {
+        dfs_send(client_socket, "Error: server is unavailable", 28, 0);
+        return;
+    }
 
-    send(sock, buffer, strlen(buffer), 0);
+    dfs_backend_begin(port);
+    dfs_trace_send(sock, buffer);
+    shutdown(sock, SHUT_WR);
     char response[BUFFER_SIZE];
     memset(response, 0, BUFFER_SIZE);
-    recv(sock, response, BUFFER_SIZE, 0);
-    printf("%s response: %s\n", servername, response);
+    int answered = dfs_recv(sock, response, BUFFER_SIZE - 1, 0) > 0;
+    dfs_log(DFS_LOG_INFO, "%s response: %s", servername, answered ? response : "(none)");
     close(sock);
-    send(client_socket, response, strlen(response), 0);
+    dfs_backend_end(port, answered);
+    if (!answered)
+    {
+        strcpy(response, "Error: no response from server");
+    }
+    dfs_send_all(client_socket, response, strlen(response));
 }
 
 /* OPTION 4 - Remove file feature ----------------------------------------------------------------*/
@@ -474,41 +573,100 @@ void remove_handler(int client_socket, char buffer[])
     char *ext = strrchr(file_path, '.');
     if (!ext)
     {
-        printf("Invalid file extension in remove command.\n");
-        send(client_socket, "Invalid file extension", 22, 0);
+        dfs_log(DFS_LOG_WARN, "Invalid file extension in remove command.");
+        dfs_send(client_socket, "Invalid file extension", 22, 0);
         return;
     }
     char base_path[512];
     get_s1_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, file_path, base_path);
+    dfs_fs_resolve(resolved_path, file_path, base_path);
 
     if (strcmp(ext, ".c") == 0)
     {
-        if (remove(resolved_path) == 0)
+        if (dfs_pack_remove(resolved_path) == 0 || remove(resolved_path) == 0)
         {
-            printf("Removed file %s\n", resolved_path);
-            send(client_socket, "File removed successfully", 26, 0);
+            dfs_meta_remove(resolved_path);
+            dfs_log(DFS_LOG_INFO, "Removed file %s", resolved_path);
+            dfs_send(client_socket, "File removed successfully", 25, 0);
         }
         else
         {
             perror("Error removing file");
-            send(client_socket, "Error removing file", 20, 0);
+            dfs_send(client_socket, "Error removing file", 19, 0);
         }
     }
     else if (strcmp(ext, ".pdf") == 0)
     {
-        int sock = connect_to_server(SERVER_PORT_2);
-        remove_request_forwader(sock, buffer, client_socket, "S2");
+        remove_request_forwader(SERVER_PORT_2, buffer, client_socket, "S2");
     }
     else if (strcmp(ext, ".txt") == 0)
     {
-        int sock = connect_to_server(SERVER_PORT_3);
-        remove_request_forwader(sock, buffer, client_socket, "S3");
+        remove_request_forwader(SERVER_PORT_3, buffer, client_socket, "S3");
+    }
+    else
+    {
+        dfs_send(client_socket, "Unsupported file type for remove", 32, 0);
+    }
+}
+
+// asks one replica of a node for a file's metadata
+void stat_request_forwader(int base_port, char buffer[], int client_socket, char *servername)
+{
+    char reply[BUFFER_SIZE];
+    size_t received = 0;
+    int port;
+    int sock = dfs_backend_request(base_port, buffer, reply, 1, sizeof(reply) - 1, &received, &port);
+    if (sock < 0)
+    {
+        dfs_send(client_socket, "Error: server is unavailable", 28, 0);
+        return;
+    }
+    reply[received] = '\0';
+    dfs_log(DFS_LOG_INFO, "%s response: %s", servername, reply);
+    close(sock);
+    dfs_backend_end(port, 1);
+    dfs_send_all(client_socket, reply, strlen(reply));
+}
+
+// file metadata: size, upload time and content hash
+void stat_handler(int client_socket, char buffer[])
+{
+    char command[20], file_path[512];
+    sscanf(buffer, "%s %s", command, file_path);
+    char *ext = strrchr(file_path, '.');
+    if (!ext)
+    {
+        dfs_send(client_socket, "Invalid file extension", 22, 0);
+        return;
+    }
+
+    if (strcmp(ext, ".c") == 0)
+    {
+        char base_path[512];
+        get_s1_folder_path(base_path);
+        char resolved_path[512];
+        dfs_fs_resolve(resolved_path, file_path, base_path);
+        char reply[BUFFER_SIZE];
+        dfs_meta_describe(resolved_path, reply, sizeof(reply));
+        dfs_log(DFS_LOG_INFO, "statf %s: %s", resolved_path, reply);
+        dfs_send_all(client_socket, reply, strlen(reply));
+    }
+    else if (strcmp(ext, ".pdf") == 0)
+    {
+        stat_request_forwader(SERVER_PORT_2, buffer, client_socket, "S2");
+    }
+    else if (strcmp(ext, ".txt") == 0)
+    {
+        stat_request_forwader(SERVER_PORT_3, buffer, client_socket, "S3");
+    }
+    else if (strcmp(ext, ".zip") == 0)
+    {
+        stat_request_forwader(SERVER_PORT_4, buffer, client_socket, "S4");
     }
     else
     {
-        send(client_socket, "Unsupported file type for remove", 33, 0);
+        dfs_send(client_socket, "Unsupported file type for statf", 31, 0);
     }
 }
 
@@ -524,50 +682,31 @@ void downltar_handler(int client_socket, char *buffer)
         char s1folder[512];
         get_s1_folder_path(s1folder);
         
-        // First check if any .c files exist
-        char check_command[1024];
-        snprintf(check_command, sizeof(check_command), "find \"%s\" -type f -name '*.c' | wc -l", s1folder);
-        FILE *check_fp = popen(check_command, "r");
-        if (check_fp == NULL) {
-            send(client_socket, "Error checking for .c files", 26, 0);
-            return;
-        }
-        
-        char count_str[16];
-        fgets(count_str, sizeof(count_str), check_fp);
-        pclose(check_fp);
-        
-        int file_count = atoi(count_str);
-        if (file_count == 0) {
-            // Send 0 as filesize first
-            int zero_size = 0;
-            send(client_socket, &zero_size, sizeof(int), 0);
-            // Then send the error message
-            send(client_socket, "No .c files found to create tar archive", 36, 0);
-            return;
-        }
-
-        // Generate a unique tar filename by appending the current timestamp.
+        long build_started = DFS_PROBE_CLOCK(tar_phase);
+        // Generate a unique tar filename from the current timestamp and handler.
         char tarFilename[128];
-        snprintf(tarFilename, sizeof(tarFilename), "cfiles_%ld.tar", time(NULL));
-        char tarCommand[1024];
-        snprintf(tarCommand, sizeof(tarCommand),
-                 "find \"%s\" -type f -name '*.c' | tar -cf %s -T -", s1folder, tarFilename);
-        
-        if (system(tarCommand) != 0) {
+        snprintf(tarFilename, sizeof(tarFilename), "cfiles_%ld_%d.tar", time(NULL), getpid());
+        int file_count = dfs_fs_tar(s1folder, ".c", tarFilename);
+        if (file_count <= 0) {
+            // Send 0 as filesize first, then the reason
             int zero_size = 0;
-            send(client_socket, &zero_size, sizeof(int), 0);
-            send(client_socket, "Error creating tar file", 22, 0);
+            dfs_send(client_socket, &zero_size, sizeof(int), 0);
+            if (file_count == 0) {
+                dfs_send(client_socket, "No .c files found to create tar archive", 39, 0);
+            } else {
+                dfs_send(client_socket, "Error creating tar file", 23, 0);
+            }
             return;
         }
+        DFS_PROBE3(tar_phase, ".c", "build", DFS_PROBE_SINCE(build_started));
         
         // Open and send the tar file to the client.
         FILE *fp = fopen(tarFilename, "rb");
         if (fp == NULL)
         {
             int zero_size = 0;
-            send(client_socket, &zero_size, sizeof(int), 0);
-            send(client_socket, "Error creating tar file", 22, 0);
+            dfs_send(client_socket, &zero_size, sizeof(int), 0);
+            dfs_send(client_socket, "Error creating tar file", 23, 0);
             return;
         }
         
@@ -575,134 +714,170 @@ void downltar_handler(int client_socket, char *buffer)
         int filesize = ftell(fp);
         rewind(fp);
         
-        if (filesize == 0) {
-            fclose(fp);
-            remove(tarFilename);
-            int zero_size = 0;
-            send(client_socket, &zero_size, sizeof(int), 0);
-            send(client_socket, "No files found to create tar archive", 34, 0);
-            return;
-        }
-        
-        send(client_socket, &filesize, sizeof(int), 0);
+        dfs_send(client_socket, &filesize, sizeof(int), 0);
+        long send_started = DFS_PROBE_CLOCK(tar_phase);
         char filebuffer[BUFFER_SIZE];
         int bytes;
         while ((bytes = fread(filebuffer, 1, BUFFER_SIZE, fp)) > 0)
         {
-            send(client_socket, filebuffer, bytes, 0);
+            dfs_lane_transfer(bytes);
+            dfs_rate_bytes(bytes);
+            if (dfs_send_all(client_socket, filebuffer, bytes) < 0)
+            {
+                break;
+            }
         }
         fclose(fp);
+        DFS_PROBE3(tar_phase, ".c", "send", DFS_PROBE_SINCE(send_started));
         remove(tarFilename);
-        printf("Tar file %s sent successfully.\n", tarFilename);
+        dfs_log(DFS_LOG_INFO, "Tar file %s sent successfully.", tarFilename);
     }
     else if (strcmp(filetype, ".pdf") == 0)
     {
-        int sock = connect_to_server(SERVER_PORT_2);
+        int port = dfs_backend_pick_read(SERVER_PORT_2, 0);
+        int sock = connect_to_server(port);
         if (sock < 0) {
             int zero_size = 0;
-            send(client_socket, &zero_size, sizeof(int), 0);
-            send(client_socket, "Error connecting to PDF server", 29, 0);
+            dfs_send(client_socket, &zero_size, sizeof(int), 0);
+            dfs_send(client_socket, "Error connecting to PDF server", 30, 0);
             return;
         }
-        send(sock, buffer, strlen(buffer), 0);
-        int filesize;
-        recv(sock, &filesize, sizeof(int), 0);
+        dfs_backend_begin(port);
+        long started = dfs_now_us();
+        dfs_trace_send(sock, buffer);
+        shutdown(sock, SHUT_WR);
+        int filesize = 0;
+        int answered = dfs_recv_all(sock, &filesize, sizeof(int)) == 0;
+        dfs_backend_observe(port, dfs_now_us() - started);
         
         if (filesize <= 0) {
             close(sock);
+            // a size of 0 is the node's answer when it has no such files, not a failure
+            dfs_backend_end(port, answered);
             int zero_size = 0;
-            send(client_socket, &zero_size, sizeof(int), 0);
-            send(client_socket, "No PDF files found to create tar archive", 37, 0);
+            dfs_send(client_socket, &zero_size, sizeof(int), 0);
+            dfs_send(client_socket, "No PDF files found to create tar archive", 40, 0);
             return;
         }
         
-        send(client_socket, &filesize, sizeof(int), 0);
+        dfs_send(client_socket, &filesize, sizeof(int), 0);
         char filebuffer[BUFFER_SIZE];
-        int bytes, totalReceived = 0;
+        // bytes is the node's last recv: a client that stops reading leaves it > 0, the node not failed
+        int bytes = 0, totalReceived = 0;
         while (totalReceived < filesize)
         {
-            bytes = recv(sock, filebuffer, BUFFER_SIZE, 0);
+            bytes = dfs_recv(sock, filebuffer, BUFFER_SIZE, 0);
             if (bytes <= 0)
                 break;
-            send(client_socket, filebuffer, bytes, 0);
+            DFS_PROBE3(relay_chunk, port, bytes, 1);
+            dfs_lane_transfer(bytes);
+            dfs_rate_bytes(bytes);
+            if (dfs_send_all(client_socket, filebuffer, bytes) < 0)
+                break;
             totalReceived += bytes;
         }
         close(sock);
-        printf("Tar file (pdf.tar) received from S2 and forwarded to client.\n");
+        dfs_backend_end(port, bytes > 0);
+        if (totalReceived < filesize)
+        {
+            // a short archive cannot be told from a complete one, end the client's session
+            dfs_log(DFS_LOG_ERROR, "Tar relay from port %d stopped after %d of %d bytes", port, totalReceived, filesize);
+            shutdown(client_socket, SHUT_RDWR);
+            return;
+        }
+        dfs_log(DFS_LOG_INFO, "Tar file (pdf.tar) received from S2 and forwarded to client.");
     }
     else if (strcmp(filetype, ".txt") == 0)
     {
-        int sock = connect_to_server(SERVER_PORT_3);
+        int port = dfs_backend_pick_read(SERVER_PORT_3, 0);
+        int sock = connect_to_server(port);
         if (sock < 0) {
             int zero_size = 0;
-            send(client_socket, &zero_size, sizeof(int), 0);
-            send(client_socket, "Error connecting to TXT server", 29, 0);
+            dfs_send(client_socket, &zero_size, sizeof(int), 0);
+            dfs_send(client_socket, "Error connecting to TXT server", 30, 0);
             return;
         }
-        send(sock, buffer, strlen(buffer), 0);
-        int filesize;
-        recv(sock, &filesize, sizeof(int), 0);
+        dfs_backend_begin(port);
+        long started = dfs_now_us();
+        dfs_trace_send(sock, buffer);
+        shutdown(sock, SHUT_WR);
+        int filesize = 0;
+        int answered = dfs_recv_all(sock, &filesize, sizeof(int)) == 0;
+        dfs_backend_observe(port, dfs_now_us() - started);
         
         if (filesize <= 0) {
             close(sock);
+            // a size of 0 is the node's answer when it has no such files, not a failure
+            dfs_backend_end(port, answered);
             int zero_size = 0;
-            send(client_socket, &zero_size, sizeof(int), 0);
-            send(client_socket, "No TXT files found to create tar archive", 37, 0);
+            dfs_send(client_socket, &zero_size, sizeof(int), 0);
+            dfs_send(client_socket, "No TXT files found to create tar archive", 40, 0);
             return;
         }
         
-        send(client_socket, &filesize, sizeof(int), 0);
+        dfs_send(client_socket, &filesize, sizeof(int), 0);
         char filebuffer[BUFFER_SIZE];
-        int bytes, totalReceived = 0;
+        // bytes is the node's last recv: a client that stops reading leaves it > 0, the node not failed
+        int bytes = 0, totalReceived = 0;
         while (totalReceived < filesize)
         {
-            bytes = recv(sock, filebuffer, BUFFER_SIZE, 0);
+            bytes = dfs_recv(sock, filebuffer, BUFFER_SIZE, 0);
             if (bytes <= 0)
                 break;
-            send(client_socket, filebuffer, bytes, 0);
+            DFS_PROBE3(relay_chunk, port, bytes, 1);
+            dfs_lane_transfer(bytes);
+            dfs_rate_bytes(bytes);
+            if (dfs_send_all(client_socket, filebuffer, bytes) < 0)
+                break;
             totalReceived += bytes;
         }
         close(sock);
-        printf("Tar file (text.tar) received from S3 and forwarded to client.\n");
+        dfs_backend_end(port, bytes > 0);
+        if (totalReceived < filesize)
+        {
+            // a short archive cannot be told from a complete one, end the client's session
+            dfs_log(DFS_LOG_ERROR, "Tar relay from port %d stopped after %d of %d bytes", port, totalReceived, filesize);
+            shutdown(client_socket, SHUT_RDWR);
+            return;
+        }
+        dfs_log(DFS_LOG_INFO, "Tar file (text.tar) received from S3 and forwarded to client.");
     }
     else
     {
         int zero_size = 0;
-        send(client_socket, &zero_size, sizeof(int), 0);
-        send(client_socket, "Unsupported file type for downltar", 33, 0);
+        dfs_send(client_socket, &zero_size, sizeof(int), 0);
+        dfs_send(client_socket, "Unsupported file type for downltar", 34, 0);
     }
 }
 
 // this fucntion get all the files names from servers
-void get_fnames_from_other_servers(char *all_file_name, size_t buffer_size, char buffer[], int socket)
+void get_fnames_from_other_servers(char *all_file_name, size_t buffer_size, char buffer[], int base_port)
 {
-    int sock = connect_to_server(socket);
+    // any replica of the node can answer a listing; an empty listing is just an early close
+    size_t received = 0;
+    int port;
+    int sock = dfs_backend_request(base_port, buffer, all_file_name, 0, buffer_size - 1, &received, &port);
     if (sock < 0)
     {
-        printf("Failed to connect to server on port %d\n", socket);
-        if (buffer_size > 0)
-        {
-            all_file_name[0] = '\0';
-        }
+        dfs_log(DFS_LOG_ERROR, "Failed to get a listing from server on port %d", base_port);
+        all_file_name[0] = '\0';
         return;
     }
-    send(sock, buffer, strlen(buffer), 0);
-    ssize_t bytes_received = recv(sock, all_file_name, buffer_size - 1, 0);
-    if (bytes_received >= 0)
-    {
-        all_file_name[bytes_received] = '\0';
-        printf("Server %d response: %s\n\n", socket, all_file_name);
-    }
-    else
+
+    // the node closes the connection after the listing, read up to that point
+    ssize_t bytes_received = received > 0 ? 1 : 0;
+    while (bytes_received > 0 && received < buffer_size - 1)
     {
-        perror("recv failed");
-        if (buffer_size > 0)
+        bytes_received = dfs_recv(sock, all_file_name + received, buffer_size - 1 - received, 0);
+        if (bytes_received > 0)
         {
-            all_file_name[0] = '\0';
+            received += bytes_received;
         }
-        printf("Failed to receive data from server %d\n", socket);
     }
+    all_file_name[received] = '\0';
+    dfs_log(DFS_LOG_DEBUG, "Server %d response: %s", port, all_file_name);
     close(sock);
+    dfs_backend_end(port, bytes_received >= 0);
 }
 
 // this will aggregates and sends all complete file listing from all servers
@@ -732,14 +907,14 @@ void diplay_filename_handler(int client_socket, char buffer[])
     char base_path[512];
     get_s1_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, file_path, base_path);
+    dfs_fs_resolve(resolved_path, file_path, base_path);
 
     char file_list[BUFFER_SIZE * 5] = {0};
-    if (check_path_exists(resolved_path) == 2)
+    if (dfs_fs_exists(resolved_path) == 2)
     {
-        if (list_all_files(resolved_path, NULL, file_list, sizeof(file_list)) != NULL)
+        if (dfs_fs_list(resolved_path, NULL, file_list, sizeof(file_list)) != NULL)
         {
-            printf("All files:\n%s\n", file_list);
+            dfs_log(DFS_LOG_DEBUG, "All files:\n%s", file_list);
         }
     }
 
@@ -787,26 +962,123 @@ void diplay_filename_handler(int client_socket, char buffer[])
     }
 
     // Send the combined result to the client
-    send(client_socket, result, strlen(result), 0);
+    dfs_send_all(client_socket, result, strlen(result));
 
     memset(buffer, 0, strlen(buffer));
 }
 
+/* Admin - selftest ----------------------------------------------------------------------------------*/
+// Relays one test transfer of bytes between a stand-in client and a node, returns its MB/s
+double selftest_relay(int port, char request[], long bytes, char *servername)
+{
+    int peer_pid;
+    int peer = dfs_selftest_peer(bytes, bytes > 0, &peer_pid);
+    if (peer < 0)
+    {
+        return 0;
+    }
+    relay_bytes = 0;
+    relay_us = 0;
+    if (bytes > 0)
+    {
+        int sock = connect_to_server(port);
+        if (sock >= 0)
+        {
+            file_forwader(sock, request, bytes, peer, servername, port);
+        }
+    }
+    else
+    {
+        download_request_forwader(port, request, peer, servername);
+    }
+    dfs_selftest_peer_end(peer, peer_pid);
+    return dfs_selftest_rate(relay_bytes, relay_us);
+}
+
+// Sends a selftest request to one node instance and reads its text reply
+int selftest_ask(int port, const char *request, char *reply, size_t reply_size)
+{
+    memset(reply, 0, reply_size);
+    int sock = connect_to_server(port);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    dfs_backend_begin(port);
+    dfs_trace_send(sock, request);
+    shutdown(sock, SHUT_WR);
+    int answered = dfs_recv(sock, reply, reply_size - 1, 0) > 0;
+    close(sock);
+    dfs_backend_end(port, answered);
+    return answered ? 0 : -1;
+}
+
+// Measures the throughput of each node's network, disk and relays (see dfs_selftest.h)
+void selftest_handler(int client_socket, char buffer[])
+{
+    char command[20];
+    int mb = 16;
+    sscanf(buffer, "%19s %d", command, &mb);
+    mb = mb < 1 ? 1 : mb > 1024 ? 1024 : mb;
+    long bytes = (long)mb << 20;
+    char *names[] = {"S2", "S3", "S4"};
+    const char *extensions[] = {".pdf", ".txt", ".zip"};
+    const int ports[] = {SERVER_PORT_2, SERVER_PORT_3, SERVER_PORT_4};
+
+    char report[BUFFER_SIZE];
+    int used = snprintf(report, sizeof(report), "Self-test with %d MB transfers, in MB/s:\n", mb);
+    for (int i = 0; i < 3; i++)
+    {
+        char request[BUFFER_SIZE], path[256], reply[64];
+        snprintf(path, sizeof(path), "%s/selftest_%d%s", DFS_SELFTEST_DIR, getpid(), extensions[i]);
+
+        snprintf(request, sizeof(request), "selftest net %ld", bytes);
+        double net = selftest_relay(ports[i], request, 0, names[i]);
+        snprintf(request, sizeof(request), "uploadf selftest_%d%s %s", getpid(), extensions[i], DFS_SELFTEST_DIR);
+        double upload = selftest_relay(ports[i], request, bytes, names[i]);
+        snprintf(request, sizeof(request), "selftest disk %s", path);
+        long disk_bytes = 0, disk_us = 0;
+        if (selftest_ask(ports[i], request, reply, sizeof(reply)) == 0)
+        {
+            sscanf(reply, "%ld %ld", &disk_bytes, &disk_us);
+        }
+        snprintf(request, sizeof(request), "downlf %s", path);
+        double download = selftest_relay(ports[i], request, 0, names[i]);
+
+        // uploads are replicated down the chain, so every instance may hold a copy
+        snprintf(request, sizeof(request), "selftest remove %s", path);
+        for (int instance = 0; instance < dfs_instances(); instance++)
+        {
+            selftest_ask(dfs_instance_port(ports[i], instance), request, reply, sizeof(reply));
+        }
+
+        used += snprintf(report + used, sizeof(report) - used,
+                         "%s (port %d): net %.1f  upload %.1f  disk read %.1f  download %.1f\n", names[i], ports[i],
+                         net, upload, dfs_selftest_rate(disk_bytes, disk_us), download);
+        dfs_log(DFS_LOG_INFO, "Self-test of %s: net %.1f upload %.1f disk %.1f download %.1f MB/s", names[i], net,
+                upload, dfs_selftest_rate(disk_bytes, disk_us), download);
+    }
+    dfs_send(client_socket, &used, sizeof(int), 0);
+    dfs_send_all(client_socket, report, used);
+}
+
 // Client request processing loop handling different commands
 void prcclient(int client_socket)
 {
-    char buffer[BUFFER_SIZE];
+    char buffer[DFS_FRAME_SIZE + 1]; // a whole command and its terminator
     char command[20], filename[256], path[512];
 
     while (1)
     {
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
+        memset(buffer, 0, sizeof(buffer));
+        int bytes_received = dfs_recv_command(client_socket, buffer, &client_framed);
         if (bytes_received <= 0)
         {
             break;
         }
 
+        // the client's trace context goes before the command (see dfs_trace.h)
+        dfs_trace_begin(buffer);
         sscanf(buffer, "%s", command);
         // sscanf(buffer, "%s %s %s", command, filename, path);
 
@@ -816,12 +1088,18 @@ void prcclient(int client_socket)
 
         // Resolve ~S1/... to actual full folder path
         char dest_path[512];
-        // sanitize_path(dest_path, path, base_path);
+        // dfs_fs_resolve(dest_path, path, base_path);
+
+        // metadata requests never queue behind large transfers (see dfs_lane.h)
+        dfs_metrics_begin(client_socket, buffer);
+        dfs_record_begin(buffer);
+        dfs_lane_begin(command);
+        dfs_rate_request(client_socket, buffer);
 
         if (strcmp(command, "uploadf") == 0)
         {
             sscanf(buffer, "%s %s %s", command, filename, path);
-            sanitize_path(dest_path, path, base_path);
+            dfs_fs_resolve(dest_path, path, base_path);
             upload_handler(client_socket, filename, dest_path, buffer);
         }
         else if (strcmp(command, "downlf") == 0)
@@ -842,19 +1120,61 @@ void prcclient(int client_socket)
             // printf("inside the display\n");
             diplay_filename_handler(client_socket, buffer);
         }
+        else if (strcmp(command, "statf") == 0)
+        {
+            stat_handler(client_socket, buffer);
+        }
+        else if (strcmp(command, "stats") == 0)
+        {
+            dfs_metrics_send(client_socket);
+        }
+        else if (strcmp(command, "setlimit") == 0)
+        {
+            char reply[BUFFER_SIZE];
+            dfs_rate_command(buffer, reply, sizeof(reply));
+            dfs_send_all(client_socket, reply, strlen(reply));
+        }
+        else if (strcmp(command, "selftest") == 0)
+        {
+            selftest_handler(client_socket, buffer);
+        }
         else
         {
-            printf("Received unknown command: %s\n", buffer);
-            send(client_socket, "Unknown command", 15, 0);
+            dfs_log(DFS_LOG_WARN, "Received unknown command: %s", buffer);
+            dfs_send(client_socket, "Unknown command", 15, 0);
+        }
+        if (client_framed)
+        {
+            // the client may have sent more commands behind this one, mark where this reply ends
+            dfs_send_all(client_socket, DFS_REPLY_END, strlen(DFS_REPLY_END));
         }
+        dfs_lane_end();
+        dfs_record_end();
+        dfs_metrics_end();
+        dfs_trace_end();
     }
 }
 
 int main()
 {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_size;
+    int server_socket;
+    struct sockaddr_in server_addr;
+
+    // shared by every forked client handler, so it has to exist before the first fork
+    dfs_log_init("S1", PORT);
+    dfs_fault_init();
+    dfs_backend_init();
+    dfs_lane_init();
+    dfs_rate_init();
+    dfs_metrics_init("S1", PORT);
+    dfs_trace_init("S1", PORT);
+    dfs_record_init();
+    char root[512];
+    get_s1_folder_path(root);
+    dfs_durable_init(root);
+    dfs_pack_init(root);
+    dfs_meta_init(root);
+    dfs_watch_init(root);
 
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -879,7 +1199,7 @@ int main()
 
     if (listen(server_socket, MAX_CLIENTS) == 0)
     {
-        printf("S1 Server listening on port %d\n", PORT);
+        dfs_log(DFS_LOG_INFO, "S1 Server listening on port %d", PORT);
     }
     else
     {
@@ -887,25 +1207,7 @@ int main()
         exit(1);
     }
 
-    while (1)
-    {
-        addr_size = sizeof(client_addr);
-        client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &addr_size);
-        if (client_socket < 0)
-        {
-            perror("Accept failed");
-            continue;
-        }
-
-        if (fork() == 0)
-        {
-            close(server_socket);
-            prcclient(client_socket);
-            exit(0);
-        }
-
-        close(client_socket);
-    }
-
+    // one forked handler per connection, bounded and queued fairly (see dfs_admit.h)
+    dfs_admit_serve(server_socket, "S1", 32, prcclient);
     return 0;
 }
\ No newline at end of file
@@ -13,186 +13,55 @@
 #include <errno.h>
 #include <time.h>
 
+#include "dfs_cluster.h"
+#include "dfs_meta.h"
+#include "dfs_watch.h"
+#include "dfs_durable.h"
+#include "dfs_net.h"
+#include "dfs_engine.h"
+#include "dfs_admit.h"
+#include "dfs_rate.h"
+#include "dfs_metrics.h"
+#include "dfs_trace.h"
+#include "dfs_fs.h"
+#include "dfs_selftest.h"
+#include "dfs_log.h"
+#include "dfs_fault.h"
+#include "dfs_probe.h"
+
 // #define PORT 8001
 #define BUFFER_SIZE 1024
-#define MAX_CLIENTS 10
+#define MAX_CLIENTS SOMAXCONN // listen backlog
 #define SERVER_PORT_2 7778
 
-
-// this function creates a directory path recursively if not already present.
-void create_path_if_not_exist(const char *path)
-{
-    char temp[512];
-    strcpy(temp, path);
-    char *p = temp + 1; // skip first slash
-    while ((p = strchr(p, '/')) != NULL)
-    {
-        *p = '\0';
-        mkdir(temp, 0777);
-        *p = '/';
-        p++;
-    }
-    mkdir(temp, 0777); // Create final directory
-}
+// index of this S2 instance; instance 0 is the head of the replication chain
+int node_instance = 0;
 
 // this Sets the S2 base folder path usually under the HOME directory eg. home/patel4xa/S2
 void get_s2_folder_path(char *base_path)
 {
-    const char *home_dir = getenv("HOME");
-    char cwd[512];
-    if (home_dir != NULL)
-    {
-        snprintf(base_path, 512, "%s/S2", home_dir);
-        mkdir(base_path, 0777); // ensure S1_folder exists
-    }
-    else
-    {
-        perror("getcwd() error");
-        exit(1);
-    }
-}
-
-// Replace ~S1/ with the actual S2 base folder path.
-void sanitize_path(char *resolved_path, const char *raw_path, const char *base_dir)
-{
-    if (strncmp(raw_path, "~S1/", 4) == 0)
-    {
-        snprintf(resolved_path, 512, "%s/%s", base_dir, raw_path + 4);
-    }
-    else
-    {
-        snprintf(resolved_path, 512, "%s", raw_path);
-    }
-}
-
-// check whether path exist return 2 for direcotory, return 1 for file, otherwise 0
-int check_path_exists(const char *path)
-{
-    struct stat path_stat;
-    // Check if path exists using stat
-    if (stat(path, &path_stat) != 0)
-    {
-        return 0;
-    }
-    // Check if it's a directory
-    if (S_ISDIR(path_stat.st_mode))
-    {
-        return 2;
-    }
-    return 1;
-}
-
-// List and sort all files in a directory
-char *list_all_files(const char *path, const char *extension, char *result, size_t result_size)
-{
-    char command[1024];
-    // Clear the result buffer
-    memset(result, 0, result_size);
-
-    // Validate inputs
-    if (path == NULL || result == NULL || result_size <= 0)
-    {
-        return NULL;
-    }
-
-    // Check if directory exists or not
-    struct stat st;
-    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
-    {
-        return NULL;
-    }
-
-    if (extension != NULL){
-        snprintf(command, sizeof(command),"find \"%s\" -type f -name \"*%s\"",path, extension);
-    }
-    else
-    {
-        // All files
-        snprintf(command, sizeof(command),"find \"%s\" -type f",path);
-    }
-    // Execute the command
-    FILE *fp = popen(command, "r");
-    if (fp == NULL)
-    {
-        perror("popen failed");
-        return NULL;
-    }
-    // Storing name for sorting
-    char filenames[1000][256]; // Support up to 1000 files
-    int file_count = 0;
-    char line[1024];
-    // Read each line and extract the filename
-    while (fgets(line, sizeof(line), fp) != NULL && file_count < 1000)
-    {
-        // Remove newline character
-        line[strcspn(line, "\n")] = 0;
-
-        // Extract just the filename (not the full path)
-        const char *filename = strrchr(line, '/');
-        if (filename)
-        {
-            filename++; // Skip the '/'
-        }
-        else
-        {
-            filename = line;
-        }
-        // Store the filename
-        strncpy(filenames[file_count], filename, 255);
-        filenames[file_count][255] = '\0'; // Ensure null termination
-        file_count++;
-    }
-    pclose(fp);
-
-    // Sort the filenames using a simple bubble sort
-    for (int i = 0; i < file_count - 1; i++)
-    {
-        for (int j = 0; j < file_count - i - 1; j++)
-        {
-            if (strcasecmp(filenames[j], filenames[j + 1]) > 0)
-            {
-                // Swap filenames
-                char temp[256];
-                strcpy(temp, filenames[j]);
-                strcpy(filenames[j], filenames[j + 1]);
-                strcpy(filenames[j + 1], temp);
-            }
-        }
-    }
-    // Now add the sorted filenames to the result
-    size_t current_size = 0;
-    for (int i = 0; i < file_count; i++)
-    {
-        size_t needed = strlen(filenames[i]) + 1; // +1 for newline
-
-        // Check if we have enough space left in the buffer
-        if (current_size + needed >= result_size - 1)
-        { // -1 for null terminator
-            break;
-        }
-        // Append the filename and a newline
-        strcat(result, filenames[i]);
-        strcat(result, "\n");
-
-        current_size += needed;
-    }
-    return result;
+    dfs_instance_root("S2", node_instance, base_path, 512);
 }
 
 // Handle file upload & its only accepts PDF files and stores them in S2.
-void upload_handler(int client_socket, char *filename, char *dest_path)
+void upload_handler(int client_socket, char *filename, char *dest_path, char command[])
 {
     char *ext = strrchr(filename, '.');
     if (!ext)
     {
-        printf("Invalid file extension.\n");
+        dfs_log(DFS_LOG_WARN, "Invalid file extension.");
         return;
     }
 
     // Receive file size
     int filesize;
-    recv(client_socket, &filesize, sizeof(int), 0);
-    printf("Receiving file: %s (%d bytes)\n", filename, filesize);
+    if (dfs_recv_all(client_socket, &filesize, sizeof(int)) < 0 || filesize < 0)
+    {
+        dfs_log(DFS_LOG_WARN, "No valid size for %s", filename);
+        dfs_send(client_socket, "Error storing file", 18, 0);
+        return;
+    }
+    dfs_log(DFS_LOG_INFO, "Receiving file: %s (%d bytes)", filename, filesize);
 
     char full_path[512];
 
@@ -200,65 +69,110 @@ void upload_handler(int client_socket, char *filename, char *dest_path)
     {
         // Save in ~/S1/...
         snprintf(full_path, sizeof(full_path), "%s/%s", dest_path, filename);
-        create_path_if_not_exist(dest_path);
+        dfs_fs_mkdirs(dest_path);
 
-        FILE *fp = fopen(full_path, "wb");
+        // written aside and renamed into place once complete and on disk
+        char tmp_path[600];
+        FILE *fp = dfs_durable_open(full_path, tmp_path, sizeof(tmp_path));
         if (fp == NULL)
         {
             perror("File open failed");
             return;
         }
 
+        // pass the file down the replication chain while writing our own copy
+        int next_replica = dfs_chain_open(SERVER_PORT_2, node_instance, command, filesize);
+
         int bytes_received, total_received = 0;
+        unsigned long long hash = DFS_META_HASH_INIT;
         char buffer[BUFFER_SIZE];
         while (total_received < filesize)
         {
-            bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
+            bytes_received = dfs_recv(client_socket, buffer, BUFFER_SIZE, 0);
+            if (bytes_received <= 0)
+                break;
             fwrite(buffer, 1, bytes_received, fp);
+            dfs_fault_disk(bytes_received);
+            DFS_PROBE2(disk_write, full_path, bytes_received);
+            hash = dfs_meta_hash(hash, buffer, bytes_received);
+            dfs_rate_bytes(bytes_received);
+            if (next_replica >= 0 && dfs_send_all(next_replica, buffer, bytes_received) < 0)
+            {
+                dfs_log(DFS_LOG_WARN, "Lost the next replica while forwarding %s", filename);
+                close(next_replica);
+                next_replica = DFS_CHAIN_LOST;
+            }
             total_received += bytes_received;
         }
-        // At the end of the PDF handling in upload_handler()
-        send(client_socket, "File stored in S2 successfully", 30, 0);
-        fclose(fp);
-        printf("File saved to %s\n", full_path);
+        char replica_response[BUFFER_SIZE];
+        if (total_received < filesize || dfs_durable_commit(fp, tmp_path, full_path) != 0)
+        {
+            if (total_received < filesize)
+            {
+                dfs_durable_abort(fp, tmp_path);
+            }
+            dfs_log(DFS_LOG_ERROR, "Upload of %s failed after %d of %d bytes, nothing stored", filename, total_received,
+                    filesize);
+            dfs_chain_close(next_replica, replica_response, sizeof(replica_response));
+            dfs_send(client_socket, "Error storing file", 18, 0);
+            return;
+        }
+        dfs_meta_put(full_path, total_received, hash);
+        dfs_log(DFS_LOG_INFO, "File saved to %s", full_path);
+
+        // acknowledge only once the rest of the chain has stored the file: if a replica
+        // missed it the upload fails instead of leaving fewer copies than DFS_REPLICAS
+        if (!dfs_chain_close(next_replica, replica_response, sizeof(replica_response)))
+        {
+            dfs_log(DFS_LOG_ERROR, "%s was not stored on every replica", full_path);
+            dfs_send_all(client_socket, "Error: not stored on every replica", 34);
+            return;
+        }
+        dfs_send(client_socket, "File stored in S2 successfully", 30, 0);
     }
     else
     {
-        printf("Forwarding %s to appropriate server based on extension\n", filename);
+        dfs_log(DFS_LOG_INFO, "Forwarding %s to appropriate server based on extension", filename);
     }
 }
 
 
 // Handle file removal
-void handle_remove(int client_socket, char *filepath)
+void handle_remove(int client_socket, char *filepath, char command[])
 {
+    // remove the file from the rest of the replication chain first
+    int next_replica = dfs_chain_open(SERVER_PORT_2, node_instance, command, -1);
+    char replica_response[BUFFER_SIZE];
+    dfs_chain_close(next_replica, replica_response, sizeof(replica_response));
+
     // filepath should be like "~S1/folder1/folder2/sample.pdf"
     char base_path[512];
     get_s2_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, filepath, base_path);
+    dfs_fs_resolve(resolved_path, filepath, base_path);
     if (remove(resolved_path) == 0)
     {
-        printf("Removed file %s\n", resolved_path);
-        send(client_socket, "File removed successfully", 33, 0);
+        dfs_meta_remove(resolved_path);
+        dfs_log(DFS_LOG_INFO, "Removed file %s", resolved_path);
+        dfs_send(client_socket, "File removed successfully", 33, 0);
     }
     else
     {
         perror("Error removing file");
-        send(client_socket, "Error removing file from S2", 28, 0);
+        dfs_send(client_socket, "Error removing file from S2", 28, 0);
     }
 }
 
 void download_request_forwader(int sock, char buffer[], int client_socket, char *servername)
 {
 
-    send(sock, buffer, strlen(buffer), 0);
+    dfs_send(sock, buffer, strlen(buffer), 0);
     char response[BUFFER_SIZE];
     memset(response, 0, BUFFER_SIZE);
-    recv(sock, response, BUFFER_SIZE, 0);
-    printf("%s response: %s\n", servername, response);
+    dfs_recv(sock, response, BUFFER_SIZE, 0);
+    dfs_log(DFS_LOG_INFO, "%s response: %s", servername, response);
     close(sock);
-    send(client_socket, response, strlen(response), 0);
+    dfs_send_all(client_socket, response, strlen(response));
 }
 
 //download handler for downloding fucntion
@@ -270,24 +184,25 @@ void download_handler(int client_socket, char buffer[])
     char *ext = strrchr(file_path, '.');
     if (!ext)
     {
-        printf("Invalid file extension in download command.\n");
-        send(client_socket, "Invalid file extension", 22, 0);
+        dfs_log(DFS_LOG_WARN, "Invalid file extension in download command.");
+        dfs_send(client_socket, "Invalid file extension", 22, 0);
         return;
     }
 
     char base_path[512];
     get_s2_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, file_path, base_path);
+    dfs_fs_resolve(resolved_path, file_path, base_path);
 
     if (strcmp(ext, ".pdf") == 0)
     {
         // For .c files stored locally
+        long open_started = dfs_trace_now();
         FILE *fp = fopen(resolved_path, "rb");
         if (fp == NULL)
         {
-            printf("Cannot open file %s\n", resolved_path);
-            send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
+            dfs_log(DFS_LOG_ERROR, "Cannot open file %s", resolved_path);
+            dfs_send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
             return;
         }
 
@@ -295,26 +210,35 @@ void download_handler(int client_socket, char buffer[])
         fseek(fp, 0, SEEK_END);
         int filesize = ftell(fp);
         rewind(fp);
+        dfs_trace_span("open", open_started, resolved_path);
 
         // Send file size
-        send(client_socket, &filesize, sizeof(int), 0);
+        dfs_send(client_socket, &filesize, sizeof(int), 0);
         usleep(100000);
 
         // Send file content
+        long send_started = dfs_trace_now();
         char filebuffer[BUFFER_SIZE];
         int bytes;
         while ((bytes = fread(filebuffer, 1, BUFFER_SIZE, fp)) > 0)
         {
-            send(client_socket, filebuffer, bytes, 0);
+            dfs_fault_disk(bytes);
+            DFS_PROBE2(disk_read, resolved_path, bytes);
+            dfs_rate_bytes(bytes);
+            if (dfs_send_all(client_socket, filebuffer, bytes) < 0)
+            {
+                break;
+            }
         }
+        dfs_trace_span("send", send_started, resolved_path);
 
         fclose(fp);
-        printf("File '%s' sent to S1 successfully.\n", resolved_path);
+        dfs_log(DFS_LOG_INFO, "File '%s' sent to S1 successfully.", resolved_path);
     }
     else
     {
-        printf("Unsupported file extension: %s\n", ext);
-        send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
+        dfs_log(DFS_LOG_WARN, "Unsupported file extension: %s", ext);
+        dfs_send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
     }
 }
 
@@ -333,34 +257,34 @@ void diplay_filename_handler(int client_socket, char buffer[])
     char base_path[512];
     get_s2_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, file_path, base_path);
+    dfs_fs_resolve(resolved_path, file_path, base_path);
 
     // printf("absolute path  %s\n", resolved_path);
     char file_list[4096] = {0};
-    if (check_path_exists(resolved_path) == 2)
+    if (dfs_fs_exists(resolved_path) == 2)
     {
 
         // printf("the path is valid and so inside the conditions\n\n");
-        if (list_all_files(resolved_path, NULL, file_list, sizeof(file_list)) != NULL)
+        if (dfs_fs_list(resolved_path, NULL, file_list, sizeof(file_list)) != NULL)
         {
-            printf("All files:\n%s\n", file_list);
+            dfs_log(DFS_LOG_DEBUG, "All files:\n%s", file_list);
         }
         else
         {
             strcpy(file_list, "Error listing files in the specified directory.");
-            printf("Error listing files in %s\n", resolved_path);
+            dfs_log(DFS_LOG_ERROR, "Error listing files in %s", resolved_path);
         }
     }
     else
     {
         // Path doesn't exist
         strcpy(file_list, "path does not exist");
-        printf("Path does not exist: %s\n", resolved_path);
+        dfs_log(DFS_LOG_WARN, "Path does not exist: %s", resolved_path);
     }
 
     file_list[4095] = '\0';
     // printf("\n\n%sn\n", resolved_path);
-    send(client_socket, file_list, strlen(file_list), 0);
+    dfs_send_all(client_socket, file_list, strlen(file_list));
 }
 
 //tar function download
@@ -373,111 +297,188 @@ void downtar_pdf_fucntion(int client_socket, char buffer[])
     {
         char s2folder[512];
         get_s2_folder_path(s2folder);
+        long build_started = DFS_PROBE_CLOCK(tar_phase);
         char tarFilename[128];
-        snprintf(tarFilename, sizeof(tarFilename), "pdf_%ld.tar", time(NULL));
-        char tarCommand[1024];
-        snprintf(tarCommand, sizeof(tarCommand), "find \"%s\" -type f -name '*.pdf' | tar -cf %s -T -", s2folder, tarFilename);
-        system(tarCommand);
+        snprintf(tarFilename, sizeof(tarFilename), "pdf_%ld_%d.tar", time(NULL), getpid());
+        if (dfs_fs_tar(s2folder, ".pdf", tarFilename) <= 0)
+        {
+            // S1 reads a size of 0 as "nothing to send"
+            int zero_size = 0;
+            dfs_send(client_socket, &zero_size, sizeof(int), 0);
+            return;
+        }
+        DFS_PROBE3(tar_phase, ".pdf", "build", DFS_PROBE_SINCE(build_started));
         FILE *fp = fopen(tarFilename, "rb");
         if (fp == NULL)
         {
             perror("Failed to open tar file");
-            send(client_socket, "Error creating tar file", 25, 0);
+            dfs_send(client_socket, "Error creating tar file", 25, 0);
             return;
         }
                         
         fseek(fp, 0, SEEK_END);
         int filesize = ftell(fp);
         rewind(fp);
-        send(client_socket, &filesize, sizeof(int), 0);
+        dfs_send(client_socket, &filesize, sizeof(int), 0);
+        long send_started = DFS_PROBE_CLOCK(tar_phase);
         char bufferTar[BUFFER_SIZE];
         int bytes;
         while ((bytes = fread(bufferTar, 1, BUFFER_SIZE, fp)) > 0)
         {
-            send(client_socket, bufferTar, bytes, 0);
+            dfs_rate_bytes(bytes);
+            if (dfs_send_all(client_socket, bufferTar, bytes) < 0)
+            {
+                break;
+            }
         }
         fclose(fp);
+        DFS_PROBE3(tar_phase, ".pdf", "send", DFS_PROBE_SINCE(send_started));
         remove(tarFilename);
-        printf("Tar file %s sent successfully from S2.\n", tarFilename);
+        dfs_log(DFS_LOG_INFO, "Tar file %s sent successfully from S2.", tarFilename);
     }
     else
     {
-        send(client_socket, "Unsupported file type for downltar", 35, 0);
+        dfs_send(client_socket, "Unsupported file type for downltar", 35, 0);
     }
 }
 
 
-// Process client commands
-void prcclient(int client_socket)
+// file metadata (size, upload time, content hash), answered from the index when it is on
+// example: statf ~S1/folder/sample.pdf
+void stat_handler(int client_socket, char *filepath)
 {
-    char buffer[BUFFER_SIZE];
-    char command[20], filename[256], path[512];
-    ;
+    char base_path[512];
+    get_s2_folder_path(base_path);
+    char resolved_path[512];
+    dfs_fs_resolve(resolved_path, filepath, base_path);
+    char reply[BUFFER_SIZE];
+    dfs_meta_describe(resolved_path, reply, sizeof(reply));
+    dfs_log(DFS_LOG_INFO, "statf %s: %s", resolved_path, reply);
+    dfs_send_all(client_socket, reply, strlen(reply));
+}
 
-    while (1)
-    {
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
-        if (bytes_received <= 0)
-        {
-            break;
-        }
+// Runs one command received from S1
+void process_request(int client_socket, char buffer[])
+{
+    char command[20] = "", filename[256] = "", path[512] = "";
 
-        sscanf(buffer, "%s %s %s", command, filename, path);
+    dfs_trace_begin(buffer); // a traced request arrives with its context in front
+    sscanf(buffer, "%s %s %s", command, filename, path);
+    dfs_metrics_begin(client_socket, buffer);
+    dfs_rate_request(client_socket, buffer);
 
-        // get dynamic S1 folder path
-        char base_path[512];
-        get_s2_folder_path(base_path);
+    // get dynamic S1 folder path
+    char base_path[512];
+    get_s2_folder_path(base_path);
 
-        // Resolve ~S1/... to actual full folder path
-        char dest_path[512];
-        sanitize_path(dest_path, path, base_path);
+    // Resolve ~S1/... to actual full folder path
+    char dest_path[512];
+    dfs_fs_resolve(dest_path, path, base_path);
 
-        //upload
-        if (strcmp(command, "uploadf") == 0)
-        {
-            upload_handler(client_socket, filename, dest_path);
-        }
+    //upload
+    if (strcmp(command, "uploadf") == 0)
+    {
+        upload_handler(client_socket, filename, dest_path, buffer);
+    }
 
-        // Download a file from the server
-        else if (strcmp(command, "downlf") == 0)
-        {
-            // printf("this is inside the download");
-            download_handler(client_socket, buffer);
-        }
+    // Download a file from the server
+    else if (strcmp(command, "downlf") == 0)
+    {
+        // printf("this is inside the download");
+        download_handler(client_socket, buffer);
+    }
 
-        //remove fun
-        else if (strcmp(command, "removef") == 0)
-        {
-            handle_remove(client_socket, filename);
-        }
+    //remove fun
+    else if (strcmp(command, "removef") == 0)
+    {
+        handle_remove(client_socket, filename, buffer);
+    }
 
-        //download tar function
-        else if (strcmp(command, "downltar") == 0)
-        {
-            downtar_pdf_fucntion(client_socket,buffer);
-        }
+    //download tar function
+    else if (strcmp(command, "downltar") == 0)
+    {
+        downtar_pdf_fucntion(client_socket,buffer);
+    }
 
-        //display names
-        else if (strcmp(command, "dispfnames") == 0)
-        {
-            printf("inside the display\n");
-            diplay_filename_handler(client_socket, buffer);
-        }
-        else
+    //display names
+    else if (strcmp(command, "dispfnames") == 0)
+    {
+        dfs_log(DFS_LOG_DEBUG, "inside the display");
+        diplay_filename_handler(client_socket, buffer);
+    }
+    else if (strcmp(command, "statf") == 0)
+    {
+        stat_handler(client_socket, filename);
+    }
+    else if (strcmp(command, "stats") == 0)
+    {
+        dfs_metrics_send(client_socket);
+    }
+    else if (strcmp(command, "selftest") == 0)
+    {
+        dfs_selftest_serve(client_socket, buffer, base_path);
+    }
+    else if (strcmp(command, "setlimit") == 0)
+    {
+        char reply[BUFFER_SIZE];
+        dfs_rate_command(buffer, reply, sizeof(reply));
+        dfs_send_all(client_socket, reply, strlen(reply));
+    }
+    else
+    {
+        dfs_log(DFS_LOG_WARN, "Received unknown command: %s", buffer);
+        dfs_send(client_socket, "Unknown command", 15, 0);
+    }
+    dfs_metrics_end();
+    dfs_trace_end();
+}
+
+// Process client commands
+void prcclient(int client_socket)
+{
+    char buffer[DFS_FRAME_SIZE + 1]; // a whole command and its terminator
+    int framed;                      // S1 and the previous replica frame uploads, so the size can follow at once
+
+    while (1)
+    {
+        memset(buffer, 0, sizeof(buffer));
+        int bytes_received = dfs_recv_command(client_socket, buffer, &framed);
+        if (bytes_received <= 0)
         {
-            printf("Received unknown command: %s\n", buffer);
-            send(client_socket, "Unknown command", 15, 0);
+            break;
         }
+        process_request(client_socket, buffer);
+    }
+}
+
+// Serves a connection the I/O engine hands over (see dfs_engine.h)
+void engine_fallback(int client_socket, char *request)
+{
+    if (request != NULL)
+    {
+        process_request(client_socket, request);
     }
+    prcclient(client_socket);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_size;
-    char filetype[10]; // Added filetype variable declaration
+    int server_socket;
+    struct sockaddr_in server_addr;
+    node_instance = dfs_parse_instance(argc, argv);
+    int port = dfs_instance_port(SERVER_PORT_2, node_instance);
+    dfs_log_init("S2", port);
+    dfs_fault_init();
+
+    // rebuilt here if it is missing, so no handler ever has to scan the tree
+    char root[512];
+    get_s2_folder_path(root);
+    dfs_durable_init(root);
+    dfs_meta_init(root);
+    dfs_watch_init(root);
+    dfs_rate_init();
+    dfs_metrics_init("S2", port);
+    dfs_trace_init("S2", port);
 
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -488,10 +489,15 @@ int main()
     }
     int opt = 1;
     setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (dfs_engine_workers() > 1)
+    {
+        // engine workers open their own listeners on the same port
+        setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    }
 
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT_2);
+    server_addr.sin_port = htons(port);
     server_addr.sin_addr.s_addr = INADDR_ANY;
 
     if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
@@ -502,7 +508,7 @@ int main()
 
     if (listen(server_socket, MAX_CLIENTS) == 0)
     {
-        printf("S2 Server listening on port %d\n", SERVER_PORT_2);
+        dfs_log(DFS_LOG_INFO, "S2 Server (instance %d) listening on port %d", node_instance, port);
     }
     else
     {
@@ -510,25 +516,11 @@ int main()
         exit(1);
     }
 
-    while (1)
-    {
-        addr_size = sizeof(client_addr);
-        client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &addr_size);
-        if (client_socket < 0)
-        {
-            perror("Accept failed");
-            continue;
-        }
-
-        if (fork() == 0)
-        {
-            close(server_socket);
-            prcclient(client_socket);
-            exit(0);
-        }
-
-        close(client_socket);
-    }
+    // downloads run in the event loop when DFS_ENGINE is set, everything else as below
+    struct dfs_engine_config engine = {"S2", root, ".pdf", engine_fallback};
+    dfs_engine_run(server_socket, &engine);
 
+    // one forked handler per connection, bounded and queued fairly (see dfs_admit.h)
+    dfs_admit_serve(server_socket, "S2", 0, prcclient);
     return 0;
 }
\ No newline at end of file
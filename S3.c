@@ -13,185 +13,55 @@
 #include <errno.h>
 #include <time.h>
 
+#include "dfs_cluster.h"
+#include "dfs_meta.h"
+#include "dfs_watch.h"
+#include "dfs_durable.h"
+#include "dfs_net.h"
+#include "dfs_engine.h"
+#include "dfs_pack.h"
+#include "dfs_admit.h"
+#include "dfs_rate.h"
+#include "dfs_metrics.h"
+#include "dfs_trace.h"
+#include "dfs_fs.h"
+#include "dfs_selftest.h"
+#include "dfs_log.h"
+#include "dfs_fault.h"
+#include "dfs_probe.h"
+
 #define SERVER_PORT 7779 // S3 listens on port 8003
 #define BUFFER_SIZE 1024
-#define MAX_CLIENTS 10
+#define MAX_CLIENTS SOMAXCONN // listen backlog
 
-// this function creates a directory path recursively if not already present.
-void create_path_if_not_exist(const char *path)
-{
-    char temp[512];
-    strcpy(temp, path);
-    char *p = temp + 1; // skip first character
-    while ((p = strchr(p, '/')) != NULL)
-    {
-        *p = '\0';
-        mkdir(temp, 0777);
-        *p = '/';
-        p++;
-    }
-    mkdir(temp, 0777);
-}
+// index of this S3 instance; instance 0 is the head of the replication chain
+int node_instance = 0;
 
 // this Sets the S3 folder path usually under the HOME directory eg. home/patel4xa/S3
 void get_s3_folder_path(char *base_path)
 {
-    const char *home_dir = getenv("HOME");
-    char cwd[512];
-    if (home_dir != NULL)
-    {
-        snprintf(base_path, 512, "%s/S3", home_dir);
-        mkdir(base_path, 0777); // ensure S1_folder exists
-    }
-    else
-    {
-        perror("getcwd() error");
-        exit(1);
-    }
+    dfs_instance_root("S3", node_instance, base_path, 512);
 }
 
-// Replace ~S1/ with the actual S3 base folder path.
-void sanitize_path(char *resolved_path, const char *raw_path, const char *base_dir)
-{
-    // Strip "~S1/" from the beginning if present, so that "uploadf sample.txt ~S1/hatch"
-    // becomes a folder "hatch" under S3's base folder.
-    if (strncmp(raw_path, "~S1/", 4) == 0)
-    {
-        snprintf(resolved_path, 512, "%s/%s", base_dir, raw_path + 4);
-    }
-    else
-    {
-        snprintf(resolved_path, 512, "%s", raw_path);
-    }
-}
 
-// check whether path exist return 2 for direcotory, return 1 for file, otherwise 0
-int check_path_exists(const char *path)
-{
-    struct stat path_stat;
-
-    if (stat(path, &path_stat) != 0)
-    {
-        return 0;
-    }
-    // Check if it's a directory
-    if (S_ISDIR(path_stat.st_mode))
-    {
-        return 2;
-    }
-    return 1;
-}
-
-char *list_all_files(const char *path, const char *extension, char *result, size_t result_size)
-{
-    char command[1024];
-    // Clear the result buffer
-    memset(result, 0, result_size);
-
-    // Validate inputs
-    if (path == NULL || result == NULL || result_size <= 0)
-    {
-        return NULL;
-    }
-
-    // Check if directory exists
-    struct stat st;
-    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
-    {
-        return NULL;
-    }
-
-    // Build the find command
-    if (extension != NULL)
-    {
-        // Filter by extension
-        snprintf(command, sizeof(command),"find \"%s\" -type f -name \"*%s\"",path, extension);
-    }
-    else
-    {
-        // All files
-        snprintf(command, sizeof(command),"find \"%s\" -type f", path);
-    }
-    // Execute the command
-    FILE *fp = popen(command, "r");
-    if (fp == NULL)
-    {
-        perror("popen failed");
-        return NULL;
-    }
-    // storing names in array for sorting
-    char filenames[1000][256];
-    int file_count = 0;
-    char line[1024];
-    while (fgets(line, sizeof(line), fp) != NULL && file_count < 1000)
-    {
-        // Remove newline character
-        line[strcspn(line, "\n")] = 0;
-
-        // Extract just the filename (not the full path)
-        const char *filename = strrchr(line, '/');
-        if (filename)
-        {
-            filename++; // Skip the '/'
-        }
-        else
-        {
-            filename = line;
-        }
-        // Store the filename
-        strncpy(filenames[file_count], filename, 255);
-        filenames[file_count][255] = '\0'; 
-        file_count++;
-    }
-    pclose(fp);
-    for (int i = 0; i < file_count - 1; i++)
-    {
-        for (int j = 0; j < file_count - i - 1; j++)
-        {
-            if (strcasecmp(filenames[j], filenames[j + 1]) > 0)
-            {
-                // Swap filenames
-                char temp[256];
-                strcpy(temp, filenames[j]);
-                strcpy(filenames[j], filenames[j + 1]);
-                strcpy(filenames[j + 1], temp);
-            }
-        }
-    }
-    // Now add the sorted filenames to the result
-    size_t current_size = 0;
-    for (int i = 0; i < file_count; i++)
-    {
-        size_t needed = strlen(filenames[i]) + 1; // +1 for newline
-
-        // Check if we have enough space left in the buffer
-        if (current_size + needed >= result_size - 1)
-        { // -1 for null terminator
-            break;
-        }
-        // Append the filename and a newline
-        strcat(result, filenames[i]);
-        strcat(result, "\n");
-
-        current_size += needed;
-    }
-    return result;
-}
-
-
-void upload_handler(int client_socket, char *filename, char *dest_path)
+void upload_handler(int client_socket, char *filename, char *dest_path, char command[])
 {
     char *ext = strrchr(filename, '.');
     if (!ext)
     {
-        printf("Invalid file extension.\n");
+        dfs_log(DFS_LOG_WARN, "Invalid file extension.");
         return;
     }
 
     // Receive the file size.
     int filesize;
-    recv(client_socket, &filesize, sizeof(int), 0);
-    printf("Receiving file: %s (%d bytes)\n", filename, filesize);
+    if (dfs_recv_all(client_socket, &filesize, sizeof(int)) < 0 || filesize < 0)
+    {
+        dfs_log(DFS_LOG_WARN, "No valid size for %s", filename);
+        dfs_send(client_socket, "Error storing file", 18, 0);
+        return;
+    }
+    dfs_log(DFS_LOG_INFO, "Receiving file: %s (%d bytes)", filename, filesize);
 
     char full_path[512];
 
@@ -199,53 +69,143 @@ void upload_handler(int client_socket, char *filename, char *dest_path)
     {
         // Construct the full path where the file will be stored.
         snprintf(full_path, sizeof(full_path), "%s/%s", dest_path, filename);
-        create_path_if_not_exist(dest_path);
+        dfs_fs_mkdirs(dest_path);
 
-        FILE *fp = fopen(full_path, "wb");
-        if (fp == NULL)
+        // small files are appended to the pack store instead of getting a file of their own
+        char *packed = dfs_pack_wanted(filesize) ? malloc(filesize + 1) : NULL;
+        FILE *fp = NULL;
+        char tmp_path[600];
+        if (packed == NULL)
         {
-            perror("File open failed");
-            return;
+            // written aside and renamed into place once complete and on disk
+            fp = dfs_durable_open(full_path, tmp_path, sizeof(tmp_path));
+            if (fp == NULL)
+            {
+                perror("File open failed");
+                return;
+            }
         }
 
+        // pass the file down the replication chain while writing our own copy
+        int next_replica = dfs_chain_open(SERVER_PORT, node_instance, command, filesize);
+
         int bytes_received, total_received = 0;
+        unsigned long long hash = DFS_META_HASH_INIT;
         char buffer[BUFFER_SIZE];
         while (total_received < filesize)
         {
-            bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
+            int want = filesize - total_received < BUFFER_SIZE ? filesize - total_received : BUFFER_SIZE;
+            bytes_received = dfs_recv(client_socket, buffer, want, 0);
             if (bytes_received <= 0)
                 break;
-            fwrite(buffer, 1, bytes_received, fp);
+            if (packed != NULL)
+                memcpy(packed + total_received, buffer, bytes_received);
+            else
+            {
+                fwrite(buffer, 1, bytes_received, fp);
+                dfs_fault_disk(bytes_received);
+                DFS_PROBE2(disk_write, full_path, bytes_received);
+            }
+            hash = dfs_meta_hash(hash, buffer, bytes_received);
+            dfs_rate_bytes(bytes_received);
+            if (next_replica >= 0 && dfs_send_all(next_replica, buffer, bytes_received) < 0)
+            {
+                dfs_log(DFS_LOG_WARN, "Lost the next replica while forwarding %s", filename);
+                close(next_replica);
+                next_replica = DFS_CHAIN_LOST;
+            }
             total_received += bytes_received;
         }
-        fclose(fp);
-        printf("File saved to %s\n", full_path);
-        send(client_socket, "File stored in S3 successfully", 30, 0);
+        char replica_response[BUFFER_SIZE];
+        if (total_received < filesize)
+        {
+            // never leave a truncated copy behind
+            if (fp != NULL)
+            {
+                dfs_durable_abort(fp, tmp_path);
+            }
+            free(packed);
+            dfs_log(DFS_LOG_ERROR, "Upload of %s failed after %d of %d bytes, nothing stored", filename, total_received,
+                    filesize);
+            dfs_chain_close(next_replica, replica_response, sizeof(replica_response));
+            dfs_send(client_socket, "Error storing file", 18, 0);
+            return;
+        }
+        int stored = 1;
+        if (packed != NULL && dfs_pack_put(full_path, packed, total_received) == 0)
+        {
+            remove(full_path); // an older copy that was stored as a regular file
+            dfs_log(DFS_LOG_INFO, "File packed as %s", full_path);
+        }
+        else if (packed != NULL)
+        {
+            // the pack index is full, fall back to a regular file
+            dfs_fault_disk(total_received);
+            stored = dfs_durable_write(full_path, packed, total_received) == 0;
+            if (stored)
+            {
+                dfs_log(DFS_LOG_INFO, "File saved to %s", full_path);
+            }
+        }
+        else
+        {
+            stored = dfs_durable_commit(fp, tmp_path, full_path) == 0;
+            if (stored)
+            {
+                dfs_pack_remove(full_path); // an older packed copy
+                dfs_log(DFS_LOG_INFO, "File saved to %s", full_path);
+            }
+        }
+        free(packed);
+        if (!stored)
+        {
+            dfs_log(DFS_LOG_ERROR, "Failed to store %s", full_path);
+            dfs_chain_close(next_replica, replica_response, sizeof(replica_response));
+            dfs_send(client_socket, "Error storing file", 18, 0);
+            return;
+        }
+        dfs_meta_put(full_path, total_received, hash);
+
+        // acknowledge only once the rest of the chain has stored the file: if a replica
+        // missed it the upload fails instead of leaving fewer copies than DFS_REPLICAS
+        if (!dfs_chain_close(next_replica, replica_response, sizeof(replica_response)))
+        {
+            dfs_log(DFS_LOG_ERROR, "%s was not stored on every replica", full_path);
+            dfs_send_all(client_socket, "Error: not stored on every replica", 34);
+            return;
+        }
+        dfs_send(client_socket, "File stored in S3 successfully", 30, 0);
     }
     else
     {
-        printf("Forwarding %s to appropriate server based on extension\n", filename);
+        dfs_log(DFS_LOG_INFO, "Forwarding %s to appropriate server based on extension", filename);
     }
 }
 
 //remove .txt files 
 // example: removef ~S1/foldertxt/1.txt
-void handle_remove(int client_socket, char *filepath)
+void handle_remove(int client_socket, char *filepath, char command[])
 {
+    // remove the file from the rest of the replication chain first
+    int next_replica = dfs_chain_open(SERVER_PORT, node_instance, command, -1);
+    char replica_response[BUFFER_SIZE];
+    dfs_chain_close(next_replica, replica_response, sizeof(replica_response));
+
     // filepath is expected to be like "~S1/folder1/folder2/sample.txt"
     char base_path[512];
     get_s3_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, filepath, base_path);
-    if (remove(resolved_path) == 0)
+    dfs_fs_resolve(resolved_path, filepath, base_path);
+    if (dfs_pack_remove(resolved_path) == 0 || remove(resolved_path) == 0)
     {
-        printf("Removed file %s\n", resolved_path);
-        send(client_socket, "File removed successfully", 33, 0);
+        dfs_meta_remove(resolved_path);
+        dfs_log(DFS_LOG_INFO, "Removed file %s", resolved_path);
+        dfs_send(client_socket, "File removed successfully", 33, 0);
     }
     else
     {
         perror("Error removing file");
-        send(client_socket, "Error removing file from S3", 28, 0);
+        dfs_send(client_socket, "Error removing file from S3", 28, 0);
     }
 }
 
@@ -262,59 +222,49 @@ void downltar_txt_handler(int client_socket, char *buffer)
         char s3folder[512];
         get_s3_folder_path(s3folder);  // Use S3 folder
         
-        // Check for .txt files in S3 folder.
-        char findCommand[1024];
-        snprintf(findCommand, sizeof(findCommand),
-                "find \"%s\" -type f -name '*.txt'", s3folder);
-        FILE *fp_find = popen(findCommand, "r");
-        if (fp_find == NULL)
-        {
-            printf("Error: Cannot execute find on S3 folder '%s'.\n", s3folder);
-            send(client_socket, "Error checking files", 21, 0);
-            return;
-        }
-        char line[256];
-        if (fgets(line, sizeof(line), fp_find) == NULL)
-        {
-            printf("Info: No .txt files found in '%s'. No tar archive created.\n", s3folder);
-            send(client_socket, "No files available for tar", 28, 0);
-            pclose(fp_find);
-            return;
-        }
-        pclose(fp_find);
-        
-        // Build the tar archive from S3 folder.
+        // Build the tar archive from S3 folder; S1 reads a size of 0 as "nothing to send".
+        long build_started = DFS_PROBE_CLOCK(tar_phase);
         char tarFilename[128];
-        snprintf(tarFilename, sizeof(tarFilename), "text_%ld.tar", time(NULL));
-        char tarCommand[1024];
-        snprintf(tarCommand, sizeof(tarCommand),"find \"%s\" -type f -name '*.txt' | tar -cf %s -T -", s3folder, tarFilename);
-        if (system(tarCommand) != 0)
+        snprintf(tarFilename, sizeof(tarFilename), "text_%ld_%d.tar", time(NULL), getpid());
+        int file_count = dfs_fs_tar(s3folder, ".txt", tarFilename);
+        if (file_count <= 0)
         {
-            printf("Error: Tar creation for TXT files failed.\n");
-            send(client_socket, "Error creating tar file", 25, 0);
+            if (file_count == 0)
+            {
+                dfs_log(DFS_LOG_INFO, "No .txt files found in '%s'. No tar archive created.", s3folder);
+            }
+            else
+            {
+                dfs_log(DFS_LOG_ERROR, "Tar creation for TXT files failed.");
+            }
+            int zero_size = 0;
+            dfs_send(client_socket, &zero_size, sizeof(int), 0);
             return;
         }
+        DFS_PROBE3(tar_phase, ".txt", "build", DFS_PROBE_SINCE(build_started));
         
         FILE *fp = fopen(tarFilename, "rb");
         if (fp == NULL)
         {
-            printf("Error: Cannot open tar file '%s': %s\n", tarFilename, strerror(errno));
-            send(client_socket, "Error creating tar file", 25, 0);
+            dfs_log(DFS_LOG_ERROR, "Cannot open tar file '%s': %s", tarFilename, strerror(errno));
+            dfs_send(client_socket, "Error creating tar file", 25, 0);
             return;
         }
         fseek(fp, 0, SEEK_END);
         int filesize = ftell(fp);
         rewind(fp);
-        if (send(client_socket, &filesize, sizeof(int), 0) < 0)
-            printf("Error: Failed to send tar file size.\n");
+        if (dfs_send(client_socket, &filesize, sizeof(int), 0) < 0)
+            dfs_log(DFS_LOG_ERROR, "Failed to send tar file size.");
+        long send_started = DFS_PROBE_CLOCK(tar_phase);
         
         char filebuffer[BUFFER_SIZE];
         int bytes;
         while ((bytes = fread(filebuffer, 1, BUFFER_SIZE, fp)) > 0)
         {
-            if (send(client_socket, filebuffer, bytes, 0) < bytes)
+            dfs_rate_bytes(bytes);
+            if (dfs_send_all(client_socket, filebuffer, bytes) < 0)
             {
-                printf("Error: Incomplete sending of tar file '%s'.\n", tarFilename);
+                dfs_log(DFS_LOG_ERROR, "Incomplete sending of tar file '%s'.", tarFilename);
                 fclose(fp);
                 remove(tarFilename);
                 return;
@@ -322,12 +272,13 @@ void downltar_txt_handler(int client_socket, char *buffer)
         }
         fclose(fp);
         remove(tarFilename);
-        printf("Tar file for TXT files sent successfully.\n");
+        DFS_PROBE3(tar_phase, ".txt", "send", DFS_PROBE_SINCE(send_started));
+        dfs_log(DFS_LOG_INFO, "Tar file for TXT files sent successfully.");
     }
     else
     {
-        printf("Error: Unsupported file type '%s' for downltar on TXT server.\n", filetype);
-        send(client_socket, "Unsupported file type for tar", 29, 0);
+        dfs_log(DFS_LOG_WARN, "Unsupported file type '%s' for downltar on TXT server.", filetype);
+        dfs_send(client_socket, "Unsupported file type for tar", 29, 0);
     }
 
 }
@@ -336,13 +287,13 @@ void downltar_txt_handler(int client_socket, char *buffer)
 void download_request_forwader(int sock, char buffer[], int client_socket, char *servername)
 {
 
-    send(sock, buffer, strlen(buffer), 0);
+    dfs_send(sock, buffer, strlen(buffer), 0);
     char response[BUFFER_SIZE];
     memset(response, 0, BUFFER_SIZE);
-    recv(sock, response, BUFFER_SIZE, 0);
-    printf("%s response: %s\n", servername, response);
+    dfs_recv(sock, response, BUFFER_SIZE, 0);
+    dfs_log(DFS_LOG_INFO, "%s response: %s", servername, response);
     close(sock);
-    send(client_socket, response, strlen(response), 0);
+    dfs_send_all(client_socket, response, strlen(response));
 }
 
 //download txt files from server and give to client
@@ -355,26 +306,39 @@ void download_handler(int client_socket, char buffer[])
     char *ext = strrchr(file_path, '.');
     if (!ext)
     {
-        printf("Invalid file extension in download command.\n");
-        send(client_socket, "Invalid file extension", 22, 0);
+        dfs_log(DFS_LOG_WARN, "Invalid file extension in download command.");
+        dfs_send(client_socket, "Invalid file extension", 22, 0);
         return;
     }
 
     char base_path[512];
     get_s3_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, file_path, base_path);
+    dfs_fs_resolve(resolved_path, file_path, base_path);
 
     // printf("Download request for file: %s\n", resolved_path);
 
-    if (strcmp(ext, ".txt") == 0)
+    int packed_size;
+    char *packed = strcmp(ext, ".txt") == 0 ? dfs_pack_load(resolved_path, &packed_size) : NULL;
+    if (packed != NULL)
+    {
+        // packed file, already read with a single pread
+        dfs_send(client_socket, &packed_size, sizeof(int), 0);
+        usleep(100000);
+        dfs_rate_bytes(packed_size);
+        dfs_send_all(client_socket, packed, packed_size);
+        free(packed);
+        dfs_log(DFS_LOG_INFO, "File '%s' sent to S1 successfully.", resolved_path);
+    }
+    else if (strcmp(ext, ".txt") == 0)
     {
         // For .txt files stored locally
+        long open_started = dfs_trace_now();
         FILE *fp = fopen(resolved_path, "rb");
         if (fp == NULL)
         {
-            printf("Cannot open file %s\n", resolved_path);
-            send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
+            dfs_log(DFS_LOG_ERROR, "Cannot open file %s", resolved_path);
+            dfs_send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
             return;
         }
 
@@ -382,27 +346,36 @@ void download_handler(int client_socket, char buffer[])
         fseek(fp, 0, SEEK_END);
         int filesize = ftell(fp);
         rewind(fp);
+        dfs_trace_span("open", open_started, resolved_path);
 
         // Send file size
-        send(client_socket, &filesize, sizeof(int), 0);
+        dfs_send(client_socket, &filesize, sizeof(int), 0);
         usleep(100000);
 
         // Send file content
+        long send_started = dfs_trace_now();
         char filebuffer[BUFFER_SIZE];
         int bytes;
         while ((bytes = fread(filebuffer, 1, BUFFER_SIZE, fp)) > 0)
         {
-            send(client_socket, filebuffer, bytes, 0);
+            dfs_fault_disk(bytes);
+            DFS_PROBE2(disk_read, resolved_path, bytes);
+            dfs_rate_bytes(bytes);
+            if (dfs_send_all(client_socket, filebuffer, bytes) < 0)
+            {
+                break;
+            }
         }
+        dfs_trace_span("send", send_started, resolved_path);
 
         fclose(fp);
-        printf("File '%s' sent to S1 successfully.\n", resolved_path);
+        dfs_log(DFS_LOG_INFO, "File '%s' sent to S1 successfully.", resolved_path);
     }
 
     else
     {
-        printf("Unsupported file extension: %s\n", ext);
-        send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
+        dfs_log(DFS_LOG_WARN, "Unsupported file extension: %s", ext);
+        dfs_send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
     }
 }
 
@@ -422,92 +395,165 @@ void diplay_filename_handler(int client_socket, char buffer[])
     char base_path[512];
     get_s3_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, file_path, base_path);
+    dfs_fs_resolve(resolved_path, file_path, base_path);
 
     // printf("Removed file %s\n", resolved_path);
     char file_list[4096] = {0};
-    if (check_path_exists(resolved_path) == 2)
+    if (dfs_fs_exists(resolved_path) == 2)
     {
 
         // printf("the path is valid and so inside the conditions\n\n");
-        if (list_all_files(resolved_path, NULL, file_list, sizeof(file_list)) != NULL)
+        if (dfs_fs_list(resolved_path, NULL, file_list, sizeof(file_list)) != NULL)
         {
-            printf("All files:\n%s\n", file_list);
+            dfs_log(DFS_LOG_DEBUG, "All files:\n%s", file_list);
         }
         else
         {
             strcpy(file_list, "Error listing files in the specified directory.");
-            printf("Error listing files in %s\n", resolved_path);
+            dfs_log(DFS_LOG_ERROR, "Error listing files in %s", resolved_path);
         }
     }
     else
     {
         // Path doesn't exist
         strcpy(file_list, "path does not exist");
-        printf("Path does not exist: %s\n", resolved_path);
+        dfs_log(DFS_LOG_WARN, "Path does not exist: %s", resolved_path);
     }
     // printf("\n\n%sn\n", resolved_path);
-    send(client_socket, file_list, strlen(file_list), 0);
+    dfs_send_all(client_socket, file_list, strlen(file_list));
 }
 
-// Process client commands
-void prcclient(int client_socket)
+// file metadata (size, upload time, content hash), answered from the index when it is on
+// example: statf ~S1/folder/sample.txt
+void stat_handler(int client_socket, char *filepath)
 {
-    char buffer[BUFFER_SIZE];
-    char command[20], filename[256], path[512];
+    char base_path[512];
+    get_s3_folder_path(base_path);
+    char resolved_path[512];
+    dfs_fs_resolve(resolved_path, filepath, base_path);
+    char reply[BUFFER_SIZE];
+    dfs_meta_describe(resolved_path, reply, sizeof(reply));
+    dfs_log(DFS_LOG_INFO, "statf %s: %s", resolved_path, reply);
+    dfs_send_all(client_socket, reply, strlen(reply));
+}
 
-    while (1)
+// Runs one command received from S1
+void process_request(int client_socket, char buffer[])
+{
+    char command[20] = "", filename[256] = "", path[512] = "";
+
+    dfs_trace_begin(buffer); // a traced request arrives with its context in front
+    // Parse the full command line received from S1.
+    sscanf(buffer, "%s %s %s", command, filename, path);
+    dfs_metrics_begin(client_socket, buffer);
+    dfs_rate_request(client_socket, buffer);
+
+    if (strcmp(command, "uploadf") == 0)
     {
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
-        if (bytes_received <= 0)
-            break;
+        char base_path[512];
+        get_s3_folder_path(base_path);
 
-        // Parse the full command line received from S1.
-        sscanf(buffer, "%s %s %s", command, filename, path);
+        char dest_path[512];
+        dfs_fs_resolve(dest_path, path, base_path);
 
-        if (strcmp(command, "uploadf") == 0)
-        {
-            char base_path[512];
-            get_s3_folder_path(base_path);
+        upload_handler(client_socket, filename, dest_path, buffer);
+    }
+    else if (strcmp(command, "downlf") == 0)
+    {
+        // printf("this is inside the download");
+        download_handler(client_socket, buffer);
+    }
+    else if (strcmp(command, "removef") == 0)
+    {
+        handle_remove(client_socket, filename, buffer);
+    }
+    // Inside S3.c prcclient(), add after processing other commands:
+    else if (strcmp(command, "downltar") == 0)
+    {
+        downltar_txt_handler(client_socket, buffer);
+    }
+    else if (strcmp(command, "dispfnames") == 0)
+    {
+        // printf("inside the display\n");
+        diplay_filename_handler(client_socket, buffer);
+    }
+    else if (strcmp(command, "statf") == 0)
+    {
+        stat_handler(client_socket, filename);
+    }
+    else if (strcmp(command, "stats") == 0)
+    {
+        dfs_metrics_send(client_socket);
+    }
+    else if (strcmp(command, "selftest") == 0)
+    {
+        char base_path[512];
+        get_s3_folder_path(base_path);
+        dfs_selftest_serve(client_socket, buffer, base_path);
+    }
+    else if (strcmp(command, "setlimit") == 0)
+    {
+        char reply[BUFFER_SIZE];
+        dfs_rate_command(buffer, reply, sizeof(reply));
+        dfs_send_all(client_socket, reply, strlen(reply));
+    }
+    else
+    {
+        dfs_log(DFS_LOG_WARN, "Received unknown command: %s", buffer);
+        dfs_send(client_socket, "Unknown command", 15, 0);
+    }
+    dfs_metrics_end();
+    dfs_trace_end();
+}
 
-            char dest_path[512];
-            sanitize_path(dest_path, path, base_path);
+// Process client commands
+void prcclient(int client_socket)
+{
+    char buffer[DFS_FRAME_SIZE + 1]; // a whole command and its terminator
+    int framed;                      // S1 and the previous replica frame uploads, so the size can follow at once
 
-            upload_handler(client_socket, filename, dest_path);
-        }
-        else if (strcmp(command, "downlf") == 0)
-        {
-            // printf("this is inside the download");
-            download_handler(client_socket, buffer);
-        }
-        else if (strcmp(command, "removef") == 0)
-        {
-            handle_remove(client_socket, filename);
-        }
-        // Inside S3.c prcclient(), add after processing other commands:
-        else if (strcmp(command, "downltar") == 0)
-        {
-            downltar_txt_handler(client_socket, buffer);
-        }
-        else if (strcmp(command, "dispfnames") == 0)
-        {
-            // printf("inside the display\n");
-            diplay_filename_handler(client_socket, buffer);
-        }
-        else
+    while (1)
+    {
+        memset(buffer, 0, sizeof(buffer));
+        int bytes_received = dfs_recv_command(client_socket, buffer, &framed);
+        if (bytes_received <= 0)
         {
-            printf("Received unknown command: %s\n", buffer);
-            send(client_socket, "Unknown command", 15, 0);
+            break;
         }
+        process_request(client_socket, buffer);
     }
 }
 
-int main()
+// Serves a connection the I/O engine hands over (see dfs_engine.h)
+void engine_fallback(int client_socket, char *request)
 {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_size;
+    if (request != NULL)
+    {
+        process_request(client_socket, request);
+    }
+    prcclient(client_socket);
+}
+
+int main(int argc, char *argv[])
+{
+    int server_socket;
+    struct sockaddr_in server_addr;
+
+    node_instance = dfs_parse_instance(argc, argv);
+    int port = dfs_instance_port(SERVER_PORT, node_instance);
+    dfs_log_init("S3", port);
+    dfs_fault_init();
+
+    // the pack index is shared by every forked handler, so it has to exist before the first fork
+    char root[512];
+    get_s3_folder_path(root);
+    dfs_durable_init(root);
+    dfs_pack_init(root);
+    dfs_meta_init(root);
+    dfs_watch_init(root);
+    dfs_rate_init();
+    dfs_metrics_init("S3", port);
+    dfs_trace_init("S3", port);
 
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket < 0)
@@ -517,10 +563,15 @@ int main()
     }
     int opt = 1;
     setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (dfs_engine_workers() > 1)
+    {
+        // engine workers open their own listeners on the same port
+        setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    }
 
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
+    server_addr.sin_port = htons(port);
     server_addr.sin_addr.s_addr = INADDR_ANY;
 
     if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
@@ -530,7 +581,7 @@ int main()
     }
     if (listen(server_socket, MAX_CLIENTS) == 0)
     {
-        printf("S3 Server listening on port %d\n", SERVER_PORT);
+        dfs_log(DFS_LOG_INFO, "S3 Server (instance %d) listening on port %d", node_instance, port);
     }
     else
     {
@@ -538,23 +589,11 @@ int main()
         exit(1);
     }
 
-    while (1)
-    {
-        addr_size = sizeof(client_addr);
-        client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &addr_size);
-        if (client_socket < 0)
-        {
-            perror("Accept failed");
-            continue;
-        }
-        if (fork() == 0)
-        {
-            close(server_socket);
-            prcclient(client_socket);
-            exit(0);
-        }
-        close(client_socket);
-    }
+    // downloads run in the event loop when DFS_ENGINE is set, everything else as below
+    struct dfs_engine_config engine = {"S3", root, ".txt", engine_fallback};
+    dfs_engine_run(server_socket, &engine);
 
+    // one forked handler per connection, bounded and queued fairly (see dfs_admit.h)
+    dfs_admit_serve(server_socket, "S3", 0, prcclient);
     return 0;
 }
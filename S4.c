@@ -12,184 +12,55 @@
 #include <fcntl.h>
 #include <errno.h>
 
+#include "dfs_cluster.h"
+#include "dfs_meta.h"
+#include "dfs_watch.h"
+#include "dfs_durable.h"
+#include "dfs_direct.h"
+#include "dfs_net.h"
+#include "dfs_engine.h"
+#include "dfs_admit.h"
+#include "dfs_rate.h"
+#include "dfs_metrics.h"
+#include "dfs_trace.h"
+#include "dfs_fs.h"
+#include "dfs_selftest.h"
+#include "dfs_log.h"
+#include "dfs_fault.h"
+#include "dfs_probe.h"
+
 #define SERVER_PORT 7780 // S4 listens on port 8004
 #define BUFFER_SIZE 1024
-#define MAX_CLIENTS 10
+#define MAX_CLIENTS SOMAXCONN // listen backlog
 
+// index of this S4 instance; instance 0 is the head of the replication chain
+int node_instance = 0;
 
-// this function creates a directory path recursively if not already present.
-void create_path_if_not_exist(const char *path)
-{
-    char temp[512];
-    strcpy(temp, path);
-    char *p = temp + 1; // skip first character
-    while ((p = strchr(p, '/')) != NULL)
-    {
-        *p = '\0';
-        mkdir(temp, 0777);
-        *p = '/';
-        p++;
-    }
-    mkdir(temp, 0777);
-}
 
 // this Sets the S2 base folder path usually under the HOME directory eg. home/shah9c2/S4
 void get_s4_folder_path(char *base_path)
 {
-    const char *home_dir = getenv("HOME");
-    char cwd[512];
-    if (home_dir != NULL)
-    {
-        snprintf(base_path, 512, "%s/S4", home_dir);
-        mkdir(base_path, 0777); // ensure S1_folder exists
-    }
-    else
-    {
-        perror("getcwd() error");
-        exit(1);
-    }
-}
-
-// Replace ~S1/ with the actual S4 base folder path.
-void sanitize_path(char *resolved_path, const char *raw_path, const char *base_dir)
-{
-    // Strip "~S1/" if present; S1 sends the destination using ~S1/ prefix.
-    if (strncmp(raw_path, "~S1/", 4) == 0)
-    {
-        snprintf(resolved_path, 512, "%s/%s", base_dir, raw_path + 4);
-    }
-    else
-    {
-        snprintf(resolved_path, 512, "%s", raw_path);
-    }
-}
-
-// check whether path exist return 2 for direcotory, return 1 for file, otherwise 0
-int check_path_exists(const char *path)
-{
-    struct stat path_stat;
-    // Check if path exists using stat
-    if (stat(path, &path_stat) != 0)
-    {
-        return 0;
-    }
-    // Check if it's a directory
-    if (S_ISDIR(path_stat.st_mode))
-    {
-        return 2;
-    }
-    return 1;
+    dfs_instance_root("S4", node_instance, base_path, 512);
 }
 
-// List and sort all files in a directory
-char *list_all_files(const char *path, const char *extension, char *result, size_t result_size)
-{
-    char command[1024];
-    // Clear the result buffer
-    memset(result, 0, result_size);
-
-    // Validate inputs
-    if (path == NULL || result == NULL || result_size <= 0)
-    {
-        return NULL;
-    }
-
-    // Check if directory exists
-    struct stat st;
-    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
-    {
-        return NULL;
-    }
-
-    // Build the find command
-    if (extension != NULL)
-    {
-        // Filter by extension
-        snprintf(command, sizeof(command),"find \"%s\" -type f -name \"*%s\"",path, extension);
-    }
-    else
-    {
-        // All files
-        snprintf(command, sizeof(command),"find \"%s\" -type f",path);
-    }
-    // Execute the command
-    FILE *fp = popen(command, "r");
-    if (fp == NULL)
-    {
-        perror("popen failed");
-        return NULL;
-    }
-    // storing array in sortred oder
-    char filenames[1000][256]; 
-    int file_count = 0;
-    char line[1024];
-    // read each and get names
-    while (fgets(line, sizeof(line), fp) != NULL && file_count < 1000)
-    {
-        line[strcspn(line, "\n")] = 0;
-
-        const char *filename = strrchr(line, '/'); //extract names from full path 
-        if (filename)
-        {
-            filename++; // Skip the '/'
-        }
-        else
-        {
-            filename = line;
-        }
-        // Store the filename
-        strncpy(filenames[file_count], filename, 255);
-        filenames[file_count][255] = '\0'; // Ensure null termination
-        file_count++;
-    }
-    pclose(fp);
-    // Sort the filenames using a simple bubble sort
-    for (int i = 0; i < file_count - 1; i++)
-    {
-        for (int j = 0; j < file_count - i - 1; j++)
-        {
-            if (strcasecmp(filenames[j], filenames[j + 1]) > 0)
-            {
-                // Swap filenames
-                char temp[256];
-                strcpy(temp, filenames[j]);
-                strcpy(filenames[j], filenames[j + 1]);
-                strcpy(filenames[j + 1], temp);
-            }
-        }
-    }
-    // Now add the sorted filenames to the result
-    size_t current_size = 0;
-    for (int i = 0; i < file_count; i++)
-    {
-        size_t needed = strlen(filenames[i]) + 1; // +1 for newline
-
-        // Check if we have enough space left in the buffer
-        if (current_size + needed >= result_size - 1)
-        { // -1 for null terminator
-            break;
-        }
-        // Append the filename and a newline
-        strcat(result, filenames[i]);
-        strcat(result, "\n");
-
-        current_size += needed;
-    }
-    return result;
-}
-void upload_handler(int client_socket, char *filename, char *dest_path)
+void upload_handler(int client_socket, char *filename, char *dest_path, char command[])
 {
     char *ext = strrchr(filename, '.');
     if (!ext)
     {
-        printf("Invalid file extension.\n");
+        dfs_log(DFS_LOG_WARN, "Invalid file extension.");
         return;
     }
 
     // Receive file size (sent by S1)
     int filesize;
-    recv(client_socket, &filesize, sizeof(int), 0);
-    printf("Receiving file: %s (%d bytes)\n", filename, filesize);
+    if (dfs_recv_all(client_socket, &filesize, sizeof(int)) < 0 || filesize < 0)
+    {
+        dfs_log(DFS_LOG_WARN, "No valid size for %s", filename);
+        dfs_send(client_socket, "Error storing file", 18, 0);
+        return;
+    }
+    dfs_log(DFS_LOG_INFO, "Receiving file: %s (%d bytes)", filename, filesize);
 
     char full_path[512];
 
@@ -197,44 +68,93 @@ void upload_handler(int client_socket, char *filename, char *dest_path)
     {
         // Construct full destination path for the .zip file.
         snprintf(full_path, sizeof(full_path), "%s/%s", dest_path, filename);
-        create_path_if_not_exist(dest_path);
+        dfs_fs_mkdirs(dest_path);
 
-        FILE *fp = fopen(full_path, "wb");
+        // written aside and renamed into place once complete and on disk
+        char tmp_path[600];
+        FILE *fp = dfs_durable_open(full_path, tmp_path, sizeof(tmp_path));
         if (fp == NULL)
         {
             perror("File open failed");
             return;
         }
 
+        // the declared size is reserved up front; large zips may skip the page cache
+        struct dfs_direct_writer *writer = dfs_direct_open(fp, filesize);
+        if (writer == NULL)
+        {
+            dfs_durable_abort(fp, tmp_path);
+            dfs_send(client_socket, "Error storing file", 18, 0);
+            return;
+        }
+
+        // pass the file down the replication chain while writing our own copy
+        int next_replica = dfs_chain_open(SERVER_PORT, node_instance, command, filesize);
+
         int bytes_received, total_received = 0;
-        char buffer[BUFFER_SIZE];
+        unsigned long long hash = DFS_META_HASH_INIT;
+        char buffer[BUFFER_SIZE * 64];
         while (total_received < filesize)
         {
-            bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
+            int want = filesize - total_received < (int)sizeof(buffer) ? filesize - total_received : (int)sizeof(buffer);
+            bytes_received = dfs_recv(client_socket, buffer, want, 0);
             if (bytes_received <= 0)
                 break;
-            fwrite(buffer, 1, bytes_received, fp);
+            dfs_direct_write(writer, buffer, bytes_received);
+            dfs_fault_disk(bytes_received);
+            DFS_PROBE2(disk_write, full_path, bytes_received);
+            hash = dfs_meta_hash(hash, buffer, bytes_received);
+            dfs_rate_bytes(bytes_received);
+            if (next_replica >= 0 && dfs_send_all(next_replica, buffer, bytes_received) < 0)
+            {
+                dfs_log(DFS_LOG_WARN, "Lost the next replica while forwarding %s", filename);
+                close(next_replica);
+                next_replica = DFS_CHAIN_LOST;
+            }
             total_received += bytes_received;
         }
-        fclose(fp);
-        printf("File saved to %s\n", full_path);
-        send(client_socket, "File stored in S4 successfully", 30, 0);
+        char replica_response[BUFFER_SIZE];
+        int complete = dfs_direct_finish(writer) == 0 && total_received == filesize;
+        if (!complete || dfs_durable_commit(fp, tmp_path, full_path) != 0)
+        {
+            if (!complete)
+            {
+                dfs_durable_abort(fp, tmp_path);
+            }
+            dfs_log(DFS_LOG_ERROR, "Upload of %s failed after %d of %d bytes, nothing stored", filename, total_received,
+                    filesize);
+            dfs_chain_close(next_replica, replica_response, sizeof(replica_response));
+            dfs_send(client_socket, "Error storing file", 18, 0);
+            return;
+        }
+        dfs_meta_put(full_path, total_received, hash);
+        dfs_log(DFS_LOG_INFO, "File saved to %s", full_path);
+
+        // acknowledge only once the rest of the chain has stored the file: if a replica
+        // missed it the upload fails instead of leaving fewer copies than DFS_REPLICAS
+        if (!dfs_chain_close(next_replica, replica_response, sizeof(replica_response)))
+        {
+            dfs_log(DFS_LOG_ERROR, "%s was not stored on every replica", full_path);
+            dfs_send_all(client_socket, "Error: not stored on every replica", 34);
+            return;
+        }
+        dfs_send(client_socket, "File stored in S4 successfully", 30, 0);
     }
     else
     {
-        printf("Forwarding %s to appropriate server based on extension\n", filename);
+        dfs_log(DFS_LOG_INFO, "Forwarding %s to appropriate server based on extension", filename);
     }
 }
 void download_request_forwader(int sock, char buffer[], int client_socket, char *servername)
 {
 
-    send(sock, buffer, strlen(buffer), 0);
+    dfs_send(sock, buffer, strlen(buffer), 0);
     char response[BUFFER_SIZE];
     memset(response, 0, BUFFER_SIZE);
-    recv(sock, response, BUFFER_SIZE, 0);
-    printf("%s response: %s\n", servername, response);
+    dfs_recv(sock, response, BUFFER_SIZE, 0);
+    dfs_log(DFS_LOG_INFO, "%s response: %s", servername, response);
     close(sock);
-    send(client_socket, response, strlen(response), 0);
+    dfs_send_all(client_socket, response, strlen(response));
 }
 void download_handler(int client_socket, char buffer[])
 {
@@ -244,50 +164,206 @@ void download_handler(int client_socket, char buffer[])
     char *ext = strrchr(file_path, '.');
     if (!ext)
     {
-        printf("Invalid file extension in download command.\n");
-        send(client_socket, "Invalid file extension", 22, 0);
+        dfs_log(DFS_LOG_WARN, "Invalid file extension in download command.");
+        dfs_send(client_socket, "Invalid file extension", 22, 0);
         return;
     }
 
     char base_path[512];
     get_s4_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, file_path, base_path);
+    dfs_fs_resolve(resolved_path, file_path, base_path);
 
     // printf("Download request for file: %s\n", resolved_path);
 
     if (strcmp(ext, ".zip") == 0)
     {
+        long open_started = dfs_trace_now();
         FILE *fp = fopen(resolved_path, "rb");
         if (fp == NULL)
         {
-            printf("Cannot open file %s\n", resolved_path);
-            send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
+            dfs_log(DFS_LOG_ERROR, "Cannot open file %s", resolved_path);
+            dfs_send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
             return;
         }
 
         fseek(fp, 0, SEEK_END);
         int filesize = ftell(fp);
         rewind(fp);
+        dfs_trace_span("open", open_started, resolved_path);
 
-        send(client_socket, &filesize, sizeof(int), 0);
+        dfs_send(client_socket, &filesize, sizeof(int), 0);
         usleep(100000);
 
+        long send_started = dfs_trace_now();
         char filebuffer[BUFFER_SIZE];
         int bytes;
         while ((bytes = fread(filebuffer, 1, BUFFER_SIZE, fp)) > 0)
         {
-            send(client_socket, filebuffer, bytes, 0);
+            dfs_fault_disk(bytes);
+            DFS_PROBE2(disk_read, resolved_path, bytes);
+            dfs_rate_bytes(bytes);
+            if (dfs_send_all(client_socket, filebuffer, bytes) < 0)
+            {
+                break;
+            }
         }
+        dfs_trace_span("send", send_started, resolved_path);
 
         fclose(fp);
-        printf("File '%s' sent to S1 successfully.\n", resolved_path);
+        dfs_log(DFS_LOG_INFO, "File '%s' sent to S1 successfully.", resolved_path);
+    }
+    else
+    {
+        dfs_log(DFS_LOG_WARN, "Unsupported file extension: %s", ext);
+        dfs_send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
+    }
+}
+
+// Stripe columns of large zips live under <S4 folder>/.dfs/stripes so they never show up in listings
+// eg. ~S1/folder/big.zip column 2 -> home/shah9c2/S4.2/.dfs/stripes/folder/big.zip.2
+// Returns -1 if the path does not fit in size bytes
+int get_column_path(char *column_path, size_t size, const char *file_path, int column)
+{
+    char base_path[512];
+    get_s4_folder_path(base_path);
+    const char *relative = strncmp(file_path, "~S1/", 4) == 0 ? file_path + 4 : file_path;
+    int n = snprintf(column_path, size, "%s/.dfs/stripes/%s.%d", base_path, relative, column);
+    return n >= 0 && (size_t)n < size ? 0 : -1;
+}
+
+// Stores this instance's column of a striped zip
+// example: putcol big.zip ~S1/folder 2
+void column_upload_handler(int client_socket, char buffer[])
+{
+    char command[20], filename[256], dest[512], file_path[1024], column_path[512];
+    int column;
+    if (sscanf(buffer, "%19s %255s %511s %d", command, filename, dest, &column) != 4)
+    {
+        dfs_send(client_socket, "Invalid putcol command", 22, 0);
+        return;
+    }
+    // S1 sends no size when the stripe is given up before any data moves (a column node
+    // unreachable): nothing is opened then, so no temp file is left behind
+    int filesize;
+    if (dfs_recv_all(client_socket, &filesize, sizeof(int)) < 0 || filesize < 0)
+    {
+        dfs_log(DFS_LOG_WARN, "No valid size for column %d of %s, nothing stored", column, filename);
+        dfs_send(client_socket, "Error storing column", 20, 0);
+        return;
+    }
+
+    snprintf(file_path, sizeof(file_path), "%s/%s", dest, filename);
+    char tmp_path[600];
+    FILE *fp = NULL;
+    if (get_column_path(column_path, sizeof(column_path), file_path, column) < 0)
+    {
+        // the column is still read, so the reply is not lost behind it
+        dfs_log(DFS_LOG_ERROR, "Column path for %s is too long", file_path);
     }
     else
     {
-        printf("Unsupported file extension: %s\n", ext);
-        send(client_socket, &(int){0}, sizeof(int), 0); // Send 0 size to indicate error
+        char column_dir[512];
+        strcpy(column_dir, column_path);
+        *strrchr(column_dir, '/') = '\0';
+        dfs_fs_mkdirs(column_dir);
+        fp = dfs_durable_open(column_path, tmp_path, sizeof(tmp_path));
+        if (fp == NULL)
+        {
+            perror("Column open failed");
+        }
+    }
+    struct dfs_direct_writer *writer = fp ? dfs_direct_open(fp, filesize) : NULL;
+    char data[BUFFER_SIZE * 64];
+    int bytes_received, total_received = 0;
+    while (total_received < filesize)
+    {
+        int want = filesize - total_received < (int)sizeof(data) ? filesize - total_received : (int)sizeof(data);
+        bytes_received = dfs_recv(client_socket, data, want, 0);
+        if (bytes_received <= 0)
+            break;
+        if (writer != NULL)
+            dfs_direct_write(writer, data, bytes_received);
+        dfs_fault_disk(bytes_received);
+        DFS_PROBE2(disk_write, column_path, bytes_received);
+        total_received += bytes_received;
+        dfs_rate_bytes(bytes_received);
+    }
+    int written = writer != NULL && dfs_direct_finish(writer) == 0;
+    if (fp != NULL && (!written || total_received < filesize))
+    {
+        dfs_durable_abort(fp, tmp_path);
+        fp = NULL;
+    }
+    if (fp == NULL || dfs_durable_commit(fp, tmp_path, column_path) != 0)
+    {
+        dfs_send(client_socket, "Error storing column", 20, 0);
+        return;
+    }
+    dfs_log(DFS_LOG_INFO, "Column %d of %s saved (%d bytes)", column, file_path, filesize);
+    dfs_send(client_socket, "Column stored", 13, 0);
+}
+
+// Removes this instance's column of a striped zip whose upload failed
+// example: rmcol ~S1/folder/big.zip 2
+void column_remove_handler(int client_socket, char buffer[])
+{
+    char command[20], file_path[512], column_path[512];
+    int column;
+    if (sscanf(buffer, "%19s %511s %d", command, file_path, &column) != 3 ||
+        get_column_path(column_path, sizeof(column_path), file_path, column) < 0)
+    {
+        dfs_send(client_socket, "Invalid rmcol command", 21, 0);
+        return;
+    }
+    if (unlink(column_path) < 0 && errno != ENOENT)
+    {
+        perror("Column remove failed");
+        dfs_send(client_socket, "Error removing column", 21, 0);
+        return;
     }
+    dfs_log(DFS_LOG_INFO, "Column %d of %s removed", column, file_path);
+    dfs_send(client_socket, "Column removed", 14, 0);
+}
+
+// Sends this instance's column of a striped zip: size (-1 if missing) then content
+// example: getcol ~S1/folder/big.zip 2
+void column_download_handler(int client_socket, char buffer[])
+{
+    char command[20], file_path[512], column_path[512];
+    int column;
+    if (sscanf(buffer, "%19s %511s %d", command, file_path, &column) != 3)
+    {
+        dfs_send(client_socket, &(int){-1}, sizeof(int), 0);
+        return;
+    }
+    FILE *fp = NULL;
+    if (get_column_path(column_path, sizeof(column_path), file_path, column) == 0)
+    {
+        fp = fopen(column_path, "rb");
+    }
+    if (fp == NULL)
+    {
+        dfs_log(DFS_LOG_WARN, "Missing column %s", column_path);
+        dfs_send(client_socket, &(int){-1}, sizeof(int), 0);
+        return;
+    }
+    fseek(fp, 0, SEEK_END);
+    int filesize = ftell(fp);
+    rewind(fp);
+    dfs_send(client_socket, &filesize, sizeof(int), 0);
+
+    char data[BUFFER_SIZE * 64];
+    int bytes;
+    while ((bytes = fread(data, 1, sizeof(data), fp)) > 0)
+    {
+        dfs_fault_disk(bytes);
+        DFS_PROBE2(disk_read, column_path, bytes);
+        dfs_rate_bytes(bytes);
+        if (dfs_send_all(client_socket, data, bytes) < 0)
+            break;
+    }
+    fclose(fp);
 }
 
 void diplay_filename_handler(int client_socket, char buffer[])
@@ -304,81 +380,166 @@ void diplay_filename_handler(int client_socket, char buffer[])
     char base_path[512];
     get_s4_folder_path(base_path);
     char resolved_path[512];
-    sanitize_path(resolved_path, file_path, base_path);
+    dfs_fs_resolve(resolved_path, file_path, base_path);
 
     // printf("Removed file %s\n", resolved_path);
     char file_list[4096] = {0};
-    if (check_path_exists(resolved_path) == 2)
+    if (dfs_fs_exists(resolved_path) == 2)
     {
 
         // printf("the path is valid and so inside the conditions\n\n");
-        if (list_all_files(resolved_path, NULL, file_list, sizeof(file_list)) != NULL)
+        if (dfs_fs_list(resolved_path, NULL, file_list, sizeof(file_list)) != NULL)
         {
-            printf("All files:\n%s\n", file_list);
+            dfs_log(DFS_LOG_DEBUG, "All files:\n%s", file_list);
         }
         else
         {
             strcpy(file_list, "Error listing files in the specified directory.");
-            printf("Error listing files in %s\n", resolved_path);
+            dfs_log(DFS_LOG_ERROR, "Error listing files in %s", resolved_path);
         }
     }
     else
     {
         // Path doesn't exist
         strcpy(file_list, "path does not exist");
-        printf("Path does not exist: %s\n", resolved_path);
+        dfs_log(DFS_LOG_WARN, "Path does not exist: %s", resolved_path);
     }
     // printf("\n\n%sn\n", resolved_path);
-    send(client_socket, file_list, strlen(file_list), 0);
+    dfs_send_all(client_socket, file_list, strlen(file_list));
 }
 
-void prcclient(int client_socket)
+// file metadata (size, upload time, content hash), answered from the index when it is on
+// example: statf ~S1/folder/sample.zip
+void stat_handler(int client_socket, char *filepath)
+{
+    char base_path[512];
+    get_s4_folder_path(base_path);
+    char resolved_path[512];
+    dfs_fs_resolve(resolved_path, filepath, base_path);
+    char reply[BUFFER_SIZE];
+    dfs_meta_describe(resolved_path, reply, sizeof(reply));
+    dfs_log(DFS_LOG_INFO, "statf %s: %s", resolved_path, reply);
+    dfs_send_all(client_socket, reply, strlen(reply));
+}
+
+// Runs one command received from S1
+void process_request(int client_socket, char buffer[])
 {
-    char buffer[BUFFER_SIZE];
-    char command[20], filename[256], path[512];
+    char command[20] = "", filename[256] = "", path[512] = "";
 
-    while (1)
+    dfs_trace_begin(buffer); // a traced request arrives with its context in front
+    sscanf(buffer, "%s %s %s", command, filename, path);
+    dfs_metrics_begin(client_socket, buffer);
+    dfs_rate_request(client_socket, buffer);
+
+    if (strcmp(command, "uploadf") == 0)
     {
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
-        if (bytes_received <= 0)
-            break;
+        char base_path[512];
+        get_s4_folder_path(base_path);
 
-        sscanf(buffer, "%s %s %s", command, filename, path);
+        char dest_path[512];
+        dfs_fs_resolve(dest_path, path, base_path);
 
-        if (strcmp(command, "uploadf") == 0)
-        {
-            char base_path[512];
-            get_s4_folder_path(base_path);
+        upload_handler(client_socket, filename, dest_path, buffer);
+    }
+    else if (strcmp(command, "downlf") == 0)
+    {
+        // printf("this is inside the download");
+        download_handler(client_socket, buffer);
+    }
+    else if (strcmp(command, "dispfnames") == 0)
+    {
+        // printf("inside the display\n");
+        diplay_filename_handler(client_socket, buffer);
+    }
+    else if (strcmp(command, "statf") == 0)
+    {
+        stat_handler(client_socket, filename);
+    }
+    else if (strcmp(command, "stats") == 0)
+    {
+        dfs_metrics_send(client_socket);
+    }
+    else if (strcmp(command, "selftest") == 0)
+    {
+        char base_path[512];
+        get_s4_folder_path(base_path);
+        dfs_selftest_serve(client_socket, buffer, base_path);
+    }
+    else if (strcmp(command, "setlimit") == 0)
+    {
+        char reply[BUFFER_SIZE];
+        dfs_rate_command(buffer, reply, sizeof(reply));
+        dfs_send_all(client_socket, reply, strlen(reply));
+    }
+    // columns of striped zips, only sent by S1
+    else if (strcmp(command, "putcol") == 0)
+    {
+        column_upload_handler(client_socket, buffer);
+    }
+    else if (strcmp(command, "getcol") == 0)
+    {
+        column_download_handler(client_socket, buffer);
+    }
+    else if (strcmp(command, "rmcol") == 0)
+    {
+        column_remove_handler(client_socket, buffer);
+    }
+    else
+    {
+        dfs_log(DFS_LOG_WARN, "Received unknown command: %s", buffer);
+        dfs_send(client_socket, "Unknown command", 15, 0);
+    }
+    dfs_metrics_end();
+    dfs_trace_end();
+}
 
-            char dest_path[512];
-            sanitize_path(dest_path, path, base_path);
+void prcclient(int client_socket)
+{
+    char buffer[DFS_FRAME_SIZE + 1]; // a whole command and its terminator
+    int framed;                      // S1 and the previous replica frame uploads, so the size can follow at once
 
-            upload_handler(client_socket, filename, dest_path);
-        }
-        else if (strcmp(command, "downlf") == 0)
-        {
-            // printf("this is inside the download");
-            download_handler(client_socket, buffer);
-        }
-        else if (strcmp(command, "dispfnames") == 0)
-        {
-            // printf("inside the display\n");
-            diplay_filename_handler(client_socket, buffer);
-        }
-        else
+    while (1)
+    {
+        memset(buffer, 0, sizeof(buffer));
+        int bytes_received = dfs_recv_command(client_socket, buffer, &framed);
+        if (bytes_received <= 0)
         {
-            printf("Received unknown command: %s\n", buffer);
-            send(client_socket, "Unknown command", 15, 0);
+            break;
         }
+        process_request(client_socket, buffer);
     }
 }
 
-int main()
+// Serves a connection the I/O engine hands over (see dfs_engine.h)
+void engine_fallback(int client_socket, char *request)
 {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_size;
+    if (request != NULL)
+    {
+        process_request(client_socket, request);
+    }
+    prcclient(client_socket);
+}
+
+int main(int argc, char *argv[])
+{
+    int server_socket;
+    struct sockaddr_in server_addr;
+
+    node_instance = dfs_parse_instance(argc, argv);
+    int port = dfs_instance_port(SERVER_PORT, node_instance);
+    dfs_log_init("S4", port);
+    dfs_fault_init();
+
+    // rebuilt here if it is missing, so no handler ever has to scan the tree
+    char root[512];
+    get_s4_folder_path(root);
+    dfs_durable_init(root);
+    dfs_meta_init(root);
+    dfs_watch_init(root);
+    dfs_rate_init();
+    dfs_metrics_init("S4", port);
+    dfs_trace_init("S4", port);
 
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket < 0)
@@ -388,10 +549,15 @@ int main()
     }
     int opt = 1;
     setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (dfs_engine_workers() > 1)
+    {
+        // engine workers open their own listeners on the same port
+        setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    }
 
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
+    server_addr.sin_port = htons(port);
     server_addr.sin_addr.s_addr = INADDR_ANY;
 
     if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
@@ -402,7 +568,7 @@ int main()
 
     if (listen(server_socket, MAX_CLIENTS) == 0)
     {
-        printf("S4 Server listening on port %d\n", SERVER_PORT);
+        dfs_log(DFS_LOG_INFO, "S4 Server (instance %d) listening on port %d", node_instance, port);
     }
     else
     {
@@ -410,23 +576,11 @@ int main()
         exit(1);
     }
 
-    while (1)
-    {
-        addr_size = sizeof(client_addr);
-        client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &addr_size);
-        if (client_socket < 0)
-        {
-            perror("Accept failed");
-            continue;
-        }
-        if (fork() == 0)
-        {
-            close(server_socket);
-            prcclient(client_socket);
-            exit(0);
-        }
-        close(client_socket);
-    }
+    // downloads run in the event loop when DFS_ENGINE is set, everything else as below
+    struct dfs_engine_config engine = {"S4", root, ".zip", engine_fallback};
+    dfs_engine_run(server_socket, &engine);
 
+    // one forked handler per connection, bounded and queued fairly (see dfs_admit.h)
+    dfs_admit_serve(server_socket, "S4", 0, prcclient);
     return 0;
 }
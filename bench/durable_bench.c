@@ -0,0 +1,85 @@
+// durable_bench.c - Upload write throughput under each DFS_SYNC policy.
+//
+// gcc -O2 -I. -o durable_bench bench/durable_bench.c dfs_durable.c
+// ./durable_bench [dir] [writers] [files_per_writer] [file_bytes]
+// Run it on the disk the servers store to: on a tmpfs every policy costs the same.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "dfs_durable.h"
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = argc > 1 ? argv[1] : "durable_bench.dir";
+    int writers = argc > 2 ? atoi(argv[2]) : 8;
+    int files = argc > 3 ? atoi(argv[3]) : 200;
+    int bytes = argc > 4 ? atoi(argv[4]) : 4096;
+    if (writers < 1 || files < 1 || bytes < 0)
+    {
+        fprintf(stderr, "Usage: %s [dir] [writers] [files_per_writer] [file_bytes]\n", argv[0]);
+        return 1;
+    }
+    char *data = malloc(bytes + 1);
+    memset(data, 'x', bytes);
+    mkdir(dir, 0777);
+
+    const char *policies[] = {"none", "batch", "file"};
+    for (int p = 0; p < 3; p++)
+    {
+        setenv("DFS_SYNC", policies[p], 1);
+        dfs_durable_init(dir);
+
+        // each writer stands in for one forked upload handler
+        double start = now_seconds();
+        for (int w = 0; w < writers; w++)
+        {
+            if (fork() == 0)
+            {
+                for (int f = 0; f < files; f++)
+                {
+                    char path[1024];
+                    snprintf(path, sizeof(path), "%s/w%d_%d.dat", dir, w, f);
+                    if (dfs_durable_write(path, data, bytes) != 0)
+                    {
+                        _exit(1);
+                    }
+                }
+                _exit(0);
+            }
+        }
+        int failed = 0, status;
+        while (wait(&status) > 0)
+        {
+            failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        }
+        double elapsed = now_seconds() - start;
+        long total = (long)writers * files;
+        printf("%-5s %9.0f files/s %8.1f MB/s %7lu filesystem syncs%s\n", policies[p], total / elapsed,
+               (double)total * bytes / elapsed / 1e6, dfs_durable_group_syncs(), failed ? " (writes failed)" : "");
+
+        for (int w = 0; w < writers; w++)
+        {
+            for (int f = 0; f < files; f++)
+            {
+                char path[1024];
+                snprintf(path, sizeof(path), "%s/w%d_%d.dat", dir, w, f);
+                unlink(path);
+            }
+        }
+    }
+    free(data);
+    return 0;
+}
@@ -0,0 +1,87 @@
+// ec_bench.c - Encode and decode throughput of the erasure coding kernel.
+//
+// gcc -O2 -I. -o ec_bench bench/ec_bench.c dfs_ec.c
+// ./ec_bench [k] [m] [shard_bytes] [rounds]
+// Run with DFS_EC_SIMD=0 to measure the scalar kernel.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dfs_ec.h"
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int k = argc > 1 ? atoi(argv[1]) : 4;
+    int m = argc > 2 ? atoi(argv[2]) : 2;
+    size_t len = argc > 3 ? (size_t)atol(argv[3]) : 1024 * 1024;
+    int rounds = argc > 4 ? atoi(argv[4]) : 200;
+    if (k < 1 || m < 1 || k + m > DFS_EC_MAX_SHARDS || len == 0 || rounds < 1)
+    {
+        fprintf(stderr, "Usage: %s [k] [m] [shard_bytes] [rounds], k+m <= %d\n", argv[0], DFS_EC_MAX_SHARDS);
+        return 1;
+    }
+
+    unsigned char *shards[DFS_EC_MAX_SHARDS];
+    unsigned char *original[DFS_EC_MAX_SHARDS];
+    for (int i = 0; i < k + m; i++)
+    {
+        shards[i] = malloc(len);
+        original[i] = malloc(len);
+        for (size_t b = 0; b < len; b++)
+        {
+            shards[i][b] = rand();
+        }
+    }
+    printf("k=%d m=%d shard=%zu bytes kernel=%s\n", k, m, len, dfs_ec_kernel());
+
+    double start = now_seconds();
+    for (int r = 0; r < rounds; r++)
+    {
+        dfs_ec_encode(k, m, len, shards, shards + k);
+    }
+    double elapsed = now_seconds() - start;
+    printf("encode: %.2f GB/s of data\n", (double)k * len * rounds / elapsed / 1e9);
+
+    for (int i = 0; i < k + m; i++)
+    {
+        memcpy(original[i], shards[i], len);
+    }
+
+    // worst case: the first m data shards are gone
+    int present[DFS_EC_MAX_SHARDS];
+    for (int i = 0; i < k + m; i++)
+    {
+        present[i] = i >= (m < k ? m : k);
+    }
+    start = now_seconds();
+    for (int r = 0; r < rounds; r++)
+    {
+        if (dfs_ec_decode(k, m, len, shards, present) < 0)
+        {
+            fprintf(stderr, "decode failed\n");
+            return 1;
+        }
+    }
+    elapsed = now_seconds() - start;
+    printf("decode (%d lost): %.2f GB/s of data\n", m < k ? m : k, (double)k * len * rounds / elapsed / 1e9);
+
+    for (int i = 0; i < k; i++)
+    {
+        if (memcmp(original[i], shards[i], len) != 0)
+        {
+            fprintf(stderr, "shard %d rebuilt wrong\n", i);
+            return 1;
+        }
+    }
+    printf("rebuilt shards match\n");
+    return 0;
+}
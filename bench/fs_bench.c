@@ -0,0 +1,280 @@
+// fs_bench.c - Listing, sorting, path resolution, mkdir -p and tar throughput of dfs_fs.
+//
+// gcc -O2 -I. -o fs_bench bench/fs_bench.c dfs_*.c
+// ./fs_bench [dir] [max_files] [rounds]
+// Sorts 1k-1M synthetic names, lists real trees of 1k, 10k and 100k files (up to
+// max_files), and reports the median, min and max over rounds as one JSON object. Names
+// come from a fixed seed and the trees are kept in dir between runs, so numbers from two
+// builds compare directly. With DFS_META=1 the listings are answered from the index.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "dfs_fs.h"
+#include "dfs_meta.h"
+
+#define MKDIRS_DEPTH 32
+#define MKDIRS_PATHS 200
+#define TAR_FILES_MAX 10000
+
+static FILE *json; // the results; stdout is left to the messages of the dfs modules
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// prints "name":{"median":..,"min":..,"max":..} of the rounds
+static void print_stats(const char *name, double *samples, int rounds)
+{
+    qsort(samples, rounds, sizeof(double), compare_doubles);
+    fprintf(json, "\"%s\":{\"median\":%.3f,\"min\":%.3f,\"max\":%.3f}", name, samples[rounds / 2], samples[0],
+            samples[rounds - 1]);
+}
+
+static unsigned long long seed = 88172645463325252ULL;
+
+static unsigned long long next_random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+// n files of 200 bytes, 100 to a directory; kept for the next run
+static void build_tree(const char *root, int n)
+{
+    char path[DFS_FS_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.complete", root);
+    if (dfs_fs_exists(path))
+    {
+        return;
+    }
+    char data[200];
+    memset(data, 'x', sizeof(data));
+    for (int i = 0; i < n; i++)
+    {
+        snprintf(path, sizeof(path), "%s/d%04d", root, i / 100);
+        if (i % 100 == 0)
+        {
+            dfs_fs_mkdirs(path);
+        }
+        snprintf(path, sizeof(path), "%s/d%04d/File%07d_%llx.c", root, i / 100, i, next_random() % 4096);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, data, sizeof(data)) != (ssize_t)sizeof(data))
+        {
+            perror(path);
+            exit(1);
+        }
+        close(fd);
+    }
+    snprintf(path, sizeof(path), "%s/.complete", root);
+    close(open(path, O_WRONLY | O_CREAT, 0644));
+}
+
+static void bench_sort(int rounds)
+{
+    const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    int max = 1000000;
+    char *text = malloc((size_t)max * 16);
+    char **names = malloc(sizeof(char *) * max);
+    char **sorted = malloc(sizeof(char *) * max);
+    for (int i = 0; i < max; i++)
+    {
+        names[i] = text + (size_t)i * 16;
+        for (int c = 0; c < 12; c++)
+        {
+            names[i][c] = alphabet[next_random() % (sizeof(alphabet) - 1)];
+        }
+        strcpy(names[i] + 12, ".c");
+    }
+    double *samples = malloc(sizeof(double) * rounds);
+    fprintf(json, "\"sort_ms\":[");
+    for (int n = 1000; n <= max; n *= 10)
+    {
+        for (int r = 0; r < rounds; r++)
+        {
+            memcpy(sorted, names, sizeof(char *) * n);
+            double start = now_seconds();
+            dfs_fs_sort(sorted, n);
+            samples[r] = (now_seconds() - start) * 1e3;
+        }
+        fprintf(json, "%s{\"n\":%d,", n > 1000 ? "," : "", n);
+        print_stats("ms", samples, rounds);
+        fprintf(json, "}");
+    }
+    fprintf(json, "],\n");
+    free(samples);
+    free(sorted);
+    free(names);
+    free(text);
+}
+
+static void bench_list(const char *dir, int max_files, int rounds)
+{
+    double *samples = malloc(sizeof(double) * rounds);
+    fprintf(json, "\"list_ms\":[");
+    for (int n = 1000; n <= max_files && n <= 100000; n *= 10)
+    {
+        char root[DFS_FS_PATH_MAX];
+        snprintf(root, sizeof(root), "%s/tree_%d", dir, n);
+        build_tree(root, n);
+        dfs_meta_init(root);
+
+        // room for every name, so the whole listing is produced
+        size_t result_size = (size_t)n * 32;
+        char *result = malloc(result_size);
+        int listed = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            double start = now_seconds();
+            if (dfs_fs_list(root, ".c", result, result_size) == NULL)
+            {
+                fprintf(stderr, "listing %s failed\n", root);
+                exit(1);
+            }
+            samples[r] = (now_seconds() - start) * 1e3;
+        }
+        for (char *p = result; (p = strchr(p, '\n')) != NULL; p++)
+        {
+            listed++;
+        }
+        fprintf(json, "%s{\"n\":%d,\"listed\":%d,", n > 1000 ? "," : "", n, listed);
+        print_stats("ms", samples, rounds);
+        fprintf(json, "}");
+        free(result);
+    }
+    fprintf(json, "],\n");
+    free(samples);
+}
+
+static void bench_paths(const char *dir, int rounds)
+{
+    double *samples = malloc(sizeof(double) * rounds);
+    char resolved[DFS_FS_PATH_MAX];
+    int ops = 1000000;
+    for (int r = 0; r < rounds; r++)
+    {
+        double start = now_seconds();
+        for (int i = 0; i < ops; i++)
+        {
+            dfs_fs_resolve(resolved, "~S1/projects/2026/reports/summary.txt", "/home/user/S1");
+        }
+        samples[r] = (now_seconds() - start) * 1e9 / ops;
+    }
+    print_stats("resolve_ns", samples, rounds);
+    fprintf(json, ",\n");
+
+    ops = 100000;
+    for (int r = 0; r < rounds; r++)
+    {
+        double start = now_seconds();
+        for (int i = 0; i < ops; i++)
+        {
+            dfs_fs_exists(dir);
+        }
+        samples[r] = (now_seconds() - start) * 1e9 / ops;
+    }
+    print_stats("exists_ns", samples, rounds);
+    fprintf(json, ",\n");
+
+    // MKDIRS_PATHS new paths MKDIRS_DEPTH levels deep, then the same ones again
+    double *existing = malloc(sizeof(double) * rounds);
+    char path[DFS_FS_PATH_MAX];
+    char command[DFS_FS_PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf \"%s/mkdirs\"", dir);
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int pass = 0; pass < 2; pass++)
+        {
+            double start = now_seconds();
+            for (int i = 0; i < MKDIRS_PATHS; i++)
+            {
+                int len = snprintf(path, sizeof(path), "%s/mkdirs/p%d", dir, i);
+                for (int d = 0; d < MKDIRS_DEPTH; d++)
+                {
+                    len += snprintf(path + len, sizeof(path) - len, "/d%02d", d);
+                }
+                dfs_fs_mkdirs(path);
+            }
+            (pass == 0 ? samples : existing)[r] = (now_seconds() - start) * 1e6 / MKDIRS_PATHS;
+        }
+        if (!dfs_fs_exists(path) || system(command) != 0)
+        {
+            fprintf(stderr, "mkdirs did not create %s\n", path);
+            exit(1);
+        }
+    }
+    fprintf(json, "\"mkdirs_us\":{\"depth\":%d,", MKDIRS_DEPTH);
+    print_stats("fresh", samples, rounds);
+    fprintf(json, ",");
+    print_stats("existing", existing, rounds);
+    fprintf(json, "},\n");
+    free(existing);
+    free(samples);
+}
+
+static void bench_tar(const char *dir, int max_files, int rounds)
+{
+    int n = max_files < TAR_FILES_MAX ? max_files : TAR_FILES_MAX;
+    char root[DFS_FS_PATH_MAX], tar_path[DFS_FS_PATH_MAX];
+    snprintf(root, sizeof(root), "%s/tar_%d", dir, n);
+    snprintf(tar_path, sizeof(tar_path), "%s/fs_bench.tar", dir);
+    build_tree(root, n);
+    double *samples = malloc(sizeof(double) * rounds);
+    for (int r = 0; r < rounds; r++)
+    {
+        double start = now_seconds();
+        int files = dfs_fs_tar(root, ".c", tar_path);
+        double seconds = now_seconds() - start;
+        struct stat st;
+        if (files != n || stat(tar_path, &st) != 0)
+        {
+            fprintf(stderr, "tar of %s archived %d files\n", root, files);
+            exit(1);
+        }
+        samples[r] = st.st_size / 1e6 / seconds;
+        remove(tar_path);
+    }
+    fprintf(json, "\"tar\":{\"files\":%d,", n);
+    print_stats("mb_per_sec", samples, rounds);
+    fprintf(json, "}\n");
+    free(samples);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = argc > 1 ? argv[1] : "fs_bench.dir";
+    int max_files = argc > 2 ? atoi(argv[2]) : 100000;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    if (max_files < 1 || rounds < 1)
+    {
+        fprintf(stderr, "Usage: %s [dir] [max_files] [rounds]\n", argv[0]);
+        return 1;
+    }
+    dfs_fs_mkdirs(dir);
+    fflush(stdout);
+    json = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    fprintf(json, "{\"rounds\":%d,\n", rounds);
+    bench_sort(rounds);
+    bench_list(dir, max_files, rounds);
+    bench_paths(dir, rounds);
+    bench_tar(dir, max_files, rounds);
+    fprintf(json, "}\n");
+    return 0;
+}
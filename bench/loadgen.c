@@ -0,0 +1,1487 @@
+// loadgen.c - End-to-end throughput and latency of the whole cluster.
+//
+// gcc -O2 -o loadgen bench/loadgen.c
+// ./loadgen [-b bindir] [-c clients] [-d seconds] [-m mix] [-f files] [-D depth] [-s small_kb]
+//           [-z zip_kb] [-l label] [-x] [-k] [-B baseline.json] [-T percent] [-r recording] [-S speed]
+//           [-F server=rules] [-P command=ms] [-E commands] [-t seconds] [-V]
+//
+// Starts s1-s4 from bindir (default .) on loopback with a temporary HOME, uploads a
+// synthetic tree (files small .c/.txt/.pdf files of small_kb spread over directories up
+// to depth levels deep, and two zips of zip_kb), then runs clients client processes for
+// the given time. Each client keeps one connection to S1, like w25clients, and picks its commands
+// from the mix: weights for uploadf (small .c), downlf (the zips), dispfnames (the whole
+// tree) and downltar (.c, .pdf or .txt), default 40:30:20:10.
+//
+// Prints one JSON object: per command the requests served, errors, busy replies, ops/s,
+// MB/s and p50/p99/p99.9/max latency. With -B it compares the run against an earlier
+// run's JSON and exits with 2 if a command lost more than -T percent (default 10) of its
+// ops/s or its p99 grew by more. -x uses servers that are already running instead.
+//
+// With -r it replays a recording S1 made with DFS_RECORD (see dfs_record.h) instead of the
+// mix: every file the recording downloads is first uploaded with synthetic content of the
+// recorded size, then each recorded connection is replayed on a connection of its own,
+// its commands issued at their recorded times divided by -S (default 1, real time; 0
+// sends them back to back) and uploads carrying synthetic payloads of the recorded sizes.
+// A connection's commands run one after another, and at most -c (default 64 here)
+// connections are open at once. Commands that start more than 1 ms behind schedule are
+// counted as late. Run it on the builds to compare and diff the reports with -B.
+//
+// -F s3=<rules> restarts a server with DFS_FAULT=<rules> (see dfs_fault.h) once the files
+// are seeded, to see how S1 copes with a slow node or one that drops connections. -P
+// downltar=<ms> bounds a command's p99 and -E downltar,downlf lists the commands allowed to
+// fail (none: no command may). A run that breaks a bound, has a command fail that is not
+// listed, or has a command time out (-t, default 60 s, instead of being failed by S1)
+// exits with 2. A zip download whose bytes differ from the upload always does.
+//
+// -V only seeds the files, on one connection, and downloads the first 20 and the zips back:
+// it exits with 2 if an upload or download fails or returns other bytes. It is the quick
+// check to run after changing how S1 reads commands or delimits its replies.
+//
+// The servers must be built as for a normal run; ports 7777-7780 must be free.
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../dfs_record.h"
+
+#define S1_PORT 7777
+#define COMMAND_SIZE 1024 // S1 reads a command with one recv of this size
+#define BUCKETS 608       // 16 per power of two, as in dfs_metrics
+#define REPLY_MAX 131072
+
+enum
+{
+    OP_UPLOAD,
+    OP_DOWNLOAD,
+    OP_LIST,
+    OP_TAR,
+    MIX_OPS, // the ops the synthetic mix picks from; the rest only come from recordings
+    OP_REMOVE = MIX_OPS,
+    OP_STAT,
+    OP_OTHER,
+    OPS
+};
+
+static const char *op_names[OPS] = {"uploadf", "downlf", "dispfnames", "downltar", "removef", "statf", "other"};
+static const char *tar_types[] = {".c", ".pdf", ".txt"};
+
+struct op_stats
+{
+    unsigned long ops;
+    unsigned long errors;
+    unsigned long busy;
+    unsigned long timeouts;
+    unsigned long corrupt;
+    unsigned long bytes;
+    unsigned long max_us;
+    unsigned long late; // replay: started behind schedule
+    unsigned long hist[BUCKETS];
+};
+
+// a result of one command
+#define RESULT_ERROR -1
+#define RESULT_BUSY -2
+#define RESULT_TIMEOUT -3 // no reply within -t
+#define RESULT_CORRUPT -4 // downloaded bytes differ from the uploaded ones
+
+static const char *server_names[] = {"s2", "s3", "s4", "s1"};
+static const int server_ports[] = {7778, 7779, 7780, 7777};
+static pid_t server_pids[4];
+
+static int clients = 16;
+static int seconds = 30;
+static int weights[MIX_OPS] = {40, 30, 20, 10};
+static int files = 200;
+static int depth = 8;
+static int small_kb = 4;
+static int zip_kb = 8192;
+static const char *recording; // -r
+static double speed = 1;
+static int timeout_seconds = 60;
+static const char *server_faults[4]; // -F, DFS_FAULT of each server
+static long p99_bound_ms[OPS];       // -P, 0: none
+static int may_fail[OPS];            // -E
+static int errors_checked;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bucket_of(unsigned long us)
+{
+    if (us < 16)
+    {
+        return us;
+    }
+    int msb = 63 - __builtin_clzl(us);
+    int bucket = (msb - 3) * 16 + ((us >> (msb - 4)) & 15);
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+// the largest latency that falls in bucket
+static unsigned long bucket_top(int bucket)
+{
+    if (bucket < 16)
+    {
+        return bucket;
+    }
+    int shift = bucket / 16 - 1;
+    return ((16UL + bucket % 16 + 1) << shift) - 1;
+}
+
+static unsigned long percentile(const struct op_stats *s, double q)
+{
+    if (s->ops == 0)
+    {
+        return 0;
+    }
+    unsigned long rank = (unsigned long)(q * s->ops + 0.999999);
+    unsigned long seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += s->hist[i];
+        if (seen >= rank)
+        {
+            unsigned long top = bucket_top(i);
+            return top < s->max_us ? top : s->max_us;
+        }
+    }
+    return s->max_us;
+}
+
+static int connect_port(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval timeout = {timeout_seconds, 0}; // a wedged server shows up as timeouts, not a hang
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+static int send_all(int fd, const void *data, size_t size)
+{
+    const char *p = data;
+    while (size > 0)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *data, size_t size)
+{
+    char *p = data;
+    while (size > 0)
+    {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n <= 0)
+        {
+            errno = n == 0 ? 0 : errno;
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// The interactive client sleeps 100 ms after a command so its data is not read along
+// with it; a command padded to the size of S1's read needs no pause.
+static int send_command(int fd, const char *text)
+{
+    char command[COMMAND_SIZE];
+    memset(command, 0, sizeof(command));
+    snprintf(command, sizeof(command), "%s", text);
+    return send_all(fd, command, sizeof(command));
+}
+
+// a text reply is one send on the server, read it and whatever of it is already queued
+static ssize_t recv_text(int fd, char *out, size_t size)
+{
+    ssize_t used = recv(fd, out, size - 1, 0);
+    if (used <= 0)
+    {
+        errno = used == 0 ? 0 : errno;
+        return -1;
+    }
+    ssize_t n;
+    while ((size_t)used < size - 1 && (n = recv(fd, out + used, size - 1 - used, MSG_DONTWAIT)) > 0)
+    {
+        used += n;
+    }
+    out[used] = '\0';
+    return used;
+}
+
+// the result of a command whose send or recv just failed: the server closed the
+// connection or failed it (an error), or did not answer in time
+static long failure(void)
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK ? RESULT_TIMEOUT : RESULT_ERROR;
+}
+
+static long upload(int fd, const char *name, const char *dest, const char *data, int size)
+{
+    char command[COMMAND_SIZE];
+    snprintf(command, sizeof(command), "uploadf %s %s", name, dest);
+    if (send_command(fd, command) < 0 || send_all(fd, &size, sizeof(size)) < 0 || send_all(fd, data, size) < 0)
+    {
+        return failure();
+    }
+    char reply[256];
+    if (recv_text(fd, reply, sizeof(reply)) < 0)
+    {
+        return failure();
+    }
+    if (strncmp(reply, "BUSY", 4) == 0)
+    {
+        return RESULT_BUSY;
+    }
+    return strncmp(reply, "File uploaded", 13) == 0 ? size : RESULT_ERROR;
+}
+
+// downlf and downltar: a size, then that many bytes (-1 and a message when busy, 0 and for
+// downltar a message on failure). With expected set the bytes are compared with it, the
+// expected_size bytes uploaded.
+static long download(int fd, const char *command, char *scratch, size_t scratch_size, const char *expected,
+                     long expected_size)
+{
+    int size;
+    if (send_command(fd, command) < 0 || recv_all(fd, &size, sizeof(size)) < 0)
+    {
+        return failure();
+    }
+    if (size <= 0)
+    {
+        if (size < 0 || strncmp(command, "downltar", 8) == 0)
+        {
+            recv_text(fd, scratch, scratch_size);
+        }
+        return size < 0 ? RESULT_BUSY : RESULT_ERROR;
+    }
+    int corrupt = expected != NULL && size != expected_size;
+    for (long left = size; left > 0;)
+    {
+        ssize_t n = recv(fd, scratch, left < (long)scratch_size ? (size_t)left : scratch_size, 0);
+        if (n <= 0)
+        {
+            errno = n == 0 ? 0 : errno;
+            return failure();
+        }
+        if (expected != NULL && !corrupt && memcmp(scratch, expected + (size - left), n) != 0)
+        {
+            corrupt = 1;
+        }
+        left -= n;
+    }
+    return corrupt ? RESULT_CORRUPT : size;
+}
+
+static long list(int fd, const char *path, char *scratch, size_t scratch_size)
+{
+    char command[COMMAND_SIZE];
+    snprintf(command, sizeof(command), "dispfnames %s", path);
+    if (send_command(fd, command) < 0)
+    {
+        return failure();
+    }
+    ssize_t n = recv_text(fd, scratch, scratch_size);
+    if (n < 0)
+    {
+        return failure();
+    }
+    if (strncmp(scratch, "BUSY", 4) == 0)
+    {
+        return RESULT_BUSY;
+    }
+    return strncmp(scratch, "Files in directory", 18) == 0 ? n : RESULT_ERROR;
+}
+
+// the tree directory at level (0: the tree's root)
+static void tree_dir(char *out, size_t size, int level)
+{
+    int used = snprintf(out, size, "~S1/bench/tree");
+    for (int i = 0; i < level && used < (int)size; i++)
+    {
+        used += snprintf(out + used, size - used, "/d%d", i);
+    }
+}
+
+// uploads the tree and the zips the clients download
+static int seed(const char *small, const char *zip)
+{
+    int fd = connect_port(S1_PORT);
+    if (fd < 0)
+    {
+        perror("Connect to S1");
+        return -1;
+    }
+    char name[64], dir[512];
+    for (int i = 0; i < files; i++)
+    {
+        // mostly .c, with enough .txt and .pdf for the nodes' listings and tars
+        const char *ext = i % 10 < 7 ? ".c" : i % 10 < 9 ? ".txt" : ".pdf";
+        snprintf(name, sizeof(name), "f%d%s", i, ext);
+        tree_dir(dir, sizeof(dir), i % (depth + 1));
+        if (upload(fd, name, dir, small, small_kb * 1024) < 0)
+        {
+            fprintf(stderr, "Seeding %s/%s failed\n", dir, name);
+            close(fd);
+            return -1;
+        }
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        snprintf(name, sizeof(name), "z%d.zip", i);
+        if (upload(fd, name, "~S1/bench/zip", zip, zip_kb * 1024) < 0)
+        {
+            fprintf(stderr, "Seeding ~S1/bench/zip/%s failed\n", name);
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+// downloads command over fd and compares it with the size bytes of expected; 0 if they match
+static int verify_download(int fd, const char *command, const char *expected, long size)
+{
+    char scratch[65536];
+    long result = download(fd, command, scratch, sizeof(scratch), expected, size);
+    if (result == size)
+    {
+        return 0;
+    }
+    fprintf(stderr, "Verify: %s %s\n", command, result == RESULT_CORRUPT ? "returned other bytes" : "failed");
+    return -1;
+}
+
+// -V: downloads the first seeded files and the zips and compares them with what seed() sent
+static int verify_seed(const char *small, const char *zip)
+{
+    int fd = connect_port(S1_PORT);
+    if (fd < 0)
+    {
+        perror("Connect to S1");
+        return -1;
+    }
+    char dir[512], command[COMMAND_SIZE];
+    int failed = 0;
+    for (int i = 0; i < files && i < 20; i++)
+    {
+        const char *ext = i % 10 < 7 ? ".c" : i % 10 < 9 ? ".txt" : ".pdf";
+        tree_dir(dir, sizeof(dir), i % (depth + 1));
+        snprintf(command, sizeof(command), "downlf %s/f%d%s", dir, i, ext);
+        failed |= verify_download(fd, command, small, small_kb * 1024L) < 0;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        snprintf(command, sizeof(command), "downlf ~S1/bench/zip/z%d.zip", i);
+        failed |= verify_download(fd, command, zip, zip_kb * 1024L) < 0;
+    }
+    close(fd);
+    return failed ? -1 : 0;
+}
+
+static int pick_op(unsigned int *rng)
+{
+    int total = 0;
+    for (int i = 0; i < MIX_OPS; i++)
+    {
+        total += weights[i];
+    }
+    int r = rand_r(rng) % total;
+    for (int i = 0; i < MIX_OPS; i++)
+    {
+        if (r < weights[i])
+        {
+            return i;
+        }
+        r -= weights[i];
+    }
+    return OP_UPLOAD;
+}
+
+// adds the result of a command sent at started to s; -1 if it failed
+static int account(struct op_stats *s, long result, double started)
+{
+    unsigned long us = (unsigned long)((now_seconds() - started) * 1e6);
+    if (result >= 0)
+    {
+        s->ops++;
+        s->bytes += result;
+        s->hist[bucket_of(us)]++;
+        if (us > s->max_us)
+        {
+            s->max_us = us;
+        }
+        return 0;
+    }
+    if (result == RESULT_BUSY)
+    {
+        s->busy++;
+    }
+    else if (result == RESULT_TIMEOUT)
+    {
+        s->timeouts++;
+    }
+    else if (result == RESULT_CORRUPT)
+    {
+        s->corrupt++;
+    }
+    else
+    {
+        s->errors++;
+    }
+    return -1;
+}
+
+// one simulated client: commands back to back until the deadline
+static void client(int id, struct op_stats *stats, double deadline, const char *small, const char *zip)
+{
+    static char scratch[REPLY_MAX];
+    unsigned int rng = getpid() ^ (id * 2654435761U);
+    int fd = -1;
+    long uploads = 0;
+    while (now_seconds() < deadline)
+    {
+        if (fd < 0 && (fd = connect_port(S1_PORT)) < 0)
+        {
+            usleep(10000);
+            continue;
+        }
+        int op = pick_op(&rng);
+        char text[COMMAND_SIZE];
+        double started = now_seconds();
+        long result;
+        switch (op)
+        {
+        case OP_UPLOAD:
+            snprintf(text, sizeof(text), "u%d_%ld.c", id, uploads++);
+            result = upload(fd, text, "~S1/bench/up", small, small_kb * 1024);
+            break;
+        case OP_DOWNLOAD:
+            snprintf(text, sizeof(text), "downlf ~S1/bench/zip/z%d.zip", rand_r(&rng) % 2);
+            result = download(fd, text, scratch, sizeof(scratch), zip, zip_kb * 1024L);
+            break;
+        case OP_LIST:
+            result = list(fd, "~S1/bench/tree", scratch, sizeof(scratch));
+            break;
+        default:
+            snprintf(text, sizeof(text), "downltar %s", tar_types[rand_r(&rng) % 3]);
+            result = download(fd, text, scratch, sizeof(scratch), NULL, 0);
+            break;
+        }
+        if (account(&stats[op], result, started) < 0)
+        {
+            // the reply may be out of step with the next command, start over on a new connection
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+// one command of a recording
+struct replay_command
+{
+    struct dfs_record record;
+    char *text;
+    int worker; // the process replaying its connection
+    int last;   // the connection's last command
+};
+
+static struct replay_command *replay;
+static long replay_count;
+
+static int compare_start(const void *a, const void *b)
+{
+    long x = ((const struct replay_command *)a)->record.start_us;
+    long y = ((const struct replay_command *)b)->record.start_us;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_text(const void *a, const void *b)
+{
+    return strcmp((*(struct replay_command *const *)a)->text, (*(struct replay_command *const *)b)->text);
+}
+
+static int load_recording(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    char magic[sizeof(DFS_RECORD_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, DFS_RECORD_MAGIC, sizeof(magic)) != 0)
+    {
+        fprintf(stderr, "%s is not a DFS_RECORD recording\n", path);
+        fclose(fp);
+        return -1;
+    }
+    long max = 0;
+    struct dfs_record record;
+    while (fread(&record, sizeof(record), 1, fp) == 1)
+    {
+        // a record cut short by a crash ends the recording
+        char *text = malloc(record.command_len + 1);
+        if (text == NULL || fread(text, 1, record.command_len, fp) != record.command_len)
+        {
+            free(text);
+            break;
+        }
+        text[record.command_len] = '\0';
+        if (replay_count == max)
+        {
+            max = max > 0 ? max * 2 : 1024;
+            replay = realloc(replay, sizeof(struct replay_command) * max);
+        }
+        struct replay_command *c = &replay[replay_count++];
+        c->record = record;
+        c->text = text;
+        c->worker = 0;
+        c->last = 0;
+    }
+    fclose(fp);
+    if (replay_count == 0)
+    {
+        fprintf(stderr, "%s holds no commands\n", path);
+        return -1;
+    }
+    // handlers append concurrently, so records are only roughly in order
+    qsort(replay, replay_count, sizeof(struct replay_command), compare_start);
+    return 0;
+}
+
+// Gives each recorded connection to one replaying process for its whole life. A process is
+// reused once its previous connection has ended; past clients processes, connections
+// share the one that frees up first. Returns the number of processes.
+static int assign_workers(void)
+{
+    struct session
+    {
+        unsigned int id;
+        int worker;
+        long end_us;
+        long last;
+    } *sessions = malloc(sizeof(struct session) * replay_count);
+    long table_size = 1;
+    while (table_size < replay_count * 2)
+    {
+        table_size *= 2;
+    }
+    long *table = malloc(sizeof(long) * table_size);
+    memset(table, -1, sizeof(long) * table_size);
+    long session_count = 0;
+    for (long i = 0; i < replay_count; i++)
+    {
+        struct dfs_record *r = &replay[i].record;
+        long slot = (r->session * 2654435761U) & (table_size - 1);
+        while (table[slot] >= 0 && sessions[table[slot]].id != r->session)
+        {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] < 0)
+        {
+            table[slot] = session_count;
+            sessions[session_count] = (struct session){r->session, -1, 0, 0};
+            session_count++;
+        }
+        struct session *s = &sessions[table[slot]];
+        if (r->start_us + (long)r->latency_us > s->end_us)
+        {
+            s->end_us = r->start_us + r->latency_us;
+        }
+        s->last = i;
+        replay[i].worker = table[slot]; // the session until workers are assigned
+    }
+
+    long *free_at = calloc(clients, sizeof(long));
+    int workers = 0;
+    for (long i = 0; i < replay_count; i++)
+    {
+        struct session *s = &sessions[replay[i].worker];
+        if (s->worker < 0)
+        {
+            // the process that frees up first, or a new one if that one is still busy
+            int pick = -1;
+            for (int w = 0; w < workers; w++)
+            {
+                if (pick < 0 || free_at[w] < free_at[pick])
+                {
+                    pick = w;
+                }
+            }
+            if ((pick < 0 || free_at[pick] > replay[i].record.start_us) && workers < clients)
+            {
+                pick = workers++;
+            }
+            s->worker = pick;
+            free_at[pick] = s->end_us > free_at[pick] ? s->end_us : free_at[pick];
+        }
+        replay[i].last = s->last == i;
+        replay[i].worker = s->worker;
+    }
+    free(free_at);
+    free(table);
+    free(sessions);
+    return workers;
+}
+
+// uploads a file of the recorded size for every file the recording downloads
+static int seed_recording(const char *payload)
+{
+    struct replay_command **downloads = malloc(sizeof(struct replay_command *) * replay_count);
+    long count = 0;
+    for (long i = 0; i < replay_count; i++)
+    {
+        if (replay[i].record.size > 0 && strncmp(replay[i].text, "downlf ", 7) == 0)
+        {
+            downloads[count++] = &replay[i];
+        }
+    }
+    qsort(downloads, count, sizeof(struct replay_command *), compare_text);
+    int fd = connect_port(S1_PORT);
+    if (fd < 0)
+    {
+        perror("Connect to S1");
+        free(downloads);
+        return -1;
+    }
+    int status = 0;
+    for (long i = 0; i < count && status == 0; i++)
+    {
+        char path[COMMAND_SIZE];
+        if ((i > 0 && strcmp(downloads[i]->text, downloads[i - 1]->text) == 0) ||
+            sscanf(downloads[i]->text, "%*s %1023s", path) != 1)
+        {
+            continue;
+        }
+        char *slash = strrchr(path, '/');
+        if (slash == NULL)
+        {
+            continue;
+        }
+        *slash = '\0';
+        if (upload(fd, slash + 1, path, payload, downloads[i]->record.size) < 0)
+        {
+            fprintf(stderr, "Seeding %s/%s failed\n", path, slash + 1);
+            status = -1;
+        }
+    }
+    close(fd);
+    free(downloads);
+    return status;
+}
+
+static int replay_op(const char *text)
+{
+    char command[20] = "";
+    sscanf(text, "%19s", command);
+    for (int i = 0; i < OP_OTHER; i++)
+    {
+        if (strcmp(command, op_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return OP_OTHER;
+}
+
+static long replay_one(int fd, const struct replay_command *c, int op, const char *payload, char *scratch,
+                       size_t scratch_size)
+{
+    if (op == OP_UPLOAD)
+    {
+        char name[COMMAND_SIZE / 2], dest[COMMAND_SIZE / 2];
+        if (c->record.size < 0 || sscanf(c->text, "%*s %511s %511s", name, dest) != 2)
+        {
+            return RESULT_ERROR;
+        }
+        return upload(fd, name, dest, payload, c->record.size);
+    }
+    // size-prefixed replies
+    if (op == OP_DOWNLOAD || op == OP_TAR || strncmp(c->text, "stats", 5) == 0)
+    {
+        return download(fd, c->text, scratch, scratch_size, NULL, 0);
+    }
+    if (send_command(fd, c->text) < 0)
+    {
+        return failure();
+    }
+    ssize_t n = recv_text(fd, scratch, scratch_size);
+    if (n < 0)
+    {
+        return failure();
+    }
+    return strncmp(scratch, "BUSY", 4) == 0 ? RESULT_BUSY : n;
+}
+
+#define REPLAY_OPEN_MAX 256
+
+// replays the connections given to worker, each command at its recorded time over speed
+static void replay_worker(int worker, struct op_stats *stats, double started, const char *payload)
+{
+    static char scratch[REPLY_MAX];
+    struct
+    {
+        unsigned int session;
+        int fd;
+    } open_fds[REPLAY_OPEN_MAX];
+    int open_count = 0;
+    long first_us = replay[0].record.start_us;
+    for (long i = 0; i < replay_count; i++)
+    {
+        struct replay_command *c = &replay[i];
+        if (c->worker != worker)
+        {
+            continue;
+        }
+        int slot = 0;
+        while (slot < open_count && open_fds[slot].session != c->record.session)
+        {
+            slot++;
+        }
+        if (slot == open_count)
+        {
+            if (open_count == REPLAY_OPEN_MAX)
+            {
+                close(open_fds[--open_count].fd);
+                slot = open_count;
+            }
+            open_fds[slot].session = c->record.session;
+            open_fds[slot].fd = -1;
+            open_count++;
+        }
+
+        int op = replay_op(c->text);
+        if (speed > 0)
+        {
+            double due = started + (c->record.start_us - first_us) / 1e6 / speed;
+            double behind = now_seconds() - due;
+            if (behind < 0)
+            {
+                usleep((useconds_t)(-behind * 1e6));
+            }
+            else if (behind > 0.001)
+            {
+                stats[op].late++;
+            }
+        }
+        if (open_fds[slot].fd < 0)
+        {
+            open_fds[slot].fd = connect_port(S1_PORT);
+        }
+        double sent = now_seconds();
+        long result = open_fds[slot].fd >= 0 ? replay_one(open_fds[slot].fd, c, op, payload, scratch, sizeof(scratch))
+                                             : RESULT_ERROR;
+        // a failed command leaves the connection out of step, the next one gets a new one
+        if (account(&stats[op], result, sent) < 0 || c->last)
+        {
+            if (open_fds[slot].fd >= 0)
+            {
+                close(open_fds[slot].fd);
+            }
+            open_fds[slot].fd = -1;
+            if (c->last)
+            {
+                open_fds[slot] = open_fds[--open_count];
+            }
+        }
+    }
+    for (int i = 0; i < open_count; i++)
+    {
+        if (open_fds[i].fd >= 0)
+        {
+            close(open_fds[i].fd);
+        }
+    }
+}
+
+static int port_open(int port)
+{
+    int fd = connect_port(port);
+    if (fd >= 0)
+    {
+        close(fd);
+        return 1;
+    }
+    return 0;
+}
+
+static void stop_servers(void)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (server_pids[i] > 0)
+        {
+            kill(-server_pids[i], SIGTERM); // with its handlers and helpers
+            waitpid(server_pids[i], NULL, 0);
+            server_pids[i] = 0;
+        }
+    }
+}
+
+static void on_interrupt(int sig)
+{
+    (void)sig;
+    for (int i = 0; i < 4; i++)
+    {
+        if (server_pids[i] > 0)
+        {
+            kill(-server_pids[i], SIGTERM);
+        }
+    }
+    _exit(130);
+}
+
+// starts server i in its own process group with home as HOME and cwd, and fault as its
+// DFS_FAULT; its log is appended to, so a restart keeps the earlier lines
+static int start_server(int i, const char *bindir, const char *home, const char *fault)
+{
+    char path[1024], log[1024];
+    snprintf(path, sizeof(path), "%s/%s", bindir, server_names[i]);
+    snprintf(log, sizeof(log), "%s/%s.log", home, server_names[i]);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        setenv("HOME", home, 1);
+        if (fault != NULL)
+        {
+            setenv("DFS_FAULT", fault, 1);
+        }
+        if (chdir(home) != 0)
+        {
+            _exit(127);
+        }
+        int out = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (out >= 0)
+        {
+            dup2(out, STDOUT_FILENO);
+            dup2(out, STDERR_FILENO);
+            close(out);
+        }
+        execl(path, server_names[i], (char *)NULL);
+        perror(path);
+        _exit(127);
+    }
+    if (pid < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+    setpgid(pid, pid);
+    server_pids[i] = pid;
+
+    double give_up = now_seconds() + 10;
+    while (!port_open(server_ports[i]))
+    {
+        if (now_seconds() > give_up || waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            server_pids[i] = 0;
+            fprintf(stderr, "%s did not start, see %s\n", path, log);
+            return -1;
+        }
+        usleep(20000);
+    }
+    return 0;
+}
+
+// starts the nodes, then S1
+static int start_servers(const char *bindir, const char *home)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (port_open(server_ports[i]))
+        {
+            fprintf(stderr, "Port %d is in use: stop the running servers or pass -x\n", server_ports[i]);
+            return -1;
+        }
+    }
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
+    for (int i = 0; i < 4; i++)
+    {
+        if (start_server(i, bindir, home, NULL) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// restarts the servers given faults with -F, once seeding no longer needs them healthy
+static int start_faults(const char *bindir, const char *home)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (server_faults[i] == NULL)
+        {
+            continue;
+        }
+        kill(-server_pids[i], SIGTERM);
+        waitpid(server_pids[i], NULL, 0);
+        server_pids[i] = 0;
+        while (port_open(server_ports[i]))
+        {
+            usleep(20000);
+        }
+        fprintf(stderr, "Restarting %s with DFS_FAULT=%s\n", server_names[i], server_faults[i]);
+        if (start_server(i, bindir, home, server_faults[i]) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void print_json(FILE *out, const char *label, double elapsed, struct op_stats *totals)
+{
+    fprintf(out, "{\n  \"label\": \"%s\",\n  \"clients\": %d,\n  \"seconds\": %.3f,\n", label, clients, elapsed);
+    if (recording != NULL)
+    {
+        fprintf(out, "  \"recording\": \"%s\",\n  \"speed\": %g,\n", recording, speed);
+    }
+    fprintf(out, "  \"commands\": {\n");
+    unsigned long ops = 0, errors = 0, busy = 0, timeouts = 0, corrupt = 0, bytes = 0, late = 0;
+    int shown = 0;
+    for (int i = 0; i < OPS; i++)
+    {
+        struct op_stats *s = &totals[i];
+        if (i >= MIX_OPS && s->ops + s->errors + s->busy + s->timeouts == 0)
+        {
+            continue; // only recordings have these
+        }
+        fprintf(out,
+                "%s    \"%s\": {\"ops\": %lu, \"errors\": %lu, \"busy\": %lu, \"timeouts\": %lu, \"corrupt\": %lu, "
+                "\"ops_per_sec\": %.2f, \"mb_per_sec\": %.3f, \"p50_us\": %lu, \"p99_us\": %lu, \"p999_us\": %lu, "
+                "\"max_us\": %lu}",
+                shown++ > 0 ? ",\n" : "", op_names[i], s->ops, s->errors, s->busy, s->timeouts, s->corrupt,
+                s->ops / elapsed, s->bytes / elapsed / 1e6, percentile(s, 0.5), percentile(s, 0.99),
+                percentile(s, 0.999), s->max_us);
+        ops += s->ops;
+        errors += s->errors;
+        busy += s->busy;
+        timeouts += s->timeouts;
+        corrupt += s->corrupt;
+        bytes += s->bytes;
+        late += s->late;
+    }
+    fprintf(out, "\n  },\n");
+    fprintf(out,
+            "  \"total\": {\"ops\": %lu, \"errors\": %lu, \"busy\": %lu, \"timeouts\": %lu, \"corrupt\": %lu, "
+            "\"late\": %lu, \"ops_per_sec\": %.2f, \"mb_per_sec\": %.3f}\n}\n",
+            ops, errors, busy, timeouts, corrupt, late, ops / elapsed, bytes / elapsed / 1e6);
+}
+
+// a number from a command's entry in a JSON report this program wrote, -1 if missing
+static double json_field(const char *json, const char *command, const char *field)
+{
+    char key[64];
+    snprintf(key, sizeof(key), "\"%s\": {", command);
+    const char *entry = strstr(json, key);
+    if (entry == NULL)
+    {
+        return -1;
+    }
+    const char *end = strchr(entry, '}');
+    snprintf(key, sizeof(key), "\"%s\": ", field);
+    const char *at = strstr(entry, key);
+    if (at == NULL || at > end)
+    {
+        return -1;
+    }
+    return atof(at + strlen(key));
+}
+
+// 1 if some command regressed by more than percent against the baseline report
+static int compare(const char *baseline_path, const char *json, int percent)
+{
+    FILE *fp = fopen(baseline_path, "r");
+    if (fp == NULL)
+    {
+        perror(baseline_path);
+        return 1;
+    }
+    static char baseline[65536];
+    size_t n = fread(baseline, 1, sizeof(baseline) - 1, fp);
+    baseline[n] = '\0';
+    fclose(fp);
+
+    int regressed = 0;
+    double slack = percent / 100.0;
+    for (int i = 0; i < OPS; i++)
+    {
+        double old_rate = json_field(baseline, op_names[i], "ops_per_sec");
+        double new_rate = json_field(json, op_names[i], "ops_per_sec");
+        double old_p99 = json_field(baseline, op_names[i], "p99_us");
+        double new_p99 = json_field(json, op_names[i], "p99_us");
+        if (json_field(baseline, op_names[i], "ops") <= 0 || json_field(json, op_names[i], "ops") <= 0)
+        {
+            continue; // not run in one of the two
+        }
+        if (new_rate < old_rate * (1 - slack))
+        {
+            fprintf(stderr, "%s: %.2f ops/s, was %.2f (%+.0f%%)\n", op_names[i], new_rate, old_rate,
+                    (new_rate / old_rate - 1) * 100);
+            regressed = 1;
+        }
+        if (old_p99 > 0 && new_p99 > old_p99 * (1 + slack))
+        {
+            fprintf(stderr, "%s: p99 %.0f us, was %.0f us (%+.0f%%)\n", op_names[i], new_p99, old_p99,
+                    (new_p99 / old_p99 - 1) * 100);
+            regressed = 1;
+        }
+    }
+    return regressed;
+}
+
+static int parse_mix(const char *mix)
+{
+    int parsed[MIX_OPS];
+    if (sscanf(mix, "%d:%d:%d:%d", &parsed[0], &parsed[1], &parsed[2], &parsed[3]) != MIX_OPS)
+    {
+        return -1;
+    }
+    int total = 0;
+    for (int i = 0; i < MIX_OPS; i++)
+    {
+        if (parsed[i] < 0)
+        {
+            return -1;
+        }
+        total += parsed[i];
+    }
+    if (total == 0)
+    {
+        return -1;
+    }
+    memcpy(weights, parsed, sizeof(weights));
+    return 0;
+}
+
+// 1 if the run broke a -P bound or an -E expectation, or downloaded wrong bytes
+static int check(struct op_stats *totals)
+{
+    int failed = 0;
+    for (int i = 0; i < OPS; i++)
+    {
+        struct op_stats *s = &totals[i];
+        unsigned long p99 = percentile(s, 0.99);
+        if (p99_bound_ms[i] > 0 && (s->ops == 0 || p99 > p99_bound_ms[i] * 1000UL))
+        {
+            fprintf(stderr, "%s: p99 %lu us, bound %ld ms (%lu served)\n", op_names[i], p99, p99_bound_ms[i], s->ops);
+            failed = 1;
+        }
+        if (s->corrupt > 0)
+        {
+            fprintf(stderr, "%s: %lu downloads differ from the uploaded file\n", op_names[i], s->corrupt);
+            failed = 1;
+        }
+        if (errors_checked && s->timeouts > 0)
+        {
+            fprintf(stderr, "%s: %lu commands got no reply within %d s\n", op_names[i], s->timeouts, timeout_seconds);
+            failed = 1;
+        }
+        if (errors_checked && !may_fail[i] && s->errors > 0)
+        {
+            fprintf(stderr, "%s: %lu commands failed\n", op_names[i], s->errors);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+// the op of a command name given to -P or -E, -1 if unknown
+static int op_named(const char *name, size_t len)
+{
+    for (int i = 0; i < OPS; i++)
+    {
+        if (strlen(op_names[i]) == len && strncmp(op_names[i], name, len) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// -F s3=rules
+static int parse_fault(const char *arg)
+{
+    const char *rules = strchr(arg, '=');
+    for (int i = 0; rules != NULL && i < 4; i++)
+    {
+        if ((size_t)(rules - arg) == strlen(server_names[i]) && strncmp(arg, server_names[i], rules - arg) == 0)
+        {
+            server_faults[i] = rules + 1;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// -P downltar=500
+static int parse_bound(const char *arg)
+{
+    const char *ms = strchr(arg, '=');
+    int op = ms != NULL ? op_named(arg, ms - arg) : -1;
+    if (op < 0 || atol(ms + 1) <= 0)
+    {
+        return -1;
+    }
+    p99_bound_ms[op] = atol(ms + 1);
+    return 0;
+}
+
+// -E downltar,downlf or -E none
+static int parse_may_fail(const char *arg)
+{
+    errors_checked = 1;
+    if (strcmp(arg, "none") == 0)
+    {
+        return 0;
+    }
+    for (const char *name = arg; *name != '\0';)
+    {
+        size_t len = strcspn(name, ",");
+        int op = op_named(name, len);
+        if (op < 0)
+        {
+            return -1;
+        }
+        may_fail[op] = 1;
+        name += len + (name[len] == ',');
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *bindir = ".";
+    const char *label = "";
+    const char *baseline = NULL;
+    int percent = 10;
+    int external = 0, keep = 0, clients_set = 0, verify = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:c:d:m:f:D:s:z:l:xkB:T:r:S:F:P:E:t:V")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            bindir = optarg;
+            break;
+        case 'c':
+            clients = atoi(optarg);
+            clients_set = 1;
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 'm':
+            if (parse_mix(optarg) < 0)
+            {
+                fprintf(stderr, "Mix is uploadf:downlf:dispfnames:downltar weights, e.g. 40:30:20:10\n");
+                return 1;
+            }
+            break;
+        case 'f':
+            files = atoi(optarg);
+            break;
+        case 'D':
+            depth = atoi(optarg);
+            break;
+        case 's':
+            small_kb = atoi(optarg);
+            break;
+        case 'z':
+            zip_kb = atoi(optarg);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 'x':
+            external = 1;
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        case 'B':
+            baseline = optarg;
+            break;
+        case 'T':
+            percent = atoi(optarg);
+            break;
+        case 'r':
+            recording = optarg;
+            break;
+        case 'S':
+            speed = atof(optarg);
+            break;
+        case 'F':
+            if (parse_fault(optarg) < 0)
+            {
+                fprintf(stderr, "-F takes a server and its DFS_FAULT rules, e.g. s3=delay=exp:20\n");
+                return 1;
+            }
+            break;
+        case 'P':
+            if (parse_bound(optarg) < 0)
+            {
+                fprintf(stderr, "-P takes a command and its p99 bound in ms, e.g. downlf=500\n");
+                return 1;
+            }
+            break;
+        case 'E':
+            if (parse_may_fail(optarg) < 0)
+            {
+                fprintf(stderr, "-E takes the commands allowed to fail, e.g. downltar,downlf, or none\n");
+                return 1;
+            }
+            break;
+        case 't':
+            timeout_seconds = atoi(optarg);
+            break;
+        case 'V':
+            verify = 1;
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-b bindir] [-c clients] [-d seconds] [-m mix] [-f files] [-D depth] [-s small_kb]\n"
+                    "       [-z zip_kb] [-l label] [-x] [-k] [-B baseline.json] [-T percent] [-r recording]\n"
+                    "       [-S speed] [-F server=rules] [-P command=ms] [-E commands] [-t seconds] [-V]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (clients < 1 || seconds < 1 || files < 1 || depth < 0 || small_kb < 1 || zip_kb < 1 || speed < 0 ||
+        timeout_seconds < 1)
+    {
+        fprintf(stderr, "Clients, seconds, files, sizes and the timeout must be positive\n");
+        return 1;
+    }
+    for (int i = 0; i < 4 && external; i++)
+    {
+        if (server_faults[i] != NULL)
+        {
+            fprintf(stderr, "-F restarts the servers, it cannot be used with -x\n");
+            return 1;
+        }
+    }
+    if (verify && recording != NULL)
+    {
+        fprintf(stderr, "-V checks the synthetic tree, it cannot be used with -r\n");
+        return 1;
+    }
+    if (recording != NULL)
+    {
+        if (load_recording(recording) < 0)
+        {
+            return 1;
+        }
+        clients = clients_set ? clients : 64;
+    }
+
+    char home[] = "/tmp/dfs_loadgen.XXXXXX";
+    if (!external)
+    {
+        if (mkdtemp(home) == NULL)
+        {
+            perror("mkdtemp");
+            return 1;
+        }
+        if (start_servers(bindir, home) < 0)
+        {
+            stop_servers();
+            return 1;
+        }
+    }
+
+    char *small = malloc(small_kb * 1024);
+    char *zip = malloc((size_t)zip_kb * 1024);
+    for (long i = 0; i < small_kb * 1024; i++)
+    {
+        small[i] = 'a' + i % 26;
+    }
+    for (long i = 0; i < (long)zip_kb * 1024; i++)
+    {
+        zip[i] = (char)(i * 2654435761U >> 24);
+    }
+
+    // a replay's uploads and seeded downloads all send prefixes of one synthetic payload
+    char *payload = NULL;
+    int seeded;
+    if (recording != NULL)
+    {
+        long payload_size = 1;
+        for (long i = 0; i < replay_count; i++)
+        {
+            payload_size = replay[i].record.size > payload_size ? replay[i].record.size : payload_size;
+        }
+        payload = malloc(payload_size);
+        for (long i = 0; i < payload_size; i++)
+        {
+            payload[i] = (char)(i * 2654435761U >> 24);
+        }
+        fprintf(stderr, "Seeding the files downloaded by %ld recorded commands\n", replay_count);
+        seeded = seed_recording(payload) == 0;
+        clients = assign_workers();
+    }
+    else
+    {
+        fprintf(stderr, "Seeding %d files up to %d levels deep and 2 zips of %d KB\n", files, depth, zip_kb);
+        seeded = seed(small, zip) == 0;
+    }
+    if (seeded && !external && start_faults(bindir, home) < 0)
+    {
+        seeded = 0;
+    }
+    int status = 1;
+    if (verify)
+    {
+        status = seeded && verify_seed(small, zip) == 0 ? 0 : 2;
+        fprintf(stderr, "Verify: %s\n", status == 0 ? "uploads and downloads match" : "FAILED");
+    }
+    else if (seeded)
+    {
+        struct op_stats *stats = mmap(NULL, sizeof(struct op_stats) * OPS * clients, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (recording != NULL)
+        {
+            fprintf(stderr, "Replaying %s at %gx in %d processes\n", recording, speed > 0 ? speed : INFINITY, clients);
+        }
+        else
+        {
+            fprintf(stderr, "Running %d clients for %d s\n", clients, seconds);
+        }
+        double started = now_seconds();
+        double deadline = started + seconds;
+        fflush(stdout);
+        for (int i = 0; i < clients; i++)
+        {
+            if (fork() == 0)
+            {
+                signal(SIGINT, SIG_DFL);
+                signal(SIGTERM, SIG_DFL);
+                if (recording != NULL)
+                {
+                    replay_worker(i, stats + (size_t)i * OPS, started, payload);
+                }
+                else
+                {
+                    client(i, stats + (size_t)i * OPS, deadline, small, zip);
+                }
+                _exit(0);
+            }
+        }
+        for (int i = 0; i < clients; i++)
+        {
+            wait(NULL);
+        }
+        double elapsed = now_seconds() - started;
+
+        struct op_stats totals[OPS];
+        memset(totals, 0, sizeof(totals));
+        for (int c = 0; c < clients; c++)
+        {
+            for (int i = 0; i < OPS; i++)
+            {
+                struct op_stats *s = &stats[c * OPS + i];
+                totals[i].ops += s->ops;
+                totals[i].errors += s->errors;
+                totals[i].busy += s->busy;
+                totals[i].timeouts += s->timeouts;
+                totals[i].corrupt += s->corrupt;
+                totals[i].bytes += s->bytes;
+                totals[i].late += s->late;
+                totals[i].max_us = s->max_us > totals[i].max_us ? s->max_us : totals[i].max_us;
+                for (int b = 0; b < BUCKETS; b++)
+                {
+                    totals[i].hist[b] += s->hist[b];
+                }
+            }
+        }
+
+        char *json = NULL;
+        size_t json_size = 0;
+        FILE *mem = open_memstream(&json, &json_size);
+        print_json(mem, label, elapsed, totals);
+        fclose(mem);
+        fputs(json, stdout);
+        fflush(stdout);
+        status = baseline != NULL && compare(baseline, json, percent) ? 2 : 0;
+        status = check(totals) ? 2 : status;
+        free(json);
+    }
+
+    if (!external)
+    {
+        stop_servers();
+        if (keep)
+        {
+            fprintf(stderr, "Server roots and logs kept in %s\n", home);
+        }
+        else
+        {
+            char command[1100];
+            snprintf(command, sizeof(command), "rm -rf '%s'", home);
+            if (system(command) != 0)
+            {
+                fprintf(stderr, "Could not remove %s\n", home);
+            }
+        }
+    }
+    free(small);
+    free(zip);
+    free(payload);
+    return status;
+}
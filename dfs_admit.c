@@ -0,0 +1,386 @@
+// dfs_admit.c - Bounded, fair accept loop for S1 and the storage nodes.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include "dfs_admit.h"
+#include "dfs_cluster.h"
+#include "dfs_backend.h"
+#include "dfs_trace.h"
+#include "dfs_log.h"
+#include "dfs_net.h"
+
+#define REJECT_MAX 64            // turned-away connections being answered at once
+#define REJECT_LINGER_US 2000000 // time one gets to send its command, and to stop sending
+#define REJECT_DRAIN_BYTES (1 << 20)
+
+struct handler
+{
+    pid_t pid; // 0 if the slot is free
+    in_addr_t client;
+};
+
+struct waiting
+{
+    int fd;
+    in_addr_t client;
+    long since_us;
+    long drained; // turned away: -1 until the busy reply is sent, then bytes discarded
+};
+
+static struct dfs_admit_stats *stats;
+static const char *server_name;
+static void (*serve_connection)(int client_socket);
+static struct handler *handlers;
+static int max_handlers, max_per_client;
+static struct waiting *queue; // oldest first
+static int queue_max;
+static struct waiting rejects[REJECT_MAX];
+static int reject_count;
+static int listen_fd;
+static sigset_t handler_mask; // the signal mask forked handlers start with
+static long last_busy_log_us;
+
+static void on_child(int sig)
+{
+    (void)sig; // only interrupts ppoll, the loop reaps
+}
+
+const struct dfs_admit_stats *dfs_admit_stats(void)
+{
+    return stats;
+}
+
+static int running_for(in_addr_t client)
+{
+    int count = 0;
+    for (int i = 0; i < max_handlers; i++)
+    {
+        count += handlers[i].pid != 0 && handlers[i].client == client;
+    }
+    return count;
+}
+
+static int has_room(in_addr_t client)
+{
+    return stats->handlers < max_handlers && (max_per_client <= 0 || running_for(client) < max_per_client);
+}
+
+static void log_busy(void)
+{
+    // at most once a second, a burst would otherwise flood the log
+    long now = dfs_now_us();
+    if (now - last_busy_log_us >= 1000000)
+    {
+        last_busy_log_us = now;
+        dfs_log(DFS_LOG_WARN, "%s busy: %d handlers running, %d waiting, %lu connections turned away so far",
+                server_name, stats->handlers, stats->queued, stats->rejected + stats->expired);
+    }
+}
+
+static void turn_away(int fd, in_addr_t client)
+{
+    log_busy();
+    if (reject_count == REJECT_MAX)
+    {
+        close(fd); // too many to answer at once
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    rejects[reject_count].fd = fd;
+    rejects[reject_count].client = client;
+    rejects[reject_count].since_us = dfs_now_us();
+    rejects[reject_count].drained = -1;
+    reject_count++;
+}
+
+static void start_handler(int fd, in_addr_t client)
+{
+    int slot = 0;
+    while (handlers[slot].pid != 0)
+    {
+        slot++;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(listen_fd);
+        for (int i = 0; i < stats->queued; i++)
+        {
+            close(queue[i].fd);
+        }
+        for (int i = 0; i < reject_count; i++)
+        {
+            close(rejects[i].fd);
+        }
+        signal(SIGCHLD, SIG_DFL);
+        sigprocmask(SIG_SETMASK, &handler_mask, NULL);
+        serve_connection(fd);
+        exit(0);
+    }
+    if (pid < 0)
+    {
+        perror("fork");
+        __atomic_fetch_add(&stats->rejected, 1, __ATOMIC_RELAXED);
+        turn_away(fd, client);
+        return;
+    }
+    close(fd);
+    handlers[slot].pid = pid;
+    handlers[slot].client = client;
+    __atomic_fetch_add(&stats->handlers, 1, __ATOMIC_RELAXED);
+    if (stats->handlers > stats->handlers_peak)
+    {
+        stats->handlers_peak = stats->handlers;
+    }
+}
+
+static void dequeue(int index)
+{
+    memmove(&queue[index], &queue[index + 1], (stats->queued - index - 1) * sizeof(*queue));
+    __atomic_fetch_sub(&stats->queued, 1, __ATOMIC_RELAXED);
+}
+
+static void admit(int fd, in_addr_t client)
+{
+    __atomic_fetch_add(&stats->accepted, 1, __ATOMIC_RELAXED);
+    if (has_room(client))
+    {
+        start_handler(fd, client);
+        return;
+    }
+    if (stats->queued == queue_max)
+    {
+        __atomic_fetch_add(&stats->rejected, 1, __ATOMIC_RELAXED);
+        turn_away(fd, client);
+        return;
+    }
+    queue[stats->queued].fd = fd;
+    queue[stats->queued].client = client;
+    queue[stats->queued].since_us = dfs_now_us();
+    __atomic_fetch_add(&stats->queued, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->waited, 1, __ATOMIC_RELAXED);
+    if (stats->queued > stats->queued_peak)
+    {
+        stats->queued_peak = stats->queued;
+    }
+}
+
+// starts waiting connections while there is room, least served client first
+static void dispatch(void)
+{
+    while (stats->handlers < max_handlers)
+    {
+        int best = -1, best_running = 0;
+        for (int i = 0; i < stats->queued; i++)
+        {
+            int running = running_for(queue[i].client);
+            if ((max_per_client <= 0 || running < max_per_client) && (best < 0 || running < best_running))
+            {
+                best = i;
+                best_running = running;
+            }
+        }
+        if (best < 0)
+        {
+            return;
+        }
+        struct waiting w = queue[best];
+        dequeue(best);
+        start_handler(w.fd, w.client);
+    }
+}
+
+static void reap(void)
+{
+    pid_t pid;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+    {
+        for (int i = 0; i < max_handlers; i++)
+        {
+            if (handlers[i].pid == pid)
+            {
+                handlers[i].pid = 0;
+                __atomic_fetch_sub(&stats->handlers, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+    }
+}
+
+static void expire(long now)
+{
+    long wait_us = dfs_env_int("DFS_ADMIT_WAIT_MS", 10000) * 1000L;
+    while (stats->queued > 0 && now - queue[0].since_us >= wait_us)
+    {
+        struct waiting w = queue[0];
+        dequeue(0);
+        __atomic_fetch_add(&stats->expired, 1, __ATOMIC_RELAXED);
+        turn_away(w.fd, w.client);
+    }
+}
+
+static void send_busy(int fd, const char *request)
+{
+    int framed = request[0] == DFS_FRAME_MARK;
+    const char *command = dfs_trace_command(request + framed);
+    char reply[64];
+    int len = snprintf(reply, sizeof(reply), "BUSY retry after %d ms", dfs_env_int("DFS_BUSY_RETRY_MS", 1000));
+    if (strncmp(command, "downlf", 6) == 0 || strncmp(command, "downltar", 8) == 0 || strncmp(command, "getcol", 6) == 0 ||
+        strncmp(command, "stats", 5) == 0 || strncmp(command, "selftest", 8) == 0)
+    {
+        int size = -1;
+        send(fd, &size, sizeof(size), MSG_NOSIGNAL);
+    }
+    send(fd, reply, len, MSG_NOSIGNAL);
+    if (framed)
+    {
+        send(fd, DFS_REPLY_END, strlen(DFS_REPLY_END), MSG_NOSIGNAL);
+    }
+}
+
+// a turned-away connection has input: its first command gets the busy reply, anything
+// after it (an upload's data) is read and dropped so the client sees the reply, not a reset
+static int serve_reject(struct waiting *r)
+{
+    char buffer[16384];
+    ssize_t n = recv(r->fd, buffer, sizeof(buffer) - 1, 0);
+    if (n < 0 && errno == EAGAIN)
+    {
+        return 0;
+    }
+    if (n <= 0)
+    {
+        return -1;
+    }
+    if (r->drained < 0)
+    {
+        buffer[n] = '\0';
+        send_busy(r->fd, buffer);
+        r->drained = 0;
+        return 0;
+    }
+    r->drained += n;
+    return r->drained > REJECT_DRAIN_BYTES ? -1 : 0;
+}
+
+static void drop_reject(int index)
+{
+    close(rejects[index].fd);
+    rejects[index] = rejects[--reject_count];
+}
+
+void dfs_admit_serve(int server_socket, const char *name, int per_client, void (*serve)(int client_socket))
+{
+    server_name = name;
+    serve_connection = serve;
+    listen_fd = server_socket;
+    max_handlers = dfs_env_int("DFS_MAX_HANDLERS", 256);
+    max_handlers = max_handlers > 0 ? max_handlers : 256;
+    max_per_client = dfs_env_int("DFS_MAX_PER_CLIENT", per_client);
+    queue_max = dfs_env_int("DFS_ADMIT_QUEUE", 128);
+    queue_max = queue_max >= 0 ? queue_max : 128;
+
+    stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    handlers = calloc(max_handlers, sizeof(*handlers));
+    queue = calloc(queue_max + 1, sizeof(*queue));
+    if (stats == MAP_FAILED || handlers == NULL || queue == NULL)
+    {
+        perror("Admission control");
+        exit(1);
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    // SIGCHLD stays blocked except inside ppoll, so no exit is missed between checks
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_child;
+    sigaction(SIGCHLD, &sa, NULL);
+    sigset_t blocked, waiting_mask;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &blocked, &handler_mask);
+    waiting_mask = handler_mask;
+    sigdelset(&waiting_mask, SIGCHLD);
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+    struct pollfd fds[1 + REJECT_MAX];
+    while (1)
+    {
+        long now = dfs_now_us();
+        long timeout_us = -1;
+        if (stats->queued > 0)
+        {
+            timeout_us = queue[0].since_us + dfs_env_int("DFS_ADMIT_WAIT_MS", 10000) * 1000L - now;
+        }
+        fds[0].fd = listen_fd;
+        fds[0].events = reject_count < REJECT_MAX ? POLLIN : 0; // else the kernel backlog holds them
+        for (int i = 0; i < reject_count; i++)
+        {
+            fds[1 + i].fd = rejects[i].fd;
+            fds[1 + i].events = POLLIN;
+            long left = rejects[i].since_us + REJECT_LINGER_US - now;
+            if (timeout_us < 0 || left < timeout_us)
+            {
+                timeout_us = left;
+            }
+        }
+        struct timespec timeout = {0, 0};
+        if (timeout_us > 0)
+        {
+            timeout.tv_sec = timeout_us / 1000000;
+            timeout.tv_nsec = timeout_us % 1000000 * 1000;
+        }
+        int ready = ppoll(fds, 1 + reject_count, timeout_us < 0 ? NULL : &timeout, &waiting_mask);
+        if (ready < 0 && errno != EINTR)
+        {
+            perror("Accept failed");
+            continue;
+        }
+        reap();
+
+        // rejects first: fds[] still lines up with the array until they are dropped
+        now = dfs_now_us();
+        for (int i = reject_count - 1; ready > 0 && i >= 0; i--)
+        {
+            if (fds[1 + i].revents != 0 && serve_reject(&rejects[i]) < 0)
+            {
+                drop_reject(i);
+            }
+        }
+        for (int i = reject_count - 1; i >= 0; i--)
+        {
+            if (now - rejects[i].since_us >= REJECT_LINGER_US)
+            {
+                drop_reject(i);
+            }
+        }
+
+        if (ready > 0 && (fds[0].revents & POLLIN))
+        {
+            struct sockaddr_in client_addr;
+            socklen_t addr_size = sizeof(client_addr);
+            int fd;
+            while (reject_count < REJECT_MAX &&
+                   (fd = accept4(listen_fd, (struct sockaddr *)&client_addr, &addr_size, 0)) >= 0)
+            {
+                admit(fd, client_addr.sin_addr.s_addr);
+                addr_size = sizeof(client_addr);
+            }
+        }
+        dispatch();
+        expire(dfs_now_us());
+    }
+}
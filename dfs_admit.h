@@ -0,0 +1,38 @@
+// dfs_admit.h - Bounded, fair accept loop for S1 and the storage nodes.
+//
+// Every connection is still served by a forked handler, but at most DFS_MAX_HANDLERS
+// (default 256) run at once, and at most DFS_MAX_PER_CLIENT of them for one client
+// address. That is 32 on S1 and unlimited on the nodes, whose only client is S1.
+// Connections over the limits wait in a queue of DFS_ADMIT_QUEUE (default 128). When a
+// handler exits, the next one to start is the waiting connection whose client has the
+// fewest handlers running (the oldest among equals), so one busy client cannot starve
+// the rest. A connection that finds the queue full, or waits longer than
+// DFS_ADMIT_WAIT_MS (default 10000), is not dropped silently. Once its first command
+// arrives it is answered "BUSY retry after <DFS_BUSY_RETRY_MS> ms" and closed.
+// Commands whose answer starts with a size (downlf, downltar, getcol, stats, selftest)
+// get the size -1 first.
+
+#ifndef DFS_ADMIT_H
+#define DFS_ADMIT_H
+
+struct dfs_admit_stats
+{
+    int handlers;      // running now
+    int queued;        // waiting now
+    int handlers_peak;
+    int queued_peak;
+    unsigned long accepted; // connections accepted in total
+    unsigned long waited;   // of those, connections that had to wait
+    unsigned long rejected; // turned away because the queue was full
+    unsigned long expired;  // turned away after waiting too long
+};
+
+// Runs the server's accept loop, forking serve(client_socket) for each admitted
+// connection. per_client is the default of DFS_MAX_PER_CLIENT (0: no limit). Never returns.
+void dfs_admit_serve(int server_socket, const char *name, int per_client, void (*serve)(int client_socket));
+
+// The accept loop's counters, in shared memory so handlers can report them. NULL
+// before dfs_admit_serve has started.
+const struct dfs_admit_stats *dfs_admit_stats(void);
+
+#endif
@@ -0,0 +1,556 @@
+// dfs_backend.c - S1's shared view of the storage node instances.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "dfs_backend.h"
+#include "dfs_cluster.h"
+#include "dfs_net.h"
+#include "dfs_trace.h"
+#include "dfs_log.h"
+
+#define HISTOGRAM_WINDOW 2048   // samples kept before the histogram is halved
+#define MIN_PERCENTILE_SAMPLES 20
+
+static struct dfs_backend *table;
+static struct dfs_backend local_table[DFS_MAX_BACKENDS]; // used if init was never called
+static unsigned long *pick_counter;
+static int probe_port; // the backend this handler holds the half-open probe of, 0 if none
+
+void dfs_backend_init(void)
+{
+    size_t size = sizeof(struct dfs_backend) * DFS_MAX_BACKENDS + sizeof(unsigned long);
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("mmap backend table");
+        exit(1);
+    }
+    memset(mem, 0, size);
+    table = mem;
+    pick_counter = (unsigned long *)(table + DFS_MAX_BACKENDS);
+}
+
+long dfs_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+struct dfs_backend *dfs_backend_get(int port)
+{
+    struct dfs_backend *entries = table ? table : local_table;
+    for (int i = 0; i < DFS_MAX_BACKENDS; i++)
+    {
+        int current = __atomic_load_n(&entries[i].port, __ATOMIC_ACQUIRE);
+        if (current == port)
+        {
+            return &entries[i];
+        }
+        if (current == 0)
+        {
+            int expected = 0;
+            if (__atomic_compare_exchange_n(&entries[i].port, &expected, port, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+                expected == port)
+            {
+                return &entries[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+struct dfs_backend *dfs_backend_at(int index)
+{
+    if (table == NULL || index < 0 || index >= DFS_MAX_BACKENDS ||
+        __atomic_load_n(&table[index].port, __ATOMIC_ACQUIRE) == 0)
+    {
+        return NULL;
+    }
+    return &table[index];
+}
+
+// expected wait on an instance is roughly (queue depth + 1) * latency
+static long backend_score(struct dfs_backend *b)
+{
+    long latency = __atomic_load_n(&b->ewma_us, __ATOMIC_RELAXED);
+    if (latency <= 0)
+    {
+        latency = 1; // not measured yet: try it so it gets a latency estimate
+    }
+    int inflight = __atomic_load_n(&b->inflight, __ATOMIC_RELAXED);
+    return (inflight + 1) * latency;
+}
+
+static int breaker_open(struct dfs_backend *b)
+{
+    return __atomic_load_n(&b->open_until_us, __ATOMIC_RELAXED) > dfs_now_us();
+}
+
+int dfs_backend_pick_read(int base_port, int exclude_port)
+{
+    int replicas = dfs_replicas();
+
+    // rotate the starting replica so equal scores spread the load
+    unsigned long turn = pick_counter ? __atomic_fetch_add(pick_counter, 1, __ATOMIC_RELAXED) : 0;
+    int best_port = -1;
+    long best_score = -1;
+    for (int i = 0; i < replicas; i++)
+    {
+        int port = dfs_instance_port(base_port, (turn + i) % replicas);
+        struct dfs_backend *b = dfs_backend_get(port);
+        if (port == exclude_port || b == NULL || breaker_open(b))
+        {
+            continue;
+        }
+        long score = backend_score(b);
+        if (best_score < 0 || score < best_score)
+        {
+            best_score = score;
+            best_port = port;
+        }
+    }
+    return best_port;
+}
+
+int dfs_backend_allow(int port)
+{
+    struct dfs_backend *b = dfs_backend_get(port);
+    if (b == NULL)
+    {
+        return 1;
+    }
+    long open_until = __atomic_load_n(&b->open_until_us, __ATOMIC_RELAXED);
+    if (open_until == 0)
+    {
+        return 1; // closed
+    }
+    if (open_until > dfs_now_us())
+    {
+        return 0; // open: fail fast
+    }
+    // half-open: let one probe through at a time. The probe holds the slot until it has had
+    // the time a request is given, so one whose handler died or was dropped does not hold it forever.
+    long now = dfs_now_us();
+    long probe_until = __atomic_load_n(&b->probe_until_us, __ATOMIC_ACQUIRE);
+    if (probe_until > now)
+    {
+        return 0;
+    }
+    long deadline =
+        now + (dfs_env_int("DFS_CONNECT_TIMEOUT_MS", 1000) + dfs_env_int("DFS_REQUEST_TIMEOUT_MS", 5000)) * 1000L;
+    if (!__atomic_compare_exchange_n(&b->probe_until_us, &probe_until, deadline, 0, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+    probe_port = port;
+    return 1;
+}
+
+// Ends this handler's probe of port without a verdict, so the next request can probe
+static void release_probe(int port)
+{
+    struct dfs_backend *b = dfs_backend_get(port);
+    if (b != NULL && probe_port == port)
+    {
+        probe_port = 0;
+        __atomic_store_n(&b->probe_until_us, 0, __ATOMIC_RELEASE);
+    }
+}
+
+void dfs_backend_result(int port, int ok)
+{
+    struct dfs_backend *b = dfs_backend_get(port);
+    if (b == NULL)
+    {
+        return;
+    }
+    if (ok)
+    {
+        __atomic_store_n(&b->consecutive_failures, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&b->open_until_us, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&b->probe_until_us, 0, __ATOMIC_RELEASE);
+        probe_port = port == probe_port ? 0 : probe_port;
+        return;
+    }
+
+    __atomic_fetch_add(&b->failures, 1, __ATOMIC_RELAXED);
+    int failures = __atomic_add_fetch(&b->consecutive_failures, 1, __ATOMIC_RELAXED);
+    if (failures >= dfs_env_int("DFS_BREAKER_FAILURES", 3))
+    {
+        long cooldown_us = dfs_env_int("DFS_BREAKER_COOLDOWN_MS", 2000) * 1000L;
+        __atomic_store_n(&b->open_until_us, dfs_now_us() + cooldown_us, __ATOMIC_RELAXED);
+        __atomic_store_n(&b->probe_until_us, 0, __ATOMIC_RELEASE);
+        probe_port = port == probe_port ? 0 : probe_port;
+        if (failures == dfs_env_int("DFS_BREAKER_FAILURES", 3))
+        {
+            dfs_log(DFS_LOG_WARN, "Circuit breaker opened for backend on port %d", port);
+        }
+    }
+}
+
+void dfs_backend_begin(int port)
+{
+    struct dfs_backend *b = dfs_backend_get(port);
+    if (b != NULL)
+    {
+        __atomic_fetch_add(&b->inflight, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&b->requests, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static int latency_bucket(long us)
+{
+    if (us < 8)
+    {
+        return us < 0 ? 0 : (int)us;
+    }
+    int msb = 63 - __builtin_clzl(us);
+    int bucket = (msb - 2) * 8 + (int)((us >> (msb - 3)) & 7);
+    return bucket < DFS_LATENCY_BUCKETS ? bucket : DFS_LATENCY_BUCKETS - 1;
+}
+
+// largest latency that still falls in the bucket
+static long bucket_upper_us(int bucket)
+{
+    if (bucket < 8)
+    {
+        return bucket;
+    }
+    int msb = bucket / 8 + 2;
+    long sub = bucket % 8;
+    return ((8 + sub + 1) << (msb - 3)) - 1;
+}
+
+void dfs_backend_observe(int port, long latency_us)
+{
+    struct dfs_backend *b = dfs_backend_get(port);
+    if (b == NULL)
+    {
+        return;
+    }
+    long old = __atomic_load_n(&b->ewma_us, __ATOMIC_RELAXED);
+    // alpha = 1/8; racing updates from other handlers only lose a sample
+    long updated = old <= 0 ? latency_us : old + (latency_us - old) / 8;
+    __atomic_store_n(&b->ewma_us, updated, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&b->latency_hist[latency_bucket(latency_us)], 1, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&b->latency_samples, 1, __ATOMIC_RELAXED) == HISTOGRAM_WINDOW)
+    {
+        // age out old samples; concurrent increments during the halving are harmless
+        for (int i = 0; i < DFS_LATENCY_BUCKETS; i++)
+        {
+            __atomic_store_n(&b->latency_hist[i], b->latency_hist[i] / 2, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&b->latency_samples, HISTOGRAM_WINDOW / 2, __ATOMIC_RELAXED);
+    }
+}
+
+void dfs_backend_end(int port, int ok)
+{
+    struct dfs_backend *b = dfs_backend_get(port);
+    if (b == NULL)
+    {
+        return;
+    }
+    __atomic_fetch_sub(&b->inflight, 1, __ATOMIC_RELAXED);
+    dfs_backend_result(port, ok);
+}
+
+long dfs_backend_percentile_us(int port, int percentile)
+{
+    struct dfs_backend *b = dfs_backend_get(port);
+    if (b == NULL)
+    {
+        return -1;
+    }
+    unsigned long total = 0;
+    for (int i = 0; i < DFS_LATENCY_BUCKETS; i++)
+    {
+        total += __atomic_load_n(&b->latency_hist[i], __ATOMIC_RELAXED);
+    }
+    if (total < MIN_PERCENTILE_SAMPLES)
+    {
+        return -1;
+    }
+    unsigned long target = (total * percentile + 99) / 100;
+    unsigned long seen = 0;
+    for (int i = 0; i < DFS_LATENCY_BUCKETS; i++)
+    {
+        seen += __atomic_load_n(&b->latency_hist[i], __ATOMIC_RELAXED);
+        if (seen >= target)
+        {
+            return bucket_upper_us(i);
+        }
+    }
+    return bucket_upper_us(DFS_LATENCY_BUCKETS - 1);
+}
+
+int dfs_backend_connect(int port)
+{
+    if (!dfs_backend_allow(port))
+    {
+        dfs_log(DFS_LOG_WARN, "Backend on port %d is failing, not contacting it", port);
+        return -1;
+    }
+    long trace_started = dfs_trace_now();
+    int sock = dfs_connect_timeout(port, dfs_env_int("DFS_CONNECT_TIMEOUT_MS", 1000));
+    char detail[32];
+    snprintf(detail, sizeof(detail), "port %d%s", port, sock < 0 ? " failed" : "");
+    dfs_trace_span("connect", trace_started, detail);
+    if (sock < 0)
+    {
+        dfs_log(DFS_LOG_ERROR, "Could not connect to backend on port %d", port);
+        dfs_backend_result(port, 0);
+        return -1;
+    }
+    dfs_set_io_timeout(sock, dfs_env_int("DFS_IO_TIMEOUT_MS", 30000));
+    return sock;
+}
+
+// one outstanding copy of a read request
+struct attempt
+{
+    int sock;
+    int port;
+    long started;
+    size_t got;
+    char *reply;
+};
+
+static int start_attempt(struct attempt *a, int port, const char *request, size_t reply_size)
+{
+    a->sock = dfs_backend_connect(port);
+    if (a->sock < 0)
+    {
+        return -1;
+    }
+    a->port = port;
+    a->got = 0;
+    a->started = dfs_now_us();
+    a->reply = malloc(reply_size);
+    dfs_backend_begin(port);
+    if (a->reply == NULL || dfs_trace_send(a->sock, request) < 0)
+    {
+        free(a->reply);
+        close(a->sock);
+        dfs_backend_end(port, 0);
+        return -1;
+    }
+    // the node sees end-of-stream after answering and releases its handler
+    shutdown(a->sock, SHUT_WR);
+    return 0;
+}
+
+static void drop_attempt(struct attempt *a, int failed)
+{
+    close(a->sock);
+    free(a->reply);
+    struct dfs_backend *b = dfs_backend_get(a->port);
+    if (failed)
+    {
+        dfs_backend_end(a->port, 0);
+    }
+    else if (b != NULL)
+    {
+        // overtaken by a hedge: count its wait so far, but it is not a failure
+        dfs_backend_observe(a->port, dfs_now_us() - a->started);
+        __atomic_fetch_sub(&b->inflight, 1, __ATOMIC_RELAXED);
+        release_probe(a->port);
+    }
+}
+
+// connects to the best replica not yet tried; returns 0 once one accepted the request
+static int start_next_replica(struct attempt *a, int base_port, int *tried, int ntried,
+                              const char *request, size_t reply_size)
+{
+    int replicas = dfs_replicas();
+    for (int n = 0; n < replicas; n++)
+    {
+        int port = dfs_backend_pick_read(base_port, 0);
+        int seen = 0;
+        for (int i = 0; i < ntried; i++)
+        {
+            seen |= tried[i] == port;
+        }
+        if (seen || port < 0)
+        {
+            // the favourite was already tried, take the remaining replicas in order
+            port = -1;
+            for (int r = 0; r < replicas && port < 0; r++)
+            {
+                int candidate = dfs_instance_port(base_port, r);
+                int used = 0;
+                for (int i = 0; i < ntried; i++)
+                {
+                    used |= tried[i] == candidate;
+                }
+                if (!used)
+                {
+                    port = candidate;
+                }
+            }
+        }
+        if (port < 0)
+        {
+            return -1;
+        }
+        tried[ntried++] = port;
+        if (start_attempt(a, port, request, reply_size) == 0)
+        {
+            return ntried;
+        }
+    }
+    return -1;
+}
+
+int dfs_backend_request(int base_port, const char *request, void *reply, size_t min_reply,
+                        size_t reply_size, size_t *reply_len, int *port_out)
+{
+    int replicas = dfs_replicas();
+    int tried[DFS_MAX_INSTANCES];
+    int ntried = 0;
+    struct attempt attempts[2];
+    int active = 0;
+
+    long now = dfs_now_us();
+    long deadline = now + dfs_env_int("DFS_REQUEST_TIMEOUT_MS", 5000) * 1000L;
+    long trace_started = dfs_trace_now();
+
+    int rc = start_next_replica(&attempts[0], base_port, tried, ntried, request, reply_size);
+    if (rc < 0)
+    {
+        return -1;
+    }
+    ntried = rc;
+    active = 1;
+
+    // hedge once the first replica is slower than it usually is
+    long hedge_at = -1;
+    if (replicas > 1 && dfs_env_int("DFS_HEDGE", 1))
+    {
+        long p95 = dfs_backend_percentile_us(attempts[0].port, 95);
+        long delay = p95 < 0 ? dfs_env_int("DFS_HEDGE_DEFAULT_MS", 50) * 1000L : p95;
+        hedge_at = now + (delay < 500 ? 500 : delay);
+    }
+
+    while (active > 0)
+    {
+        now = dfs_now_us();
+        if (now >= deadline)
+        {
+            break;
+        }
+        if (hedge_at >= 0 && now >= hedge_at && active == 1 && ntried < replicas)
+        {
+            hedge_at = -1;
+            rc = start_next_replica(&attempts[1], base_port, tried, ntried, request, reply_size);
+            if (rc > 0)
+            {
+                ntried = rc;
+                active = 2;
+                struct dfs_backend *b = dfs_backend_get(attempts[1].port);
+                if (b != NULL)
+                {
+                    __atomic_fetch_add(&b->hedges, 1, __ATOMIC_RELAXED);
+                }
+                dfs_log(DFS_LOG_INFO, "Hedged request to port %d after port %d was slow", attempts[1].port,
+                        attempts[0].port);
+            }
+            continue;
+        }
+
+        long wake = deadline;
+        if (hedge_at >= 0 && hedge_at < wake && active == 1)
+        {
+            wake = hedge_at;
+        }
+        struct pollfd pfds[2];
+        for (int i = 0; i < active; i++)
+        {
+            pfds[i].fd = attempts[i].sock;
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+        int timeout_ms = (int)((wake - now + 999) / 1000);
+        if (poll(pfds, active, timeout_ms) < 0 && errno != EINTR)
+        {
+            break;
+        }
+
+        for (int i = 0; i < active; i++)
+        {
+            if (pfds[i].revents == 0)
+            {
+                continue;
+            }
+            struct attempt *a = &attempts[i];
+            ssize_t got = dfs_recv(a->sock, a->reply + a->got, reply_size - a->got, MSG_DONTWAIT);
+            if (got < 0 && (errno == EAGAIN || errno == EINTR))
+            {
+                continue;
+            }
+            int finished = got > 0 ? 0 : (min_reply == 0 && got == 0);
+            if (got > 0)
+            {
+                a->got += got;
+                finished = a->got >= min_reply || a->got == reply_size;
+            }
+            if (finished)
+            {
+                // winner: hand the connection to the caller, cancel the other copy
+                dfs_backend_observe(a->port, dfs_now_us() - a->started);
+                char detail[48];
+                snprintf(detail, sizeof(detail), "port %d%s", a->port, ntried > 1 ? ", after failover or hedge" : "");
+                dfs_trace_span("first byte", trace_started, detail);
+                memcpy(reply, a->reply, a->got);
+                *reply_len = a->got;
+                *port_out = a->port;
+                int sock = a->sock;
+                free(a->reply);
+                for (int j = 0; j < active; j++)
+                {
+                    if (j != i)
+                    {
+                        drop_attempt(&attempts[j], 0);
+                    }
+                }
+                return sock;
+            }
+            if (got <= 0)
+            {
+                // this replica failed, keep waiting on the other or fail over
+                drop_attempt(a, 1);
+                attempts[i] = attempts[active - 1];
+                active--;
+                if (active == 0)
+                {
+                    rc = start_next_replica(&attempts[0], base_port, tried, ntried, request, reply_size);
+                    if (rc > 0)
+                    {
+                        ntried = rc;
+                        active = 1;
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < active; i++)
+    {
+        dfs_log(DFS_LOG_WARN, "Backend on port %d missed the request deadline", attempts[i].port);
+        drop_attempt(&attempts[i], 1);
+    }
+    return -1;
+}
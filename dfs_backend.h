@@ -0,0 +1,80 @@
+// dfs_backend.h - S1's shared view of the storage node instances.
+//
+// The table lives in anonymous shared memory created before S1 starts forking,
+// so every client handler sees the queue depth, latency and health observed by the
+// others. A backend that keeps failing is fast-failed by its circuit breaker until a
+// single probe request succeeds again.
+
+#ifndef DFS_BACKEND_H
+#define DFS_BACKEND_H
+
+#include <stddef.h>
+
+#define DFS_MAX_BACKENDS 64
+#define DFS_LATENCY_BUCKETS 200 // 8 buckets per power of two up to ~2 minutes
+
+struct dfs_backend
+{
+    int port;                 // 0 while the slot is unused
+    int inflight;             // requests currently outstanding on this instance
+    long ewma_us;             // smoothed time to first response byte
+    unsigned long requests;   // total requests sent
+    unsigned long failures;   // connect, timeout or protocol failures
+    unsigned long hedges;     // hedged requests sent to this instance
+
+    // circuit breaker
+    int consecutive_failures;
+    long open_until_us;       // breaker open (fast-fail) until this time
+    long probe_until_us;      // a half-open probe is in flight until this time; a later one may replace it
+
+    // recent time-to-first-byte distribution, halved periodically so it follows the node
+    unsigned int latency_samples;
+    unsigned int latency_hist[DFS_LATENCY_BUCKETS];
+};
+
+// Maps the shared table, must be called once in S1's main() before the accept loop
+void dfs_backend_init(void);
+
+// Returns the entry for a port, creating it on first use
+struct dfs_backend *dfs_backend_get(int port);
+
+// The index-th used entry of the shared table, NULL past the last one (or without a table)
+struct dfs_backend *dfs_backend_at(int index);
+
+// Picks the replica of the node at base_port with the lowest expected wait,
+// skipping replicas whose breaker is open. exclude_port (or 0) is never picked.
+// Returns -1 if every replica is unavailable.
+int dfs_backend_pick_read(int base_port, int exclude_port);
+
+// Circuit breaker: 1 if a request may be sent to the port now
+int dfs_backend_allow(int port);
+
+// Records the outcome of a request for the breaker and failure counters
+void dfs_backend_result(int port, int ok);
+
+// Request accounting around one backend request
+void dfs_backend_begin(int port);
+void dfs_backend_observe(int port, long latency_us);
+void dfs_backend_end(int port, int ok);
+
+// Latency percentile (0-100) of recent requests, -1 without enough samples
+long dfs_backend_percentile_us(int port, int percentile);
+
+// Opens a connection to one backend honouring its breaker and the connect/io timeouts.
+// Returns -1 (and records the failure) instead of exiting when the node is down.
+int dfs_backend_connect(int port);
+
+// Sends a read request to the best replica of base_port and waits, until the request
+// deadline, for at least min_reply bytes of the answer (min_reply 0 accepts any answer,
+// including an immediate close). If the replica has not answered within its p95 latency
+// the request is hedged to a second replica and the first answer wins.
+// Returns the winning socket with the first reply bytes in reply/*reply_len and the
+// chosen port in *port_out; the caller finishes the transfer and calls dfs_backend_end.
+// Returns -1 if no replica answered in time.
+int dfs_backend_request(int base_port, const char *request, void *reply, size_t min_reply,
+                        size_t reply_size, size_t *reply_len, int *port_out);
+
+// Monotonic clock in microseconds
+long dfs_now_us(void);
+
+#endif
@@ -0,0 +1,145 @@
+// dfs_cluster.c - Cluster topology shared by S1 and the storage nodes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "dfs_cluster.h"
+#include "dfs_net.h"
+#include "dfs_trace.h"
+#include "dfs_log.h"
+
+int dfs_env_int(const char *name, int def)
+{
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0')
+    {
+        return def;
+    }
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (*end != '\0')
+    {
+        fprintf(stderr, "Ignoring invalid %s=%s\n", name, value);
+        return def;
+    }
+    return (int)parsed;
+}
+
+int dfs_replicas(void)
+{
+    int replicas = dfs_env_int("DFS_REPLICAS", 1);
+    if (replicas < 1)
+    {
+        replicas = 1;
+    }
+    if (replicas > DFS_MAX_INSTANCES)
+    {
+        replicas = DFS_MAX_INSTANCES;
+    }
+    return replicas;
+}
+
+int dfs_instances(void)
+{
+    int replicas = dfs_replicas();
+    int instances = dfs_env_int("DFS_INSTANCES", replicas);
+    // there must be at least one running instance for every replica
+    if (instances < replicas)
+    {
+        instances = replicas;
+    }
+    if (instances > DFS_MAX_INSTANCES)
+    {
+        instances = DFS_MAX_INSTANCES;
+    }
+    return instances;
+}
+
+int dfs_instance_port(int base_port, int instance)
+{
+    return base_port + instance * DFS_INSTANCE_PORT_STRIDE;
+}
+
+void dfs_instance_root(const char *name, int instance, char *out, size_t out_size)
+{
+    const char *home_dir = getenv("HOME");
+    if (home_dir == NULL)
+    {
+        fprintf(stderr, "HOME is not set\n");
+        exit(1);
+    }
+    if (instance == 0)
+    {
+        snprintf(out, out_size, "%s/%s", home_dir, name);
+    }
+    else
+    {
+        snprintf(out, out_size, "%s/%s.%d", home_dir, name, instance);
+    }
+    mkdir(out, 0777); // ensure the instance folder exists
+}
+
+int dfs_parse_instance(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        return 0;
+    }
+    int instance = atoi(argv[1]);
+    if (instance < 0 || instance >= DFS_MAX_INSTANCES)
+    {
+        fprintf(stderr, "Instance must be between 0 and %d\n", DFS_MAX_INSTANCES - 1);
+        exit(1);
+    }
+    return instance;
+}
+
+int dfs_chain_open(int base_port, int instance, const char *command, int filesize)
+{
+    if (instance + 1 >= dfs_replicas())
+    {
+        return DFS_CHAIN_TAIL;
+    }
+    int port = dfs_instance_port(base_port, instance + 1);
+    int sock = dfs_connect_port(port);
+    if (sock < 0)
+    {
+        dfs_log(DFS_LOG_WARN, "Replica on port %d is unreachable", port);
+        return DFS_CHAIN_LOST;
+    }
+
+    // a framed command is read apart from the size behind it, so both go at once
+    if (dfs_trace_send_frame(sock, command) < 0 || (filesize >= 0 && dfs_send_all(sock, &filesize, sizeof(int)) < 0))
+    {
+        dfs_log(DFS_LOG_WARN, "Replica on port %d closed the connection", port);
+        close(sock);
+        return DFS_CHAIN_LOST;
+    }
+    return sock;
+}
+
+int dfs_chain_close(int sock, char *response, size_t response_size)
+{
+    memset(response, 0, response_size);
+    if (sock < 0)
+    {
+        return sock == DFS_CHAIN_TAIL;
+    }
+    int acked = dfs_recv(sock, response, response_size - 1, 0) > 0;
+    close(sock);
+    if (!acked)
+    {
+        dfs_log(DFS_LOG_WARN, "Replica closed the connection without acknowledging");
+        return 0;
+    }
+    if (strncmp(response, "Error", 5) == 0)
+    {
+        dfs_log(DFS_LOG_WARN, "Replica answered: %s", response);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,49 @@
+// dfs_cluster.h - Cluster topology shared by S1 and the storage nodes (S2, S3, S4).
+//
+// Every storage node type can run several instances. Instance 0 listens on the
+// node's usual port and stores under $HOME/S<n>; instance i listens on
+// port + i * DFS_INSTANCE_PORT_STRIDE and stores under $HOME/S<n>.<i>.
+// Files are replicated on instances 0 .. DFS_REPLICAS-1 (instance 0 is the head
+// of the replication chain).
+
+#ifndef DFS_CLUSTER_H
+#define DFS_CLUSTER_H
+
+#include <stddef.h>
+
+#define DFS_INSTANCE_PORT_STRIDE 10
+#define DFS_MAX_INSTANCES 16
+
+// Reads an integer setting from the environment, returns def if unset or invalid
+int dfs_env_int(const char *name, int def);
+
+// Replication factor R (DFS_REPLICAS, default 1)
+int dfs_replicas(void);
+
+// Number of running instances per node type (DFS_INSTANCES, default R)
+int dfs_instances(void);
+
+// Port of the given instance of a node whose instance 0 listens on base_port
+int dfs_instance_port(int base_port, int instance);
+
+// Storage root of the given instance, eg. home/patel4xa/S2 or home/patel4xa/S2.1
+void dfs_instance_root(const char *name, int instance, char *out, size_t out_size);
+
+// Parses the optional instance index from the node command line (./s2 [instance])
+int dfs_parse_instance(int argc, char *argv[]);
+
+// dfs_chain_open's results when there is no connection to the next instance
+#define DFS_CHAIN_TAIL -1 // this instance is the tail of the chain
+#define DFS_CHAIN_LOST -2 // the successor is unreachable; a forwarding caller sets it once the successor is lost
+
+// Opens the connection to the next instance in the replication chain and forwards the
+// command as a frame (and the file size when filesize >= 0). Returns DFS_CHAIN_TAIL or DFS_CHAIN_LOST
+// instead of a socket when there is nothing to forward to.
+int dfs_chain_open(int base_port, int instance, const char *command, int filesize);
+
+// Waits for the successor's reply, copies it into response and closes the connection.
+// Returns 1 if the rest of the chain stored the request (or this is the tail), 0 if a
+// replica was lost, did not answer or answered with an error: fewer than R copies exist.
+int dfs_chain_close(int sock, char *response, size_t response_size);
+
+#endif
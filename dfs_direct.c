@@ -0,0 +1,203 @@
+// dfs_direct.c - Preallocated and optionally O_DIRECT writing of large uploads.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+#include "dfs_direct.h"
+#include "dfs_cluster.h"
+
+#define DIRECT_ALIGN 4096
+
+struct dfs_direct_writer
+{
+    FILE *fp;
+    int fd;
+    int direct; // 0: through fp and the page cache
+    int failed;
+    long written; // bytes handed to dfs_direct_write
+    long offset;  // bytes handed to the disk
+
+    // O_DIRECT: one buffer fills while the other is being written
+    char *buffer[2];
+    size_t buffer_size;
+    size_t fill;
+    int current;
+    aio_context_t aio; // 0 if kernel AIO is not available
+    struct iocb iocb;
+    long in_flight; // bytes of the write under way, 0 if none
+};
+
+static int pwrite_all(int fd, const char *data, size_t len, long offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static void wait_in_flight(struct dfs_direct_writer *w)
+{
+    if (w->in_flight == 0)
+    {
+        return;
+    }
+    struct io_event event;
+    if (syscall(SYS_io_getevents, w->aio, 1, 1, &event, NULL) != 1 || event.res != w->in_flight)
+    {
+        w->failed = 1;
+    }
+    w->in_flight = 0;
+}
+
+// writes the current buffer (bytes is a multiple of DIRECT_ALIGN) and switches to the other
+static void submit(struct dfs_direct_writer *w, size_t bytes)
+{
+    wait_in_flight(w);
+    char *data = w->buffer[w->current];
+    int queued = 0;
+    if (w->aio != 0)
+    {
+        memset(&w->iocb, 0, sizeof(w->iocb));
+        w->iocb.aio_fildes = w->fd;
+        w->iocb.aio_lio_opcode = IOCB_CMD_PWRITE;
+        w->iocb.aio_buf = (uint64_t)(uintptr_t)data;
+        w->iocb.aio_nbytes = bytes;
+        w->iocb.aio_offset = w->offset;
+        struct iocb *list[1] = {&w->iocb};
+        queued = syscall(SYS_io_submit, w->aio, 1, list) == 1;
+    }
+    if (queued)
+    {
+        w->in_flight = bytes;
+    }
+    else if (pwrite_all(w->fd, data, bytes, w->offset) < 0)
+    {
+        w->failed = 1;
+    }
+    w->offset += bytes;
+    w->current ^= 1;
+    w->fill = 0;
+}
+
+static int start_direct(struct dfs_direct_writer *w)
+{
+    long kb = dfs_env_int("DFS_DIRECT_BUFFER_KB", 1024);
+    w->buffer_size = ((kb > 0 ? kb : 1024) * 1024 + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+    void *a = NULL, *b = NULL;
+    if (posix_memalign(&a, DIRECT_ALIGN, w->buffer_size) != 0 || posix_memalign(&b, DIRECT_ALIGN, w->buffer_size) != 0)
+    {
+        free(a);
+        return -1;
+    }
+    int flags = fcntl(w->fd, F_GETFL);
+    if (fflush(w->fp) != 0 || flags < 0 || fcntl(w->fd, F_SETFL, flags | O_DIRECT) != 0)
+    {
+        free(a);
+        free(b);
+        return -1; // the filesystem does not do O_DIRECT
+    }
+    w->buffer[0] = a;
+    w->buffer[1] = b;
+    if (syscall(SYS_io_setup, 2, &w->aio) != 0)
+    {
+        w->aio = 0;
+    }
+    w->direct = 1;
+    return 0;
+}
+
+struct dfs_direct_writer *dfs_direct_open(FILE *fp, long size)
+{
+    struct dfs_direct_writer *w = calloc(1, sizeof(*w));
+    if (w == NULL)
+    {
+        return NULL;
+    }
+    w->fp = fp;
+    w->fd = fileno(fp);
+    // not fatal if the filesystem cannot do it, the file just grows as it is written
+    if (dfs_env_int("DFS_PREALLOC", 1) == 1 && size > 0)
+    {
+        fallocate(w->fd, 0, 0, size);
+    }
+    if (dfs_env_int("DFS_DIRECT", 0) == 1 && size >= dfs_env_int("DFS_DIRECT_MIN_MB", 64) * 1024L * 1024)
+    {
+        start_direct(w);
+    }
+    return w;
+}
+
+int dfs_direct_write(struct dfs_direct_writer *w, const char *data, int len)
+{
+    w->written += len;
+    if (!w->direct)
+    {
+        if (fwrite(data, 1, len, w->fp) != (size_t)len)
+        {
+            w->failed = 1;
+        }
+        return w->failed ? -1 : 0;
+    }
+    while (len > 0)
+    {
+        size_t n = w->buffer_size - w->fill < (size_t)len ? w->buffer_size - w->fill : (size_t)len;
+        memcpy(w->buffer[w->current] + w->fill, data, n);
+        w->fill += n;
+        data += n;
+        len -= n;
+        if (w->fill == w->buffer_size)
+        {
+            submit(w, w->fill);
+        }
+    }
+    return w->failed ? -1 : 0;
+}
+
+int dfs_direct_finish(struct dfs_direct_writer *w)
+{
+    if (w->direct)
+    {
+        // O_DIRECT only writes whole blocks: pad the tail and cut the file back below
+        if (w->fill > 0)
+        {
+            size_t padded = (w->fill + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+            memset(w->buffer[w->current] + w->fill, 0, padded - w->fill);
+            submit(w, padded);
+        }
+        wait_in_flight(w);
+        fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+        if (w->aio != 0)
+        {
+            syscall(SYS_io_destroy, w->aio);
+        }
+        free(w->buffer[0]);
+        free(w->buffer[1]);
+    }
+    else if (fflush(w->fp) != 0)
+    {
+        w->failed = 1;
+    }
+    // preallocation (or the padding) may have left the file longer than what was written
+    if (ftruncate(w->fd, w->written) != 0)
+    {
+        w->failed = 1;
+    }
+    int result = w->failed ? -1 : 0;
+    free(w);
+    return result;
+}
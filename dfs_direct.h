@@ -0,0 +1,30 @@
+// dfs_direct.h - Preallocated and optionally O_DIRECT writing of large uploads (used by S4).
+//
+// The declared size of an upload is reserved with fallocate before the first byte
+// arrives, so the file gets a few large extents instead of growing piece by piece
+// (DFS_PREALLOC=0 turns this off). With DFS_DIRECT=1, uploads of at least
+// DFS_DIRECT_MIN_MB (default 64) bypass the page cache. Incoming data is gathered into
+// two aligned buffers of DFS_DIRECT_BUFFER_KB (default 1024). One buffer is written with
+// kernel AIO while the other fills from the socket, so receiving and writing overlap.
+// Without AIO the writes are synchronous, and where O_DIRECT is not supported the file
+// is written through the page cache as before.
+
+#ifndef DFS_DIRECT_H
+#define DFS_DIRECT_H
+
+#include <stdio.h>
+
+struct dfs_direct_writer;
+
+// Starts writing an upload of size bytes to fp (a freshly opened, empty file). Returns
+// NULL only if out of memory.
+struct dfs_direct_writer *dfs_direct_open(FILE *fp, long size);
+
+// Appends len bytes, returns -1 on a write error
+int dfs_direct_write(struct dfs_direct_writer *w, const char *data, int len);
+
+// Writes what is still buffered, trims the file to the bytes written and frees the
+// writer (fp stays open). Returns -1 if any write failed.
+int dfs_direct_finish(struct dfs_direct_writer *w);
+
+#endif
@@ -0,0 +1,272 @@
+// dfs_durable.c - Durable, all-or-nothing writes of uploaded files.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dfs_durable.h"
+#include "dfs_probe.h"
+
+#define SYNC_NONE 0
+#define SYNC_BATCH 1
+#define SYNC_FILE 2
+
+// Group commit state shared by every forked handler. Each writer takes a ticket; whoever
+// finds no sync running becomes the leader and runs one syncfs, which covers every ticket
+// handed out before it started. The others wait for completed to pass their ticket, then
+// take the result of the sync that covered it from the failed range.
+struct group_commit
+{
+    unsigned long requested; // last ticket handed out
+    unsigned long completed; // every ticket up to this one has been synced
+    unsigned long failed_from, failed_upto; // tickets covered by the latest failed syncs
+    int failed_errno;                       // what the latest of them failed with
+    unsigned long syncs;
+    int leader; // pid running the current sync, 0 if none
+};
+
+static int policy = SYNC_NONE;
+static int root_fd = -1;
+static char tmp_dir[512];
+static unsigned int tmp_counter;
+static struct group_commit *group;
+
+static const char *policy_name(int p)
+{
+    return p == SYNC_FILE ? "file" : p == SYNC_BATCH ? "batch" : "none";
+}
+
+static int group_sync(void)
+{
+    if (group == NULL)
+    {
+        return syncfs(root_fd);
+    }
+    unsigned long ticket = __atomic_add_fetch(&group->requested, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&group->completed, __ATOMIC_ACQUIRE) < ticket)
+    {
+        int leader = 0;
+        if (__atomic_compare_exchange_n(&group->leader, &leader, getpid(), 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            unsigned long covered = __atomic_load_n(&group->requested, __ATOMIC_ACQUIRE);
+            unsigned long done = __atomic_load_n(&group->completed, __ATOMIC_RELAXED);
+            if (syncfs(root_fd) < 0 && covered > done)
+            {
+                // back-to-back failures extend the range, so a waiter that wakes late still sees its
+                // sync failed. A new range empties the old one first, for readers in the middle of it.
+                if (__atomic_load_n(&group->failed_upto, __ATOMIC_RELAXED) != done)
+                {
+                    __atomic_store_n(&group->failed_upto, 0, __ATOMIC_RELEASE);
+                    __atomic_store_n(&group->failed_from, done + 1, __ATOMIC_RELEASE);
+                }
+                __atomic_store_n(&group->failed_errno, errno, __ATOMIC_RELEASE);
+                __atomic_store_n(&group->failed_upto, covered, __ATOMIC_RELEASE);
+            }
+            if (covered > done)
+            {
+                __atomic_store_n(&group->completed, covered, __ATOMIC_RELEASE);
+            }
+            __atomic_add_fetch(&group->syncs, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&group->leader, 0, __ATOMIC_RELEASE);
+        }
+        else if (kill(leader, 0) != 0 && errno == ESRCH)
+        {
+            // the leader was killed in the middle of its sync, let someone else take over
+            __atomic_compare_exchange_n(&group->leader, &leader, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            usleep(100);
+        }
+    }
+    // the range of the sync that covered the ticket was written before completed passed it
+    unsigned long from, upto;
+    int error;
+    do
+    {
+        upto = __atomic_load_n(&group->failed_upto, __ATOMIC_ACQUIRE);
+        from = __atomic_load_n(&group->failed_from, __ATOMIC_ACQUIRE);
+        error = __atomic_load_n(&group->failed_errno, __ATOMIC_ACQUIRE);
+    } while (upto != __atomic_load_n(&group->failed_upto, __ATOMIC_ACQUIRE));
+    if (ticket >= from && ticket <= upto)
+    {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+static int sync_fd(int fd)
+{
+    if (policy == SYNC_FILE)
+    {
+        return fdatasync(fd);
+    }
+    return policy == SYNC_BATCH ? group_sync() : 0;
+}
+
+static int sync_parent(const char *path)
+{
+    if (policy == SYNC_BATCH)
+    {
+        return group_sync();
+    }
+    if (policy != SYNC_FILE)
+    {
+        return 0;
+    }
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL)
+    {
+        return 0;
+    }
+    *slash = '\0';
+    int fd = open(dir[0] ? dir : "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+void dfs_durable_init(const char *root)
+{
+    const char *mode = getenv("DFS_SYNC");
+    policy = mode == NULL || strcmp(mode, "batch") == 0 ? SYNC_BATCH : strcmp(mode, "file") == 0 ? SYNC_FILE : SYNC_NONE;
+
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/.dfs", root);
+    mkdir(tmp_dir, 0777);
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/.dfs/tmp", root);
+    mkdir(tmp_dir, 0777);
+
+    // uploads that were in progress when the server went down
+    int stale = 0;
+    DIR *d = opendir(tmp_dir);
+    struct dirent *de;
+    while (d != NULL && (de = readdir(d)) != NULL)
+    {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", tmp_dir, de->d_name);
+        stale += de->d_name[0] != '.' && unlink(path) == 0;
+    }
+    if (d != NULL)
+    {
+        closedir(d);
+    }
+
+    if (root_fd >= 0)
+    {
+        close(root_fd);
+    }
+    root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    void *mem = mmap(NULL, sizeof(struct group_commit), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    group = mem == MAP_FAILED ? NULL : mem;
+    if (root_fd < 0)
+    {
+        perror("Durable writes: open storage root");
+        policy = SYNC_NONE;
+    }
+    printf("Durable writes: %s policy, %d unfinished uploads discarded\n", policy_name(policy), stale);
+    fflush(stdout);
+}
+
+FILE *dfs_durable_open(const char *path, char *tmp, size_t tmp_size)
+{
+    if (tmp_dir[0] == '\0')
+    {
+        tmp[0] = '\0'; // not set up: write in place
+        return fopen(path, "wb");
+    }
+    snprintf(tmp, tmp_size, "%s/%d.%u", tmp_dir, getpid(), tmp_counter++);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (fp == NULL && fd >= 0)
+    {
+        close(fd);
+        unlink(tmp);
+    }
+    return fp;
+}
+
+int dfs_durable_commit(FILE *fp, const char *tmp, const char *path)
+{
+    if (tmp[0] == '\0')
+    {
+        return fclose(fp) == 0 ? 0 : -1;
+    }
+    // the data has to be on disk before the name points at it
+    long started = DFS_PROBE_CLOCK(durable_commit);
+    int ok = fflush(fp) == 0 && sync_fd(fileno(fp)) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0)
+    {
+        perror("Durable write");
+        unlink(tmp);
+        return -1;
+    }
+    if (sync_parent(path) != 0)
+    {
+        perror("Durable write: sync directory");
+    }
+    DFS_PROBE2(durable_commit, path, DFS_PROBE_SINCE(started));
+    return 0;
+}
+
+void dfs_durable_abort(FILE *fp, const char *tmp)
+{
+    fclose(fp);
+    if (tmp[0] != '\0')
+    {
+        unlink(tmp);
+    }
+}
+
+int dfs_durable_write(const char *path, const char *data, int len)
+{
+    char tmp[600];
+    FILE *fp = dfs_durable_open(path, tmp, sizeof(tmp));
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    if (fwrite(data, 1, len, fp) != (size_t)len)
+    {
+        dfs_durable_abort(fp, tmp);
+        return -1;
+    }
+    DFS_PROBE2(disk_write, path, len);
+    return dfs_durable_commit(fp, tmp, path);
+}
+
+int dfs_durable_sync(const char *path)
+{
+    if (policy != SYNC_FILE)
+    {
+        return policy == SYNC_BATCH ? group_sync() : 0;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    int result = fdatasync(fd);
+    close(fd);
+    return result;
+}
+
+unsigned long dfs_durable_group_syncs(void)
+{
+    return group ? __atomic_load_n(&group->syncs, __ATOMIC_RELAXED) : 0;
+}
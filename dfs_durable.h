@@ -0,0 +1,47 @@
+// dfs_durable.h - Durable, all-or-nothing writes of uploaded files.
+//
+// An upload is written to a temporary file under <root>/.dfs/tmp and renamed to its final
+// path once it is complete, so a crash or a dropped client never leaves a half-written
+// file behind. How much is flushed to disk before the upload is acknowledged depends on
+// DFS_SYNC:
+//
+//   none   no flushing, the rename alone (what the page cache has may be lost on a crash)
+//   batch  the default: uploads that finish at the same time share one syncfs of the
+//          storage root's filesystem (group commit), once for the data and once for
+//          the rename
+//   file   fdatasync of each file before its rename and fsync of its directory after
+//
+// Writers in every forked handler take part in the same group commit, and a failed
+// syncfs fails every upload it covered, not only the one that ran it.
+
+#ifndef DFS_DURABLE_H
+#define DFS_DURABLE_H
+
+#include <stdio.h>
+
+// Sets up the temporary directory (removing files left there by a crash) and the shared
+// group commit state. Call before the server forks its first handler.
+void dfs_durable_init(const char *root);
+
+// Opens a temporary file that dfs_durable_commit will turn into path. tmp receives its
+// name. Returns NULL on error.
+FILE *dfs_durable_open(const char *path, char *tmp, size_t tmp_size);
+
+// Flushes the temporary file as the policy asks, closes it and renames it to path.
+// Returns 0 once the file is in place, -1 (with the temporary file removed) otherwise.
+int dfs_durable_commit(FILE *fp, const char *tmp, const char *path);
+
+// Closes and removes a temporary file that is not wanted after all (incomplete upload)
+void dfs_durable_abort(FILE *fp, const char *tmp);
+
+// Writes len bytes as the file at path through a temporary file, returns 0 on success
+int dfs_durable_write(const char *path, const char *data, int len);
+
+// Makes the data already written to the file at path durable under the policy (used for
+// appends to files that are never renamed, like pack segments)
+int dfs_durable_sync(const char *path);
+
+// Number of group commit syncs run so far (batch policy), shared by all processes
+unsigned long dfs_durable_group_syncs(void);
+
+#endif
@@ -0,0 +1,330 @@
+// dfs_ec.c - Reed-Solomon erasure coding over GF(2^8).
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DFS_EC_X86 1
+#endif
+
+#include "dfs_ec.h"
+
+#define GF_POLY 0x11d
+#define EC_BLOCK 16384 // region block size, keeps a block of every shard in cache
+
+static unsigned char gf_exp[512];
+static unsigned char gf_log[256];
+static int gf_ready;
+
+typedef void (*mul_xor_fn)(unsigned char *dst, const unsigned char *src, unsigned char c, size_t len);
+static mul_xor_fn mul_xor;
+static const char *kernel_name;
+
+static void gf_init(void)
+{
+    int x = 1;
+    for (int i = 0; i < 255; i++)
+    {
+        gf_exp[i] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+        {
+            x ^= GF_POLY;
+        }
+    }
+    for (int i = 255; i < 512; i++)
+    {
+        gf_exp[i] = gf_exp[i - 255];
+    }
+    gf_ready = 1;
+}
+
+static unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+    if (a == 0 || b == 0)
+    {
+        return 0;
+    }
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static unsigned char gf_inv(unsigned char a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+// products of c with every low nibble and every high nibble
+static void nibble_tables(unsigned char c, unsigned char *low, unsigned char *high)
+{
+    for (int x = 0; x < 16; x++)
+    {
+        low[x] = gf_mul(c, x);
+        high[x] = gf_mul(c, x << 4);
+    }
+}
+
+static void mul_xor_scalar(unsigned char *dst, const unsigned char *src, unsigned char c, size_t len)
+{
+    unsigned char table[256];
+    for (int x = 0; x < 256; x++)
+    {
+        table[x] = gf_mul(c, x);
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        dst[i] ^= table[src[i]];
+    }
+}
+
+#ifdef DFS_EC_X86
+__attribute__((target("ssse3"))) static void mul_xor_ssse3(unsigned char *dst, const unsigned char *src,
+                                                            unsigned char c, size_t len)
+{
+    unsigned char low[16], high[16];
+    nibble_tables(c, low, high);
+    __m128i tlow = _mm_loadu_si128((const __m128i *)low);
+    __m128i thigh = _mm_loadu_si128((const __m128i *)high);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_and_si128(s, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi64(s, 4), mask);
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(tlow, lo), _mm_shuffle_epi8(thigh, hi));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, product));
+    }
+    for (; i < len; i++)
+    {
+        dst[i] ^= low[src[i] & 0x0f] ^ high[src[i] >> 4];
+    }
+}
+
+__attribute__((target("avx2"))) static void mul_xor_avx2(unsigned char *dst, const unsigned char *src,
+                                                          unsigned char c, size_t len)
+{
+    unsigned char low[16], high[16];
+    nibble_tables(c, low, high);
+    __m256i tlow = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)low));
+    __m256i thigh = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)high));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i lo = _mm256_and_si256(s, mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+        __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(tlow, lo), _mm256_shuffle_epi8(thigh, hi));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, product));
+    }
+    for (; i < len; i++)
+    {
+        dst[i] ^= low[src[i] & 0x0f] ^ high[src[i] >> 4];
+    }
+}
+#endif
+
+static void ec_init(void)
+{
+    if (gf_ready)
+    {
+        return;
+    }
+    gf_init();
+    mul_xor = mul_xor_scalar;
+    kernel_name = "scalar";
+    const char *simd = getenv("DFS_EC_SIMD");
+    if (simd != NULL && strcmp(simd, "0") == 0)
+    {
+        return;
+    }
+#ifdef DFS_EC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        mul_xor = mul_xor_avx2;
+        kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("ssse3"))
+    {
+        mul_xor = mul_xor_ssse3;
+        kernel_name = "ssse3";
+    }
+#endif
+}
+
+const char *dfs_ec_kernel(void)
+{
+    ec_init();
+    return kernel_name;
+}
+
+// dst ^= c * src, with the trivial coefficients short-circuited
+static void region_mul_xor(unsigned char *dst, const unsigned char *src, unsigned char c, size_t len)
+{
+    if (c == 0)
+    {
+        return;
+    }
+    if (c == 1)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+    mul_xor(dst, src, c, len);
+}
+
+// Cauchy coefficient of parity row i and data column j; any k rows of [I; C] are invertible
+static unsigned char cauchy(int k, int i, int j)
+{
+    return gf_inv((unsigned char)((k + i) ^ j));
+}
+
+void dfs_ec_encode(int k, int m, size_t len, unsigned char **data, unsigned char **parity)
+{
+    ec_init();
+    for (int i = 0; i < m; i++)
+    {
+        memset(parity[i], 0, len);
+    }
+    for (size_t off = 0; off < len; off += EC_BLOCK)
+    {
+        size_t n = len - off < EC_BLOCK ? len - off : EC_BLOCK;
+        for (int i = 0; i < m; i++)
+        {
+            for (int j = 0; j < k; j++)
+            {
+                region_mul_xor(parity[i] + off, data[j] + off, cauchy(k, i, j), n);
+            }
+        }
+    }
+}
+
+// Gauss-Jordan inversion of a k x k matrix over GF(2^8), returns -1 if singular
+static int invert_matrix(int k, unsigned char *a, unsigned char *inverse)
+{
+    memset(inverse, 0, k * k);
+    for (int i = 0; i < k; i++)
+    {
+        inverse[i * k + i] = 1;
+    }
+    for (int col = 0; col < k; col++)
+    {
+        int pivot = col;
+        while (pivot < k && a[pivot * k + col] == 0)
+        {
+            pivot++;
+        }
+        if (pivot == k)
+        {
+            return -1;
+        }
+        if (pivot != col)
+        {
+            for (int x = 0; x < k; x++)
+            {
+                unsigned char t = a[col * k + x];
+                a[col * k + x] = a[pivot * k + x];
+                a[pivot * k + x] = t;
+                t = inverse[col * k + x];
+                inverse[col * k + x] = inverse[pivot * k + x];
+                inverse[pivot * k + x] = t;
+            }
+        }
+        unsigned char scale = gf_inv(a[col * k + col]);
+        for (int x = 0; x < k; x++)
+        {
+            a[col * k + x] = gf_mul(a[col * k + x], scale);
+            inverse[col * k + x] = gf_mul(inverse[col * k + x], scale);
+        }
+        for (int row = 0; row < k; row++)
+        {
+            unsigned char factor = a[row * k + col];
+            if (row == col || factor == 0)
+            {
+                continue;
+            }
+            for (int x = 0; x < k; x++)
+            {
+                a[row * k + x] ^= gf_mul(factor, a[col * k + x]);
+                inverse[row * k + x] ^= gf_mul(factor, inverse[col * k + x]);
+            }
+        }
+    }
+    return 0;
+}
+
+int dfs_ec_decode(int k, int m, size_t len, unsigned char **shards, const int *present)
+{
+    ec_init();
+
+    // use the first k shards we have, data shards first so most rows are trivial
+    int rows[DFS_EC_MAX_SHARDS];
+    int used = 0;
+    for (int s = 0; s < k + m && used < k; s++)
+    {
+        if (present[s])
+        {
+            rows[used++] = s;
+        }
+    }
+    if (used < k)
+    {
+        return -1;
+    }
+
+    int missing = 0;
+    for (int j = 0; j < k; j++)
+    {
+        missing += !present[j];
+    }
+    if (missing == 0)
+    {
+        return 0;
+    }
+
+    unsigned char a[DFS_EC_MAX_SHARDS * DFS_EC_MAX_SHARDS];
+    unsigned char inverse[DFS_EC_MAX_SHARDS * DFS_EC_MAX_SHARDS];
+    for (int r = 0; r < k; r++)
+    {
+        for (int j = 0; j < k; j++)
+        {
+            a[r * k + j] = rows[r] < k ? (rows[r] == j) : cauchy(k, rows[r] - k, j);
+        }
+    }
+    if (invert_matrix(k, a, inverse) < 0)
+    {
+        return -1;
+    }
+
+    for (int j = 0; j < k; j++)
+    {
+        if (!present[j])
+        {
+            memset(shards[j], 0, len);
+        }
+    }
+    for (size_t off = 0; off < len; off += EC_BLOCK)
+    {
+        size_t n = len - off < EC_BLOCK ? len - off : EC_BLOCK;
+        for (int j = 0; j < k; j++)
+        {
+            if (present[j])
+            {
+                continue;
+            }
+            for (int r = 0; r < k; r++)
+            {
+                region_mul_xor(shards[j] + off, shards[rows[r]] + off, inverse[j * k + r], n);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+// dfs_ec.h - Reed-Solomon erasure coding over GF(2^8).
+//
+// Systematic code: k data shards are stored as they are and m parity shards are
+// computed with a Cauchy matrix, so any k of the k+m shards rebuild the data.
+// The multiply-accumulate kernel uses AVX2 or SSSE3 nibble lookups when the CPU
+// has them (checked at run time) and a table-driven loop otherwise.
+
+#ifndef DFS_EC_H
+#define DFS_EC_H
+
+#include <stddef.h>
+
+#define DFS_EC_MAX_SHARDS 16
+
+// Name of the kernel in use ("avx2", "ssse3" or "scalar"). DFS_EC_SIMD=0 forces scalar.
+const char *dfs_ec_kernel(void);
+
+// Computes the m parity shards of len bytes each from the k data shards
+void dfs_ec_encode(int k, int m, size_t len, unsigned char **data, unsigned char **parity);
+
+// Rebuilds missing data shards in place. shards holds the k data shards followed by the
+// m parity shards; present[i] is 0 for every shard that has to be rebuilt (its buffer
+// must still be allocated). Returns 0 on success, -1 if fewer than k shards are present.
+int dfs_ec_decode(int k, int m, size_t len, unsigned char **shards, const int *present);
+
+#endif
@@ -0,0 +1,820 @@
+// dfs_engine.c - Event-driven download engine for the storage nodes.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+#include "dfs_engine.h"
+#include "dfs_cluster.h"
+#include "dfs_rate.h"
+#include "dfs_backend.h"
+#include "dfs_metrics.h"
+#include "dfs_net.h"
+#include "dfs_log.h"
+#include "dfs_fault.h"
+#include "dfs_probe.h"
+
+#define REQUEST_MAX (DFS_FRAME_SIZE + 1) // one command frame and its terminator
+#define CHUNK (64 * 1024)
+
+// the step a completion belongs to; the connection slot is in the upper bits of user_data
+#define OP_ACCEPT 1
+#define OP_RECV 2
+#define OP_OPEN 3
+#define OP_STATX 4
+#define OP_HEADER 5
+#define OP_READ 6
+#define OP_SEND 7
+
+struct conn
+{
+    int fd;        // client socket, -1 if the slot is free
+    int file;      // file being sent, -1 if none
+    int fixed;     // file is in the fixed file table at the slot's index
+    int closing;   // drop the connection once nothing is in flight
+    int in_flight; // submitted requests not completed yet
+    long size;     // of the file
+    long sent;     // bytes of the file sent so far
+    int chunk;     // bytes of the chunk being sent
+    int chunk_sent;
+    int header; // the size reply
+    int header_sent;
+    long started_us; // when the request arrived
+    char *buffer; // this slot's part of the registered buffers
+    struct statx stx;
+    char request[REQUEST_MAX];
+    char path[512];
+};
+
+static const struct dfs_engine_config *cfg;
+static int listen_fd;
+static int engine_fd = -1; // ring or epoll instance
+static struct conn *conns;
+static int conn_count;
+static cpu_set_t allowed_cpus; // before pinning, restored in forked handlers
+static int worker_cpu = -1;
+
+// ---- shared by both engines ----
+
+static int alloc_conn(int fd)
+{
+    for (int i = 0; i < conn_count; i++)
+    {
+        if (conns[i].fd < 0)
+        {
+            char *buffer = conns[i].buffer;
+            memset(&conns[i], 0, sizeof(conns[i]));
+            conns[i].fd = fd;
+            conns[i].file = -1;
+            conns[i].buffer = buffer;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 1 if the request is a download this engine serves, with c->path set
+static int wants_engine(struct conn *c)
+{
+    char command[20], raw[512];
+    if (sscanf(c->request, "%19s %511s", command, raw) != 2 || strcmp(command, "downlf") != 0)
+    {
+        return 0;
+    }
+    const char *ext = strrchr(raw, '.');
+    if (ext == NULL || strcmp(ext, cfg->extension) != 0 || dfs_rate_limited())
+    {
+        return 0; // limited transfers are paced by the forked handlers
+    }
+    // same mapping as the nodes' sanitize_path
+    if (strncmp(raw, "~S1/", 4) == 0)
+    {
+        snprintf(c->path, sizeof(c->path), "%s/%s", cfg->root, raw + 4);
+    }
+    else
+    {
+        snprintf(c->path, sizeof(c->path), "%s", raw);
+    }
+    c->started_us = dfs_now_us();
+    return 1;
+}
+
+static void download_done(struct conn *c)
+{
+    dfs_metrics_record("downlf", dfs_now_us() - c->started_us, strlen(c->request), c->size + sizeof(c->header));
+    dfs_log(DFS_LOG_INFO, "File '%s' sent to S1 successfully.", c->path);
+}
+
+// gives the connection to a forked handler; the caller closes its own copy
+// len is what the recv of request returned; a frame it cut short is completed in the child
+static void hand_off(int fd, char *request, ssize_t len)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(listen_fd);
+        close(engine_fd);
+        signal(SIGPIPE, SIG_DFL);
+        if (worker_cpu >= 0)
+        {
+            sched_setaffinity(0, sizeof(allowed_cpus), &allowed_cpus);
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        int framed;
+        if (request != NULL && dfs_finish_command(fd, request, len, &framed) < 0)
+        {
+            exit(0);
+        }
+        cfg->fallback(fd, request);
+        exit(0);
+    }
+    if (pid < 0)
+    {
+        perror("fork");
+    }
+}
+
+static void reap_children(void)
+{
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+    {
+    }
+}
+
+// ---- io_uring ----
+
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static unsigned sq_entries, sq_local_tail, to_submit;
+static int fixed_buffers, fixed_files;
+
+static int ring_enter(unsigned submit, unsigned wait)
+{
+    return syscall(__NR_io_uring_enter, engine_fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static int ring_setup(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    engine_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (engine_fd < 0)
+    {
+        return -1;
+    }
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+    {
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+    }
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine_fd, IORING_OFF_SQ_RING);
+    char *cq = single ? sq : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine_fd, IORING_OFF_CQ_RING);
+    sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                engine_fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        close(engine_fd);
+        engine_fd = -1;
+        return -1;
+    }
+    sq_head = (unsigned *)(sq + p.sq_off.head);
+    sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq + p.sq_off.array);
+    cq_head = (unsigned *)(cq + p.cq_off.head);
+    cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    sq_entries = p.sq_entries;
+    sq_local_tail = *sq_tail;
+    return 0;
+}
+
+static struct io_uring_sqe *sqe_get(void)
+{
+    // a full queue is handed to the kernel first
+    while (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+    {
+        ring_enter(to_submit, 0);
+        to_submit = 0;
+    }
+    unsigned index = sq_local_tail & *sq_mask;
+    sq_array[index] = index;
+    memset(&sqes[index], 0, sizeof(sqes[index]));
+    return &sqes[index];
+}
+
+static void sqe_push(struct io_uring_sqe *sqe, struct conn *c, int slot, int op)
+{
+    sqe->user_data = ((uint64_t)slot << 8) | op;
+    if (c != NULL)
+    {
+        c->in_flight++;
+    }
+    sq_local_tail++;
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    to_submit++;
+}
+
+static void prep_accept(void)
+{
+    struct io_uring_sqe *sqe = sqe_get();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe_push(sqe, NULL, 0, OP_ACCEPT);
+}
+
+static void prep_recv(struct conn *c, int slot)
+{
+    struct io_uring_sqe *sqe = sqe_get();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->addr = (uint64_t)(uintptr_t)c->request;
+    sqe->len = REQUEST_MAX - 1;
+    sqe_push(sqe, c, slot, OP_RECV);
+}
+
+// openat and statx of the same path, linked so a failed open cancels the statx
+static void prep_open(struct conn *c, int slot)
+{
+    struct io_uring_sqe *sqe = sqe_get();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)c->path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe_push(sqe, c, slot, OP_OPEN);
+
+    sqe = sqe_get();
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)c->path;
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = (uint64_t)(uintptr_t)&c->stx;
+    sqe_push(sqe, c, slot, OP_STATX);
+}
+
+static void prep_send(struct conn *c, int slot, const void *data, int len, int op, int link)
+{
+    struct io_uring_sqe *sqe = sqe_get();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->fd;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe_push(sqe, c, slot, op);
+}
+
+// the next chunk: a read into the slot's buffer linked to the send of it
+static void prep_chunk(struct conn *c, int slot)
+{
+    c->chunk = c->size - c->sent < CHUNK ? c->size - c->sent : CHUNK;
+    c->chunk_sent = 0;
+    struct io_uring_sqe *sqe = sqe_get();
+    sqe->opcode = fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->buf_index = fixed_buffers ? slot : 0;
+    sqe->fd = c->fixed ? slot : c->file;
+    sqe->flags = IOSQE_IO_LINK | (c->fixed ? IOSQE_FIXED_FILE : 0);
+    sqe->addr = (uint64_t)(uintptr_t)c->buffer;
+    sqe->len = c->chunk;
+    sqe->off = c->sent;
+    sqe_push(sqe, c, slot, OP_READ);
+    prep_send(c, slot, c->buffer, c->chunk, OP_SEND, 0);
+}
+
+static void set_fixed_file(int slot, int fd)
+{
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds = (uint64_t)(uintptr_t)&fd;
+    syscall(__NR_io_uring_register, engine_fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+}
+
+static void close_file(struct conn *c, int slot)
+{
+    if (c->file < 0)
+    {
+        return;
+    }
+    if (c->fixed)
+    {
+        set_fixed_file(slot, -1);
+    }
+    close(c->file);
+    c->file = -1;
+    c->fixed = 0;
+}
+
+static void maybe_release(struct conn *c, int slot)
+{
+    if (c->closing && c->in_flight == 0)
+    {
+        close_file(c, slot);
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static void drop(struct conn *c, int slot)
+{
+    c->closing = 1;
+    maybe_release(c, slot);
+}
+
+static void start_download(struct conn *c, int slot)
+{
+    c->size = c->stx.stx_size;
+    c->sent = 0;
+    c->header = (int)c->size;
+    if (fixed_files)
+    {
+        set_fixed_file(slot, c->file);
+        c->fixed = 1;
+    }
+    // size reply, then the first chunk, in one chain
+    prep_send(c, slot, &c->header, sizeof(c->header), OP_HEADER, c->size > 0);
+    if (c->size > 0)
+    {
+        prep_chunk(c, slot);
+    }
+}
+
+static void finish_download(struct conn *c, int slot)
+{
+    close_file(c, slot);
+    download_done(c);
+    prep_recv(c, slot); // the connection may carry another request
+}
+
+static void ring_complete(const struct io_uring_cqe *cqe)
+{
+    int op = cqe->user_data & 0xff;
+    int slot = cqe->user_data >> 8;
+    int res = cqe->res;
+    if (op == OP_ACCEPT)
+    {
+        prep_accept();
+        int fresh = res >= 0 ? alloc_conn(res) : -1;
+        if (res >= 0 && fresh < 0)
+        {
+            hand_off(res, NULL, 0); // every slot is busy
+            close(res);
+        }
+        else if (fresh >= 0)
+        {
+            prep_recv(&conns[fresh], fresh);
+        }
+        return;
+    }
+
+    struct conn *c = &conns[slot];
+    c->in_flight--;
+    if (c->closing)
+    {
+        maybe_release(c, slot);
+        return;
+    }
+    switch (op)
+    {
+    case OP_RECV:
+        if (res <= 0)
+        {
+            drop(c, slot);
+            break;
+        }
+        c->request[res] = '\0';
+        if (wants_engine(c))
+        {
+            prep_open(c, slot);
+        }
+        else
+        {
+            hand_off(c->fd, c->request, res);
+            drop(c, slot);
+        }
+        break;
+    case OP_OPEN:
+        c->file = res >= 0 ? res : -1;
+        break;
+    case OP_STATX:
+        if (c->file < 0 || res < 0 || !S_ISREG(c->stx.stx_mode) || c->stx.stx_size > INT_MAX)
+        {
+            // missing here (maybe packed) or not a plain file: the regular handler answers
+            close_file(c, slot);
+            hand_off(c->fd, c->request, strlen(c->request));
+            drop(c, slot);
+        }
+        else
+        {
+            start_download(c, slot);
+        }
+        break;
+    case OP_HEADER:
+        if (res != (int)sizeof(c->header))
+        {
+            drop(c, slot);
+        }
+        else if (c->size == 0)
+        {
+            finish_download(c, slot);
+        }
+        break;
+    case OP_READ:
+        if (res != c->chunk)
+        {
+            drop(c, slot); // the linked send was cancelled
+            break;
+        }
+        DFS_PROBE2(disk_read, c->path, res);
+        break;
+    case OP_SEND:
+        if (res <= 0)
+        {
+            drop(c, slot);
+            break;
+        }
+        c->chunk_sent += res;
+        if (c->chunk_sent < c->chunk)
+        {
+            prep_send(c, slot, c->buffer + c->chunk_sent, c->chunk - c->chunk_sent, OP_SEND, 0);
+        }
+        else if ((c->sent += c->chunk) < c->size)
+        {
+            prep_chunk(c, slot);
+        }
+        else
+        {
+            finish_download(c, slot);
+        }
+        break;
+    }
+}
+
+static int run_uring(void)
+{
+    if (ring_setup(conn_count * 4 < 4096 ? conn_count * 4 : 4096) < 0)
+    {
+        return -1;
+    }
+    // one CHUNK per connection slot, registered so reads skip the page pinning per call
+    char *buffers = mmap(NULL, (size_t)conn_count * CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    struct iovec *iov = malloc(sizeof(*iov) * conn_count);
+    int *files = malloc(sizeof(int) * conn_count);
+    if (buffers == MAP_FAILED || iov == NULL || files == NULL)
+    {
+        return -1;
+    }
+    for (int i = 0; i < conn_count; i++)
+    {
+        conns[i].buffer = buffers + (size_t)i * CHUNK;
+        iov[i].iov_base = conns[i].buffer;
+        iov[i].iov_len = CHUNK;
+        files[i] = -1;
+    }
+    fixed_buffers = syscall(__NR_io_uring_register, engine_fd, IORING_REGISTER_BUFFERS, iov, conn_count) == 0;
+    fixed_files = syscall(__NR_io_uring_register, engine_fd, IORING_REGISTER_FILES, files, conn_count) == 0;
+    free(iov);
+    free(files);
+    dfs_log(DFS_LOG_INFO, "%s I/O engine: io_uring, %d connections, %s buffers, %s files", cfg->name, conn_count,
+            fixed_buffers ? "registered" : "plain", fixed_files ? "fixed" : "plain");
+
+    prep_accept();
+    while (1)
+    {
+        // submit everything queued and wait for at least one completion, in one call
+        if (ring_enter(to_submit, 1) >= 0)
+        {
+            to_submit = 0;
+        }
+        else if (errno != EINTR)
+        {
+            perror("io_uring_enter");
+            exit(1);
+        }
+        unsigned head = *cq_head;
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe cqe = cqes[head & *cq_mask];
+            head++;
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            ring_complete(&cqe);
+        }
+        reap_children();
+    }
+}
+
+// ---- epoll ----
+
+static void epoll_watch(int slot, int fd, unsigned events, int op)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u32 = slot + 1; // 0 is the listening socket
+    epoll_ctl(engine_fd, op, fd, &ev);
+}
+
+static void epoll_drop(struct conn *c)
+{
+    if (c->file >= 0)
+    {
+        close(c->file);
+        c->file = -1;
+    }
+    close(c->fd);
+    c->fd = -1;
+}
+
+// sends what the socket takes; the connection goes back to reading once the file is out
+static void epoll_send(struct conn *c, int slot)
+{
+    while (c->header_sent < (int)sizeof(c->header))
+    {
+        ssize_t n = send(c->fd, (char *)&c->header + c->header_sent, sizeof(c->header) - c->header_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EAGAIN)
+        {
+            return;
+        }
+        if (n <= 0)
+        {
+            epoll_drop(c);
+            return;
+        }
+        c->header_sent += n;
+    }
+    while (c->sent < c->size)
+    {
+        off_t offset = c->sent;
+        ssize_t n = sendfile(c->fd, c->file, &offset, CHUNK);
+        if (n < 0 && errno == EAGAIN)
+        {
+            return;
+        }
+        if (n <= 0)
+        {
+            epoll_drop(c);
+            return;
+        }
+        c->sent = offset;
+        DFS_PROBE2(disk_read, c->path, n);
+    }
+    close(c->file);
+    c->file = -1;
+    download_done(c);
+    epoll_watch(slot, c->fd, EPOLLIN, EPOLL_CTL_MOD);
+}
+
+static void epoll_receive(struct conn *c, int slot)
+{
+    ssize_t n = recv(c->fd, c->request, REQUEST_MAX - 1, 0);
+    if (n < 0 && errno == EAGAIN)
+    {
+        return;
+    }
+    if (n <= 0)
+    {
+        epoll_drop(c);
+        return;
+    }
+    c->request[n] = '\0';
+    struct stat st;
+    if (wants_engine(c) && (c->file = open(c->path, O_RDONLY | O_CLOEXEC)) >= 0 && fstat(c->file, &st) == 0 &&
+        S_ISREG(st.st_mode) && st.st_size <= INT_MAX)
+    {
+        c->size = st.st_size;
+        c->sent = 0;
+        c->header = (int)c->size;
+        c->header_sent = 0;
+        epoll_watch(slot, c->fd, EPOLLOUT, EPOLL_CTL_MOD);
+        epoll_send(c, slot);
+        return;
+    }
+    hand_off(c->fd, c->request, n);
+    epoll_drop(c);
+}
+
+static int run_epoll(void)
+{
+    engine_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (engine_fd < 0)
+    {
+        return -1;
+    }
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    epoll_ctl(engine_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    dfs_log(DFS_LOG_INFO, "%s I/O engine: epoll, %d connections", cfg->name, conn_count);
+
+    struct epoll_event events[64];
+    while (1)
+    {
+        int n = epoll_wait(engine_fd, events, 64, -1);
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.u32 == 0)
+            {
+                int fd;
+                while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+                {
+                    int slot = alloc_conn(fd);
+                    if (slot < 0)
+                    {
+                        hand_off(fd, NULL, 0);
+                        close(fd);
+                        continue;
+                    }
+                    epoll_watch(slot, fd, EPOLLIN, EPOLL_CTL_ADD);
+                }
+                continue;
+            }
+            int slot = events[i].data.u32 - 1;
+            struct conn *c = &conns[slot];
+            if (c->fd < 0)
+            {
+                continue;
+            }
+            if (c->file >= 0)
+            {
+                epoll_send(c, slot);
+            }
+            else
+            {
+                epoll_receive(c, slot);
+            }
+        }
+        reap_children();
+    }
+}
+
+// ---- workers ----
+
+int dfs_engine_workers(void)
+{
+    int workers = dfs_env_int("DFS_WORKERS", 1);
+    if (workers <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? cpus : 1;
+    }
+    return workers;
+}
+
+// a listener of the worker's own on the address server_socket is bound to
+static int open_listener(int server_socket)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(server_socket, (struct sockaddr *)&addr, &len) < 0)
+    {
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0 ||
+        bind(fd, (struct sockaddr *)&addr, len) < 0 || listen(fd, SOMAXCONN) < 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// pins the process to the worker-th CPU it may run on, wrapping around
+static void pin_worker(int worker)
+{
+    if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) != 0 || dfs_env_int("DFS_WORKER_PIN", 1) != 1)
+    {
+        return;
+    }
+    int n = worker % CPU_COUNT(&allowed_cpus);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed_cpus) && n-- == 0)
+        {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            if (sched_setaffinity(0, sizeof(one), &one) == 0)
+            {
+                worker_cpu = cpu;
+            }
+            return;
+        }
+    }
+}
+
+void dfs_engine_run(int server_socket, const struct dfs_engine_config *config)
+{
+    int workers = dfs_engine_workers();
+    const char *mode = getenv("DFS_ENGINE");
+    if (mode == NULL && workers > 1)
+    {
+        mode = "uring"; // asking for workers is asking for the engine
+    }
+    if (mode == NULL || (strcmp(mode, "uring") != 0 && strcmp(mode, "epoll") != 0))
+    {
+        return;
+    }
+    if (dfs_fault_active())
+    {
+        // the engine's sends and reads bypass dfs_send and the disk hooks
+        dfs_log(DFS_LOG_WARN, "DFS_FAULT is set, serving downloads from forked handlers instead of the engine");
+        return;
+    }
+    cfg = config;
+    fflush(stdout); // forked workers and handlers must not inherit buffered output
+
+    // every worker but the first gets its own SO_REUSEPORT listener, so the kernel
+    // spreads incoming connections over the workers' accept queues
+    int worker = 0;
+    for (int i = 1; i < workers; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            int fd = open_listener(server_socket);
+            if (fd < 0)
+            {
+                perror("Worker listener failed");
+                exit(1);
+            }
+            close(server_socket);
+            server_socket = fd;
+            worker = i;
+            break;
+        }
+        if (pid < 0)
+        {
+            perror("fork");
+            break;
+        }
+    }
+    if (workers > 1)
+    {
+        pin_worker(worker);
+        dfs_log(DFS_LOG_INFO, "%s worker %d of %d started on cpu %d", cfg->name, worker, workers, worker_cpu);
+    }
+
+    // each worker has its own connection slots and buffers, shared with nobody
+    listen_fd = server_socket;
+    conn_count = dfs_env_int("DFS_ENGINE_CONNECTIONS", 256);
+    conn_count = conn_count > 0 ? conn_count : 256;
+    conns = calloc(conn_count, sizeof(*conns));
+    for (int i = 0; conns != NULL && i < conn_count; i++)
+    {
+        conns[i].fd = -1;
+        conns[i].file = -1;
+    }
+    signal(SIGPIPE, SIG_IGN); // a client that goes away must not take the engine with it
+
+    if (conns != NULL && strcmp(mode, "uring") == 0 && run_uring() < 0)
+    {
+        dfs_log(DFS_LOG_WARN, "%s I/O engine: io_uring is not available, using epoll", cfg->name);
+        if (engine_fd >= 0)
+        {
+            close(engine_fd);
+            engine_fd = -1;
+        }
+    }
+    if (conns != NULL)
+    {
+        run_epoll();
+    }
+    if (worker > 0)
+    {
+        exit(1); // the caller's accept loop is on the first worker's socket
+    }
+    signal(SIGPIPE, SIG_DFL);
+}
@@ -0,0 +1,41 @@
+// dfs_engine.h - Event-driven download engine for the storage nodes (io_uring or epoll).
+//
+// By default a node forks one process per connection. With DFS_ENGINE=uring the node
+// process instead drives all its connections from one io_uring: accept, recv, openat,
+// statx, read and send are submitted as linked SQEs. File reads use registered buffers
+// and fixed files, and one io_uring_enter submits a whole batch and waits for the next
+// completions. Downloads of files stored on disk, the bulk of a node's traffic, never
+// leave the engine. Every other request (uploads, removes, listings, tar, statf, packed
+// files) is handed, with its connection, to a forked handler exactly as before.
+//
+// DFS_ENGINE=epoll, or a kernel without io_uring, runs the same engine on epoll and
+// sendfile. DFS_ENGINE_CONNECTIONS (default 256) bounds the connections the engine
+// serves at once. Past that, new connections get a forked handler of their own.
+//
+// DFS_WORKERS=N (0: one per CPU) runs N engine processes. Each has its own SO_REUSEPORT
+// listener on the node's port, its own ring, connection slots and buffers, and is
+// pinned to a CPU of its own (DFS_WORKER_PIN=0 leaves scheduling to the kernel).
+// DFS_WORKERS above 1 turns the engine on with io_uring if DFS_ENGINE is not set.
+
+#ifndef DFS_ENGINE_H
+#define DFS_ENGINE_H
+
+struct dfs_engine_config
+{
+    const char *name;      // "S2", for log lines
+    const char *root;      // storage root, ~S1/ paths resolve below it
+    const char *extension; // the file type this node stores
+    // Serves a connection in a forked child, starting with request (already read from
+    // the socket) or, if request is NULL, by reading the first request itself
+    void (*fallback)(int client_socket, char *request);
+};
+
+// Number of engine processes DFS_WORKERS asks for. A node sets SO_REUSEPORT on its
+// listening socket before binding it when this is above 1.
+int dfs_engine_workers(void);
+
+// Serves the listening socket until the process exits. Returns only if DFS_ENGINE is
+// unset or off or no engine could be started; the caller then runs its own accept loop.
+void dfs_engine_run(int server_socket, const struct dfs_engine_config *config);
+
+#endif
@@ -0,0 +1,328 @@
+// dfs_fault.c - Fault injection in the socket and disk I/O of the servers, for tail-latency tests.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "dfs_fault.h"
+#include "dfs_log.h"
+
+#define SOCKETS 4096 // sockets with a descriptor above this are not faulted
+
+enum
+{
+    DIST_NONE,
+    DIST_FIXED,
+    DIST_UNIFORM,
+    DIST_EXP,
+    DIST_TAIL
+};
+
+struct dist
+{
+    int kind;
+    double a, b; // fixed: a; uniform: a to b; exp: mean a; tail: b to a percent of draws
+};
+
+static struct
+{
+    int on;
+    struct dist delay, connect, disk;
+    double refuse;
+    long partial;
+    long reset;
+    double reset_percent;
+    double disk_mbps;
+    int port;
+    unsigned long seed;
+} fault;
+
+// per socket, recognised by its inode so a reused descriptor starts over
+static struct
+{
+    ino_t ino;
+    char faulted;
+    long bytes;
+    long reset_at; // -1: never
+} sockets[SOCKETS];
+
+static unsigned long long rng;
+static pid_t rng_pid;
+
+// uniform in (0, 1], a stream of its own in every forked handler
+static double uniform(void)
+{
+    if (rng_pid != getpid())
+    {
+        // splitmix64 of seed and pid, so handlers forked one after another draw apart
+        rng_pid = getpid();
+        rng = fault.seed * 0x9E3779B97F4A7C15ULL + (unsigned long long)rng_pid;
+        rng = (rng ^ (rng >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        rng = (rng ^ (rng >> 27)) * 0x94D049BB133111EBULL;
+        rng = (rng ^ (rng >> 31)) | 1;
+    }
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return ((rng >> 11) + 1) / 9007199254740992.0;
+}
+
+// natural log of x in (0, 1], so the servers do not need libm for exp:<mean>
+static double log_unit(double x)
+{
+    int halvings = 0;
+    while (x < 0.5)
+    {
+        x *= 2;
+        halvings++;
+    }
+    double t = (x - 1) / (x + 1), term = t, sum = 0;
+    for (int i = 1; i < 24; i += 2)
+    {
+        sum += term / i;
+        term *= t * t;
+    }
+    return 2 * sum - halvings * 0.69314718055994531;
+}
+
+// a draw in ms
+static double draw(const struct dist *d)
+{
+    switch (d->kind)
+    {
+    case DIST_FIXED:
+        return d->a;
+    case DIST_UNIFORM:
+        return d->a + (d->b - d->a) * uniform();
+    case DIST_EXP:
+        return -d->a * log_unit(uniform());
+    case DIST_TAIL:
+        return uniform() * 100 < d->a ? d->b : 0;
+    }
+    return 0;
+}
+
+static void pause_ms(double ms)
+{
+    if (ms > 0)
+    {
+        usleep((useconds_t)(ms * 1000));
+    }
+}
+
+static int parse_dist(const char *text, struct dist *d)
+{
+    char end;
+    if (sscanf(text, "uniform:%lf:%lf%c", &d->a, &d->b, &end) == 2 && d->a >= 0 && d->b >= d->a)
+    {
+        d->kind = DIST_UNIFORM;
+    }
+    else if (sscanf(text, "exp:%lf%c", &d->a, &end) == 1 && d->a >= 0)
+    {
+        d->kind = DIST_EXP;
+    }
+    else if (sscanf(text, "tail:%lf:%lf%c", &d->a, &d->b, &end) == 2 && d->a >= 0 && d->b >= 0)
+    {
+        d->kind = DIST_TAIL;
+    }
+    else if (sscanf(text, "%lf%c", &d->a, &end) == 1 && d->a >= 0)
+    {
+        d->kind = DIST_FIXED;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_rule(char *rule)
+{
+    char *value = strchr(rule, '=');
+    if (value == NULL)
+    {
+        return -1;
+    }
+    *value++ = '\0';
+    char end;
+    if (strcmp(rule, "delay") == 0)
+    {
+        return parse_dist(value, &fault.delay);
+    }
+    if (strcmp(rule, "connect") == 0)
+    {
+        return parse_dist(value, &fault.connect);
+    }
+    if (strcmp(rule, "disk") == 0)
+    {
+        return parse_dist(value, &fault.disk);
+    }
+    if (strcmp(rule, "refuse") == 0)
+    {
+        return sscanf(value, "%lf%c", &fault.refuse, &end) == 1 ? 0 : -1;
+    }
+    if (strcmp(rule, "partial") == 0)
+    {
+        return sscanf(value, "%ld%c", &fault.partial, &end) == 1 && fault.partial > 0 ? 0 : -1;
+    }
+    if (strcmp(rule, "reset") == 0)
+    {
+        fault.reset_percent = 100;
+        int fields = sscanf(value, "%ld:%lf%c", &fault.reset, &fault.reset_percent, &end);
+        return (fields == 1 || fields == 2) && fault.reset > 0 ? 0 : -1;
+    }
+    if (strcmp(rule, "disk_mbps") == 0)
+    {
+        return sscanf(value, "%lf%c", &fault.disk_mbps, &end) == 1 && fault.disk_mbps >= 0 ? 0 : -1;
+    }
+    if (strcmp(rule, "port") == 0)
+    {
+        return sscanf(value, "%d%c", &fault.port, &end) == 1 ? 0 : -1;
+    }
+    if (strcmp(rule, "seed") == 0)
+    {
+        return sscanf(value, "%lu%c", &fault.seed, &end) == 1 ? 0 : -1;
+    }
+    return -1;
+}
+
+void dfs_fault_init(void)
+{
+    const char *spec = getenv("DFS_FAULT");
+    if (spec == NULL || *spec == '\0')
+    {
+        return;
+    }
+    fault.seed = 1;
+    char rules[1024];
+    snprintf(rules, sizeof(rules), "%s", spec);
+    char *saved;
+    for (char *rule = strtok_r(rules, ",", &saved); rule != NULL; rule = strtok_r(NULL, ",", &saved))
+    {
+        char text[256];
+        snprintf(text, sizeof(text), "%s", rule);
+        if (parse_rule(rule) < 0)
+        {
+            dfs_log(DFS_LOG_ERROR, "DFS_FAULT: cannot use \"%s\" (see dfs_fault.h)", text);
+            exit(1);
+        }
+    }
+    fault.on = 1;
+    dfs_log(DFS_LOG_WARN, "Fault injection on: %s", spec);
+}
+
+int dfs_fault_active(void)
+{
+    return fault.on;
+}
+
+static int port_of(struct sockaddr_storage *addr)
+{
+    return addr->ss_family == AF_INET ? ntohs(((struct sockaddr_in *)addr)->sin_port) : -1;
+}
+
+// looks sock up in sockets[], starting it over if it is a new socket; -1 if it is not faulted
+static int state_of(int sock)
+{
+    struct stat st;
+    if (sock < 0 || sock >= SOCKETS || fstat(sock, &st) != 0 || !S_ISSOCK(st.st_mode))
+    {
+        return -1;
+    }
+    if (sockets[sock].ino != st.st_ino)
+    {
+        sockets[sock].ino = st.st_ino;
+        sockets[sock].bytes = 0;
+        sockets[sock].faulted = 1;
+        if (fault.port > 0)
+        {
+            struct sockaddr_storage local, peer;
+            socklen_t local_len = sizeof(local), peer_len = sizeof(peer);
+            getsockname(sock, (struct sockaddr *)&local, &local_len);
+            int peer_port = getpeername(sock, (struct sockaddr *)&peer, &peer_len) == 0 ? port_of(&peer) : -1;
+            sockets[sock].faulted = port_of(&local) == fault.port || peer_port == fault.port;
+        }
+        sockets[sock].reset_at = fault.reset > 0 && uniform() * 100 <= fault.reset_percent ? fault.reset : -1;
+    }
+    return sockets[sock].faulted ? sock : -1;
+}
+
+int dfs_fault_socket(int sock, size_t *len, int sending)
+{
+    if (!fault.on || state_of(sock) < 0)
+    {
+        return 0;
+    }
+    pause_ms(draw(&fault.delay));
+    if (sending && fault.partial > 0 && *len > (size_t)fault.partial)
+    {
+        *len = fault.partial;
+    }
+    long reset_at = sockets[sock].reset_at;
+    if (reset_at >= 0)
+    {
+        if (sockets[sock].bytes >= reset_at)
+        {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (*len > (size_t)(reset_at - sockets[sock].bytes))
+        {
+            *len = reset_at - sockets[sock].bytes;
+        }
+    }
+    return 0;
+}
+
+void dfs_fault_moved(int sock, ssize_t n)
+{
+    if (!fault.on || n <= 0 || state_of(sock) < 0)
+    {
+        return;
+    }
+    sockets[sock].bytes += n;
+    if (sockets[sock].reset_at >= 0 && sockets[sock].bytes >= sockets[sock].reset_at)
+    {
+        // connecting a TCP socket to AF_UNSPEC aborts the connection with a RST and
+        // leaves the descriptor open, so the caller's next I/O fails as on a real reset
+        struct sockaddr unspec = {.sa_family = AF_UNSPEC};
+        connect(sock, &unspec, sizeof(unspec));
+        dfs_log(DFS_LOG_WARN, "Fault: connection reset after %ld bytes", sockets[sock].bytes);
+    }
+}
+
+int dfs_fault_connect(int port)
+{
+    if (!fault.on || (fault.port > 0 && port != fault.port))
+    {
+        return 0;
+    }
+    pause_ms(draw(&fault.connect));
+    if (fault.refuse > 0 && uniform() * 100 <= fault.refuse)
+    {
+        dfs_log(DFS_LOG_WARN, "Fault: connection to port %d refused", port);
+        errno = ECONNREFUSED;
+        return -1;
+    }
+    return 0;
+}
+
+void dfs_fault_disk(long bytes)
+{
+    if (!fault.on)
+    {
+        return;
+    }
+    double ms = draw(&fault.disk);
+    if (fault.disk_mbps > 0)
+    {
+        ms += bytes / fault.disk_mbps / 1000; // 1 MB/s moves a byte a microsecond
+    }
+    pause_ms(ms);
+}
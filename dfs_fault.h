@@ -0,0 +1,49 @@
+// dfs_fault.h - Fault injection in the socket and disk I/O of the servers, for tail-latency tests.
+//
+// DFS_FAULT=<rule>[,<rule>...] makes the server it is set for misbehave:
+//   delay=<dist>          added before every send and recv (dfs_send, dfs_recv)
+//   connect=<dist>        added before every connect to another server
+//   refuse=<percent>      that share of connects to other servers fail with ECONNREFUSED
+//   partial=<bytes>       a longer send moves only bytes, as one that times out on a full
+//                         socket buffer does; the caller has to send the rest
+//   reset=<bytes>[:<pct>] connections (pct of them, default all) are reset once bytes
+//                         have gone through them in either direction
+//   disk=<dist>           added before every read or write of file data
+//   disk_mbps=<MB/s>      file data is read and written no faster than this
+//   port=<port>           socket faults only on connections to or from port, e.g. S1's
+//                         connections to S3 with port=7779
+//   seed=<n>              of the random draws (default 1), mixed with the handler's pid
+// A <dist> is in ms: <ms> (fixed), uniform:<lo>:<hi>, exp:<mean> or tail:<pct>:<ms> (ms
+// added to pct of the calls, none to the others). A reset aborts the connection with a
+// RST; the I/O that hits it fails with ECONNRESET. Unset, every hook returns at once.
+// The download engine (dfs_engine.h) has no hooks, so a node with DFS_FAULT set serves
+// every connection from forked handlers.
+
+#ifndef DFS_FAULT_H
+#define DFS_FAULT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Parses DFS_FAULT, exits on a rule it does not understand; call in main() after dfs_log_init
+void dfs_fault_init(void);
+
+// 1 when DFS_FAULT is set
+int dfs_fault_active(void);
+
+// Before a send (sending set) or recv of up to *len bytes on sock: sleeps the drawn delay
+// and lowers *len for partial sends and resets. Returns -1 with errno ECONNRESET if sock
+// has been reset.
+int dfs_fault_socket(int sock, size_t *len, int sending);
+
+// After a send or recv on sock returned n; resets the connection when it reaches its limit
+void dfs_fault_moved(int sock, ssize_t n);
+
+// Before connecting to port: sleeps the drawn delay, returns -1 with errno ECONNREFUSED
+// to refuse the connection
+int dfs_fault_connect(int port);
+
+// Before reading or writing bytes of file data: sleeps as a slow disk would
+void dfs_fault_disk(long bytes);
+
+#endif
@@ -0,0 +1,319 @@
+// dfs_fs.c - Paths, listings and tar archives of a storage root (all four servers).
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "dfs_fs.h"
+#include "dfs_meta.h"
+#include "dfs_pack.h"
+#include "dfs_probe.h"
+
+#define PACKED_TAR_MAX 10000 // packed files added to one tar
+
+// the names of a listing, back to back in one buffer
+struct names
+{
+    char *text;
+    size_t used;
+    size_t size;
+    size_t *offsets;
+    long count;
+    long max;
+};
+
+void dfs_fs_mkdirs(const char *path)
+{
+    // usually the directory is there already or only its last level is missing, so
+    // start at the end instead of trying every level from the root
+    if (mkdir(path, 0777) == 0 || errno != ENOENT)
+    {
+        return;
+    }
+    char parent[DFS_FS_PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s", path);
+    char *slash = strrchr(parent, '/');
+    while (slash != NULL && slash > parent && slash[1] == '\0')
+    {
+        *slash = '\0'; // a trailing slash names the same directory
+        slash = strrchr(parent, '/');
+    }
+    if (slash == NULL || slash == parent)
+    {
+        return;
+    }
+    *slash = '\0';
+    dfs_fs_mkdirs(parent);
+    mkdir(path, 0777);
+}
+
+void dfs_fs_resolve(char *resolved, const char *raw_path, const char *base_dir)
+{
+    if (strncmp(raw_path, "~S1/", 4) == 0)
+    {
+        snprintf(resolved, DFS_FS_PATH_MAX, "%s/%s", base_dir, raw_path + 4);
+    }
+    else
+    {
+        snprintf(resolved, DFS_FS_PATH_MAX, "%s", raw_path);
+    }
+}
+
+int dfs_fs_exists(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        return 0;
+    }
+    return S_ISDIR(st.st_mode) ? 2 : 1;
+}
+
+// adds the last component of path; -1 once the listing is full or out of memory
+static int add_name(struct names *n, const char *path)
+{
+    const char *name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+    size_t len = strlen(name) + 1;
+    if (n->count >= DFS_FS_LIST_MAX)
+    {
+        return -1;
+    }
+    if (n->used + len > n->size)
+    {
+        size_t size = n->size > 0 ? n->size * 2 : 16384;
+        while (size < n->used + len)
+        {
+            size *= 2;
+        }
+        char *text = realloc(n->text, size);
+        if (text == NULL)
+        {
+            return -1;
+        }
+        n->text = text;
+        n->size = size;
+    }
+    if (n->count == n->max)
+    {
+        long max = n->max > 0 ? n->max * 2 : 1024;
+        size_t *offsets = realloc(n->offsets, sizeof(size_t) * max);
+        if (offsets == NULL)
+        {
+            return -1;
+        }
+        n->offsets = offsets;
+        n->max = max;
+    }
+    memcpy(n->text + n->used, name, len);
+    n->offsets[n->count++] = n->used;
+    n->used += len;
+    return 0;
+}
+
+// from the metadata index; -1 if it is off
+static int list_indexed(const char *path, const char *extension, struct names *n)
+{
+    for (int max = 1024;; max *= 2)
+    {
+        struct dfs_meta_entry *entries = malloc(sizeof(struct dfs_meta_entry) * max);
+        if (entries == NULL)
+        {
+            return -1;
+        }
+        int found = dfs_meta_list(path, extension, entries, max);
+        if (found == max && max < DFS_FS_LIST_MAX)
+        {
+            free(entries); // there may be more
+            continue;
+        }
+        for (int i = 0; i < found && add_name(n, entries[i].path) == 0; i++)
+        {
+        }
+        free(entries);
+        return found;
+    }
+}
+
+// packed files have no inode of their own, find cannot see them
+static void list_packed(const char *path, const char *extension, struct names *n)
+{
+    for (int max = 1024;; max *= 2)
+    {
+        struct dfs_pack_file *packed = malloc(sizeof(struct dfs_pack_file) * max);
+        if (packed == NULL)
+        {
+            return;
+        }
+        int found = dfs_pack_list(path, extension, packed, max);
+        if (found == max && max < DFS_FS_LIST_MAX)
+        {
+            free(packed);
+            continue;
+        }
+        for (int i = 0; i < found && add_name(n, packed[i].path) == 0; i++)
+        {
+        }
+        free(packed);
+        return;
+    }
+}
+
+static int list_found(const char *path, const char *extension, struct names *n)
+{
+    char command[1024];
+    if (extension != NULL)
+    {
+        snprintf(command, sizeof(command), "find \"%s\" -type f -name \"*%s\" -not -path '*/.dfs/*'", path, extension);
+    }
+    else
+    {
+        snprintf(command, sizeof(command), "find \"%s\" -type f -not -path '*/.dfs/*'", path);
+    }
+    FILE *fp = popen(command, "r");
+    if (fp == NULL)
+    {
+        perror("popen failed");
+        return -1;
+    }
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_size, fp)) > 0)
+    {
+        if (line[len - 1] == '\n')
+        {
+            line[len - 1] = '\0';
+        }
+        if (add_name(n, line) < 0)
+        {
+            break;
+        }
+    }
+    free(line);
+    pclose(fp);
+    list_packed(path, extension, n);
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    const char *x = *(char *const *)a;
+    const char *y = *(char *const *)b;
+    int order = strcasecmp(x, y);
+    return order != 0 ? order : strcmp(x, y);
+}
+
+void dfs_fs_sort(char **names, long count)
+{
+    qsort(names, count, sizeof(char *), compare_names);
+}
+
+char *dfs_fs_list(const char *path, const char *extension, char *result, size_t result_size)
+{
+    if (path == NULL || result == NULL || result_size == 0)
+    {
+        return NULL;
+    }
+    result[0] = '\0';
+    if (dfs_fs_exists(path) != 2)
+    {
+        return NULL;
+    }
+    long list_started = DFS_PROBE_CLOCK(list_end);
+    DFS_PROBE1(list_start, path);
+
+    // the metadata index answers without walking the tree; find is only the fallback
+    struct names n;
+    memset(&n, 0, sizeof(n));
+    if (list_indexed(path, extension, &n) < 0 && list_found(path, extension, &n) < 0)
+    {
+        free(n.text);
+        free(n.offsets);
+        return NULL;
+    }
+
+    char **sorted = malloc(sizeof(char *) * (n.count > 0 ? n.count : 1));
+    long count = sorted != NULL ? n.count : 0;
+    for (long i = 0; i < count; i++)
+    {
+        sorted[i] = n.text + n.offsets[i];
+    }
+    dfs_fs_sort(sorted, count);
+    size_t used = 0;
+    for (long i = 0; i < count; i++)
+    {
+        size_t len = strlen(sorted[i]);
+        if (used + len + 1 >= result_size - 1)
+        {
+            break;
+        }
+        memcpy(result + used, sorted[i], len);
+        result[used + len] = '\n';
+        used += len + 1;
+    }
+    result[used] = '\0';
+    free(sorted);
+    free(n.text);
+    free(n.offsets);
+    DFS_PROBE3(list_end, path, count, DFS_PROBE_SINCE(list_started));
+    return result;
+}
+
+static long count_lines(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    char buffer[65536];
+    size_t n;
+    long lines = 0;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    {
+        for (char *p = buffer; (p = memchr(p, '\n', buffer + n - p)) != NULL; p++)
+        {
+            lines++;
+        }
+    }
+    fclose(fp);
+    return lines;
+}
+
+int dfs_fs_tar(const char *root, const char *extension, const char *tar_path)
+{
+    // one walk of the tree: its list both tells whether there is anything and feeds tar
+    char list_path[DFS_FS_PATH_MAX + 8];
+    snprintf(list_path, sizeof(list_path), "%s.list", tar_path);
+    char command[2 * DFS_FS_PATH_MAX + 128];
+    snprintf(command, sizeof(command), "find \"%s\" -type f -name '*%s' -not -path '*/.dfs/*' > \"%s\"", root,
+             extension, list_path);
+    long files = system(command) == 0 ? count_lines(list_path) : -1;
+
+    // regular files go through tar, packed ones are appended straight from their segments
+    struct dfs_pack_file *packed = malloc(sizeof(struct dfs_pack_file) * PACKED_TAR_MAX);
+    int packed_count = packed != NULL ? dfs_pack_list(root, extension, packed, PACKED_TAR_MAX) : 0;
+    int ok = files >= 0;
+    if (ok && files > 0)
+    {
+        snprintf(command, sizeof(command), "tar -cf \"%s\" -T \"%s\"", tar_path, list_path);
+        ok = system(command) == 0;
+    }
+    if (ok && packed_count > 0)
+    {
+        ok = dfs_pack_write_tar(tar_path, packed, packed_count) >= 0;
+    }
+    free(packed);
+    remove(list_path);
+    if (!ok || files + packed_count == 0)
+    {
+        remove(tar_path);
+        return ok ? 0 : -1;
+    }
+    return files + packed_count;
+}
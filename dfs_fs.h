@@ -0,0 +1,39 @@
+// dfs_fs.h - Paths, listings and tar archives of a storage root (all four servers).
+//
+// Clients name files by their place in S1's tree ("~S1/dir/file.pdf"); every server maps
+// that onto its own storage root. Listings come from the metadata index when it is on and
+// from find plus the pack store otherwise, and are sorted case-insensitively with no
+// limit on the number of files (up to DFS_FS_LIST_MAX). bench/fs_bench.c measures these.
+
+#ifndef DFS_FS_H
+#define DFS_FS_H
+
+#include <stddef.h>
+
+#define DFS_FS_PATH_MAX 512
+#define DFS_FS_LIST_MAX (1 << 20) // files one listing looks at
+
+// Creates path and any missing parent directories (mkdir -p)
+void dfs_fs_mkdirs(const char *path);
+
+// Maps "~S1/..." onto base_dir and copies any other path as it is; resolved has room for
+// DFS_FS_PATH_MAX bytes
+void dfs_fs_resolve(char *resolved, const char *raw_path, const char *base_dir);
+
+// 2 if path is a directory, 1 if it is another kind of file, 0 if it does not exist
+int dfs_fs_exists(const char *path);
+
+// Writes the names of the files under path (recursively) that end in extension (NULL for
+// all) into result, sorted, one per line; names past the end of result are left out.
+// Returns result, or NULL if path is not a directory or could not be listed.
+char *dfs_fs_list(const char *path, const char *extension, char *result, size_t result_size);
+
+// Sorts names case-insensitively, byte order breaking ties
+void dfs_fs_sort(char **names, long count);
+
+// Archives the files under root that end in extension, packed ones included, into
+// tar_path. Returns the number of files archived; when it is 0 (none) or -1 (failure) no
+// archive is left behind.
+int dfs_fs_tar(const char *root, const char *extension, const char *tar_path);
+
+#endif
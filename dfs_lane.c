@@ -0,0 +1,248 @@
+// dfs_lane.c - Priority lanes for S1's requests.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/ioprio.h>
+
+#include "dfs_lane.h"
+#include "dfs_cluster.h"
+#include "dfs_backend.h"
+#include "dfs_trace.h"
+
+#define LANE_TABLE 512 // requests tracked at once, more than S1 runs handlers
+#define CONTENTION_CHECK_US 10000
+#define PACE_BATCH_BYTES 65536
+#define SWEEP_US 1000000
+#define LANE_WAITING DFS_LANES // a transfer waiting for a bulk slot counts in no lane
+
+// one request in progress; a handler killed mid-request is swept out by the others
+struct entry
+{
+    pid_t pid; // 0 if free
+    int lane;
+};
+
+struct lanes
+{
+    char lock; // serialises bulk slot hand-out
+    long pace_next_us; // the shared bulk budget is spent up to here
+    unsigned long served[DFS_LANES];
+    unsigned long bulk_waits;
+    unsigned long paced_us;
+    struct entry table[LANE_TABLE];
+};
+
+static struct lanes *lanes;
+static int bulk_slots, bulk_bytes, contended_mbps;
+
+// the request this handler is serving
+static struct entry *mine;
+static int saved_ioprio = -1;
+static long contention_checked_us, swept_us;
+static int contended;
+static long unpaced_bytes;
+
+void dfs_lane_init(void)
+{
+    lanes = mmap(NULL, sizeof(*lanes), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (lanes == MAP_FAILED)
+    {
+        perror("Lane table");
+        exit(1);
+    }
+    memset(lanes, 0, sizeof(*lanes));
+    bulk_slots = dfs_env_int("DFS_BULK_SLOTS", 2);
+    bulk_bytes = dfs_env_int("DFS_BULK_KB", 4096) * 1024;
+    contended_mbps = dfs_env_int("DFS_BULK_CONTENDED_MBPS", 64);
+}
+
+static void sweep(void)
+{
+    for (int i = 0; i < LANE_TABLE; i++)
+    {
+        pid_t pid = __atomic_load_n(&lanes->table[i].pid, __ATOMIC_RELAXED);
+        if (pid != 0 && kill(pid, 0) < 0 && errno == ESRCH)
+        {
+            __atomic_compare_exchange_n(&lanes->table[i].pid, &pid, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static int count_lane(int lane)
+{
+    int count = 0;
+    for (int i = 0; i < LANE_TABLE; i++)
+    {
+        count += __atomic_load_n(&lanes->table[i].pid, __ATOMIC_RELAXED) != 0 &&
+                 __atomic_load_n(&lanes->table[i].lane, __ATOMIC_RELAXED) == lane;
+    }
+    return count;
+}
+
+static void lower_io_priority(void)
+{
+    saved_ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, IOPRIO_BE_NR - 1));
+}
+
+// moves this handler's request to the bulk lane once a slot is free
+static void enter_bulk(void)
+{
+    int waited = 0;
+    long trace_started = dfs_trace_now();
+    __atomic_store_n(&mine->lane, LANE_WAITING, __ATOMIC_RELAXED);
+    while (bulk_slots > 0)
+    {
+        while (__atomic_test_and_set(&lanes->lock, __ATOMIC_ACQUIRE))
+        {
+            sched_yield();
+        }
+        int free_slot = count_lane(DFS_LANE_BULK) < bulk_slots;
+        if (free_slot)
+        {
+            __atomic_store_n(&mine->lane, DFS_LANE_BULK, __ATOMIC_RELAXED);
+        }
+        __atomic_clear(&lanes->lock, __ATOMIC_RELEASE);
+        if (free_slot)
+        {
+            break;
+        }
+        if (!waited)
+        {
+            waited = 1;
+            __atomic_fetch_add(&lanes->bulk_waits, 1, __ATOMIC_RELAXED);
+        }
+        usleep(10000);
+        sweep(); // a handler that died holding a slot
+    }
+    __atomic_store_n(&mine->lane, DFS_LANE_BULK, __ATOMIC_RELAXED);
+    if (waited)
+    {
+        dfs_trace_span("bulk slot wait", trace_started, NULL);
+    }
+    lower_io_priority();
+}
+
+void dfs_lane_begin(const char *command)
+{
+    if (lanes == NULL)
+    {
+        return;
+    }
+    int lane = DFS_LANE_META;
+    if (strncmp(command, "uploadf", 7) == 0 || strncmp(command, "downlf", 6) == 0)
+    {
+        lane = DFS_LANE_SMALL;
+    }
+    for (int i = 0; i < LANE_TABLE && mine == NULL; i++)
+    {
+        pid_t none = 0;
+        if (__atomic_compare_exchange_n(&lanes->table[i].pid, &none, getpid(), 0, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        {
+            mine = &lanes->table[i];
+        }
+    }
+    if (mine == NULL)
+    {
+        return; // table full: served without a lane
+    }
+    __atomic_store_n(&mine->lane, lane, __ATOMIC_RELAXED);
+    if (strncmp(command, "downltar", 8) == 0)
+    {
+        enter_bulk();
+    }
+    unpaced_bytes = 0;
+    contention_checked_us = 0;
+}
+
+void dfs_lane_size(long bytes)
+{
+    if (mine != NULL && mine->lane == DFS_LANE_SMALL && bytes >= bulk_bytes)
+    {
+        enter_bulk();
+    }
+}
+
+void dfs_lane_end(void)
+{
+    if (mine == NULL)
+    {
+        return;
+    }
+    __atomic_fetch_add(&lanes->served[mine->lane], 1, __ATOMIC_RELAXED);
+    if (saved_ioprio >= 0)
+    {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, saved_ioprio);
+        saved_ioprio = -1;
+    }
+    __atomic_store_n(&mine->pid, 0, __ATOMIC_RELEASE);
+    mine = NULL;
+}
+
+void dfs_lane_transfer(int bytes)
+{
+    if (mine == NULL || mine->lane != DFS_LANE_BULK || contended_mbps <= 0)
+    {
+        return;
+    }
+    long now = dfs_now_us();
+    if (now - contention_checked_us >= CONTENTION_CHECK_US)
+    {
+        contention_checked_us = now;
+        contended = count_lane(DFS_LANE_META) + count_lane(DFS_LANE_SMALL) > 0;
+        if (contended && now - swept_us >= SWEEP_US)
+        {
+            swept_us = now;
+            sweep(); // the interactive request may be a dead handler's
+        }
+    }
+    if (!contended)
+    {
+        unpaced_bytes = 0;
+        return;
+    }
+    unpaced_bytes += bytes;
+    if (unpaced_bytes < PACE_BATCH_BYTES)
+    {
+        return;
+    }
+    // reserve the next stretch of the budget all bulk transfers share (1 MB/s is 1 byte/us)
+    long cost = unpaced_bytes / contended_mbps;
+    unpaced_bytes = 0;
+    long start, prev = __atomic_load_n(&lanes->pace_next_us, __ATOMIC_RELAXED);
+    do
+    {
+        start = prev > now ? prev : now;
+    } while (!__atomic_compare_exchange_n(&lanes->pace_next_us, &prev, start + cost, 0, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    if (start > now)
+    {
+        usleep(start - now);
+        __atomic_fetch_add(&lanes->paced_us, start - now, __ATOMIC_RELAXED);
+    }
+}
+
+void dfs_lane_snapshot(struct dfs_lane_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (lanes == NULL)
+    {
+        return;
+    }
+    for (int lane = 0; lane < DFS_LANES; lane++)
+    {
+        out->active[lane] = count_lane(lane);
+        out->served[lane] = lanes->served[lane];
+    }
+    out->bulk_waits = lanes->bulk_waits;
+    out->paced_us = lanes->paced_us;
+}
@@ -0,0 +1,48 @@
+// dfs_lane.h - Priority lanes for S1's requests.
+//
+// Each request is put in one of three lanes. Metadata requests (dispfnames, removef,
+// statf) never wait for anything. Transfers start in the small lane and move to the
+// bulk lane once their size is known to be at least DFS_BULK_KB (default 4096), and
+// downltar is always bulk. Bulk transfers are limited in three ways:
+//  - at most DFS_BULK_SLOTS (default 2) run at once, later ones wait their turn;
+//  - while a metadata or small request is in progress anywhere in S1, all bulk
+//    transfers together are paced to DFS_BULK_CONTENDED_MBPS (default 64) and run at
+//    full speed again once it is done (0 turns the pacing off);
+//  - a bulk handler drops to the lowest best-effort disk I/O priority.
+// The counters live in shared memory created before S1 starts forking.
+
+#ifndef DFS_LANE_H
+#define DFS_LANE_H
+
+#define DFS_LANE_META 0
+#define DFS_LANE_SMALL 1
+#define DFS_LANE_BULK 2
+#define DFS_LANES 3
+
+struct dfs_lane_stats
+{
+    int active[DFS_LANES];          // requests in progress
+    unsigned long served[DFS_LANES]; // requests finished
+    unsigned long bulk_waits;        // bulk transfers that had to wait for a slot
+    unsigned long paced_us;          // time bulk transfers slept while being paced
+};
+
+// Maps the shared counters, must be called once in S1's main() before the accept loop
+void dfs_lane_init(void);
+
+// A request with this command starts in its lane; every dfs_lane_begin is paired
+// with a dfs_lane_end once the reply has been sent
+void dfs_lane_begin(const char *command);
+void dfs_lane_end(void);
+
+// The transfer of the current request is bytes long; large ones move to the bulk lane
+// and may wait there for a slot
+void dfs_lane_size(long bytes);
+
+// Called after each chunk relayed for the current request, sleeps if it is paced
+void dfs_lane_transfer(int bytes);
+
+// Current counters of all handlers
+void dfs_lane_snapshot(struct dfs_lane_stats *out);
+
+#endif
@@ -0,0 +1,414 @@
+// dfs_log.c - Leveled log written off the request path.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#include "dfs_log.h"
+#include "dfs_cluster.h"
+
+#define SLOTS 4096        // ring capacity
+#define SLOT_TEXT 232     // message bytes per slot, a slot is 256 bytes
+#define MESSAGE_MAX 16384 // longer messages (large listings) are cut
+#define SITES 256         // rate limit buckets, call sites are hashed into them
+#define OUT_MAX 65536     // the writer's batch
+#define STUCK_US 1000000  // a slot claimed and not published this long was left by a dead handler
+
+#define SLOT_FIRST 1
+#define SLOT_LAST 2
+
+struct slot
+{
+    unsigned long seq; // its position while free, position + 1 once published, + SLOTS once read
+    long time_us;
+    int pid;
+    unsigned char level;
+    unsigned char flags;
+    unsigned short len;
+    char text[SLOT_TEXT];
+};
+
+struct site
+{
+    long second;
+    unsigned int count;
+    unsigned int suppressed;
+};
+
+struct ring
+{
+    unsigned long head;    // next position to claim
+    unsigned long dropped; // messages lost to a full ring
+    unsigned int sleeping; // futex word, 1 while the writer waits for messages
+    struct site sites[SITES];
+    struct slot slots[SLOTS];
+};
+
+static const char *level_names[] = {"debug", "info", "warn", "error"};
+
+static struct ring *ring; // shared by every process of the server, NULL in the client
+static int threshold = DFS_LOG_INFO;
+static int rate;
+static char server_name[16];
+static int server_port;
+static volatile sig_atomic_t stopping;
+
+static void writer(void);
+
+void dfs_log_init(const char *name, int port)
+{
+    snprintf(server_name, sizeof(server_name), "%s", name);
+    server_port = port;
+    const char *level = getenv("DFS_LOG_LEVEL");
+    if (level != NULL && *level != '\0')
+    {
+        int found = -1;
+        for (int i = DFS_LOG_DEBUG; i <= DFS_LOG_ERROR; i++)
+        {
+            if (strcasecmp(level, level_names[i]) == 0)
+            {
+                found = i;
+            }
+        }
+        if (found < 0)
+        {
+            fprintf(stderr, "Ignoring invalid DFS_LOG_LEVEL=%s\n", level);
+        }
+        else
+        {
+            threshold = found;
+        }
+    }
+    rate = dfs_env_int("DFS_LOG_RATE", 50);
+
+    void *mem = mmap(NULL, sizeof(struct ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("Log ring"); // log directly instead
+        return;
+    }
+    ring = mem;
+    for (unsigned long i = 0; i < SLOTS; i++)
+    {
+        ring->slots[i].seq = i;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        writer();
+        exit(0);
+    }
+    if (pid < 0)
+    {
+        perror("Log writer");
+        munmap(ring, sizeof(struct ring));
+        ring = NULL;
+    }
+}
+
+int dfs_log_enabled(int level)
+{
+    return level >= threshold;
+}
+
+// 1 if the call site may log this second; *suppressed is set to what it lost before
+static int allow(const char *format, long second, unsigned int *suppressed)
+{
+    *suppressed = 0;
+    if (rate <= 0)
+    {
+        return 1;
+    }
+    // the format string's address names the call site, it is the same in every forked process
+    struct site *s = &ring->sites[((unsigned long)format * 0x9E3779B97F4A7C15UL >> 32) % SITES];
+    long seen = __atomic_load_n(&s->second, __ATOMIC_RELAXED);
+    if (seen != second && __atomic_compare_exchange_n(&s->second, &seen, second, 0, __ATOMIC_RELAXED,
+                                                      __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&s->count, 0, __ATOMIC_RELAXED);
+    }
+    if (__atomic_add_fetch(&s->count, 1, __ATOMIC_RELAXED) > (unsigned int)rate)
+    {
+        __atomic_add_fetch(&s->suppressed, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    *suppressed = __atomic_exchange_n(&s->suppressed, 0, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// claims n consecutive slots, returns the first position or -1 if the ring is full
+static long claim(unsigned int n)
+{
+    unsigned long pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        // the writer frees slots in order, so when the last one is free they all are
+        unsigned long last = pos + n - 1;
+        long diff = (long)(__atomic_load_n(&ring->slots[last % SLOTS].seq, __ATOMIC_ACQUIRE) - last);
+        if (diff < 0)
+        {
+            return -1;
+        }
+        if (diff > 0)
+        {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED); // another handler claimed it
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&ring->head, &pos, pos + n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            return (long)pos;
+        }
+    }
+}
+
+void dfs_log(int level, const char *format, ...)
+{
+    if (level < threshold)
+    {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    unsigned int suppressed = 0;
+    if (ring != NULL && !allow(format, now.tv_sec, &suppressed))
+    {
+        return;
+    }
+
+    char message[MESSAGE_MAX];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (len < 0)
+    {
+        return;
+    }
+    if (len >= (int)sizeof(message))
+    {
+        len = sizeof(message) - 1;
+    }
+    while (len > 0 && message[len - 1] == '\n')
+    {
+        len--;
+    }
+    if (suppressed > 0)
+    {
+        len += snprintf(message + len, sizeof(message) - len, " (%u similar messages suppressed)", suppressed);
+        if (len >= (int)sizeof(message))
+        {
+            len = sizeof(message) - 1;
+        }
+    }
+    if (ring == NULL)
+    {
+        printf("%.*s\n", len, message);
+        return;
+    }
+
+    unsigned int n = len > 0 ? (len + SLOT_TEXT - 1) / SLOT_TEXT : 1;
+    long pos = claim(n);
+    if (pos < 0)
+    {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    long time_us = now.tv_sec * 1000000L + now.tv_nsec / 1000;
+    int pid = getpid();
+    for (unsigned int i = 0; i < n; i++)
+    {
+        struct slot *s = &ring->slots[(pos + i) % SLOTS];
+        int part = len - (int)i * SLOT_TEXT;
+        s->time_us = time_us;
+        s->pid = pid;
+        s->level = level;
+        s->flags = (i == 0 ? SLOT_FIRST : 0) | (i == n - 1 ? SLOT_LAST : 0);
+        s->len = part < SLOT_TEXT ? part : SLOT_TEXT;
+        memcpy(s->text, message + i * SLOT_TEXT, s->len);
+        // fails only if the writer gave up waiting for this slot
+        unsigned long expected = pos + i;
+        __atomic_compare_exchange_n(&s->seq, &expected, pos + i + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+    if (__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST))
+    {
+        syscall(SYS_futex, &ring->sleeping, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+static void on_stop(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+static void write_all(const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, data, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return; // nobody reads the log any more
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+static long clock_us(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+// appends a line's fields for a message's first slot
+static size_t format_fields(char *out, size_t used, long time_us, int level, int pid)
+{
+    time_t seconds = time_us / 1000000;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    used += strftime(out + used, OUT_MAX - used, "ts=%Y-%m-%dT%H:%M:%S", &tm);
+    used += snprintf(out + used, OUT_MAX - used, ".%06ldZ level=%s server=%s port=%d pid=%d msg=\"",
+                     time_us % 1000000, level_names[level], server_name, server_port, pid);
+    return used;
+}
+
+// appends one slot; at most 2 * SLOT_TEXT + 128 bytes
+static size_t format_slot(char *out, size_t used, const struct slot *s, int *open)
+{
+    if (s->flags & SLOT_FIRST)
+    {
+        if (*open)
+        {
+            used += snprintf(out + used, OUT_MAX - used, "\"\n"); // its end was skipped
+        }
+        used = format_fields(out, used, s->time_us, s->level, s->pid);
+        *open = 1;
+    }
+    else if (!*open)
+    {
+        return used; // its start was skipped
+    }
+    for (int i = 0; i < s->len; i++)
+    {
+        unsigned char ch = s->text[i];
+        if (ch == '"' || ch == '\\')
+        {
+            out[used++] = '\\';
+            out[used++] = ch;
+        }
+        else if (ch == '\n')
+        {
+            out[used++] = '\\';
+            out[used++] = 'n';
+        }
+        else
+        {
+            out[used++] = ch < 0x20 ? ' ' : ch;
+        }
+    }
+    if (s->flags & SLOT_LAST)
+    {
+        out[used++] = '"';
+        out[used++] = '\n';
+        *open = 0;
+    }
+    return used;
+}
+
+// The writer process: copies published slots to stdout in order and frees them
+static void writer(void)
+{
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    // on shutdown it writes out what the handlers have published, then exits
+    signal(SIGTERM, on_stop);
+    signal(SIGINT, on_stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    static char out[OUT_MAX];
+    size_t used = 0;
+    int open = 0;
+    unsigned long tail = 0;
+    unsigned long reported = 0;
+    long stuck_since = 0;
+    for (;;)
+    {
+        struct slot *s = &ring->slots[tail % SLOTS];
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) == tail + 1)
+        {
+            used = format_slot(out, used, s, &open);
+            __atomic_store_n(&s->seq, tail + SLOTS, __ATOMIC_RELEASE);
+            tail++;
+            stuck_since = 0;
+            if (used > OUT_MAX - 2 * SLOT_TEXT - 256)
+            {
+                write_all(out, used);
+                used = 0;
+            }
+            continue;
+        }
+
+        // caught up with the handlers, or waiting for one that is still copying its message
+        unsigned long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped != reported && !open)
+        {
+            used = format_fields(out, used, clock_us(CLOCK_REALTIME), DFS_LOG_WARN, getpid());
+            used += snprintf(out + used, OUT_MAX - used, "%lu messages dropped, the log could not keep up\"\n",
+                             dropped - reported);
+            reported = dropped;
+        }
+        if (used > 0)
+        {
+            write_all(out, used);
+            used = 0;
+        }
+        if (stopping)
+        {
+            return;
+        }
+        int pending = __atomic_load_n(&ring->head, __ATOMIC_RELAXED) != tail;
+        if (pending)
+        {
+            long now = clock_us(CLOCK_MONOTONIC);
+            if (stuck_since == 0)
+            {
+                stuck_since = now;
+            }
+            else if (now - stuck_since > STUCK_US)
+            {
+                // its handler died while logging; a late publish fails on the sequence number
+                unsigned long expected = tail;
+                if (__atomic_compare_exchange_n(&s->seq, &expected, tail + SLOTS, 0, __ATOMIC_SEQ_CST,
+                                                __ATOMIC_RELAXED))
+                {
+                    tail++;
+                }
+                continue;
+            }
+        }
+        __atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&s->seq, __ATOMIC_SEQ_CST) != tail + 1)
+        {
+            struct timespec timeout = {0, pending ? 1000000 : 200000000};
+            syscall(SYS_futex, &ring->sleeping, FUTEX_WAIT, 1, &timeout, NULL, 0);
+        }
+        __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+    }
+}
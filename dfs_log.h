@@ -0,0 +1,39 @@
+// dfs_log.h - Leveled log written off the request path.
+//
+// Handlers format a message into a ring of fixed-size slots in shared memory and go on;
+// a writer process forked by dfs_log_init drains the ring to stdout in large writes, so a
+// slow terminal or pipe no longer stalls transfers. Slots are claimed with a compare and
+// swap and published with a sequence number, so any number of handler processes (and
+// the I/O engine's workers) log without locks. When the ring is full a message is
+// dropped and counted instead of waiting, and the writer reports how many were lost.
+//
+// Every message is one line of key=value fields:
+//   ts=2026-01-02T03:04:05.678901Z level=info server=S1 port=7777 pid=123 msg="..."
+// DFS_LOG_LEVEL (debug, info, warn or error; default info) sets the lowest level that is
+// kept, messages below it are not even formatted. Directory listings are logged at debug.
+// DFS_LOG_RATE (default 50) caps how many messages a single call site writes per second
+// across the whole server, 0 removes the cap; the next message let through says how many
+// were suppressed. Before dfs_log_init (in the client) messages are printed directly.
+
+#ifndef DFS_LOG_H
+#define DFS_LOG_H
+
+enum
+{
+    DFS_LOG_DEBUG,
+    DFS_LOG_INFO,
+    DFS_LOG_WARN,
+    DFS_LOG_ERROR
+};
+
+// Maps the ring and starts the writer; call first in main(), before anything forks.
+// name and port label every message.
+void dfs_log_init(const char *name, int port);
+
+// Logs one message (printf format, no trailing newline needed)
+void dfs_log(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// 1 if messages at level are kept, for skipping work done only to log
+int dfs_log_enabled(int level);
+
+#endif
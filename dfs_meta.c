@@ -0,0 +1,1027 @@
+// dfs_meta.c - Persistent metadata index of a storage root.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dfs_meta.h"
+#include "dfs_cluster.h"
+#include "dfs_pack.h"
+#include "dfs_log.h"
+
+#define META_MAGIC "DFSMETA1"
+#define DIRS_MAGIC "DFSDIRS1"
+#define WAL_MAGIC 0x4c415744 // "DWAL"
+#define OP_PUT 1
+#define OP_REMOVE 2
+
+// first record of the base file, the same size as an entry so the entries stay aligned
+struct meta_header
+{
+    char magic[8];
+    long count;
+    long generation; // bumped by every merge
+    char reserved[sizeof(struct dfs_meta_entry) - 24];
+};
+
+struct wal_record
+{
+    unsigned int magic;
+    unsigned int op;
+    struct dfs_meta_entry entry;
+    unsigned long long checksum;
+};
+
+// restart snapshot: a header followed by the sorted directories
+struct meta_dir
+{
+    char path[DFS_META_PATH_MAX]; // relative to the root, "" for the root itself
+    long mtime_sec;
+    long mtime_nsec;
+    char reserved[8];
+};
+
+struct dirs_header
+{
+    char magic[8];
+    long count;
+    long generation; // of the base the snapshot was taken against
+    long taken_at;   // directories changed from a second before this on are rechecked
+    char reserved[sizeof(struct meta_dir) - 32];
+};
+
+struct overlay_entry
+{
+    struct dfs_meta_entry entry;
+    int removed;
+};
+
+static int enabled;
+static char meta_root[512];
+static char meta_dir[512];
+static int wal_max;
+static int lock_fd = -1;
+static pid_t lock_owner;
+
+// this process's view: the mapped base plus the log records applied on top of it
+static pid_t view_owner;
+static void *base_map;
+static size_t base_map_size;
+static ino_t base_ino;
+static struct dfs_meta_entry *base;
+static long base_count;
+static long base_generation;
+static long wal_seen; // bytes of the log already in the overlay
+static struct overlay_entry *overlay;
+static int overlay_count;
+static int overlay_cap;
+
+// scan results while rebuilding
+static struct dfs_meta_entry *scanned;
+static long scanned_count;
+static long scanned_cap;
+
+// directories for the next restart snapshot
+static struct meta_dir *dirs;
+static long dirs_count;
+static long dirs_cap;
+
+unsigned long long dfs_meta_hash(unsigned long long hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+int dfs_meta_enabled(void)
+{
+    return enabled;
+}
+
+static void meta_file(const char *name, char *out, size_t out_size)
+{
+    snprintf(out, out_size, "%s/%s", meta_dir, name);
+}
+
+static const char *relative_path(const char *path)
+{
+    size_t root_len = strlen(meta_root);
+    if (strncmp(path, meta_root, root_len) != 0 || path[root_len] != '/')
+    {
+        return NULL;
+    }
+    const char *rel = path + root_len + 1;
+    return strlen(rel) < DFS_META_PATH_MAX ? rel : NULL;
+}
+
+// flock locks belong to the open file, so every process opens the lock file itself
+static int meta_lock(int mode)
+{
+    if (lock_fd < 0 || lock_owner != getpid())
+    {
+        char path[600];
+        meta_file("lock", path, sizeof(path));
+        lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        lock_owner = getpid();
+    }
+    return lock_fd >= 0 ? flock(lock_fd, mode) : -1;
+}
+
+static void meta_unlock(void)
+{
+    flock(lock_fd, LOCK_UN);
+}
+
+static unsigned long long record_checksum(const struct wal_record *r)
+{
+    return dfs_meta_hash(dfs_meta_hash(DFS_META_HASH_INIT, &r->op, sizeof(r->op)), &r->entry, sizeof(r->entry));
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const struct dfs_meta_entry *)a)->path, ((const struct dfs_meta_entry *)b)->path);
+}
+
+static void drop_view(void)
+{
+    if (base_map != NULL)
+    {
+        munmap(base_map, base_map_size);
+    }
+    base_map = NULL;
+    base = NULL;
+    base_count = 0;
+    wal_seen = 0;
+    overlay_count = 0;
+    view_owner = getpid();
+}
+
+// maps the base file, returns -1 if it is missing or damaged
+static int map_base(void)
+{
+    char path[600];
+    meta_file("base", path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct meta_header))
+    {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+    const struct meta_header *header = map;
+    if (memcmp(header->magic, META_MAGIC, 8) != 0 ||
+        st.st_size != (off_t)((header->count + 1) * sizeof(struct dfs_meta_entry)))
+    {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    base_map = map;
+    base_map_size = st.st_size;
+    base_ino = st.st_ino;
+    base = (struct dfs_meta_entry *)map + 1;
+    base_count = header->count;
+    base_generation = header->generation;
+    return 0;
+}
+
+static struct overlay_entry *overlay_find(const char *rel)
+{
+    for (int i = 0; i < overlay_count; i++)
+    {
+        if (strcmp(overlay[i].entry.path, rel) == 0)
+        {
+            return &overlay[i];
+        }
+    }
+    return NULL;
+}
+
+static void overlay_apply(int op, const struct dfs_meta_entry *entry)
+{
+    struct overlay_entry *o = overlay_find(entry->path);
+    if (o == NULL)
+    {
+        if (overlay_count == overlay_cap)
+        {
+            int cap = overlay_cap ? overlay_cap * 2 : 64;
+            struct overlay_entry *grown = realloc(overlay, sizeof(*overlay) * cap);
+            if (grown == NULL)
+            {
+                return;
+            }
+            overlay = grown;
+            overlay_cap = cap;
+        }
+        o = &overlay[overlay_count++];
+    }
+    o->entry = *entry;
+    o->removed = op == OP_REMOVE;
+}
+
+// applies log records written since the last look; returns the offset of the first bad one
+static long read_wal_tail(void)
+{
+    char path[600];
+    meta_file("wal", path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return wal_seen;
+    }
+    struct wal_record r;
+    while (pread(fd, &r, sizeof(r), wal_seen) == sizeof(r) && r.magic == WAL_MAGIC &&
+           r.checksum == record_checksum(&r))
+    {
+        r.entry.path[DFS_META_PATH_MAX - 1] = '\0';
+        overlay_apply(r.op, &r.entry);
+        wal_seen += sizeof(r);
+    }
+    close(fd);
+    return wal_seen;
+}
+
+// Brings this process's view up to date; the caller holds the lock (shared is enough).
+// A new base (after a merge) or a new process means starting over.
+static void refresh_view(void)
+{
+    char path[600];
+    meta_file("base", path, sizeof(path));
+    struct stat st;
+    if (view_owner != getpid() || base_map == NULL || stat(path, &st) != 0 || st.st_ino != base_ino)
+    {
+        drop_view();
+        map_base();
+    }
+    read_wal_tail();
+}
+
+static const struct dfs_meta_entry *lookup(const char *rel, int *removed)
+{
+    struct overlay_entry *o = overlay_find(rel);
+    if (o != NULL)
+    {
+        *removed = o->removed;
+        return &o->entry;
+    }
+    *removed = 0;
+    struct dfs_meta_entry key;
+    snprintf(key.path, sizeof(key.path), "%s", rel);
+    return base ? bsearch(&key, base, base_count, sizeof(*base), compare_entries) : NULL;
+}
+
+// writes a sorted entry array as the new base and empties the log
+static int write_base(const struct dfs_meta_entry *entries, long count, long generation)
+{
+    char path[600], tmp[600], wal[600];
+    meta_file("base", path, sizeof(path));
+    meta_file("base.tmp", tmp, sizeof(tmp));
+    meta_file("wal", wal, sizeof(wal));
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    struct meta_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, META_MAGIC, 8);
+    header.count = count;
+    header.generation = generation;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             (count == 0 || fwrite(entries, sizeof(*entries), count, fp) == (size_t)count);
+    ok = fflush(fp) == 0 && fdatasync(fileno(fp)) == 0 && ok;
+    fclose(fp);
+    if (!ok || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+    return truncate(wal, 0) == 0 || access(wal, F_OK) != 0 ? 0 : -1;
+}
+
+// merges the log into a new base; the caller holds the exclusive lock and a fresh view
+static void checkpoint(void)
+{
+    struct overlay_entry *sorted = malloc(sizeof(*sorted) * (overlay_count + 1));
+    struct dfs_meta_entry *merged = malloc(sizeof(*merged) * (base_count + overlay_count + 1));
+    if (sorted == NULL || merged == NULL)
+    {
+        free(sorted);
+        free(merged);
+        return;
+    }
+    memcpy(sorted, overlay, sizeof(*sorted) * overlay_count);
+    qsort(sorted, overlay_count, sizeof(*sorted), compare_entries); // entry is the first member
+
+    long count = 0, b = 0;
+    int o = 0;
+    while (b < base_count || o < overlay_count)
+    {
+        int cmp = b == base_count ? 1 : o == overlay_count ? -1 : strcmp(base[b].path, sorted[o].entry.path);
+        if (cmp < 0)
+        {
+            merged[count++] = base[b++];
+            continue;
+        }
+        if (!sorted[o].removed)
+        {
+            merged[count++] = sorted[o].entry;
+        }
+        b += cmp == 0;
+        o++;
+    }
+    if (write_base(merged, count, base_generation + 1) == 0)
+    {
+        dfs_log(DFS_LOG_INFO, "Metadata index merged %d logged changes, %ld files", overlay_count, count);
+    }
+    free(sorted);
+    free(merged);
+    drop_view();
+}
+
+static void log_change(int op, const char *path, long size, unsigned long long hash)
+{
+    const char *rel = relative_path(path);
+    if (!enabled || rel == NULL || meta_lock(LOCK_EX) < 0)
+    {
+        return;
+    }
+    refresh_view();
+    struct wal_record r;
+    memset(&r, 0, sizeof(r));
+    r.magic = WAL_MAGIC;
+    r.op = op;
+    snprintf(r.entry.path, sizeof(r.entry.path), "%s", rel);
+    r.entry.size = size;
+    r.entry.mtime = time(NULL);
+    r.entry.hash = hash;
+    r.checksum = record_checksum(&r);
+
+    char wal[600];
+    meta_file("wal", wal, sizeof(wal));
+    int fd = open(wal, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd >= 0 && write(fd, &r, sizeof(r)) == sizeof(r))
+    {
+        overlay_apply(op, &r.entry);
+        wal_seen += sizeof(r);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (wal_seen / (long)sizeof(r) >= wal_max)
+    {
+        checkpoint();
+    }
+    meta_unlock();
+}
+
+void dfs_meta_put(const char *path, long size, unsigned long long hash)
+{
+    log_change(OP_PUT, path, size, hash);
+}
+
+void dfs_meta_remove(const char *path)
+{
+    log_change(OP_REMOVE, path, 0, 0);
+}
+
+static int matches(const char *path, const char *prefix, size_t prefix_len, const char *extension)
+{
+    size_t n = strlen(path);
+    size_t ext_len = extension ? strlen(extension) : 0;
+    return strncmp(path, prefix, prefix_len) == 0 &&
+           (extension == NULL || (n >= ext_len && strcmp(path + n - ext_len, extension) == 0));
+}
+
+int dfs_meta_list(const char *dir, const char *extension, struct dfs_meta_entry *entries, int max)
+{
+    if (!enabled)
+    {
+        return -1;
+    }
+    char prefix[DFS_META_PATH_MAX + 1] = "";
+    if (strcmp(dir, meta_root) != 0)
+    {
+        const char *rel = relative_path(dir);
+        if (rel == NULL)
+        {
+            return 0;
+        }
+        snprintf(prefix, sizeof(prefix) - 1, "%s", rel);
+        size_t n = strlen(prefix);
+        while (n > 0 && prefix[n - 1] == '/')
+        {
+            prefix[--n] = '\0';
+        }
+        strcat(prefix, "/");
+    }
+    size_t prefix_len = strlen(prefix);
+
+    if (meta_lock(LOCK_SH) < 0)
+    {
+        return -1;
+    }
+    refresh_view();
+    meta_unlock();
+
+    // the base is sorted, so the directory is one contiguous range starting at the prefix
+    long lo = 0, hi = base_count;
+    while (lo < hi)
+    {
+        long mid = (lo + hi) / 2;
+        if (strcmp(base[mid].path, prefix) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    int count = 0;
+    for (long i = lo; i < base_count && count < max && strncmp(base[i].path, prefix, prefix_len) == 0; i++)
+    {
+        if (matches(base[i].path, prefix, prefix_len, extension) && overlay_find(base[i].path) == NULL)
+        {
+            entries[count++] = base[i];
+        }
+    }
+    for (int i = 0; i < overlay_count && count < max; i++)
+    {
+        if (!overlay[i].removed && matches(overlay[i].entry.path, prefix, prefix_len, extension))
+        {
+            entries[count++] = overlay[i].entry;
+        }
+    }
+    return count;
+}
+
+static unsigned long long hash_file(const char *path)
+{
+    unsigned long long hash = DFS_META_HASH_INIT;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return hash;
+    }
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        hash = dfs_meta_hash(hash, buffer, n);
+    }
+    close(fd);
+    return hash;
+}
+
+int dfs_meta_stat(const char *path, struct dfs_meta_entry *entry)
+{
+    const char *rel = relative_path(path);
+    if (enabled && rel != NULL && meta_lock(LOCK_SH) == 0)
+    {
+        refresh_view();
+        meta_unlock();
+        int removed;
+        const struct dfs_meta_entry *found = lookup(rel, &removed);
+        if (found == NULL || removed)
+        {
+            return 0;
+        }
+        *entry = *found;
+        return 1;
+    }
+
+    // no index: ask the filesystem, then the pack store
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->path, sizeof(entry->path), "%s", rel ? rel : path);
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        entry->size = st.st_size;
+        entry->mtime = st.st_mtime;
+        entry->hash = hash_file(path);
+        return 1;
+    }
+    int len;
+    char *data = dfs_pack_load(path, &len);
+    if (data != NULL)
+    {
+        entry->size = len;
+        entry->mtime = time(NULL);
+        entry->hash = dfs_meta_hash(DFS_META_HASH_INIT, data, len);
+        free(data);
+        return 1;
+    }
+    return 0;
+}
+
+void dfs_meta_describe(const char *path, char *out, size_t out_size)
+{
+    struct dfs_meta_entry entry;
+    if (dfs_meta_stat(path, &entry))
+    {
+        snprintf(out, out_size, "size %ld mtime %ld hash %016llx", entry.size, entry.mtime, entry.hash);
+    }
+    else
+    {
+        snprintf(out, out_size, "File not found");
+    }
+}
+
+static void scanned_add(const struct dfs_meta_entry *entry)
+{
+    if (scanned_count == scanned_cap)
+    {
+        long cap = scanned_cap ? scanned_cap * 2 : 1024;
+        struct dfs_meta_entry *grown = realloc(scanned, sizeof(*scanned) * cap);
+        if (grown == NULL)
+        {
+            return;
+        }
+        scanned = grown;
+        scanned_cap = cap;
+    }
+    scanned[scanned_count++] = *entry;
+}
+
+static int scan_visit(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    if (type == FTW_D && strcmp(path + ftw->base, ".dfs") == 0)
+    {
+        return FTW_SKIP_SUBTREE; // node-private data (pack segments, stripes, this index)
+    }
+    const char *rel = relative_path(path);
+    if (type != FTW_F || !S_ISREG(st->st_mode) || rel == NULL)
+    {
+        return FTW_CONTINUE;
+    }
+    struct dfs_meta_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    snprintf(entry.path, sizeof(entry.path), "%s", rel);
+    entry.size = st->st_size;
+    entry.mtime = st->st_mtime;
+    entry.hash = hash_file(path);
+    scanned_add(&entry);
+    return FTW_CONTINUE;
+}
+
+int dfs_meta_sync_file(const char *path)
+{
+    if (!enabled || relative_path(path) == NULL)
+    {
+        return 0;
+    }
+    struct stat st;
+    struct dfs_meta_entry entry;
+    int indexed = dfs_meta_stat(path, &entry);
+    if (lstat(path, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        // indexed after its last write, which is the case for everything the server stored itself
+        if (indexed && entry.size == st.st_size && entry.mtime >= st.st_mtime)
+        {
+            return 0;
+        }
+        dfs_meta_put(path, st.st_size, hash_file(path));
+        return 1;
+    }
+    int len;
+    char *packed = indexed ? dfs_pack_load(path, &len) : NULL;
+    if (!indexed || packed != NULL)
+    {
+        free(packed);
+        return 0;
+    }
+    dfs_meta_remove(path);
+    return 1;
+}
+
+static int reconciled; // changes made by the running reconcile
+
+static int reconcile_visit(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void)st;
+    if (type == FTW_D && strcmp(path + ftw->base, ".dfs") == 0)
+    {
+        return FTW_SKIP_SUBTREE;
+    }
+    if (type == FTW_F)
+    {
+        reconciled += dfs_meta_sync_file(path);
+    }
+    return FTW_CONTINUE;
+}
+
+int dfs_meta_reconcile(const char *dir, int recursive)
+{
+    if (!enabled)
+    {
+        return 0;
+    }
+    char path[1024];
+    reconciled = 0;
+
+    // files on disk that are new or changed
+    if (recursive)
+    {
+        nftw(dir, reconcile_visit, 32, FTW_PHYS | FTW_ACTIONRETVAL);
+    }
+    else
+    {
+        DIR *d = opendir(dir);
+        struct dirent *de;
+        while (d != NULL && (de = readdir(d)) != NULL)
+        {
+            if (de->d_name[0] == '.' && (de->d_name[1] == '\0' || strcmp(de->d_name, "..") == 0))
+            {
+                continue;
+            }
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            reconciled += dfs_meta_sync_file(path);
+        }
+        if (d != NULL)
+        {
+            closedir(d);
+        }
+    }
+
+    // entries whose file is gone
+    int cap = 1024, count;
+    struct dfs_meta_entry *entries = NULL;
+    while (1)
+    {
+        struct dfs_meta_entry *grown = realloc(entries, sizeof(*entries) * cap);
+        if (grown == NULL)
+        {
+            free(entries);
+            return reconciled;
+        }
+        entries = grown;
+        count = dfs_meta_list(dir, NULL, entries, cap);
+        if (count < cap)
+        {
+            break;
+        }
+        cap *= 2;
+    }
+    size_t dir_len = strlen(dir);
+    while (dir_len > 1 && dir[dir_len - 1] == '/')
+    {
+        dir_len--;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", meta_root, entries[i].path);
+        if (!recursive && (size_t)(strrchr(path, '/') - path) != dir_len)
+        {
+            continue; // in a subdirectory
+        }
+        reconciled += dfs_meta_sync_file(path);
+    }
+    free(entries);
+    return reconciled;
+}
+
+// rebuilds the base from the files under the root and the pack store
+static int rebuild_from_scan(void)
+{
+    scanned_count = 0;
+    nftw(meta_root, scan_visit, 32, FTW_PHYS | FTW_ACTIONRETVAL);
+
+    int capacity = dfs_pack_capacity();
+    struct dfs_pack_file *packed = capacity > 0 ? malloc(sizeof(*packed) * capacity) : NULL;
+    int packed_count = packed ? dfs_pack_list(meta_root, NULL, packed, capacity) : 0;
+    for (int i = 0; i < packed_count; i++)
+    {
+        const char *rel = relative_path(packed[i].path);
+        int len;
+        char *data = rel ? dfs_pack_load(packed[i].path, &len) : NULL;
+        if (data == NULL)
+        {
+            continue;
+        }
+        struct dfs_meta_entry entry;
+        memset(&entry, 0, sizeof(entry));
+        snprintf(entry.path, sizeof(entry.path), "%s", rel);
+        entry.size = len;
+        entry.mtime = packed[i].mtime;
+        entry.hash = dfs_meta_hash(DFS_META_HASH_INIT, data, len);
+        free(data);
+        scanned_add(&entry);
+    }
+    free(packed);
+
+    qsort(scanned, scanned_count, sizeof(*scanned), compare_entries);
+    int result = write_base(scanned, scanned_count, 1);
+    free(scanned);
+    scanned = NULL;
+    scanned_cap = 0;
+    return result;
+}
+
+static int compare_dirs(const void *a, const void *b)
+{
+    return strcmp(((const struct meta_dir *)a)->path, ((const struct meta_dir *)b)->path);
+}
+
+static void dirs_add(const char *rel, const struct stat *st)
+{
+    if (dirs_count == dirs_cap)
+    {
+        long cap = dirs_cap ? dirs_cap * 2 : 256;
+        struct meta_dir *grown = realloc(dirs, sizeof(*dirs) * cap);
+        if (grown == NULL)
+        {
+            return;
+        }
+        dirs = grown;
+        dirs_cap = cap;
+    }
+    struct meta_dir *d = &dirs[dirs_count++];
+    memset(d, 0, sizeof(*d));
+    snprintf(d->path, sizeof(d->path), "%s", rel);
+    d->mtime_sec = st->st_mtim.tv_sec;
+    d->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+static const char *dir_relative_path(const char *path)
+{
+    return strcmp(path, meta_root) == 0 ? "" : relative_path(path);
+}
+
+// adds path and every directory below it; only directories are stat'ed
+static void walk_dirs(const char *path)
+{
+    struct stat st;
+    const char *rel = dir_relative_path(path);
+    if (rel == NULL || lstat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        return;
+    }
+    dirs_add(rel, &st);
+    DIR *d = opendir(path);
+    struct dirent *de;
+    while (d != NULL && (de = readdir(d)) != NULL)
+    {
+        if ((de->d_type != DT_DIR && de->d_type != DT_UNKNOWN) || strcmp(de->d_name, ".") == 0 ||
+            strcmp(de->d_name, "..") == 0 || strcmp(de->d_name, ".dfs") == 0)
+        {
+            continue;
+        }
+        char child[1024];
+        snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+        walk_dirs(child);
+    }
+    if (d != NULL)
+    {
+        closedir(d);
+    }
+}
+
+// writes the collected directories as the restart snapshot
+static void write_dirs(long taken_at)
+{
+    char path[600], tmp[600];
+    meta_file("dirs", path, sizeof(path));
+    meta_file("dirs.tmp", tmp, sizeof(tmp));
+    if (meta_lock(LOCK_SH) < 0)
+    {
+        return;
+    }
+    refresh_view();
+    struct dirs_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DIRS_MAGIC, 8);
+    header.count = dirs_count;
+    header.generation = base_generation;
+    header.taken_at = taken_at;
+    meta_unlock();
+
+    qsort(dirs, dirs_count, sizeof(*dirs), compare_dirs);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL)
+    {
+        return;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             (dirs_count == 0 || fwrite(dirs, sizeof(*dirs), dirs_count, fp) == (size_t)dirs_count);
+    ok = fflush(fp) == 0 && fdatasync(fileno(fp)) == 0 && ok;
+    fclose(fp);
+    if (!ok || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+    }
+}
+
+void dfs_meta_snapshot_dirs(char *const *paths, int count, long taken_at)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    dirs_count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        struct stat st;
+        const char *rel = paths[i] ? dir_relative_path(paths[i]) : NULL;
+        if (rel != NULL && lstat(paths[i], &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            dirs_add(rel, &st);
+        }
+    }
+    write_dirs(taken_at);
+}
+
+// Reconciles the directories that changed since the restart snapshot and collects the
+// current directory list. Returns how many were reconciled, -1 if the snapshot is
+// missing or not trustworthy. *recorded is set to the number of directories in it.
+static long warm_reconcile(long *recorded)
+{
+    char path[600];
+    meta_file("dirs", path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct dirs_header))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+    const struct dirs_header *header = map;
+    const struct meta_dir *snapshot = (const struct meta_dir *)map + 1;
+    size_t map_size = st.st_size;
+    if (memcmp(header->magic, DIRS_MAGIC, 8) != 0 ||
+        map_size != (header->count + 1) * sizeof(struct meta_dir) || header->generation > base_generation)
+    {
+        munmap(map, map_size);
+        return -1;
+    }
+    *recorded = header->count;
+
+    long changed = 0;
+    char gone[DFS_META_PATH_MAX + 1] = ""; // prefix of the last directory found missing
+    size_t gone_len = 0;
+    dirs_count = 0;
+    for (long i = 0; i < header->count; i++)
+    {
+        const struct meta_dir *d = &snapshot[i];
+        char full[1024];
+        snprintf(full, sizeof(full), "%s%s%s", meta_root, d->path[0] ? "/" : "", d->path);
+        if (gone_len > 0 && strncmp(d->path, gone, gone_len) == 0)
+        {
+            continue; // inside a directory already dropped
+        }
+        if (lstat(full, &st) != 0 || !S_ISDIR(st.st_mode))
+        {
+            dfs_meta_reconcile(full, 1);
+            snprintf(gone, sizeof(gone), "%s/", d->path);
+            gone_len = strlen(gone);
+            changed++;
+            continue;
+        }
+        dirs_add(d->path, &st);
+        if (d->mtime_sec == st.st_mtim.tv_sec && d->mtime_nsec == st.st_mtim.tv_nsec &&
+            d->mtime_sec < header->taken_at - 1)
+        {
+            continue;
+        }
+        // an entry was added, removed or renamed here: its files, and subdirectories that are new
+        dfs_meta_reconcile(full, 0);
+        changed++;
+        DIR *dir = opendir(full);
+        struct dirent *de;
+        while (dir != NULL && (de = readdir(dir)) != NULL)
+        {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 || strcmp(de->d_name, ".dfs") == 0)
+            {
+                continue;
+            }
+            struct meta_dir key;
+            if (snprintf(key.path, sizeof(key.path), "%s%s%s", d->path, d->path[0] ? "/" : "", de->d_name) >=
+                (int)sizeof(key.path))
+            {
+                continue; // too long to be indexed
+            }
+            char child[1024];
+            snprintf(child, sizeof(child), "%s/%s", meta_root, key.path);
+            if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode) &&
+                bsearch(&key, snapshot, header->count, sizeof(*snapshot), compare_dirs) == NULL)
+            {
+                dfs_meta_reconcile(child, 1);
+                walk_dirs(child);
+            }
+        }
+        if (dir != NULL)
+        {
+            closedir(dir);
+        }
+    }
+    munmap(map, map_size);
+    return changed;
+}
+
+void dfs_meta_init(const char *root)
+{
+    if (dfs_env_int("DFS_META", 0) != 1)
+    {
+        return;
+    }
+    snprintf(meta_root, sizeof(meta_root), "%s", root);
+    snprintf(meta_dir, sizeof(meta_dir), "%s/.dfs", root);
+    mkdir(meta_dir, 0777);
+    snprintf(meta_dir, sizeof(meta_dir), "%s/.dfs/meta", root);
+    mkdir(meta_dir, 0777);
+    wal_max = dfs_env_int("DFS_META_WAL_MAX", 1024);
+    enabled = 1;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (meta_lock(LOCK_EX) < 0)
+    {
+        perror("Metadata index lock");
+        enabled = 0;
+        return;
+    }
+    int rebuilt = 0;
+    drop_view();
+    if (map_base() < 0)
+    {
+        rebuilt = 1;
+        if (rebuild_from_scan() < 0)
+        {
+            perror("Metadata index rebuild");
+        }
+        drop_view();
+        map_base();
+    }
+    // cut off a half-written log record left by a crash
+    char wal[600];
+    meta_file("wal", wal, sizeof(wal));
+    struct stat st;
+    if (stat(wal, &st) == 0 && st.st_size > read_wal_tail() && truncate(wal, wal_seen) == 0)
+    {
+        dfs_log(DFS_LOG_WARN, "Metadata log had %ld damaged bytes, truncated", (long)st.st_size - wal_seen);
+    }
+    long files = base_count;
+    int logged = overlay_count;
+    meta_unlock();
+    drop_view();
+
+    // catch up with changes made while the server was down, then snapshot the directories
+    long taken_at = time(NULL);
+    long recorded = 0, changed = rebuilt ? -1 : warm_reconcile(&recorded);
+    char how[128];
+    if (changed >= 0)
+    {
+        snprintf(how, sizeof(how), "loaded, %ld of %ld directories changed since the snapshot", changed, recorded);
+    }
+    else
+    {
+        // the scan is fresh, or there is no snapshot and every directory has to be checked
+        if (!rebuilt)
+        {
+            dfs_meta_reconcile(root, 1);
+        }
+        dirs_count = 0;
+        walk_dirs(root);
+        snprintf(how, sizeof(how), rebuilt ? "rebuilt from a scan" : "loaded, all %ld directories checked (no usable snapshot)",
+                 dirs_count);
+    }
+    write_dirs(taken_at);
+    free(dirs);
+    dirs = NULL;
+    dirs_count = dirs_cap = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    dfs_log(DFS_LOG_INFO, "Metadata index %s: %ld files (+%d logged changes) %s in %ld ms", meta_dir, files, logged,
+            how, (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+}
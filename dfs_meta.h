@@ -0,0 +1,75 @@
+// dfs_meta.h - Persistent metadata index of a storage root (path -> size, mtime, hash).
+//
+// With DFS_META=1 a server keeps the metadata of every stored file in
+// <root>/.dfs/meta: a base file holding a sorted array of fixed-size entries (mmap'd
+// and binary searched) plus a write-ahead log of the puts and removes made since. When
+// the log reaches DFS_META_WAL_MAX records it is merged into a new base. Listings and
+// statf are answered from the index instead of find and stat. If the base is missing
+// or damaged it is rebuilt from a scan of the root.
+//
+// A second file, dirs, records the mtime of every directory as of a moment when the index
+// matched it. On a restart only the directories whose mtime has moved since are looked
+// at, instead of the whole tree. It carries the base generation it was taken against, so
+// a snapshot newer than the base (an old base put back, or a rebuilt one) is not trusted.
+//
+// Paths passed in are resolved paths under the root given to dfs_meta_init; entry paths
+// handed back are relative to that root.
+
+#ifndef DFS_META_H
+#define DFS_META_H
+
+#include <stddef.h>
+
+#define DFS_META_PATH_MAX 232
+#define DFS_META_HASH_INIT 14695981039346656037ULL
+
+struct dfs_meta_entry
+{
+    char path[DFS_META_PATH_MAX];
+    long size;
+    long mtime;
+    unsigned long long hash; // FNV-1a of the content
+};
+
+// Continues a 64-bit FNV-1a content hash, start with DFS_META_HASH_INIT
+unsigned long long dfs_meta_hash(unsigned long long hash, const void *data, size_t len);
+
+// Opens the index of root, rebuilding it if needed. Call before the server forks its
+// first handler and after dfs_pack_init. Does nothing unless DFS_META=1.
+void dfs_meta_init(const char *root);
+
+// 1 if the index is in use
+int dfs_meta_enabled(void);
+
+// Records that path now holds size bytes with the given content hash
+void dfs_meta_put(const char *path, long size, unsigned long long hash);
+
+// Records that path was removed
+void dfs_meta_remove(const char *path);
+
+// Fills entries with the files under dir (recursively) whose name ends in extension (NULL
+// for all). Returns how many were found (at most max), or -1 if the index is off.
+int dfs_meta_list(const char *dir, const char *extension, struct dfs_meta_entry *entries, int max);
+
+// Brings the entry for one file in line with the file: puts it if it is new or changed
+// since it was indexed, removes it if the file is gone. Returns 1 if the index changed.
+int dfs_meta_sync_file(const char *path);
+
+// dfs_meta_sync_file for every file under dir and every entry indexed under it, so files
+// added, changed or removed behind the server's back are picked up. With recursive unset
+// only the files directly in dir are looked at. Returns the number of changes.
+int dfs_meta_reconcile(const char *dir, int recursive);
+
+// Records the current mtime of the given directories (paths under the root; NULL
+// entries are skipped) as the restart snapshot. taken_at is the time at which the index
+// was known to hold every change made in them.
+void dfs_meta_snapshot_dirs(char *const *paths, int count, long taken_at);
+
+// Writes the statf reply for path: "size <bytes> mtime <unix time> hash <hex>" or "File not found"
+void dfs_meta_describe(const char *path, char *out, size_t out_size);
+
+// Metadata of one file, from the index when it is on and from the file (or the pack
+// store) otherwise. Returns 1 if the file exists.
+int dfs_meta_stat(const char *path, struct dfs_meta_entry *entry);
+
+#endif
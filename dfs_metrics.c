@@ -0,0 +1,414 @@
+// dfs_metrics.c - Request counters and latency histograms for S1 and the storage nodes.
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dfs_metrics.h"
+#include "dfs_admit.h"
+#include "dfs_backend.h"
+#include "dfs_cluster.h"
+#include "dfs_lane.h"
+#include "dfs_net.h"
+#include "dfs_log.h"
+#include "dfs_probe.h"
+
+#define METRIC_BUCKETS 608 // 16 buckets per power of two up to 2^41 us
+#define REPORT_MAX 65536
+
+static const char *command_names[] = {"uploadf", "downlf",   "removef", "downltar", "dispfnames", "statf",
+                                      "putcol",  "getcol",   "setlimit", "stats",   "other"};
+#define COMMANDS (sizeof(command_names) / sizeof(command_names[0]))
+
+struct command_metrics
+{
+    unsigned long count;
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+    unsigned long latency_sum_us;
+    unsigned long latency_max_us;
+    unsigned long hist[METRIC_BUCKETS];
+};
+
+static struct command_metrics *metrics; // COMMANDS entries in shared memory
+static char server_name[16];
+static int server_port;
+
+// the request this handler is serving
+static struct command_metrics *current;
+static long started_us;
+static unsigned long request_in;
+
+static void http_endpoint(int http_port);
+
+void dfs_metrics_init(const char *name, int port)
+{
+    metrics = mmap(NULL, sizeof(*metrics) * COMMANDS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (metrics == MAP_FAILED)
+    {
+        perror("Metrics");
+        exit(1);
+    }
+    memset(metrics, 0, sizeof(*metrics) * COMMANDS);
+    snprintf(server_name, sizeof(server_name), "%s", name);
+    server_port = port;
+
+    int offset = dfs_env_int("DFS_METRICS_PORT_OFFSET", 0);
+    if (offset > 0)
+    {
+        fflush(stdout);
+        if (fork() == 0)
+        {
+            http_endpoint(port + offset);
+            exit(0);
+        }
+    }
+}
+
+static struct command_metrics *lookup(const char *command)
+{
+    for (size_t i = 0; i < COMMANDS - 1; i++)
+    {
+        if (strcmp(command, command_names[i]) == 0)
+        {
+            return &metrics[i];
+        }
+    }
+    return &metrics[COMMANDS - 1];
+}
+
+static int bucket_of(unsigned long us)
+{
+    if (us < 16)
+    {
+        return (int)us;
+    }
+    int msb = 63 - __builtin_clzl(us);
+    int bucket = (msb - 3) * 16 + (int)((us >> (msb - 4)) & 15);
+    return bucket < METRIC_BUCKETS ? bucket : METRIC_BUCKETS - 1;
+}
+
+// largest latency that still falls in the bucket
+static unsigned long bucket_upper_us(int bucket)
+{
+    if (bucket < 16)
+    {
+        return bucket;
+    }
+    int msb = bucket / 16 + 3;
+    unsigned long sub = bucket % 16;
+    return ((16 + sub + 1) << (msb - 4)) - 1;
+}
+
+static void record(struct command_metrics *m, long latency_us, long bytes_in, long bytes_out)
+{
+    unsigned long us = latency_us > 0 ? latency_us : 0;
+    __atomic_fetch_add(&m->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&m->bytes_in, bytes_in > 0 ? bytes_in : 0, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&m->bytes_out, bytes_out > 0 ? bytes_out : 0, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&m->latency_sum_us, us, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&m->hist[bucket_of(us)], 1, __ATOMIC_RELAXED);
+    DFS_PROBE5(request_end, server_name, command_names[m - metrics], us, bytes_in, bytes_out);
+    unsigned long max = __atomic_load_n(&m->latency_max_us, __ATOMIC_RELAXED);
+    while (us > max &&
+           !__atomic_compare_exchange_n(&m->latency_max_us, &max, us, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+void dfs_metrics_begin(int client_socket, const char *request)
+{
+    current = NULL;
+    if (metrics == NULL)
+    {
+        return;
+    }
+    char command[20] = "";
+    sscanf(request, "%19s", command);
+    DFS_PROBE2(request_start, server_name, request);
+    current = lookup(command);
+    started_us = dfs_now_us();
+    // count from here what the handler moves on the connection, not what the kernel has
+    // taken in: with pipelining that includes the commands queued behind this one
+    dfs_net_count(client_socket);
+    request_in = strlen(request); // the request line has already been read
+}
+
+void dfs_metrics_end(void)
+{
+    if (current == NULL)
+    {
+        return;
+    }
+    unsigned long in, out;
+    dfs_net_counted(&in, &out);
+    record(current, dfs_now_us() - started_us, request_in + in, out);
+    current = NULL;
+}
+
+void dfs_metrics_record(const char *command, long latency_us, long bytes_in, long bytes_out)
+{
+    if (metrics != NULL)
+    {
+        record(lookup(command), latency_us, bytes_in, bytes_out);
+    }
+}
+
+struct report
+{
+    char *out;
+    size_t size;
+    size_t used;
+};
+
+static void emit(struct report *r, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void emit(struct report *r, const char *format, ...)
+{
+    if (r->used >= r->size)
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(r->out + r->used, r->size - r->used, format, args);
+    va_end(args);
+    r->used = n < 0 ? r->used : (r->used + n < r->size ? r->used + n : r->size - 1);
+}
+
+static unsigned long percentile_us(const struct command_metrics *m, unsigned long total, double quantile)
+{
+    unsigned long target = (unsigned long)(total * quantile + 0.999999);
+    unsigned long seen = 0;
+    unsigned long max = __atomic_load_n(&m->latency_max_us, __ATOMIC_RELAXED);
+    for (int i = 0; i < METRIC_BUCKETS; i++)
+    {
+        seen += __atomic_load_n(&m->hist[i], __ATOMIC_RELAXED);
+        if (seen >= target)
+        {
+            unsigned long upper = bucket_upper_us(i);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+static void report_commands(struct report *r, const char *labels)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    emit(r, "# TYPE dfs_requests_total counter\n");
+    for (size_t i = 0; i < COMMANDS; i++)
+    {
+        emit(r, "dfs_requests_total{%s,command=\"%s\"} %lu\n", labels, command_names[i], metrics[i].count);
+    }
+    emit(r, "# TYPE dfs_bytes_in_total counter\n");
+    for (size_t i = 0; i < COMMANDS; i++)
+    {
+        emit(r, "dfs_bytes_in_total{%s,command=\"%s\"} %lu\n", labels, command_names[i], metrics[i].bytes_in);
+    }
+    emit(r, "# TYPE dfs_bytes_out_total counter\n");
+    for (size_t i = 0; i < COMMANDS; i++)
+    {
+        emit(r, "dfs_bytes_out_total{%s,command=\"%s\"} %lu\n", labels, command_names[i], metrics[i].bytes_out);
+    }
+    emit(r, "# TYPE dfs_request_duration_us summary\n");
+    for (size_t i = 0; i < COMMANDS; i++)
+    {
+        const struct command_metrics *m = &metrics[i];
+        unsigned long total = 0;
+        for (int b = 0; b < METRIC_BUCKETS; b++)
+        {
+            total += __atomic_load_n(&m->hist[b], __ATOMIC_RELAXED);
+        }
+        for (int q = 0; q < 4 && total > 0; q++)
+        {
+            emit(r, "dfs_request_duration_us{%s,command=\"%s\",quantile=\"%g\"} %lu\n", labels, command_names[i],
+                 quantiles[q], percentile_us(m, total, quantiles[q]));
+        }
+        emit(r, "dfs_request_duration_us_sum{%s,command=\"%s\"} %lu\n", labels, command_names[i],
+             m->latency_sum_us);
+        emit(r, "dfs_request_duration_us_count{%s,command=\"%s\"} %lu\n", labels, command_names[i], total);
+    }
+    emit(r, "# TYPE dfs_request_duration_max_us gauge\n");
+    for (size_t i = 0; i < COMMANDS; i++)
+    {
+        emit(r, "dfs_request_duration_max_us{%s,command=\"%s\"} %lu\n", labels, command_names[i],
+             metrics[i].latency_max_us);
+    }
+}
+
+static void report_admission(struct report *r, const char *labels)
+{
+    const struct dfs_admit_stats *a = dfs_admit_stats();
+    if (a == NULL)
+    {
+        return;
+    }
+    emit(r, "# TYPE dfs_connections_active gauge\ndfs_connections_active{%s} %d\n", labels, a->handlers);
+    emit(r, "# TYPE dfs_connections_queued gauge\ndfs_connections_queued{%s} %d\n", labels, a->queued);
+    emit(r, "# TYPE dfs_connections_peak gauge\ndfs_connections_peak{%s} %d\n", labels, a->handlers_peak);
+    emit(r, "# TYPE dfs_connections_total counter\n");
+    emit(r, "dfs_connections_total{%s,outcome=\"accepted\"} %lu\n", labels, a->accepted);
+    emit(r, "dfs_connections_total{%s,outcome=\"waited\"} %lu\n", labels, a->waited);
+    emit(r, "dfs_connections_total{%s,outcome=\"rejected\"} %lu\n", labels, a->rejected);
+    emit(r, "dfs_connections_total{%s,outcome=\"expired\"} %lu\n", labels, a->expired);
+}
+
+static void report_lanes(struct report *r, const char *labels)
+{
+    static const char *lane_names[DFS_LANES] = {"meta", "small", "bulk"};
+    struct dfs_lane_stats lanes;
+    dfs_lane_snapshot(&lanes);
+    emit(r, "# TYPE dfs_lane_active gauge\n");
+    for (int lane = 0; lane < DFS_LANES; lane++)
+    {
+        emit(r, "dfs_lane_active{%s,lane=\"%s\"} %d\n", labels, lane_names[lane], lanes.active[lane]);
+    }
+    emit(r, "# TYPE dfs_lane_served_total counter\n");
+    for (int lane = 0; lane < DFS_LANES; lane++)
+    {
+        emit(r, "dfs_lane_served_total{%s,lane=\"%s\"} %lu\n", labels, lane_names[lane], lanes.served[lane]);
+    }
+    emit(r, "# TYPE dfs_lane_bulk_waits_total counter\ndfs_lane_bulk_waits_total{%s} %lu\n", labels,
+         lanes.bulk_waits);
+    emit(r, "# TYPE dfs_lane_paced_us_total counter\ndfs_lane_paced_us_total{%s} %lu\n", labels, lanes.paced_us);
+}
+
+// one series per storage node instance S1 has contacted
+static void report_backends(struct report *r, const char *labels)
+{
+    static const int percentiles[] = {50, 95, 99};
+    emit(r, "# TYPE dfs_backend_requests_total counter\n# TYPE dfs_backend_failures_total counter\n"
+            "# TYPE dfs_backend_hedges_total counter\n# TYPE dfs_backend_inflight gauge\n"
+            "# TYPE dfs_backend_latency_us summary\n");
+    for (int i = 0; i < DFS_MAX_BACKENDS; i++)
+    {
+        struct dfs_backend *b = dfs_backend_at(i);
+        if (b == NULL)
+        {
+            continue;
+        }
+        emit(r, "dfs_backend_requests_total{%s,backend=\"%d\"} %lu\n", labels, b->port, b->requests);
+        emit(r, "dfs_backend_failures_total{%s,backend=\"%d\"} %lu\n", labels, b->port, b->failures);
+        emit(r, "dfs_backend_hedges_total{%s,backend=\"%d\"} %lu\n", labels, b->port, b->hedges);
+        emit(r, "dfs_backend_inflight{%s,backend=\"%d\"} %d\n", labels, b->port, b->inflight);
+        for (int p = 0; p < 3; p++)
+        {
+            long us = dfs_backend_percentile_us(b->port, percentiles[p]);
+            if (us >= 0)
+            {
+                emit(r, "dfs_backend_latency_us{%s,backend=\"%d\",quantile=\"0.%d\"} %ld\n", labels, b->port,
+                     percentiles[p], us);
+            }
+        }
+    }
+}
+
+size_t dfs_metrics_report(char *out, size_t size)
+{
+    struct report r = {out, size, 0};
+    out[0] = '\0';
+    if (metrics == NULL)
+    {
+        return 0;
+    }
+    char labels[64];
+    snprintf(labels, sizeof(labels), "server=\"%s\",port=\"%d\"", server_name, server_port);
+    report_commands(&r, labels);
+    report_admission(&r, labels);
+    if (strcmp(server_name, "S1") == 0)
+    {
+        report_lanes(&r, labels);
+        report_backends(&r, labels);
+    }
+    return r.used;
+}
+
+void dfs_metrics_send(int client_socket)
+{
+    static char report[REPORT_MAX];
+    int length = (int)dfs_metrics_report(report, sizeof(report));
+    if (dfs_send_all(client_socket, &length, sizeof(length)) == 0)
+    {
+        dfs_send_all(client_socket, report, length);
+    }
+}
+
+// fetches the report from the server itself, so every handler's view is the same
+static int fetch_report(char *out, size_t size)
+{
+    int sock = dfs_connect_timeout(server_port, 1000);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    dfs_set_io_timeout(sock, 5000);
+    int length = -1;
+    if (dfs_send_all(sock, "stats", 5) < 0 || dfs_recv_all(sock, &length, sizeof(length)) < 0 || length < 0 ||
+        (size_t)length >= size || dfs_recv_all(sock, out, length) < 0)
+    {
+        length = -1;
+    }
+    close(sock);
+    return length;
+}
+
+// Serves GET requests for the report on 127.0.0.1:http_port, one at a time
+static void http_endpoint(int http_port)
+{
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(http_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0)
+    {
+        perror("Metrics endpoint");
+        return;
+    }
+    dfs_log(DFS_LOG_INFO, "%s metrics at http://127.0.0.1:%d/metrics", server_name, http_port);
+
+    static char body[REPORT_MAX];
+    while (1)
+    {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0)
+        {
+            continue;
+        }
+        dfs_set_io_timeout(client, 2000);
+        char request[1024];
+        recv(client, request, sizeof(request), 0); // any request gets the report
+        int length = fetch_report(body, sizeof(body));
+        char header[128];
+        if (length < 0)
+        {
+            snprintf(header, sizeof(header), "HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+            length = 0;
+        }
+        else
+        {
+            snprintf(header, sizeof(header),
+                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n",
+                     length);
+        }
+        if (dfs_send_all(client, header, strlen(header)) == 0)
+        {
+            dfs_send_all(client, body, length);
+        }
+        close(client);
+    }
+}
@@ -0,0 +1,38 @@
+// dfs_metrics.h - Request counters and latency histograms for S1 and the storage nodes.
+//
+// Each server keeps, per command, the number of requests, the bytes its handler received
+// and sent on the client connection (counted by dfs_send and dfs_recv, so bytes read
+// ahead for a pipelined command are not charged to the one before it) and a log-linear
+// latency histogram with 16 buckets per power of two (about 6% resolution, 1 us to ~25
+// days). Handlers update it with atomic adds in shared
+// memory created before the server starts forking.
+//
+// The "stats" command returns the server's metrics in the Prometheus text format,
+// preceded by its length as an int. On S1 they include the admission queue, the
+// priority lanes and each storage node instance it talks to. With
+// DFS_METRICS_PORT_OFFSET set, a small helper process also serves them over HTTP on
+// 127.0.0.1 at the server's port plus that offset, for a scraper.
+
+#ifndef DFS_METRICS_H
+#define DFS_METRICS_H
+
+#include <stddef.h>
+
+// Maps the shared counters and starts the HTTP endpoint if configured; call once in
+// main() before the accept loop. name labels the metrics ("S1"), port is the server's.
+void dfs_metrics_init(const char *name, int port);
+
+// Brackets one request read from client_socket; the command is its first word
+void dfs_metrics_begin(int client_socket, const char *request);
+void dfs_metrics_end(void);
+
+// Records a request served outside the begin/end pair (the node I/O engine)
+void dfs_metrics_record(const char *command, long latency_us, long bytes_in, long bytes_out);
+
+// Writes the metrics in the Prometheus text format, returns the length
+size_t dfs_metrics_report(char *out, size_t size);
+
+// Answers a stats command: the report's length as an int, then the report
+void dfs_metrics_send(int client_socket);
+
+#endif
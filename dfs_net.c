@@ -0,0 +1,195 @@
+// dfs_net.c - Socket helpers shared by S1 and the storage nodes.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
+
+#include "dfs_net.h"
+#include "dfs_fault.h"
+
+int dfs_connect_port(int port)
+{
+    return dfs_connect_timeout(port, -1);
+}
+
+int dfs_connect_timeout(int port, int timeout_ms)
+{
+    if (dfs_fault_connect(port) < 0)
+    {
+        return -1;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        perror("Socket creation failed");
+        return -1;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    if (timeout_ms < 0)
+    {
+        if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+        {
+            close(sock);
+            return -1;
+        }
+        return sock;
+    }
+
+    // non-blocking connect so a dead or overloaded node cannot stall the caller
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    int rc = connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    if (rc < 0 && errno == EINPROGRESS)
+    {
+        struct pollfd pfd = {.fd = sock, .events = POLLOUT};
+        rc = poll(&pfd, 1, timeout_ms);
+        if (rc == 1)
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len);
+            rc = err == 0 ? 0 : -1;
+        }
+        else
+        {
+            rc = -1; // timed out
+        }
+    }
+    if (rc < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, flags);
+    return sock;
+}
+
+void dfs_set_io_timeout(int sock, int timeout_ms)
+{
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// the socket dfs_net_count names and the bytes moved on it since
+static int counted_sock = -1;
+static unsigned long counted_in, counted_out;
+
+void dfs_net_count(int sock)
+{
+    counted_sock = sock;
+    counted_in = counted_out = 0;
+}
+
+void dfs_net_counted(unsigned long *in, unsigned long *out)
+{
+    *in = counted_in;
+    *out = counted_out;
+}
+
+ssize_t dfs_send(int sock, const void *data, size_t len, int flags)
+{
+    if (dfs_fault_socket(sock, &len, 1) < 0)
+    {
+        return -1;
+    }
+    ssize_t sent = send(sock, data, len, flags | MSG_NOSIGNAL);
+    dfs_fault_moved(sock, sent);
+    if (sock == counted_sock && sent > 0)
+    {
+        counted_out += sent;
+    }
+    return sent;
+}
+
+ssize_t dfs_recv(int sock, void *data, size_t len, int flags)
+{
+    if (dfs_fault_socket(sock, &len, 0) < 0)
+    {
+        return -1;
+    }
+    ssize_t got = recv(sock, data, len, flags);
+    dfs_fault_moved(sock, got);
+    if (sock == counted_sock && got > 0 && !(flags & MSG_PEEK))
+    {
+        counted_in += got;
+    }
+    return got;
+}
+
+int dfs_send_all(int sock, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len > 0)
+    {
+        ssize_t sent = dfs_send(sock, p, len, 0);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+int dfs_recv_all(int sock, void *data, size_t len)
+{
+    char *p = data;
+    while (len > 0)
+    {
+        ssize_t got = dfs_recv(sock, p, len, 0);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return -1;
+        }
+        p += got;
+        len -= got;
+    }
+    return 0;
+}
+
+ssize_t dfs_recv_command(int sock, char *buffer, int *framed)
+{
+    // never past one frame (an unframed command may fill one), so what follows stays in the socket
+    return dfs_finish_command(sock, buffer, dfs_recv(sock, buffer, DFS_FRAME_SIZE, 0), framed);
+}
+
+ssize_t dfs_finish_command(int sock, char *buffer, ssize_t got, int *framed)
+{
+    *framed = got > 0 && buffer[0] == DFS_FRAME_MARK;
+    if (*framed)
+    {
+        if (got < DFS_FRAME_SIZE && dfs_recv_all(sock, buffer + got, DFS_FRAME_SIZE - got) < 0)
+        {
+            return -1;
+        }
+        memmove(buffer, buffer + 1, DFS_FRAME_SIZE - 1);
+        got = DFS_FRAME_SIZE - 1;
+    }
+    buffer[got > 0 ? got : 0] = '\0';
+    return got;
+}
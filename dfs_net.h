@@ -0,0 +1,53 @@
+// dfs_net.h - Socket helpers shared by S1 and the storage nodes.
+
+#ifndef DFS_NET_H
+#define DFS_NET_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Connects to a server on the loopback interface, returns -1 instead of exiting on failure
+int dfs_connect_port(int port);
+
+// Same as dfs_connect_port but gives up after timeout_ms
+int dfs_connect_timeout(int port, int timeout_ms);
+
+// Bounds every later blocking send/recv on the socket to timeout_ms without progress
+void dfs_set_io_timeout(int sock, int timeout_ms);
+
+// send() and recv() through the fault-injection layer (dfs_fault.h). dfs_send never raises
+// SIGPIPE, a peer that has gone away fails it with EPIPE.
+ssize_t dfs_send(int sock, const void *data, size_t len, int flags);
+ssize_t dfs_recv(int sock, void *data, size_t len, int flags);
+
+// Counts what dfs_send and dfs_recv move on sock from now on, in place of the socket
+// counted before; dfs_net_counted reports the bytes received and sent since. The request
+// metrics use it so each command is charged only the bytes its handler moved.
+void dfs_net_count(int sock);
+void dfs_net_counted(unsigned long *in, unsigned long *out);
+
+// Sends the whole buffer, returns 0 on success and -1 on error
+int dfs_send_all(int sock, const void *data, size_t len);
+
+// Receives exactly len bytes, returns 0 on success and -1 on error, timeout or early close
+int dfs_recv_all(int sock, void *data, size_t len);
+
+// A client that pipelines commands (w25clients -b) frames each one: DFS_FRAME_MARK, then
+// the command NUL-padded to DFS_FRAME_SIZE bytes in all, so commands sent back to back
+// are read apart. S1 ends its reply to a framed command with DFS_REPLY_END, which tells
+// the client where a text reply stops; sized replies (downlf, downltar, stats) carry it
+// after their data. Unframed commands are read and answered as before.
+#define DFS_FRAME_MARK '#'
+#define DFS_FRAME_SIZE 1024
+#define DFS_REPLY_END "\x1e" "DFS-END" "\x1e"
+
+// Receives the next command into buffer (DFS_FRAME_SIZE + 1 bytes), NUL-terminated and
+// without its frame mark; framed is set to 1 if it came in a frame. An unframed command is
+// read as before, with one recv of up to DFS_FRAME_SIZE bytes. Returns the recv result.
+ssize_t dfs_recv_command(int sock, char *buffer, int *framed);
+
+// The second half of dfs_recv_command, for a caller that did the first recv of up to
+// DFS_FRAME_SIZE bytes itself (the nodes' I/O engine): got is what that recv returned.
+ssize_t dfs_finish_command(int sock, char *buffer, ssize_t got, int *framed);
+
+#endif
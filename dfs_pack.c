@@ -0,0 +1,764 @@
+// dfs_pack.c - Packed store for small files.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "dfs_pack.h"
+#include "dfs_cluster.h"
+#include "dfs_durable.h"
+#include "dfs_log.h"
+#include "dfs_fault.h"
+#include "dfs_probe.h"
+
+#define PACK_MAGIC 0x50534644 // "DFSP"
+#define RECORD_PUT 1
+#define RECORD_DELETE 2
+#define MAX_SEGMENTS 1024
+
+#define SLOT_EMPTY 0
+#define SLOT_LIVE 1
+#define SLOT_DELETED 2
+
+// on-disk record: header, path (not terminated), data
+struct pack_record
+{
+    unsigned int magic;
+    unsigned int type;
+    unsigned int path_len;
+    unsigned int data_len;
+    long mtime;
+    unsigned int checksum; // FNV-1a of path and data
+    unsigned int reserved;
+};
+
+struct pack_slot
+{
+    char path[DFS_PACK_PATH_MAX]; // relative to the root
+    int state;
+    int segment;
+    long offset; // of the record header
+    int length;
+    long mtime;
+};
+
+// shared by every forked handler. Slots only change while the append lock (a flock on
+// .dfs/pack/lock) is held; the spinlock keeps readers from seeing half-written slots.
+struct pack_table
+{
+    int lock;
+    int active; // segment new records are appended to
+    int slots;
+    char exists[MAX_SEGMENTS];
+    long live_bytes[MAX_SEGMENTS];
+    long dead_bytes[MAX_SEGMENTS];
+    struct pack_slot slot[];
+};
+
+static struct pack_table *table;
+static char pack_root[512];
+static char pack_dir[512];
+static long segment_max;
+static int lock_fd = -1;
+static pid_t lock_owner;
+
+static unsigned int fnv1a(unsigned int hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static long record_size(size_t path_len, long data_len)
+{
+    return sizeof(struct pack_record) + path_len + data_len;
+}
+
+static void segment_path(int segment, char *out, size_t out_size)
+{
+    snprintf(out, out_size, "%s/%d.seg", pack_dir, segment);
+}
+
+// path relative to the root, or NULL if it is outside it or too long to index
+static const char *relative_path(const char *path)
+{
+    size_t root_len = strlen(pack_root);
+    if (table == NULL || strncmp(path, pack_root, root_len) != 0 || path[root_len] != '/')
+    {
+        return NULL;
+    }
+    const char *rel = path + root_len + 1;
+    return strlen(rel) < DFS_PACK_PATH_MAX ? rel : NULL;
+}
+
+static void table_lock(void)
+{
+    while (__atomic_exchange_n(&table->lock, 1, __ATOMIC_ACQUIRE))
+    {
+        sched_yield();
+    }
+}
+
+static void table_unlock(void)
+{
+    __atomic_store_n(&table->lock, 0, __ATOMIC_RELEASE);
+}
+
+// flock locks belong to the open file, so every process opens the lock file itself
+static int append_lock(void)
+{
+    if (lock_fd < 0 || lock_owner != getpid())
+    {
+        char path[600];
+        snprintf(path, sizeof(path), "%s/lock", pack_dir);
+        lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        lock_owner = getpid();
+    }
+    return lock_fd >= 0 ? flock(lock_fd, LOCK_EX) : -1;
+}
+
+static void append_unlock(void)
+{
+    flock(lock_fd, LOCK_UN);
+}
+
+// open addressing with linear probing; insert returns the key's slot or a free one
+static struct pack_slot *find_slot(const char *rel, int insert)
+{
+    unsigned int i = fnv1a(2166136261u, rel, strlen(rel)) % table->slots;
+    struct pack_slot *reusable = NULL;
+    for (int probes = 0; probes < table->slots; probes++, i = (i + 1) % table->slots)
+    {
+        struct pack_slot *s = &table->slot[i];
+        if (s->state == SLOT_EMPTY)
+        {
+            return insert ? (reusable ? reusable : s) : NULL;
+        }
+        if (s->state == SLOT_DELETED)
+        {
+            if (reusable == NULL)
+            {
+                reusable = s;
+            }
+        }
+        else if (strcmp(s->path, rel) == 0)
+        {
+            return s;
+        }
+    }
+    return insert ? reusable : NULL;
+}
+
+// Appends one record to the active segment, rolling over to a new segment when it is
+// full. The caller holds the append lock.
+static int append_record(int type, const char *rel, const char *data, int len, long mtime,
+                         int *segment, long *offset)
+{
+    int seg = table->active;
+    char path[600];
+    segment_path(seg, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end > 0 && end + record_size(strlen(rel), len) > segment_max)
+    {
+        close(fd);
+        if (seg + 1 >= MAX_SEGMENTS)
+        {
+            return -1;
+        }
+        seg++;
+        segment_path(seg, path, sizeof(path));
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        table->active = seg;
+        table->exists[seg] = 1;
+        end = lseek(fd, 0, SEEK_END);
+    }
+
+    struct pack_record header = {PACK_MAGIC, type, strlen(rel), len, mtime, 0, 0};
+    header.checksum = fnv1a(fnv1a(2166136261u, rel, header.path_len), data, len);
+    struct iovec parts[3] = {{&header, sizeof(header)}, {(void *)rel, header.path_len}, {(void *)data, len}};
+    ssize_t written = writev(fd, parts, 3);
+    close(fd);
+    if (written != record_size(header.path_len, len))
+    {
+        return -1;
+    }
+    *segment = seg;
+    *offset = end;
+    return 0;
+}
+
+// Reads the record at offset into *header and a malloc'd buffer holding path then data.
+// Returns the offset of the next record, or -1 at the end of the segment or a torn record.
+static long read_record(int fd, long offset, struct pack_record *header, char **body)
+{
+    if (pread(fd, header, sizeof(*header), offset) != sizeof(*header) || header->magic != PACK_MAGIC ||
+        header->path_len == 0 || header->path_len >= DFS_PACK_PATH_MAX)
+    {
+        return -1;
+    }
+    size_t len = header->path_len + header->data_len;
+    *body = malloc(len + 1);
+    if (*body == NULL || pread(fd, *body, len, offset + sizeof(*header)) != (ssize_t)len ||
+        fnv1a(2166136261u, *body, len) != header->checksum)
+    {
+        free(*body);
+        *body = NULL;
+        return -1;
+    }
+    (*body)[len] = '\0';
+    return offset + record_size(header->path_len, header->data_len);
+}
+
+// applies one segment's records to the index; a torn tail of the last segment is cut off
+static void replay_segment(int seg, int last)
+{
+    char path[600];
+    segment_path(seg, path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+    table->exists[seg] = 1;
+    struct pack_record header;
+    char *body;
+    long offset = 0, next;
+    while ((next = read_record(fd, offset, &header, &body)) >= 0)
+    {
+        char rel[DFS_PACK_PATH_MAX];
+        memcpy(rel, body, header.path_len);
+        rel[header.path_len] = '\0';
+        free(body);
+
+        struct pack_slot *s = find_slot(rel, 1);
+        if (s != NULL && s->state == SLOT_LIVE)
+        {
+            table->live_bytes[s->segment] -= record_size(strlen(s->path), s->length);
+            table->dead_bytes[s->segment] += record_size(strlen(s->path), s->length);
+        }
+        if (header.type == RECORD_PUT && s != NULL)
+        {
+            strcpy(s->path, rel);
+            s->state = SLOT_LIVE;
+            s->segment = seg;
+            s->offset = offset;
+            s->length = header.data_len;
+            s->mtime = header.mtime;
+            table->live_bytes[seg] += next - offset;
+        }
+        else
+        {
+            if (s != NULL && s->state == SLOT_LIVE)
+            {
+                s->state = SLOT_DELETED;
+            }
+            table->dead_bytes[seg] += next - offset;
+        }
+        offset = next;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > offset)
+    {
+        dfs_log(DFS_LOG_WARN, "Pack segment %d has %ld damaged bytes after offset %ld%s", seg,
+                (long)st.st_size - offset, offset, last ? ", truncating" : "");
+        if (last && ftruncate(fd, offset) != 0)
+        {
+            perror("ftruncate pack segment");
+        }
+    }
+    close(fd);
+}
+
+static int compare_ints(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+static void rebuild_index(void)
+{
+    int segments[MAX_SEGMENTS];
+    int count = 0;
+    DIR *dir = opendir(pack_dir);
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL && count < MAX_SEGMENTS)
+    {
+        int seg;
+        char suffix[8];
+        if (sscanf(entry->d_name, "%d.%7s", &seg, suffix) == 2 && strcmp(suffix, "seg") == 0 &&
+            seg >= 0 && seg < MAX_SEGMENTS)
+        {
+            segments[count++] = seg;
+        }
+    }
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+    qsort(segments, count, sizeof(int), compare_ints);
+    for (int i = 0; i < count; i++)
+    {
+        replay_segment(segments[i], i == count - 1);
+    }
+    table->active = count > 0 ? segments[count - 1] : 0;
+    table->exists[table->active] = 1;
+}
+
+static int older_segment_exists(int seg)
+{
+    for (int i = 0; i < seg; i++)
+    {
+        if (table->exists[i])
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Copies the live records of seg to the active segment and deletes it. Tombstones are
+// carried along while an older segment may still hold a record they cancel.
+static void compact_segment(int seg)
+{
+    char path[600];
+    segment_path(seg, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct pack_record header;
+    char *body;
+    long offset = 0, next, kept = 0;
+    while ((next = read_record(fd, offset, &header, &body)) >= 0)
+    {
+        char rel[DFS_PACK_PATH_MAX];
+        memcpy(rel, body, header.path_len);
+        rel[header.path_len] = '\0';
+        const char *data = body + header.path_len;
+
+        if (append_lock() < 0)
+        {
+            free(body);
+            break;
+        }
+        struct pack_slot *s = find_slot(rel, 0);
+        int live = s != NULL && s->state == SLOT_LIVE;
+        int new_seg;
+        long new_offset;
+        if (header.type == RECORD_PUT && live && s->segment == seg && s->offset == offset)
+        {
+            if (append_record(RECORD_PUT, rel, data, header.data_len, header.mtime, &new_seg, &new_offset) == 0)
+            {
+                table_lock();
+                s->segment = new_seg;
+                s->offset = new_offset;
+                table->live_bytes[seg] -= next - offset;
+                table->live_bytes[new_seg] += next - offset;
+                table_unlock();
+                kept += next - offset;
+            }
+        }
+        else if (header.type == RECORD_DELETE && !live && older_segment_exists(seg))
+        {
+            if (append_record(RECORD_DELETE, rel, NULL, 0, header.mtime, &new_seg, &new_offset) == 0)
+            {
+                table->dead_bytes[new_seg] += next - offset;
+            }
+        }
+        append_unlock();
+        free(body);
+        offset = next;
+    }
+    close(fd);
+
+    // anything still pointing into the segment failed to move; keep the segment then
+    if (append_lock() < 0)
+    {
+        return;
+    }
+    int pinned = 0;
+    for (int i = 0; i < table->slots; i++)
+    {
+        pinned += table->slot[i].state == SLOT_LIVE && table->slot[i].segment == seg;
+    }
+    if (!pinned && seg != table->active)
+    {
+        // the copies must be on disk before the originals go
+        for (int i = seg + 1; i <= table->active; i++)
+        {
+            char copy[600];
+            segment_path(i, copy, sizeof(copy));
+            if (table->exists[i])
+            {
+                dfs_durable_sync(copy);
+            }
+        }
+        unlink(path);
+        table->exists[seg] = 0;
+        table->live_bytes[seg] = 0;
+        table->dead_bytes[seg] = 0;
+        dfs_log(DFS_LOG_INFO, "Compacted pack segment %d (%ld live bytes kept)", seg, kept);
+    }
+    append_unlock();
+}
+
+static void compactor(void)
+{
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    int interval = dfs_env_int("DFS_PACK_COMPACT_SECONDS", 30);
+    int ratio = dfs_env_int("DFS_PACK_COMPACT_RATIO", 50); // percent dead before a segment is rewritten
+    while (1)
+    {
+        sleep(interval > 0 ? interval : 30);
+        for (int seg = 0; seg < table->active; seg++)
+        {
+            long live = table->live_bytes[seg], dead = table->dead_bytes[seg];
+            if (table->exists[seg] && live + dead > 0 && dead * 100 >= (long)ratio * (live + dead))
+            {
+                compact_segment(seg);
+            }
+        }
+    }
+}
+
+void dfs_pack_init(const char *root)
+{
+    if (dfs_env_int("DFS_PACK", 0) != 1)
+    {
+        return;
+    }
+    snprintf(pack_root, sizeof(pack_root), "%s", root);
+    snprintf(pack_dir, sizeof(pack_dir), "%s/.dfs", root);
+    mkdir(pack_dir, 0777);
+    snprintf(pack_dir, sizeof(pack_dir), "%s/.dfs/pack", root);
+    mkdir(pack_dir, 0777);
+    segment_max = (long)dfs_env_int("DFS_PACK_SEGMENT_MB", 64) * 1024 * 1024;
+
+    int slots = dfs_env_int("DFS_PACK_SLOTS", 16384);
+    size_t size = sizeof(struct pack_table) + sizeof(struct pack_slot) * (slots > 0 ? slots : 16384);
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("mmap pack index");
+        return;
+    }
+    table = mem;
+    table->slots = slots > 0 ? slots : 16384;
+
+    long started = time(NULL);
+    rebuild_index();
+    int files = 0, segments = 0;
+    for (int i = 0; i < table->slots; i++)
+    {
+        files += table->slot[i].state == SLOT_LIVE;
+    }
+    for (int i = 0; i < MAX_SEGMENTS; i++)
+    {
+        segments += table->exists[i];
+    }
+    dfs_log(DFS_LOG_INFO, "Pack store %s: %d files indexed from %d segments in %lds", pack_dir, files, segments,
+            time(NULL) - started);
+    fflush(stdout); // or every forked handler would print it again
+
+    if (fork() == 0)
+    {
+        compactor();
+        exit(0);
+    }
+}
+
+int dfs_pack_wanted(int filesize)
+{
+    return table != NULL && filesize >= 0 && filesize <= dfs_env_int("DFS_PACK_MAX_FILE", 65536);
+}
+
+int dfs_pack_put(const char *path, const char *data, int len)
+{
+    const char *rel = relative_path(path);
+    if (rel == NULL || append_lock() < 0)
+    {
+        return -1;
+    }
+    // claim the slot first so a full index never leaves an unreachable record behind
+    struct pack_slot *s = find_slot(rel, 1);
+    long now = time(NULL);
+    int seg;
+    long offset;
+    if (s == NULL || append_record(RECORD_PUT, rel, data, len, now, &seg, &offset) < 0)
+    {
+        append_unlock();
+        return -1;
+    }
+    table_lock();
+    if (s->state == SLOT_LIVE)
+    {
+        table->live_bytes[s->segment] -= record_size(strlen(rel), s->length);
+        table->dead_bytes[s->segment] += record_size(strlen(rel), s->length);
+    }
+    strcpy(s->path, rel);
+    s->state = SLOT_LIVE;
+    s->segment = seg;
+    s->offset = offset;
+    s->length = len;
+    s->mtime = now;
+    table->live_bytes[seg] += record_size(strlen(rel), len);
+    table_unlock();
+    append_unlock();
+
+    // outside the append lock, so puts that finish together share the sync
+    char segment[600];
+    segment_path(seg, segment, sizeof(segment));
+    if (dfs_durable_sync(segment) != 0)
+    {
+        perror("Pack segment sync");
+    }
+    dfs_fault_disk(len);
+    DFS_PROBE2(disk_write, path, len);
+    return 0;
+}
+
+char *dfs_pack_load(const char *path, int *len)
+{
+    const char *rel = relative_path(path);
+    if (rel == NULL)
+    {
+        return NULL;
+    }
+    // a record can move between the lookup and the read when its segment is compacted
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        table_lock();
+        struct pack_slot *s = find_slot(rel, 0);
+        struct pack_slot entry;
+        int found = s != NULL && s->state == SLOT_LIVE;
+        if (found)
+        {
+            entry = *s;
+        }
+        table_unlock();
+        if (!found)
+        {
+            return NULL;
+        }
+
+        char segment[600];
+        segment_path(entry.segment, segment, sizeof(segment));
+        int fd = open(segment, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+        size_t total = record_size(strlen(rel), entry.length);
+        char *record = malloc(total + 1);
+        ssize_t got = record ? pread(fd, record, total, entry.offset) : -1;
+        close(fd);
+        struct pack_record *header = (struct pack_record *)record;
+        if (got == (ssize_t)total && header->magic == PACK_MAGIC && header->type == RECORD_PUT &&
+            header->path_len == strlen(rel) && memcmp(record + sizeof(*header), rel, header->path_len) == 0)
+        {
+            // hand back the data in place of the header and path
+            memmove(record, record + sizeof(*header) + header->path_len, entry.length);
+            *len = entry.length;
+            dfs_fault_disk(entry.length);
+            DFS_PROBE2(disk_read, path, entry.length);
+            return record;
+        }
+        free(record);
+    }
+    return NULL;
+}
+
+int dfs_pack_capacity(void)
+{
+    return table != NULL ? table->slots : 0;
+}
+
+int dfs_pack_remove(const char *path)
+{
+    const char *rel = relative_path(path);
+    if (rel == NULL || append_lock() < 0)
+    {
+        return -1;
+    }
+    struct pack_slot *s = find_slot(rel, 0);
+    int seg;
+    long offset;
+    if (s == NULL || s->state != SLOT_LIVE || append_record(RECORD_DELETE, rel, NULL, 0, time(NULL), &seg, &offset) < 0)
+    {
+        append_unlock();
+        return -1;
+    }
+    table_lock();
+    long size = record_size(strlen(rel), s->length);
+    table->live_bytes[s->segment] -= size;
+    table->dead_bytes[s->segment] += size;
+    table->dead_bytes[seg] += record_size(strlen(rel), 0);
+    s->state = SLOT_DELETED;
+    table_unlock();
+    append_unlock();
+    return 0;
+}
+
+int dfs_pack_list(const char *dir, const char *extension, struct dfs_pack_file *files, int max)
+{
+    if (table == NULL)
+    {
+        return 0;
+    }
+    char prefix[DFS_PACK_PATH_MAX + 1] = "";
+    if (strcmp(dir, pack_root) != 0)
+    {
+        const char *rel = relative_path(dir);
+        if (rel == NULL)
+        {
+            return 0;
+        }
+        snprintf(prefix, sizeof(prefix), "%s", rel);
+        size_t n = strlen(prefix);
+        while (n > 0 && prefix[n - 1] == '/')
+        {
+            prefix[--n] = '\0';
+        }
+        strcat(prefix, "/");
+    }
+    size_t prefix_len = strlen(prefix);
+    size_t ext_len = extension ? strlen(extension) : 0;
+
+    int count = 0;
+    table_lock();
+    for (int i = 0; i < table->slots && count < max; i++)
+    {
+        struct pack_slot *s = &table->slot[i];
+        size_t n = strlen(s->path);
+        if (s->state != SLOT_LIVE || strncmp(s->path, prefix, prefix_len) != 0 ||
+            (extension && (n < ext_len || strcmp(s->path + n - ext_len, extension) != 0)))
+        {
+            continue;
+        }
+        if (snprintf(files[count].path, sizeof(files[count].path), "%s/%s", pack_root, s->path) >=
+            (int)sizeof(files[count].path))
+        {
+            continue;
+        }
+        files[count].length = s->length;
+        files[count].mtime = s->mtime;
+        count++;
+    }
+    table_unlock();
+    return count;
+}
+
+// ustar header; names too long for the name/prefix split are refused
+static int tar_header(char *h, const char *name, int size, long mtime)
+{
+    memset(h, 0, 512);
+    while (*name == '/')
+    {
+        name++; // stored relative like tar does
+    }
+    size_t len = strlen(name);
+    if (len <= 100)
+    {
+        memcpy(h, name, len);
+    }
+    else
+    {
+        const char *split = strchr(name + len - 101, '/');
+        if (split == NULL || split - name > 155)
+        {
+            return -1;
+        }
+        memcpy(h, split + 1, len - (split + 1 - name));
+        memcpy(h + 345, name, split - name);
+    }
+    snprintf(h + 100, 8, "%07o", 0644);
+    snprintf(h + 108, 8, "%07o", 0);
+    snprintf(h + 116, 8, "%07o", 0);
+    snprintf(h + 124, 12, "%011o", size);
+    snprintf(h + 136, 12, "%011lo", mtime);
+    h[156] = '0';
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    memset(h + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (int i = 0; i < 512; i++)
+    {
+        sum += (unsigned char)h[i];
+    }
+    snprintf(h + 148, 8, "%06o", sum);
+    h[155] = ' ';
+    return 0;
+}
+
+int dfs_pack_write_tar(const char *tar_path, const struct dfs_pack_file *files, int count)
+{
+    FILE *fp = fopen(tar_path, "r+b");
+    if (fp == NULL)
+    {
+        fp = fopen(tar_path, "w+b");
+    }
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    // walk the existing entries up to the end-of-archive blocks and write over them
+    char block[512];
+    long end = 0;
+    while (fseek(fp, end, SEEK_SET) == 0 && fread(block, 1, 512, fp) == 512 && block[0] != '\0')
+    {
+        char size_field[13] = {0};
+        memcpy(size_field, block + 124, 12);
+        end += 512 + (strtol(size_field, NULL, 8) + 511) / 512 * 512;
+    }
+    fseek(fp, end, SEEK_SET);
+
+    int added = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int len;
+        char *data = dfs_pack_load(files[i].path, &len);
+        if (data == NULL || tar_header(block, files[i].path, len, files[i].mtime) < 0)
+        {
+            dfs_log(DFS_LOG_WARN, "Skipping packed file %s in tar", files[i].path);
+            free(data);
+            continue;
+        }
+        fwrite(block, 1, 512, fp);
+        fwrite(data, 1, len, fp);
+        memset(block, 0, 512);
+        fwrite(block, 1, (512 - len % 512) % 512, fp);
+        free(data);
+        added++;
+    }
+    memset(block, 0, 512);
+    fwrite(block, 1, 512, fp);
+    fwrite(block, 1, 512, fp);
+    long size = ftell(fp);
+    int ok = fflush(fp) == 0 && ftruncate(fileno(fp), size) == 0;
+    fclose(fp);
+    return ok ? added : -1;
+}
@@ -0,0 +1,53 @@
+// dfs_pack.h - Packed store for small files (used by S1 for .c and S3 for .txt).
+//
+// With DFS_PACK=1 files of at most DFS_PACK_MAX_FILE bytes are not given a file of their
+// own: each upload is appended as one record to the current segment file under
+// <root>/.dfs/pack. An index shared by every forked handler maps the file's path to its
+// record (segment, offset, length), so a download is a single pread. Removing a file
+// appends a tombstone, and a background process copies the live records out of segments
+// that are mostly dead and deletes them. The index is rebuilt by scanning the segments
+// when the server starts.
+//
+// All paths passed in are resolved paths under the root given to dfs_pack_init.
+
+#ifndef DFS_PACK_H
+#define DFS_PACK_H
+
+#define DFS_PACK_PATH_MAX 256
+
+struct dfs_pack_file
+{
+    char path[512]; // resolved path
+    int length;     // bytes
+    long mtime;     // time of the upload
+};
+
+// Sets up the store for the storage root and starts the compactor. Must be called before
+// the server forks its first handler. Does nothing unless DFS_PACK=1.
+void dfs_pack_init(const char *root);
+
+// 1 if an upload of filesize bytes should go into the pack
+int dfs_pack_wanted(int filesize);
+
+// Stores len bytes as the file at path. Returns -1 if the store is off or full, in which
+// case the caller writes a regular file instead.
+int dfs_pack_put(const char *path, const char *data, int len);
+
+// Returns the content of a packed file (malloc'd, *len set) or NULL if path is not packed
+char *dfs_pack_load(const char *path, int *len);
+
+// Number of files the index can hold, 0 if the store is off
+int dfs_pack_capacity(void);
+
+// Drops a packed file, returns -1 if path is not packed
+int dfs_pack_remove(const char *path);
+
+// Fills files with the packed files under dir (recursively) whose name ends in extension
+// (NULL for all), returns how many were found, at most max
+int dfs_pack_list(const char *dir, const char *extension, struct dfs_pack_file *files, int max);
+
+// Appends the given packed files to the tar archive at tar_path, creating it if needed.
+// Returns the number of files added or -1 on error.
+int dfs_pack_write_tar(const char *tar_path, const struct dfs_pack_file *files, int count);
+
+#endif
@@ -0,0 +1,117 @@
+// dfs_probe.h - USDT (SystemTap SDT) probe points for bpftrace and perf.
+//
+// Each probe is a nop in the code plus an ELF note (.note.stapsdt) naming the probe and
+// where its arguments are, the format sys/sdt.h produces, so it is written out here
+// without needing the systemtap headers. Every probe has a semaphore that the tracer
+// increments while it is attached; until then the probe costs one predictable branch and
+// its arguments (clock reads included) are not even computed.
+//
+// List the probes with "bpftrace -l 'usdt:./s1:*'" or "perf list sdt" after
+// "perf buildid-cache --add ./s1". Provider "dfs", arguments in order:
+//   request_start   server, request text
+//   request_end     server, command, latency us, bytes in, bytes out
+//   relay_chunk     node port (0 for striped zips), bytes, direction (0: towards the node,
+//                   1: towards the client)
+//   disk_read       path, bytes
+//   disk_write      path, bytes
+//   durable_commit  path, latency us (flush, fsync and rename of an upload)
+//   list_start      directory
+//   list_end        directory, files listed, latency us
+//   tar_phase       file type, phase ("build" or "send"), latency us
+// Strings are pointers, read them with str(argN). Example scripts are in probes/.
+
+#ifndef DFS_PROBE_H
+#define DFS_PROBE_H
+
+#include <time.h>
+
+// semaphores live in .probes where tracers expect them; the weak definitions in every
+// file that includes this header are merged by the linker
+#define DFS_PROBE_SEMAPHORE(name) dfs_probe_##name##_semaphore
+#define DFS_PROBE_DEFINE(name)                                                                                    \
+    __extension__ volatile unsigned short DFS_PROBE_SEMAPHORE(name)                                               \
+        __attribute__((weak, unused, section(".probes"), visibility("hidden")))
+
+DFS_PROBE_DEFINE(request_start);
+DFS_PROBE_DEFINE(request_end);
+DFS_PROBE_DEFINE(relay_chunk);
+DFS_PROBE_DEFINE(disk_read);
+DFS_PROBE_DEFINE(disk_write);
+DFS_PROBE_DEFINE(durable_commit);
+DFS_PROBE_DEFINE(list_start);
+DFS_PROBE_DEFINE(list_end);
+DFS_PROBE_DEFINE(tar_phase);
+
+// 1 while a tracer is attached to the probe; guards work done only for its arguments
+#define DFS_PROBE_ENABLED(name) __builtin_expect(DFS_PROBE_SEMAPHORE(name) != 0, 0)
+
+// the note of one probe site; arguments are passed as 8-byte signed values in registers
+#define DFS_PROBE_NOTE(name, args)                                                                                \
+    "990: nop\n"                                                                                                  \
+    ".pushsection .note.stapsdt, \"?\", \"note\"\n"                                                               \
+    ".balign 4\n"                                                                                                 \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                                                            \
+    "991: .asciz \"stapsdt\"\n"                                                                                   \
+    "992: .balign 4\n"                                                                                            \
+    "993: .8byte 990b\n"                                                                                          \
+    ".8byte _.stapsdt.base\n"                                                                                     \
+    ".8byte dfs_probe_" #name "_semaphore\n"                                                                      \
+    ".asciz \"dfs\"\n"                                                                                            \
+    ".asciz \"" #name "\"\n"                                                                                      \
+    ".asciz \"" args "\"\n"                                                                                       \
+    "994: .balign 4\n"                                                                                            \
+    ".popsection\n"                                                                                               \
+    ".ifndef _.stapsdt.base\n"                                                                                    \
+    ".pushsection .stapsdt.base, \"aG\", \"progbits\", .stapsdt.base, comdat\n"                                   \
+    ".weak _.stapsdt.base\n"                                                                                      \
+    ".hidden _.stapsdt.base\n"                                                                                    \
+    "_.stapsdt.base: .space 1\n"                                                                                  \
+    ".size _.stapsdt.base, 1\n"                                                                                   \
+    ".popsection\n"                                                                                               \
+    ".endif\n"
+
+#define DFS_PROBE_ARG(value) "r"((long)(value))
+
+#define DFS_PROBE1(name, a1)                                                                                      \
+    do                                                                                                            \
+    {                                                                                                             \
+        if (DFS_PROBE_ENABLED(name))                                                                              \
+            __asm__ __volatile__(DFS_PROBE_NOTE(name, "-8@%0") ::DFS_PROBE_ARG(a1));                              \
+    } while (0)
+
+#define DFS_PROBE2(name, a1, a2)                                                                                  \
+    do                                                                                                            \
+    {                                                                                                             \
+        if (DFS_PROBE_ENABLED(name))                                                                              \
+            __asm__ __volatile__(DFS_PROBE_NOTE(name, "-8@%0 -8@%1") ::DFS_PROBE_ARG(a1), DFS_PROBE_ARG(a2));     \
+    } while (0)
+
+#define DFS_PROBE3(name, a1, a2, a3)                                                                              \
+    do                                                                                                            \
+    {                                                                                                             \
+        if (DFS_PROBE_ENABLED(name))                                                                              \
+            __asm__ __volatile__(DFS_PROBE_NOTE(name, "-8@%0 -8@%1 -8@%2") ::DFS_PROBE_ARG(a1),                  \
+                                 DFS_PROBE_ARG(a2), DFS_PROBE_ARG(a3));                                           \
+    } while (0)
+
+#define DFS_PROBE5(name, a1, a2, a3, a4, a5)                                                                      \
+    do                                                                                                            \
+    {                                                                                                             \
+        if (DFS_PROBE_ENABLED(name))                                                                              \
+            __asm__ __volatile__(DFS_PROBE_NOTE(name, "-8@%0 -8@%1 -8@%2 -8@%3 -8@%4") ::DFS_PROBE_ARG(a1),      \
+                                 DFS_PROBE_ARG(a2), DFS_PROBE_ARG(a3), DFS_PROBE_ARG(a4), DFS_PROBE_ARG(a5));     \
+    } while (0)
+
+// Clock for latency arguments: read only while the probe is enabled, and
+// DFS_PROBE_SINCE(start) is 0 if the tracer attached after start was taken
+#define DFS_PROBE_CLOCK(name) (DFS_PROBE_ENABLED(name) ? dfs_probe_now_us() : 0)
+#define DFS_PROBE_SINCE(start) ((start) != 0 ? dfs_probe_now_us() - (start) : 0)
+
+static inline long dfs_probe_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+#endif
@@ -0,0 +1,306 @@
+// dfs_rate.c - Token-bucket bandwidth and request-rate limits.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "dfs_rate.h"
+#include "dfs_cluster.h"
+#include "dfs_backend.h"
+#include "dfs_trace.h"
+#include "dfs_log.h"
+
+#define RATE_CLIENTS 64
+#define RATE_BATCH_BYTES 16384 // bytes gathered before the buckets are charged
+
+// A bucket is kept as the time its budget is spent up to (GCRA): a charge moves it
+// forward by cost/rate, and the charging handler sleeps for whatever it then runs
+// ahead of now by more than the burst.
+struct bucket
+{
+    int mbps; // 0: unlimited
+    int iops;
+    long bytes_until_us;
+    long ops_until_us;
+    unsigned long throttled;    // charges that had to sleep
+    unsigned long throttled_us; // total time slept
+};
+
+struct client_bucket
+{
+    in_addr_t addr;
+    long last_used_us; // 0 if the slot is free
+    struct bucket bucket;
+};
+
+static const char *type_names[] = {".c", ".pdf", ".txt", ".zip"};
+#define RATE_TYPES 4
+
+struct rates
+{
+    char lock; // serialises client slot assignment
+    struct bucket global;
+    struct bucket types[RATE_TYPES];
+    int client_mbps; // applied to every client bucket
+    int client_iops;
+    unsigned long client_throttled;
+    unsigned long client_throttled_us;
+    struct client_bucket clients[RATE_CLIENTS];
+};
+
+static struct rates *rates;
+static long burst_us;
+
+// buckets of the request this handler is serving
+static struct bucket *current[3];
+static int pending_bytes;
+
+void dfs_rate_init(void)
+{
+    rates = mmap(NULL, sizeof(*rates), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (rates == MAP_FAILED)
+    {
+        perror("Rate limits");
+        exit(1);
+    }
+    memset(rates, 0, sizeof(*rates));
+    burst_us = dfs_env_int("DFS_RATE_BURST_MS", 200) * 1000L;
+    rates->global.mbps = dfs_env_int("DFS_RATE_GLOBAL_MBPS", 0);
+    rates->global.iops = dfs_env_int("DFS_RATE_GLOBAL_IOPS", 0);
+    rates->client_mbps = dfs_env_int("DFS_RATE_CLIENT_MBPS", 0);
+    rates->client_iops = dfs_env_int("DFS_RATE_CLIENT_IOPS", 0);
+    const char *env_names[] = {"C", "PDF", "TXT", "ZIP"};
+    for (int t = 0; t < RATE_TYPES; t++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "DFS_RATE_%s_MBPS", env_names[t]);
+        rates->types[t].mbps = dfs_env_int(name, 0);
+        snprintf(name, sizeof(name), "DFS_RATE_%s_IOPS", env_names[t]);
+        rates->types[t].iops = dfs_env_int(name, 0);
+    }
+}
+
+int dfs_rate_limited(void)
+{
+    if (rates == NULL)
+    {
+        return 0;
+    }
+    int limited = rates->global.mbps || rates->global.iops || rates->client_mbps || rates->client_iops;
+    for (int t = 0; t < RATE_TYPES; t++)
+    {
+        limited |= rates->types[t].mbps || rates->types[t].iops;
+    }
+    return limited;
+}
+
+// moves the bucket's budget forward by cost_us, returns how long the caller has to wait
+static long charge(long *until_us, long cost_us, long now)
+{
+    long prev = __atomic_load_n(until_us, __ATOMIC_RELAXED), start;
+    do
+    {
+        start = prev > now ? prev : now;
+    } while (!__atomic_compare_exchange_n(until_us, &prev, start + cost_us, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    long wait = start + cost_us - burst_us - now;
+    return wait > 0 ? wait : 0;
+}
+
+static struct bucket *client_bucket(in_addr_t addr)
+{
+    long now = dfs_now_us();
+    while (__atomic_test_and_set(&rates->lock, __ATOMIC_ACQUIRE))
+    {
+        sched_yield();
+    }
+    // the client's slot, or else the one unused the longest
+    struct client_bucket *found = NULL, *oldest = &rates->clients[0];
+    for (int i = 0; i < RATE_CLIENTS && found == NULL; i++)
+    {
+        struct client_bucket *c = &rates->clients[i];
+        if (c->last_used_us != 0 && c->addr == addr)
+        {
+            found = c;
+        }
+        else if (c->last_used_us < oldest->last_used_us)
+        {
+            oldest = c;
+        }
+    }
+    if (found == NULL)
+    {
+        found = oldest;
+        memset(found, 0, sizeof(*found));
+        found->addr = addr;
+    }
+    found->last_used_us = now;
+    __atomic_clear(&rates->lock, __ATOMIC_RELEASE);
+    return &found->bucket;
+}
+
+// charges every bucket of the request and sleeps for the longest wait
+static void spend(long bytes, int ops)
+{
+    long now = dfs_now_us();
+    long longest = 0;
+    struct bucket *slowest = NULL;
+    for (int i = 0; i < 3; i++)
+    {
+        struct bucket *b = current[i];
+        if (b == NULL)
+        {
+            continue;
+        }
+        // client buckets all follow the client limit
+        int mbps = b == current[1] ? rates->client_mbps : b->mbps;
+        int iops = b == current[1] ? rates->client_iops : b->iops;
+        long wait = 0;
+        if (bytes > 0 && mbps > 0)
+        {
+            wait = charge(&b->bytes_until_us, bytes / mbps, now);
+        }
+        if (ops > 0 && iops > 0)
+        {
+            long op_wait = charge(&b->ops_until_us, ops * 1000000L / iops, now);
+            wait = op_wait > wait ? op_wait : wait;
+        }
+        if (wait > longest)
+        {
+            longest = wait;
+            slowest = b;
+        }
+    }
+    if (slowest != NULL)
+    {
+        __atomic_fetch_add(&slowest->throttled, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&slowest->throttled_us, longest, __ATOMIC_RELAXED);
+        long trace_started = dfs_trace_now();
+        usleep(longest);
+        dfs_trace_span("rate limit", trace_started, bytes > 0 ? "bandwidth" : "requests");
+    }
+}
+
+void dfs_rate_request(int client_socket, const char *request)
+{
+    current[0] = current[1] = current[2] = NULL;
+    pending_bytes = 0;
+    if (!dfs_rate_limited())
+    {
+        return;
+    }
+    current[0] = &rates->global;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(client_socket, (struct sockaddr *)&addr, &len) == 0 && addr.sin_family == AF_INET)
+    {
+        current[1] = client_bucket(addr.sin_addr.s_addr);
+    }
+    char argument[512] = "";
+    sscanf(request, "%*s %511s", argument);
+    const char *ext = strrchr(argument, '.');
+    for (int t = 0; ext != NULL && t < RATE_TYPES; t++)
+    {
+        if (strcmp(ext, type_names[t]) == 0)
+        {
+            current[2] = &rates->types[t];
+        }
+    }
+    spend(0, 1);
+}
+
+void dfs_rate_bytes(int bytes)
+{
+    if (current[0] == NULL)
+    {
+        return;
+    }
+    pending_bytes += bytes;
+    if (pending_bytes >= RATE_BATCH_BYTES)
+    {
+        spend(pending_bytes, 0);
+        pending_bytes = 0;
+    }
+}
+
+static int append_limit(char *reply, size_t reply_size, int used, const char *scope, int mbps, int iops,
+                        unsigned long throttled, unsigned long throttled_us)
+{
+    int n = snprintf(reply + used, reply_size - used, "%-7s %6d MB/s %7d ops/s  throttled %lu times, %lu ms\n",
+                     scope, mbps, iops, throttled, throttled_us / 1000);
+    return n > 0 && (size_t)(used + n) < reply_size ? used + n : used;
+}
+
+void dfs_rate_command(const char *request, char *reply, size_t reply_size)
+{
+    if (rates == NULL)
+    {
+        snprintf(reply, reply_size, "Rate limits are not available");
+        return;
+    }
+    char scope[16] = "";
+    int mbps = -1, iops = -1;
+    int fields = sscanf(request, "%*s %15s %d %d", scope, &mbps, &iops);
+    if (fields <= 0)
+    {
+        // no arguments: every limit, 0 meaning unlimited
+        int used = append_limit(reply, reply_size, 0, "global", rates->global.mbps, rates->global.iops,
+                                rates->global.throttled, rates->global.throttled_us);
+        unsigned long throttled = 0, throttled_us = 0;
+        for (int i = 0; i < RATE_CLIENTS; i++)
+        {
+            throttled += rates->clients[i].bucket.throttled;
+            throttled_us += rates->clients[i].bucket.throttled_us;
+        }
+        used = append_limit(reply, reply_size, used, "client", rates->client_mbps, rates->client_iops, throttled,
+                            throttled_us);
+        for (int t = 0; t < RATE_TYPES; t++)
+        {
+            used = append_limit(reply, reply_size, used, type_names[t], rates->types[t].mbps, rates->types[t].iops,
+                                rates->types[t].throttled, rates->types[t].throttled_us);
+        }
+        return;
+    }
+    if (fields < 2 || mbps < 0 || (fields == 3 && iops < 0))
+    {
+        snprintf(reply, reply_size, "Usage: setlimit <global|client|.c|.pdf|.txt|.zip> <MB/s> [ops/s]");
+        return;
+    }
+    int *mbps_field = NULL, *iops_field = NULL;
+    if (strcmp(scope, "global") == 0)
+    {
+        mbps_field = &rates->global.mbps;
+        iops_field = &rates->global.iops;
+    }
+    else if (strcmp(scope, "client") == 0)
+    {
+        mbps_field = &rates->client_mbps;
+        iops_field = &rates->client_iops;
+    }
+    for (int t = 0; t < RATE_TYPES && mbps_field == NULL; t++)
+    {
+        if (strcmp(scope, type_names[t]) == 0)
+        {
+            mbps_field = &rates->types[t].mbps;
+            iops_field = &rates->types[t].iops;
+        }
+    }
+    if (mbps_field == NULL)
+    {
+        snprintf(reply, reply_size, "Unknown limit scope %s", scope);
+        return;
+    }
+    __atomic_store_n(mbps_field, mbps, __ATOMIC_RELAXED);
+    if (fields == 3)
+    {
+        __atomic_store_n(iops_field, iops, __ATOMIC_RELAXED);
+    }
+    dfs_log(DFS_LOG_INFO, "Limit for %s set to %d MB/s, %d ops/s", scope, *mbps_field, *iops_field);
+    snprintf(reply, reply_size, "Limit for %s set to %d MB/s, %d ops/s (0: unlimited)", scope, *mbps_field,
+             *iops_field);
+}
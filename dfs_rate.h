@@ -0,0 +1,39 @@
+// dfs_rate.h - Token-bucket bandwidth and request-rate limits.
+//
+// Every transfer is charged to three buckets: the server's global bucket, the bucket of
+// the client address it serves, and the bucket of its file type (.c, .pdf, .txt, .zip).
+// Each bucket limits bytes (MB/s, 1 MB = 10^6 bytes) and requests (ops/s). A handler
+// that overdraws any of them sleeps until that bucket has refilled, so the tightest
+// limit wins. Buckets may run DFS_RATE_BURST_MS (default 200) ahead of their rate.
+//
+// The limits start from the environment (0, the default, means unlimited):
+//   DFS_RATE_GLOBAL_MBPS / DFS_RATE_GLOBAL_IOPS   all traffic of the server
+//   DFS_RATE_CLIENT_MBPS / DFS_RATE_CLIENT_IOPS   each client address on its own
+//   DFS_RATE_C_MBPS, DFS_RATE_PDF_MBPS, ... / DFS_RATE_<TYPE>_IOPS   one file type
+// and can be changed while the server runs with "setlimit <scope> <MB/s> [ops/s]".
+// A "setlimit" without arguments lists the limits and how often each has throttled.
+// The buckets live in shared memory created before the server starts forking.
+
+#ifndef DFS_RATE_H
+#define DFS_RATE_H
+
+#include <stddef.h>
+
+// Maps the shared buckets, call once in main() before the accept loop
+void dfs_rate_init(void);
+
+// Starts a request read from client_socket: charges one op to its buckets (the file type
+// is taken from the request's first argument) and makes them the ones dfs_rate_bytes
+// charges. May sleep.
+void dfs_rate_request(int client_socket, const char *request);
+
+// Charges bytes moved for the current request, sleeping while a bucket is overdrawn
+void dfs_rate_bytes(int bytes);
+
+// 1 if any limit is set
+int dfs_rate_limited(void);
+
+// Handles a setlimit command, writes the reply text
+void dfs_rate_command(const char *request, char *reply, size_t reply_size);
+
+#endif
@@ -0,0 +1,92 @@
+// dfs_record.c - Recording of the commands S1 serves, for replay against a test cluster.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "dfs_record.h"
+#include "dfs_log.h"
+
+static int record_fd = -1;
+
+// the command being served
+static int recording;
+static long started_us;
+static struct
+{
+    struct dfs_record record;
+    char command[DFS_RECORD_COMMAND_MAX];
+} current;
+
+static long wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+void dfs_record_init(void)
+{
+    const char *path = getenv("DFS_RECORD");
+    if (path == NULL || *path == '\0')
+    {
+        return;
+    }
+    record_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (record_fd < 0 || fstat(record_fd, &st) != 0)
+    {
+        perror("Record file");
+        record_fd = -1;
+        return;
+    }
+    if (st.st_size == 0 && write(record_fd, DFS_RECORD_MAGIC, strlen(DFS_RECORD_MAGIC)) < 0)
+    {
+        perror("Record file");
+    }
+    dfs_log(DFS_LOG_INFO, "Recording commands to %s", path);
+}
+
+void dfs_record_begin(const char *request)
+{
+    if (record_fd < 0)
+    {
+        return;
+    }
+    recording = 1;
+    started_us = wall_us();
+    size_t len = strcspn(request, "\r\n");
+    len = len < sizeof(current.command) ? len : sizeof(current.command);
+    memcpy(current.command, request, len);
+    memset(&current.record, 0, sizeof(current.record));
+    current.record.start_us = started_us;
+    current.record.session = getpid();
+    current.record.size = -1;
+    current.record.command_len = len;
+}
+
+void dfs_record_size(int size)
+{
+    current.record.size = size;
+}
+
+void dfs_record_end(void)
+{
+    if (!recording)
+    {
+        return;
+    }
+    recording = 0;
+    long latency = wall_us() - started_us;
+    current.record.latency_us = latency > 0 ? latency : 0;
+    size_t n = sizeof(current.record) + current.record.command_len;
+    if (write(record_fd, &current, n) != (ssize_t)n)
+    {
+        dfs_log(DFS_LOG_WARN, "Recording a command failed");
+    }
+}
@@ -0,0 +1,37 @@
+// dfs_record.h - Recording of the commands S1 serves, for replay against a test cluster.
+//
+// With DFS_RECORD=<file> set, S1 appends one binary record per command to file. A record
+// holds when the command was read, how long it took, the connection it came on and the
+// size of the file uploaded or downloaded, followed by the command line itself. File
+// contents are never recorded. Each record is written with a single O_APPEND write, so
+// handlers share the file without locking. A new file starts with DFS_RECORD_MAGIC.
+// "loadgen -r <file>" (bench/loadgen.c) replays a recording with synthetic payloads of
+// the recorded sizes.
+
+#ifndef DFS_RECORD_H
+#define DFS_RECORD_H
+
+#define DFS_RECORD_MAGIC "DFSREC1\n"
+#define DFS_RECORD_COMMAND_MAX 1024
+
+struct dfs_record
+{
+    long start_us;              // wall clock when the command was read
+    unsigned int session;       // handler pid: the commands of one connection share it
+    unsigned int latency_us;
+    int size;                   // bytes uploaded or downloaded, -1 for none
+    unsigned short command_len; // bytes of command line that follow the record
+    unsigned short reserved;
+};
+
+// Opens DFS_RECORD if it is set; call in main() before the accept loop
+void dfs_record_init(void);
+
+// Brackets one command; request is the command line without its trace context
+void dfs_record_begin(const char *request);
+void dfs_record_end(void);
+
+// The size of the file the current command uploads or downloads
+void dfs_record_size(int size);
+
+#endif
@@ -0,0 +1,172 @@
+// dfs_selftest.c - Throughput self-test of the paths between S1 and the storage nodes.
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "dfs_selftest.h"
+#include "dfs_backend.h"
+#include "dfs_fs.h"
+#include "dfs_log.h"
+#include "dfs_meta.h"
+#include "dfs_net.h"
+
+#define CHUNK (1 << 20)
+
+// a chunk of pattern bytes both sides stream from
+static char *pattern(void)
+{
+    static char *chunk;
+    if (chunk == NULL && (chunk = malloc(CHUNK)) != NULL)
+    {
+        for (int i = 0; i < CHUNK; i++)
+        {
+            chunk[i] = (char)(i * 2654435761U >> 24);
+        }
+    }
+    return chunk;
+}
+
+static void send_memory(int client_socket, long bytes)
+{
+    int size = bytes;
+    char *chunk = pattern();
+    if (chunk == NULL)
+    {
+        size = 0;
+    }
+    dfs_send(client_socket, &size, sizeof(int), 0);
+    for (long left = size; left > 0; left -= CHUNK)
+    {
+        if (dfs_send_all(client_socket, chunk, left < CHUNK ? left : CHUNK) < 0)
+        {
+            break;
+        }
+    }
+}
+
+static void read_disk(int client_socket, const char *path)
+{
+    char reply[64];
+    int fd = open(path, O_RDONLY);
+    char *buffer = malloc(CHUNK);
+    if (fd < 0 || buffer == NULL)
+    {
+        snprintf(reply, sizeof(reply), "-1 0");
+    }
+    else
+    {
+        // the upload just wrote it: flush it and drop it so the read comes from the disk
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        long started = dfs_now_us();
+        long total = 0;
+        ssize_t n;
+        while ((n = read(fd, buffer, CHUNK)) > 0)
+        {
+            total += n;
+        }
+        snprintf(reply, sizeof(reply), "%ld %ld", n < 0 ? -1 : total, dfs_now_us() - started);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(buffer);
+    dfs_send_all(client_socket, reply, strlen(reply));
+}
+
+void dfs_selftest_serve(int client_socket, const char *request, const char *root)
+{
+    char command[20], test[16], argument[DFS_FS_PATH_MAX];
+    if (sscanf(request, "%19s %15s %511s", command, test, argument) != 3)
+    {
+        dfs_send(client_socket, "Usage: selftest net <bytes> | disk <path> | remove <path>", 57, 0);
+        return;
+    }
+    if (strcmp(test, "net") == 0)
+    {
+        send_memory(client_socket, atol(argument));
+    }
+    else if (strcmp(test, "disk") == 0 || strcmp(test, "remove") == 0)
+    {
+        char path[DFS_FS_PATH_MAX];
+        dfs_fs_resolve(path, argument, root);
+        if (test[0] == 'd')
+        {
+            read_disk(client_socket, path);
+        }
+        else if (remove(path) == 0)
+        {
+            dfs_meta_remove(path);
+            dfs_send(client_socket, "Removed", 7, 0);
+        }
+        else
+        {
+            dfs_send(client_socket, "Not found", 9, 0);
+        }
+    }
+    else
+    {
+        dfs_send(client_socket, "Unknown selftest", 16, 0);
+    }
+    dfs_log(DFS_LOG_INFO, "Self-test %s %s", test, argument);
+}
+
+int dfs_selftest_peer(long bytes, int sending, int *pid)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        return -1;
+    }
+    *pid = fork();
+    if (*pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (*pid == 0)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        close(fds[0]);
+        char *chunk = pattern();
+        if (sending && chunk != NULL)
+        {
+            for (long left = bytes; left > 0; left -= CHUNK)
+            {
+                if (dfs_send_all(fds[1], chunk, left < CHUNK ? left : CHUNK) < 0)
+                {
+                    break;
+                }
+            }
+        }
+        // drain the relay's replies (or the whole download) until S1 closes its end
+        char sink[65536];
+        while (read(fds[1], sink, sizeof(sink)) > 0)
+        {
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    return fds[0];
+}
+
+void dfs_selftest_peer_end(int fd, int pid)
+{
+    close(fd);
+    waitpid(pid, NULL, 0);
+}
+
+double dfs_selftest_rate(long bytes, long us)
+{
+    return bytes > 0 && us > 0 ? bytes / (double)us : 0;
+}
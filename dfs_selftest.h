@@ -0,0 +1,37 @@
+// dfs_selftest.h - Throughput self-test of the paths between S1 and the storage nodes.
+//
+// The admin command "selftest [MB]" (default 16, at most 1024) makes S1 measure, for
+// each storage node (S2, S3, S4):
+//   net       the node sends MB from memory and S1 relays it as it relays a download:
+//             socket throughput with no disk involved
+//   upload    S1 relays MB to the node through the upload relay; the node stores it
+//             like any upload, under ~S1/.dfs/selftest
+//   disk      the node reads that file back after dropping it from the page cache
+//   download  S1 relays the file back from the node like a client download
+// The relays are the ones client requests go through, fed or drained by a process
+// standing in for the client, and are timed from their first payload byte to their last.
+// The test file is then removed from every instance of the node. The reply is a report with one line per node,
+// preceded by its length as an int.
+
+#ifndef DFS_SELFTEST_H
+#define DFS_SELFTEST_H
+
+#define DFS_SELFTEST_DIR "~S1/.dfs/selftest"
+
+// Node side: answers "selftest net <bytes>" with the size as an int and that many bytes
+// from memory, "selftest disk <path>" with "<bytes> <microseconds>" taken to read the
+// file from disk, and "selftest remove <path>" by removing the test file. root is the
+// node's storage root, which ~S1/ paths resolve to.
+void dfs_selftest_serve(int client_socket, const char *request, const char *root);
+
+// S1 side: a socket to hand to a relay in place of the client's. A forked peer writes
+// bytes into it (sending set) or reads it until it is closed. Returns S1's end, -1 on error.
+int dfs_selftest_peer(long bytes, int sending, int *pid);
+
+// Closes S1's end and waits for the peer
+void dfs_selftest_peer_end(int fd, int pid);
+
+// MB/s of bytes moved in us microseconds, 0 when nothing was timed
+double dfs_selftest_rate(long bytes, long us);
+
+#endif
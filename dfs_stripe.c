@@ -0,0 +1,532 @@
+// dfs_stripe.c - Striped storage of large objects across the instances of a node.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "dfs_stripe.h"
+#include "dfs_backend.h"
+#include "dfs_cluster.h"
+#include "dfs_ec.h"
+#include "dfs_net.h"
+#include "dfs_lane.h"
+#include "dfs_rate.h"
+#include "dfs_trace.h"
+#include "dfs_log.h"
+#include "dfs_probe.h"
+
+#define STRIPE_IO_SIZE 65536
+
+int dfs_stripe_wanted(int filesize)
+{
+    int threshold = dfs_env_int("DFS_STRIPE_THRESHOLD", 64 * 1024 * 1024);
+    return threshold > 0 && filesize >= threshold && dfs_instances() > 1;
+}
+
+// bytes of the object held by one column: its full units plus the tail unit if it is ours
+static long column_size(const struct dfs_manifest *m, int column)
+{
+    if (m->parity > 0)
+    {
+        // coded rows are padded, every column holds one unit per row
+        long row_bytes = (long)(m->width - m->parity) * m->unit;
+        return (m->size + row_bytes - 1) / row_bytes * m->unit;
+    }
+    long full_units = m->size / m->unit;
+    long size = (full_units / m->width + (column < full_units % m->width ? 1 : 0)) * m->unit;
+    if (m->size % m->unit != 0 && full_units % m->width == column)
+    {
+        size += m->size % m->unit;
+    }
+    return size;
+}
+
+int dfs_stripe_parse_manifest(const char *data, size_t len, struct dfs_manifest *manifest)
+{
+    char text[DFS_MANIFEST_MAX + 1];
+    if (len < strlen(DFS_STRIPE_MAGIC) || len > DFS_MANIFEST_MAX ||
+        strncmp(data, DFS_STRIPE_MAGIC, strlen(DFS_STRIPE_MAGIC)) != 0)
+    {
+        return 0;
+    }
+    memcpy(text, data, len);
+    text[len] = '\0';
+    int k = 0;
+    manifest->parity = 0;
+    int fields = sscanf(text, DFS_STRIPE_MAGIC " 1 size %ld unit %d width %d ec %d %d",
+                        &manifest->size, &manifest->unit, &manifest->width, &k, &manifest->parity);
+    if (fields != 3 && fields != 5)
+    {
+        return 0;
+    }
+    if (fields == 5 && (manifest->parity < 1 || k + manifest->parity != manifest->width ||
+                        manifest->width > DFS_EC_MAX_SHARDS))
+    {
+        return 0;
+    }
+    return manifest->unit > 0 && manifest->width > 0 && manifest->width <= DFS_MAX_INSTANCES;
+}
+
+// stores the manifest at the object's path on the head of the replication chain
+static int store_manifest(const char *filename, const char *raw_dest, const struct dfs_manifest *m, int base_port)
+{
+    char manifest[DFS_MANIFEST_MAX];
+    int len = snprintf(manifest, sizeof(manifest), DFS_STRIPE_MAGIC " 1 size %ld unit %d width %d",
+                       m->size, m->unit, m->width);
+    if (m->parity > 0)
+    {
+        len += snprintf(manifest + len, sizeof(manifest) - len, " ec %d %d", m->width - m->parity, m->parity);
+    }
+    len += snprintf(manifest + len, sizeof(manifest) - len, "\n");
+
+    int sock = dfs_backend_connect(base_port);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    char command[1024];
+    snprintf(command, sizeof(command), "uploadf %s %s", filename, raw_dest);
+    dfs_trace_send_frame(sock, command);
+    dfs_send_all(sock, &len, sizeof(int));
+    char ack[256] = {0};
+    int answered = dfs_send_all(sock, manifest, len) == 0 && dfs_recv(sock, ack, sizeof(ack) - 1, 0) > 0;
+    close(sock);
+    dfs_backend_result(base_port, answered);
+    return answered && strncmp(ack, "Error", 5) != 0 ? 0 : -1; // an error: not on every replica
+}
+
+static void close_columns(int *socks, int width, int base_port, const char *down)
+{
+    for (int c = 0; c < width; c++)
+    {
+        if (socks[c] >= 0)
+        {
+            close(socks[c]);
+            dfs_backend_end(dfs_instance_port(base_port, c), !down[c]);
+        }
+    }
+}
+
+// removes the columns a failed upload left stored, so no instance keeps a column without a manifest
+static void remove_columns(const char *filename, const char *raw_dest, int width, const int *stored, int base_port)
+{
+    for (int c = 0; c < width; c++)
+    {
+        if (!stored[c])
+        {
+            continue;
+        }
+        int port = dfs_instance_port(base_port, c);
+        int sock = dfs_backend_connect(port);
+        if (sock < 0)
+        {
+            dfs_log(DFS_LOG_WARN, "Column %d of %s/%s is left behind", c, raw_dest, filename);
+            continue;
+        }
+        dfs_backend_begin(port);
+        char command[1024];
+        snprintf(command, sizeof(command), "rmcol %s/%s %d", raw_dest, filename, c);
+        dfs_trace_send(sock, command);
+        char reply[256] = {0};
+        int answered = dfs_recv(sock, reply, sizeof(reply) - 1, 0) > 0;
+        close(sock);
+        dfs_backend_end(port, answered);
+    }
+}
+
+// picks plain striping or, with DFS_STRIPE_MODE=ec and enough instances, a k+m code
+static void choose_layout(struct dfs_manifest *m)
+{
+    m->parity = 0;
+    const char *mode = getenv("DFS_STRIPE_MODE");
+    if (mode == NULL || strcmp(mode, "ec") != 0)
+    {
+        return;
+    }
+    int k = dfs_env_int("DFS_EC_K", 4);
+    int parity = dfs_env_int("DFS_EC_M", 2);
+    if (k < 1 || parity < 1 || k + parity > DFS_EC_MAX_SHARDS || k + parity > m->width)
+    {
+        dfs_log(DFS_LOG_WARN, "Erasure coding %d+%d needs %d instances, %d available; striping without parity", k,
+                parity, k + parity, m->width);
+        return;
+    }
+    m->width = k + parity;
+    m->parity = parity;
+}
+
+// deals the client's bytes to the columns unit by unit, returns the bytes taken from the client
+static long send_units(int client_socket, int *socks, const struct dfs_manifest *m, int *failed, char *down)
+{
+    char *buffer = malloc(STRIPE_IO_SIZE);
+    long pos = 0;
+    while (buffer != NULL && pos < m->size)
+    {
+        long want = m->size - pos < STRIPE_IO_SIZE ? m->size - pos : STRIPE_IO_SIZE;
+        int got = dfs_recv(client_socket, buffer, want, 0);
+        if (got <= 0)
+        {
+            break;
+        }
+        int off = 0;
+        while (off < got)
+        {
+            long unit_index = (pos + off) / m->unit;
+            int column = unit_index % m->width;
+            long left_in_unit = (unit_index + 1) * m->unit - (pos + off);
+            int n = got - off < left_in_unit ? got - off : (int)left_in_unit;
+            if (!*failed && dfs_send_all(socks[column], buffer + off, n) < 0)
+            {
+                dfs_log(DFS_LOG_WARN, "Lost column %d", column);
+                *failed = 1;
+                down[column] = 1;
+            }
+            off += n;
+        }
+        pos += got;
+        DFS_PROBE3(relay_chunk, 0, got, 0); // port 0: spread over the instances
+        dfs_lane_transfer(got);
+        dfs_rate_bytes(got);
+    }
+    free(buffer);
+    return pos;
+}
+
+// reads the client's bytes one row of k units at a time, adds the parity units and sends
+// every unit of the row to its column; returns the bytes taken from the client
+static long send_coded_rows(int client_socket, int *socks, const struct dfs_manifest *m, int *failed, char *down)
+{
+    int k = m->width - m->parity;
+    long row_bytes = (long)k * m->unit;
+    unsigned char *buffer = malloc((size_t)m->width * m->unit);
+    unsigned char *shards[DFS_EC_MAX_SHARDS];
+    for (int c = 0; c < m->width && buffer != NULL; c++)
+    {
+        shards[c] = buffer + (size_t)c * m->unit;
+    }
+    long pos = 0;
+    while (buffer != NULL && pos < m->size)
+    {
+        long want = m->size - pos < row_bytes ? m->size - pos : row_bytes;
+        if (dfs_recv_all(client_socket, buffer, want) < 0)
+        {
+            break;
+        }
+        memset(buffer + want, 0, row_bytes - want);
+        pos += want;
+        DFS_PROBE3(relay_chunk, 0, want, 0);
+        dfs_lane_transfer(want);
+        dfs_rate_bytes(want);
+        if (*failed)
+        {
+            continue; // keep draining the client
+        }
+        dfs_ec_encode(k, m->parity, m->unit, shards, shards + k);
+        for (int c = 0; c < m->width; c++)
+        {
+            if (dfs_send_all(socks[c], shards[c], m->unit) < 0)
+            {
+                dfs_log(DFS_LOG_WARN, "Lost column %d", c);
+                *failed = 1;
+                down[c] = 1;
+                break;
+            }
+        }
+    }
+    free(buffer);
+    return pos;
+}
+
+void dfs_stripe_upload(int client_socket, const char *filename, const char *raw_dest, int filesize, int base_port)
+{
+    struct dfs_manifest m;
+    m.size = filesize;
+    m.unit = dfs_env_int("DFS_STRIPE_UNIT", 1024 * 1024);
+    m.width = dfs_instances();
+    if (m.unit <= 0)
+    {
+        m.unit = 1024 * 1024;
+    }
+    choose_layout(&m);
+    if (m.parity > 0)
+    {
+        dfs_log(DFS_LOG_INFO, "Erasure coding %s (%d bytes) as %d+%d in %d byte units (%s kernel)", filename, filesize,
+                m.width - m.parity, m.parity, m.unit, dfs_ec_kernel());
+    }
+    else
+    {
+        dfs_log(DFS_LOG_INFO, "Striping %s (%d bytes) over %d instances in %d byte units", filename, filesize, m.width,
+                m.unit);
+    }
+
+    // open one column per instance; the sizes go only once every column is open
+    // down marks the instances that failed, only those count against their breakers
+    int socks[DFS_MAX_INSTANCES];
+    char down[DFS_MAX_INSTANCES] = {0};
+    int failed = 0;
+    for (int c = 0; c < m.width; c++)
+    {
+        int port = dfs_instance_port(base_port, c);
+        socks[c] = dfs_backend_connect(port);
+        if (socks[c] < 0)
+        {
+            failed = 1; // the others get no size and store nothing
+            continue;
+        }
+        dfs_backend_begin(port);
+        char command[1024];
+        snprintf(command, sizeof(command), "putcol %s %s %d", filename, raw_dest, c);
+        dfs_trace_send_frame(socks[c], command);
+    }
+    for (int c = 0; c < m.width && !failed; c++)
+    {
+        int size = (int)column_size(&m, c);
+        dfs_send_all(socks[c], &size, sizeof(int));
+    }
+
+    // all nodes write their columns in parallel
+    long pos = m.parity > 0 ? send_coded_rows(client_socket, socks, &m, &failed, down)
+                            : send_units(client_socket, socks, &m, &failed, down);
+    if (pos < filesize)
+    {
+        dfs_log(DFS_LOG_WARN, "Client went away during striped upload of %s", filename);
+    }
+
+    // every column acknowledges once its share is on disk. After a failure the columns get
+    // end of file instead of the rest of their data and abort, except those that already had
+    // all of it: every ack is read, so a failed upload knows which stored columns to remove.
+    int stored[DFS_MAX_INSTANCES] = {0};
+    for (int c = 0; c < m.width; c++)
+    {
+        if (socks[c] >= 0 && !down[c] && (failed || pos < filesize))
+        {
+            shutdown(socks[c], SHUT_WR);
+        }
+    }
+    for (int c = 0; c < m.width; c++)
+    {
+        if (socks[c] < 0 || down[c])
+        {
+            continue;
+        }
+        char ack[256] = {0};
+        if (dfs_recv(socks[c], ack, sizeof(ack) - 1, 0) <= 0)
+        {
+            dfs_log(DFS_LOG_WARN, "Column %d of %s was not acknowledged", c, filename);
+            down[c] = 1;
+        }
+        else
+        {
+            stored[c] = strncmp(ack, "Error", 5) != 0;
+        }
+    }
+    close_columns(socks, m.width, base_port, down);
+
+    for (int c = 0; c < m.width; c++)
+    {
+        failed |= !stored[c];
+    }
+    if (pos < filesize)
+    {
+        remove_columns(filename, raw_dest, m.width, stored, base_port);
+        return; // client connection is gone
+    }
+    if (failed || store_manifest(filename, raw_dest, &m, base_port) < 0)
+    {
+        remove_columns(filename, raw_dest, m.width, stored, base_port);
+        dfs_send(client_socket, "Error storing striped file", 26, 0);
+        return;
+    }
+    dfs_send(client_socket, "File uploaded successfully", 26, 0);
+}
+
+// asks instance column for its column of raw_path, returns the socket once the size checks out
+static int open_column(const char *raw_path, int column, const struct dfs_manifest *m, int base_port)
+{
+    int port = dfs_instance_port(base_port, column);
+    int sock = dfs_backend_connect(port);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    dfs_backend_begin(port);
+    char command[1024];
+    snprintf(command, sizeof(command), "getcol %s %d", raw_path, column);
+    dfs_trace_send(sock, command);
+    shutdown(sock, SHUT_WR);
+
+    int size = -1;
+    if (dfs_recv_all(sock, &size, sizeof(int)) < 0 || size != column_size(m, column))
+    {
+        dfs_log(DFS_LOG_WARN, "Column %d of %s is missing or damaged (%d bytes)", column, raw_path, size);
+        close(sock);
+        dfs_backend_end(port, 0);
+        return -1;
+    }
+    return sock;
+}
+
+// plain stripes: the nodes stream their columns concurrently and we drain them in unit order
+static long receive_units(int client_socket, int *socks, const struct dfs_manifest *m)
+{
+    char *buffer = malloc(STRIPE_IO_SIZE);
+    long pos = 0;
+    while (buffer != NULL && pos < m->size)
+    {
+        long unit_index = pos / m->unit;
+        int column = unit_index % m->width;
+        long left = m->size - pos < m->unit ? m->size - pos : m->unit;
+        while (left > 0)
+        {
+            int want = left < STRIPE_IO_SIZE ? (int)left : STRIPE_IO_SIZE;
+            int got = dfs_recv(socks[column], buffer, want, 0);
+            if (got <= 0 || dfs_send_all(client_socket, buffer, got) < 0)
+            {
+                dfs_log(DFS_LOG_ERROR, "Striped download broke in column %d", column);
+                free(buffer);
+                return pos;
+            }
+            left -= got;
+            pos += got;
+            DFS_PROBE3(relay_chunk, 0, got, 1);
+            dfs_lane_transfer(got);
+            dfs_rate_bytes(got);
+        }
+    }
+    free(buffer);
+    return pos;
+}
+
+// reads unit number row of a column into buf, skipping rows the socket is still behind on
+static int read_unit(int sock, long *at_row, long row, unsigned char *buf, int unit)
+{
+    for (; *at_row <= row; (*at_row)++)
+    {
+        if (dfs_recv_all(sock, buf, unit) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// coded rows: data columns are read as they are; parity columns are only opened (and skipped
+// forward to the current row) once a data column is missing, then the row is rebuilt
+static long receive_coded_rows(int client_socket, const char *raw_path, int *socks,
+                               const struct dfs_manifest *m, int base_port)
+{
+    int k = m->width - m->parity;
+    long row_bytes = (long)k * m->unit;
+    long at_row[DFS_MAX_INSTANCES] = {0};
+    int tried[DFS_MAX_INSTANCES] = {0};
+    unsigned char *buffer = malloc((size_t)m->width * m->unit);
+    unsigned char *shards[DFS_EC_MAX_SHARDS];
+    for (int c = 0; c < m->width && buffer != NULL; c++)
+    {
+        shards[c] = buffer + (size_t)c * m->unit;
+        tried[c] = c < k || socks[c] >= 0;
+    }
+
+    long pos = 0;
+    int rebuilt_rows = 0;
+    for (long row = 0; buffer != NULL && pos < m->size; row++)
+    {
+        int present[DFS_EC_MAX_SHARDS] = {0};
+        int have = 0;
+        for (int c = 0; c < m->width && have < k; c++)
+        {
+            if (socks[c] < 0 && !tried[c])
+            {
+                socks[c] = open_column(raw_path, c, m, base_port);
+                tried[c] = 1;
+            }
+            if (socks[c] < 0)
+            {
+                continue;
+            }
+            if (read_unit(socks[c], &at_row[c], row, shards[c], m->unit) < 0)
+            {
+                dfs_log(DFS_LOG_WARN, "Lost column %d of %s at row %ld", c, raw_path, row);
+                close(socks[c]);
+                dfs_backend_end(dfs_instance_port(base_port, c), 0);
+                socks[c] = -1;
+                continue;
+            }
+            present[c] = 1;
+            have++;
+        }
+        if (have < k || dfs_ec_decode(k, m->parity, m->unit, shards, present) < 0)
+        {
+            dfs_log(DFS_LOG_ERROR, "Too many columns of %s lost to rebuild row %ld", raw_path, row);
+            break;
+        }
+        for (int c = 0; c < k; c++)
+        {
+            if (!present[c])
+            {
+                rebuilt_rows++;
+                break;
+            }
+        }
+        long want = m->size - pos < row_bytes ? m->size - pos : row_bytes;
+        if (dfs_send_all(client_socket, buffer, want) < 0)
+        {
+            break;
+        }
+        pos += want;
+        DFS_PROBE3(relay_chunk, 0, want, 1);
+        dfs_lane_transfer(want);
+        dfs_rate_bytes(want);
+    }
+    free(buffer);
+    if (rebuilt_rows > 0)
+    {
+        dfs_log(DFS_LOG_INFO, "Rebuilt %d rows of %s from parity", rebuilt_rows, raw_path);
+    }
+    return pos;
+}
+
+void dfs_stripe_download(int client_socket, const char *raw_path, const struct dfs_manifest *m, int base_port)
+{
+    dfs_lane_size(m->size); // the manifest looked small, the object is not
+    int k = m->width - m->parity;
+    int socks[DFS_MAX_INSTANCES];
+    int missing = 0;
+    for (int c = 0; c < m->width; c++)
+    {
+        socks[c] = c < k ? open_column(raw_path, c, m, base_port) : -1;
+        missing += c < k && socks[c] < 0;
+    }
+
+    // check enough columns are there before committing to a size towards the client
+    for (int c = k; c < m->width && missing > 0; c++)
+    {
+        socks[c] = open_column(raw_path, c, m, base_port);
+        missing -= socks[c] >= 0;
+    }
+    char down[DFS_MAX_INSTANCES] = {0}; // the missing columns are already recorded as failed
+    if (missing > 0)
+    {
+        close_columns(socks, m->width, base_port, down);
+        dfs_send(client_socket, &(int){0}, sizeof(int), 0);
+        return;
+    }
+
+    int filesize = (int)m->size;
+    dfs_send(client_socket, &filesize, sizeof(int), 0);
+
+    long pos = m->parity > 0 ? receive_coded_rows(client_socket, raw_path, socks, m, base_port)
+                             : receive_units(client_socket, socks, m);
+    memset(down, pos < m->size, sizeof(down));
+    close_columns(socks, m->width, base_port, down);
+    if (pos < m->size)
+    {
+        // the client already has the size, it cannot be resynchronised
+        dfs_log(DFS_LOG_ERROR, "Striped download of %s broke after %ld bytes", raw_path, pos);
+        shutdown(client_socket, SHUT_RDWR);
+        return;
+    }
+    dfs_log(DFS_LOG_INFO, "Striped file %s sent to client (%ld bytes from %d columns)", raw_path, m->size, m->width);
+}
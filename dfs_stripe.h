@@ -0,0 +1,43 @@
+// dfs_stripe.h - Striped storage of large objects across the instances of a node.
+//
+// An object of at least DFS_STRIPE_THRESHOLD bytes is cut into DFS_STRIPE_UNIT sized
+// units that are dealt round-robin over all DFS_INSTANCES instances of the node. Each
+// instance keeps its units back to back in one column file, and a small manifest is
+// stored at the object's own path (through the replication chain) so listings keep
+// showing the object and downloads know how to reassemble it.
+//
+// With DFS_STRIPE_MODE=ec each row of DFS_EC_K data units gets DFS_EC_M Reed-Solomon
+// parity units, one column per instance, so any DFS_EC_M columns can be lost and the
+// object still reads back (storage overhead (k+m)/k instead of a full copy per replica).
+
+#ifndef DFS_STRIPE_H
+#define DFS_STRIPE_H
+
+#include <stddef.h>
+
+#define DFS_STRIPE_MAGIC "DFSSTRIPE"
+#define DFS_MANIFEST_MAX 256
+
+struct dfs_manifest
+{
+    long size;  // object size in bytes
+    int unit;   // bytes per stripe unit
+    int width;  // number of columns (instances) the units are spread over
+    int parity; // parity columns at the end of each row, 0 for plain striping
+};
+
+// 1 if an upload of filesize bytes should be striped
+int dfs_stripe_wanted(int filesize);
+
+// Receives filesize bytes from the client and writes them as stripes to the instances of
+// the node at base_port, then stores the manifest at <raw_dest>/<filename>.
+// raw_dest is the destination as sent by the client (~S1/...). Replies to the client.
+void dfs_stripe_upload(int client_socket, const char *filename, const char *raw_dest, int filesize, int base_port);
+
+// Parses a manifest, returns 1 if data holds one
+int dfs_stripe_parse_manifest(const char *data, size_t len, struct dfs_manifest *manifest);
+
+// Streams the striped object raw_path (~S1/...) to the client: file size then content
+void dfs_stripe_download(int client_socket, const char *raw_path, const struct dfs_manifest *manifest, int base_port);
+
+#endif
@@ -0,0 +1,279 @@
+// dfs_trace.c - Request tracing across the client, S1 and the storage nodes.
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "dfs_trace.h"
+#include "dfs_cluster.h"
+#include "dfs_net.h"
+
+#define EVENTS_MAX 32768 // buffered events of one request before they are written
+#define EVENT_MAX 1024
+
+static char server_name[16] = "client";
+static int server_pid; // the server's port stands in for a process id in the viewer
+static int sample;
+static int trace_fd = -1;
+
+// the request this handler is serving
+static unsigned long trace_id;
+static int traced;
+static int forced; // client: the next command asks to be traced
+static int is_client; // set by dfs_trace_new
+static long started_us;
+static char command_name[20];
+static char request_text[256];
+static unsigned int forwards;
+static char events[EVENTS_MAX];
+static size_t events_used;
+
+static long wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static unsigned long random_id(void)
+{
+    unsigned long id = 0;
+    if (getrandom(&id, sizeof(id), GRND_NONBLOCK) != sizeof(id))
+    {
+        id = (unsigned long)wall_us() * 2654435761UL ^ (unsigned long)getpid() << 32;
+    }
+    return id;
+}
+
+void dfs_trace_init(const char *name, int port)
+{
+    snprintf(server_name, sizeof(server_name), "%s", name);
+    server_pid = port;
+    sample = dfs_env_int("DFS_TRACE_SAMPLE", 0);
+}
+
+// copies text into a JSON string body
+static void escape(char *out, size_t size, const char *text)
+{
+    size_t used = 0;
+    for (; *text != '\0' && used + 7 < size; text++)
+    {
+        unsigned char ch = *text;
+        if (ch == '"' || ch == '\\')
+        {
+            out[used++] = '\\';
+            out[used++] = ch;
+        }
+        else if (ch < 0x20)
+        {
+            used += snprintf(out + used, size - used, "\\u%04x", ch);
+        }
+        else
+        {
+            out[used++] = ch;
+        }
+    }
+    out[used] = '\0';
+}
+
+static void flush_events(void)
+{
+    if (events_used == 0)
+    {
+        return;
+    }
+    if (trace_fd < 0)
+    {
+        const char *path = getenv("DFS_TRACE_FILE");
+        if (path == NULL || *path == '\0')
+        {
+            path = "/tmp/dfs_trace.json";
+        }
+        // whoever creates the file opens the JSON array; viewers accept it unterminated
+        trace_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (trace_fd >= 0)
+        {
+            write(trace_fd, "[\n", 2);
+        }
+        else
+        {
+            trace_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        }
+        if (trace_fd < 0)
+        {
+            perror("Trace file");
+            events_used = 0;
+            return;
+        }
+        char meta[128];
+        int n = snprintf(meta, sizeof(meta),
+                         "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s :%d\"}},\n",
+                         server_pid, server_name, server_pid);
+        write(trace_fd, meta, n);
+    }
+    write(trace_fd, events, events_used); // one append per request keeps servers' events apart
+    events_used = 0;
+}
+
+static void add_event(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void add_event(const char *format, ...)
+{
+    if (events_used + EVENT_MAX > EVENTS_MAX)
+    {
+        flush_events();
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(events + events_used, EVENT_MAX, format, args);
+    va_end(args);
+    if (n > 0)
+    {
+        events_used += n < EVENT_MAX ? n : EVENT_MAX - 1;
+    }
+}
+
+const char *dfs_trace_command(const char *request)
+{
+    if (request[0] != '@')
+    {
+        return request;
+    }
+    const char *space = strchr(request, ' ');
+    return space != NULL ? space + 1 : request + strlen(request);
+}
+
+void dfs_trace_begin(char *request)
+{
+    traced = 0;
+    events_used = 0;
+    forwards = 0;
+    char flow[40] = "";
+    int asked = 0;
+    if (request[0] == '@')
+    {
+        // @<id>[.<hop>][!]
+        char *end;
+        trace_id = strtoul(request + 1, &end, 16);
+        if (*end == '.')
+        {
+            char *hop_end = end + 1;
+            strtoul(hop_end, &hop_end, 16);
+            snprintf(flow, sizeof(flow), "%016lx.%.*s", trace_id, (int)(hop_end - end - 1), end + 1);
+            end = hop_end;
+        }
+        asked = *end == '!';
+        const char *command = dfs_trace_command(request);
+        memmove(request, command, strlen(command) + 1);
+    }
+    else if (sample > 0)
+    {
+        trace_id = random_id();
+    }
+    else
+    {
+        return;
+    }
+    traced = asked || (sample > 0 && trace_id % sample == 0);
+    if (!traced)
+    {
+        return;
+    }
+    started_us = wall_us();
+    command_name[0] = '\0';
+    sscanf(request, "%19s", command_name);
+    escape(request_text, sizeof(request_text), request);
+    if (flow[0] != '\0')
+    {
+        // the arrow from the sender's span ends at this one
+        add_event("{\"name\":\"forward\",\"cat\":\"hop\",\"ph\":\"f\",\"bp\":\"e\",\"id\":\"%s\",\"ts\":%ld,"
+                  "\"pid\":%d,\"tid\":%d},\n",
+                  flow, started_us, server_pid, getpid());
+    }
+}
+
+void dfs_trace_end(void)
+{
+    if (!traced)
+    {
+        return;
+    }
+    char name[24];
+    escape(name, sizeof(name), command_name);
+    add_event("{\"name\":\"%s %s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%ld,\"dur\":%ld,\"pid\":%d,\"tid\":%d,"
+              "\"args\":{\"trace\":\"%016lx\",\"request\":\"%s\"}},\n",
+              server_name, name, started_us, wall_us() - started_us, server_pid, getpid(), trace_id, request_text);
+    flush_events();
+    traced = 0;
+}
+
+long dfs_trace_now(void)
+{
+    return traced ? wall_us() : 0;
+}
+
+void dfs_trace_span(const char *name, long start_us, const char *detail)
+{
+    if (!traced || start_us == 0)
+    {
+        return;
+    }
+    char text[256];
+    escape(text, sizeof(text), detail != NULL ? detail : "");
+    add_event("{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":%ld,\"dur\":%ld,\"pid\":%d,\"tid\":%d,"
+              "\"args\":{\"trace\":\"%016lx\",\"detail\":\"%s\"}},\n",
+              name, start_us, wall_us() - start_us, server_pid, getpid(), trace_id, text);
+}
+
+// the command as it goes to another server: with the trace context in front when there is one
+static const char *with_context(char *message, size_t size, const char *command)
+{
+    if (is_client)
+    {
+        snprintf(message, size, "@%016lx%s %s", trace_id, forced ? "!" : "", command);
+    }
+    else if (traced)
+    {
+        // the hop is named by this handler and a counter, so the receiver's span can point back here
+        unsigned int hop = (unsigned int)getpid() << 8 | (++forwards & 0xff);
+        snprintf(message, size, "@%016lx.%x! %s", trace_id, hop, command);
+        add_event("{\"name\":\"forward\",\"cat\":\"hop\",\"ph\":\"s\",\"id\":\"%016lx.%x\",\"ts\":%ld,\"pid\":%d,"
+                  "\"tid\":%d},\n",
+                  trace_id, hop, wall_us(), server_pid, getpid());
+    }
+    else
+    {
+        return command;
+    }
+    return message;
+}
+
+int dfs_trace_send(int sock, const char *command)
+{
+    char message[2048];
+    const char *text = with_context(message, sizeof(message), command);
+    return dfs_send(sock, text, strlen(text), 0);
+}
+
+int dfs_trace_send_frame(int sock, const char *command)
+{
+    char frame[DFS_FRAME_SIZE] = {DFS_FRAME_MARK};
+    char message[2048];
+    snprintf(frame + 1, sizeof(frame) - 1, "%s", with_context(message, sizeof(message), command));
+    return dfs_send_all(sock, frame, sizeof(frame));
+}
+
+unsigned long dfs_trace_new(void)
+{
+    is_client = 1;
+    trace_id = random_id();
+    forced = dfs_env_int("DFS_TRACE", 0) != 0;
+    return trace_id;
+}
@@ -0,0 +1,48 @@
+// dfs_trace.h - Request tracing across the client, S1 and the storage nodes.
+//
+// The client puts a trace context in front of every command: "@<trace id> " with a
+// random 64-bit id in hex, followed by "!" before the space when DFS_TRACE=1 asks for
+// the request to be traced. S1 traces a request when it is asked to or, with
+// DFS_TRACE_SAMPLE=N, one request in N (0, the default, traces only requests the client
+// marks). A traced request is forwarded to the storage nodes with its context, so they
+// trace their part too; untraced ones are forwarded as before. Every server strips the
+// context before parsing the command.
+//
+// Each server writes its spans to DFS_TRACE_FILE (default /tmp/dfs_trace.json) in the
+// Chrome trace event format, which chrome://tracing and Perfetto open. The servers can
+// share the file: events are appended a request at a time, and each hop from S1 to a
+// node is drawn as an arrow between the two spans. Untraced requests cost one compare.
+
+#ifndef DFS_TRACE_H
+#define DFS_TRACE_H
+
+// Names the server in the trace (pid is its port), call once in main()
+void dfs_trace_init(const char *name, int port);
+
+// Starts a request: strips a leading trace context from request (in place) and decides
+// whether the request is traced. Every dfs_trace_begin is paired with a dfs_trace_end,
+// which writes the request's spans.
+void dfs_trace_begin(char *request);
+void dfs_trace_end(void);
+
+// The request past its trace context, if any
+const char *dfs_trace_command(const char *request);
+
+// Timestamp for a span of the current request, 0 if it is not traced
+long dfs_trace_now(void);
+
+// Records a span from start_us (from dfs_trace_now) until now; detail is shown with it
+void dfs_trace_span(const char *name, long start_us, const char *detail);
+
+// Sends a command to another server with the current trace context in front of it.
+// Returns what send() returns.
+int dfs_trace_send(int sock, const char *command);
+
+// Same as dfs_trace_send but sends the command as a frame (see dfs_net.h), so whatever
+// follows it (a file size) can be sent at once. Returns 0 on success, -1 on error.
+int dfs_trace_send_frame(int sock, const char *command);
+
+// Client side: starts a new trace id for the next command and returns it
+unsigned long dfs_trace_new(void);
+
+#endif
@@ -0,0 +1,243 @@
+// dfs_watch.c - Keeps a node's metadata index in step with files changed outside the server.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+
+#include "dfs_watch.h"
+#include "dfs_meta.h"
+#include "dfs_cluster.h"
+#include "dfs_log.h"
+
+// events are read this long after the first one arrives, by when the server has indexed
+// its own writes and removes and the watcher finds nothing left to do for them
+#define WATCH_SETTLE_US 100000
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+static char watch_root[512];
+static int watch_fd = -1;
+static int watch_full_reported;
+
+// directory of each watch, indexed by watch descriptor (the kernel hands them out in order)
+static char **watched;
+static int watched_cap;
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void add_watch(const char *dir)
+{
+    int wd = inotify_add_watch(watch_fd, dir, WATCH_MASK);
+    if (wd < 0)
+    {
+        if (errno == ENOSPC && !watch_full_reported)
+        {
+            dfs_log(DFS_LOG_WARN, "Watcher: out of inotify watches at %s, raise fs.inotify.max_user_watches", dir);
+            watch_full_reported = 1;
+        }
+        return;
+    }
+    if (wd >= watched_cap)
+    {
+        int cap = watched_cap ? watched_cap : 256;
+        while (cap <= wd)
+        {
+            cap *= 2;
+        }
+        char **grown = realloc(watched, sizeof(*watched) * cap);
+        if (grown == NULL)
+        {
+            return;
+        }
+        memset(grown + watched_cap, 0, sizeof(*watched) * (cap - watched_cap));
+        watched = grown;
+        watched_cap = cap;
+    }
+    // a directory that was renamed keeps its descriptor, so this also updates its path
+    free(watched[wd]);
+    watched[wd] = strdup(dir);
+}
+
+static int watch_visit(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void)st;
+    if (type != FTW_D)
+    {
+        return FTW_CONTINUE;
+    }
+    if (strcmp(path + ftw->base, ".dfs") == 0)
+    {
+        return FTW_SKIP_SUBTREE; // node-private data, written only by the server
+    }
+    add_watch(path);
+    return FTW_CONTINUE;
+}
+
+static int watch_tree(const char *dir)
+{
+    nftw(dir, watch_visit, 32, FTW_PHYS | FTW_ACTIONRETVAL);
+    int count = 0;
+    for (int wd = 0; wd < watched_cap; wd++)
+    {
+        count += watched[wd] != NULL;
+    }
+    return count;
+}
+
+// stops watching dir and everything below it (it was moved away or deleted)
+static void unwatch_tree(const char *dir)
+{
+    size_t len = strlen(dir);
+    for (int wd = 0; wd < watched_cap; wd++)
+    {
+        if (watched[wd] != NULL && strncmp(watched[wd], dir, len) == 0 &&
+            (watched[wd][len] == '\0' || watched[wd][len] == '/'))
+        {
+            inotify_rm_watch(watch_fd, wd);
+            free(watched[wd]);
+            watched[wd] = NULL;
+        }
+    }
+}
+
+static void handle_event(const struct inotify_event *event)
+{
+    if (event->wd < 0 || event->wd >= watched_cap || watched[event->wd] == NULL)
+    {
+        return;
+    }
+    if (event->mask & IN_IGNORED)
+    {
+        free(watched[event->wd]); // the directory itself is gone
+        watched[event->wd] = NULL;
+        return;
+    }
+    if (event->len == 0 || strcmp(event->name, ".dfs") == 0)
+    {
+        return;
+    }
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", watched[event->wd], event->name);
+
+    int changes;
+    if (!(event->mask & IN_ISDIR))
+    {
+        changes = dfs_meta_sync_file(path);
+    }
+    else if (event->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+        // files may have landed in it before the watch was in place
+        watch_tree(path);
+        changes = dfs_meta_reconcile(path, 1);
+    }
+    else
+    {
+        unwatch_tree(path);
+        changes = dfs_meta_reconcile(path, 1);
+    }
+    if (changes > 0)
+    {
+        dfs_log(DFS_LOG_INFO, "Watcher: %s changed outside the server (%d index updates)", path, changes);
+    }
+}
+
+static void rescan(void)
+{
+    long started = now_ms();
+    int directories = watch_tree(watch_root);
+    int changes = dfs_meta_reconcile(watch_root, 1);
+    dfs_log(DFS_LOG_WARN,
+            "Watcher: event queue overflowed, rescanned %d directories of %s (%d index updates) in %ld ms", directories,
+            watch_root, changes, now_ms() - started);
+}
+
+static void watcher(void)
+{
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    long interval = dfs_env_int("DFS_WATCH_RESCAN_SECONDS", 5) * 1000L;
+    long last_rescan = now_ms() - interval;
+    long snapshot_interval = dfs_env_int("DFS_META_SNAPSHOT_SECONDS", 60) * 1000L;
+    if (snapshot_interval <= 0)
+    {
+        snapshot_interval = 60000;
+    }
+    long last_snapshot = now_ms(); // the server wrote one as it started
+    int overflowed = 0;
+    char buffer[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    dfs_log(DFS_LOG_INFO, "Watcher: watching %d directories of %s", watch_tree(watch_root), watch_root);
+    while (1)
+    {
+        // a rescan is due once the previous one is far enough back; overflows until then share it
+        if (overflowed && now_ms() - last_rescan >= interval)
+        {
+            rescan();
+            last_rescan = now_ms();
+            overflowed = 0;
+        }
+        int pending = 0;
+        ioctl(watch_fd, FIONREAD, &pending);
+        if (!overflowed && pending == 0 && now_ms() - last_snapshot >= snapshot_interval)
+        {
+            // every event so far is in the index, so it matches each directory as it is now
+            dfs_meta_snapshot_dirs(watched, watched_cap, time(NULL));
+            last_snapshot = now_ms();
+        }
+        struct pollfd pfd = {watch_fd, POLLIN, 0};
+        long wait = overflowed ? interval - (now_ms() - last_rescan) : snapshot_interval - (now_ms() - last_snapshot);
+        if (poll(&pfd, 1, wait > 0 ? (int)wait : 0) <= 0)
+        {
+            continue;
+        }
+        usleep(WATCH_SETTLE_US);
+        ssize_t n = read(watch_fd, buffer, sizeof(buffer));
+        for (ssize_t at = 0; at < n;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)(buffer + at);
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                overflowed = 1;
+            }
+            else if (!overflowed)
+            {
+                handle_event(event); // after an overflow the rescan covers everything
+            }
+            at += sizeof(*event) + event->len;
+        }
+    }
+}
+
+void dfs_watch_init(const char *root)
+{
+    if (!dfs_meta_enabled() || dfs_env_int("DFS_WATCH", 1) != 1)
+    {
+        return;
+    }
+    snprintf(watch_root, sizeof(watch_root), "%s", root);
+    if (fork() == 0)
+    {
+        watch_fd = inotify_init1(IN_CLOEXEC);
+        if (watch_fd < 0)
+        {
+            perror("inotify_init1");
+            exit(1);
+        }
+        watcher();
+        exit(0);
+    }
+}
@@ -0,0 +1,17 @@
+// dfs_watch.h - Keeps a node's metadata index in step with files changed outside the server.
+//
+// Operators sometimes copy files straight into a storage root. With the metadata index
+// on (DFS_META=1) a background process watches every directory of the root with inotify
+// and applies creates, writes, deletes and renames to the index as they happen, so
+// dispfnames and statf never need a scan. If the kernel's event queue overflows some
+// events are lost, and the whole root is reconciled against the index instead, at most
+// once every DFS_WATCH_RESCAN_SECONDS. DFS_WATCH=0 turns the watcher off.
+
+#ifndef DFS_WATCH_H
+#define DFS_WATCH_H
+
+// Starts the watcher for the storage root. Call after dfs_meta_init, before the server
+// forks its first handler. Does nothing unless the metadata index is on.
+void dfs_watch_init(const char *root);
+
+#endif
@@ -11,6 +11,15 @@
 #include <errno.h>
 #include <time.h>
 #include <dirent.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "dfs_backend.h"
+#include "dfs_cluster.h"
+#include "dfs_net.h"
+#include "dfs_trace.h"
 
 #define SERVER_PORT 7777
 #define BUFFER_SIZE 1024
@@ -106,6 +115,12 @@ void display_extension_error(const char *command_str)
         printf("Usage: removef <filename>\n");
         printf("Example:   removef ~S1/foldertxt/1.txt\n");
     }
+    else if (strcmp(command, "statf") == 0)
+    {
+        printf("Error: File must have a valid extension (.c, .pdf, .txt, .zip)\n");
+        printf("Usage: statf <filename>\n");
+        printf("Example:  statf ~S1/foldertxt/1.txt\n");
+    }
     else if (strcmp(command, "downltar") == 0)
     {
         printf("Error: Invalid file type. Supported types are: .c, .pdf, .txt\n");
@@ -185,9 +200,9 @@ int validate_extension(const char *command_str)
         }
         return 0; // Invalid extension
     }
-    else if (strcmp(command, "downlf") == 0 || strcmp(command, "removef") == 0)
+    else if (strcmp(command, "downlf") == 0 || strcmp(command, "removef") == 0 || strcmp(command, "statf") == 0)
     {
-        // For downlf and removef, check that the path starts with ~S1/
+        // For downlf, removef and statf, check that the path starts with ~S1/
         if (strncmp(arg1, "~S1/", 4) != 0)
         {
             printf("Error: File path must start with '~S1/'\n");
@@ -249,9 +264,34 @@ int validate_extension(const char *command_str)
         return 1;
     }
 
+    else if (strcmp(command, "setlimit") == 0)
+    {
+        // S1 checks the scope and rates; without arguments it lists the limits
+        return 1;
+    }
+
+    else if (strcmp(command, "stats") == 0 || strcmp(command, "selftest") == 0)
+    {
+        // selftest takes an optional transfer size in MB, S1 bounds it
+        return 1;
+    }
+
     return 0; // Unknown command or invalid input
 }
 
+// the name a tar archive of file_type files is saved under in the client's pwd
+void get_tar_filename(const char *file_type, char *tar_filename, size_t size)
+{
+    if (strcmp(file_type, ".c") == 0)
+        snprintf(tar_filename, size, "cfiles.tar");
+    else if (strcmp(file_type, ".pdf") == 0)
+        snprintf(tar_filename, size, "pdf.tar");
+    else if (strcmp(file_type, ".txt") == 0)
+        snprintf(tar_filename, size, "text.tar");
+    else
+        snprintf(tar_filename, size, "downloaded.tar");
+}
+
 // it takes the file extension and then make  tar file and that tar file is stored in client pwd...
 void download_tar(int sock, char *file_type)
 {
@@ -267,7 +307,7 @@ void download_tar(int sock, char *file_type)
     // Compose the downltar command and send it to the server.
     char command[BUFFER_SIZE];
     snprintf(command, sizeof(command), "downltar %s", file_type);
-    if (send(sock, command, strlen(command), 0) < 0)
+    if (dfs_trace_send(sock, command) < 0)
     {
         perror("Error sending downltar command");
         return;
@@ -281,8 +321,8 @@ void download_tar(int sock, char *file_type)
         return;
     }
 
-    // If filesize is 0, there are no files or an error occurred
-    if (filesize == 0)
+    // If filesize is 0, there are no files or an error occurred (-1: the server is busy)
+    if (filesize <= 0)
     {
         char error_msg[BUFFER_SIZE];
         memset(error_msg, 0, BUFFER_SIZE);
@@ -295,14 +335,7 @@ void download_tar(int sock, char *file_type)
     }
 
     char tar_filename[128];
-    if (strcmp(file_type, ".c") == 0)
-        snprintf(tar_filename, sizeof(tar_filename), "cfiles.tar");
-    else if (strcmp(file_type, ".pdf") == 0)
-        snprintf(tar_filename, sizeof(tar_filename), "pdf.tar");
-    else if (strcmp(file_type, ".txt") == 0)
-        snprintf(tar_filename, sizeof(tar_filename), "text.tar");
-    else
-        snprintf(tar_filename, sizeof(tar_filename), "downloaded.tar");
+    get_tar_filename(file_type, tar_filename, sizeof(tar_filename));
 
     printf("Receiving tar file as: %s (%d bytes)\n", tar_filename, filesize);
 
@@ -355,7 +388,7 @@ void upload_file(int sock, const char *file_name, const char *destination_path)
     char command[BUFFER_SIZE];
     snprintf(command, sizeof(command), "uploadf %s %s", file_name, destination_path);
 
-    send(sock, command, strlen(command), 0);
+    dfs_trace_send(sock, command);
     usleep(100000);
 
     fseek(fp, 0, SEEK_END);
@@ -392,11 +425,20 @@ void upload_file(int sock, const char *file_name, const char *destination_path)
 // it will send the file buffer and that will be read by client and client will create a file and the buffer content will be stored into that new file...
 void download_file(int sock, char buffer[])
 {
-    send(sock, buffer, strlen(buffer), 0);
+    dfs_trace_send(sock, buffer);
 
     int filesize;
     recv(sock, &filesize, sizeof(int), 0);
 
+    // -1: the server is overloaded and says when to retry
+    if (filesize < 0)
+    {
+        char busy_msg[BUFFER_SIZE];
+        memset(busy_msg, 0, BUFFER_SIZE);
+        recv(sock, busy_msg, BUFFER_SIZE - 1, 0);
+        printf("S1 response: %s\n", busy_msg);
+        return;
+    }
     if (filesize <= 0)
     {
         printf("Error: File not found or empty\n");
@@ -441,9 +483,549 @@ void download_file(int sock, char buffer[])
     printf("File downloaded successfully to: %s\n", local_filepath);
 }
 
+// prints a report S1 sends with its length in front: request counters and latency
+// percentiles (stats) or the throughput of each node (selftest)
+void show_stats(int sock, char buffer[])
+{
+    dfs_trace_send(sock, buffer);
+
+    int length;
+    if (recv(sock, &length, sizeof(int), MSG_WAITALL) != sizeof(int) || length < 0)
+    {
+        char busy_msg[BUFFER_SIZE];
+        memset(busy_msg, 0, BUFFER_SIZE);
+        recv(sock, busy_msg, BUFFER_SIZE - 1, 0);
+        printf("S1 response: %s\n", busy_msg);
+        return;
+    }
+    char *report = malloc(length + 1);
+    if (report == NULL || recv(sock, report, length, MSG_WAITALL) != length)
+    {
+        printf("Error: Incomplete reply\n");
+        free(report);
+        return;
+    }
+    report[length] = '\0';
+    printf("%s", report);
+    free(report);
+}
+
+/* Batch mode ---------------------------------------------------------------------------------*/
+// w25clients -b <file|-> [-c connections] [-w window] runs the commands of a file, or of
+// stdin for -, without prompting. The commands are dealt to the connections in turn and
+// each connection sends up to window of them ahead of their replies, framed so S1 reads
+// them apart (see DFS_FRAME_MARK in dfs_net.h). One process per connection writes the
+// commands and their uploads while another reads the replies in order, prints a status
+// line for each command and saves downloads in the pwd as the prompt does.
+
+#define BATCH_LINE_MAX 900 // the rest of a frame carries the trace context
+#define BATCH_TEXT_MAX 65536
+
+struct batch_command
+{
+    char line[BATCH_LINE_MAX];
+    int filesize;      // of the file an uploadf sends
+    const char *error; // why the command is not sent, NULL if it is
+};
+
+// what all connections have done, in shared memory
+struct batch_totals
+{
+    long ok, failed;
+    long bytes_up, bytes_down;
+};
+
+// buffered reads of one connection's replies
+struct batch_reader
+{
+    int sock;
+    int start, end;
+    char data[65536];
+};
+
+static struct batch_command *batch;
+static int batch_count;
+static struct batch_totals *totals;
+
+// checks a command as the prompt does; returns why it cannot be sent, NULL if it can
+static const char *batch_check(struct batch_command *c)
+{
+    char command[20] = "", file_name[512] = "", destination[512] = "";
+    sscanf(c->line, "%19s %511s %511s", command, file_name, destination);
+    if (!validate_extension(c->line))
+    {
+        return "invalid command or file extension";
+    }
+    if (strcmp(command, "uploadf") == 0)
+    {
+        struct stat st;
+        if (stat(file_name, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            return "cannot open the file to upload";
+        }
+        c->filesize = st.st_size;
+    }
+    return NULL;
+}
+
+// reads the commands, skipping blank lines, # comments and exit; returns -1 on error
+static int batch_load(FILE *in)
+{
+    char line[BUFFER_SIZE];
+    int capacity = 0;
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *start = line + strspn(line, " \t");
+        if (*start == '\0' || *start == '#' || strcmp(start, "exit") == 0)
+        {
+            continue;
+        }
+        if (batch_count == capacity)
+        {
+            capacity = capacity > 0 ? capacity * 2 : 256;
+            struct batch_command *grown = realloc(batch, capacity * sizeof(*batch));
+            if (grown == NULL)
+            {
+                return -1;
+            }
+            batch = grown;
+        }
+        struct batch_command *c = &batch[batch_count++];
+        memset(c, 0, sizeof(*c));
+        strncpy(c->line, start, sizeof(c->line) - 1);
+        c->error = strlen(start) >= sizeof(c->line) ? "command too long" : batch_check(c);
+    }
+    return ferror(in) ? -1 : 0;
+}
+
+// sends a command, and the file of an uploadf, as the prompt would; returns -1 on error
+static int batch_send(int sock, const struct batch_command *c)
+{
+    dfs_trace_new();
+    if (dfs_trace_send_frame(sock, c->line) < 0)
+    {
+        return -1;
+    }
+    if (strncmp(c->line, "uploadf ", 8) != 0)
+    {
+        return 0;
+    }
+    char file_name[512];
+    sscanf(c->line, "%*s %511s", file_name);
+    if (dfs_send_all(sock, &c->filesize, sizeof(int)) < 0)
+    {
+        return -1;
+    }
+    FILE *fp = fopen(file_name, "rb");
+    char filebuffer[65536];
+    size_t left = c->filesize;
+    while (left > 0)
+    {
+        size_t want = left < sizeof(filebuffer) ? left : sizeof(filebuffer);
+        size_t got = fp != NULL ? fread(filebuffer, 1, want, fp) : 0;
+        if (got == 0)
+        {
+            // the file shrank since it was checked: S1 expects the size it was sent
+            memset(filebuffer, 0, want);
+            got = want;
+        }
+        if (dfs_send_all(sock, filebuffer, got) < 0)
+        {
+            break;
+        }
+        left -= got;
+    }
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+    return left > 0 ? -1 : 0;
+}
+
+static int batch_fill(struct batch_reader *r)
+{
+    ssize_t n;
+    do
+    {
+        n = recv(r->sock, r->data, sizeof(r->data), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+    {
+        return -1;
+    }
+    r->start = 0;
+    r->end = n;
+    return 0;
+}
+
+// takes len bytes of the replies into out, or writes them to fp, or drops them if both are NULL
+static int batch_take(struct batch_reader *r, void *out, FILE *fp, long len)
+{
+    char *p = out;
+    while (len > 0)
+    {
+        if (r->start == r->end && batch_fill(r) < 0)
+        {
+            return -1;
+        }
+        int n = r->end - r->start < len ? r->end - r->start : (int)len;
+        if (p != NULL)
+        {
+            memcpy(p, r->data + r->start, n);
+            p += n;
+        }
+        else if (fp != NULL)
+        {
+            fwrite(r->data + r->start, 1, n, fp);
+        }
+        r->start += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// reads a text reply up to DFS_REPLY_END into text; -1 if the connection ends first
+static int batch_text(struct batch_reader *r, char *text, size_t size)
+{
+    const char *mark = DFS_REPLY_END;
+    size_t mark_len = strlen(mark), matched = 0, used = 0;
+    while (matched < mark_len)
+    {
+        if (r->start == r->end && batch_fill(r) < 0)
+        {
+            text[used] = '\0';
+            return -1;
+        }
+        char c = r->data[r->start++];
+        if (c == mark[matched])
+        {
+            matched++;
+            continue;
+        }
+        // what looked like the start of the mark was text; the mark's first byte occurs in it only once
+        for (size_t i = 0; i < matched && used + 1 < size; i++)
+        {
+            text[used++] = mark[i];
+        }
+        matched = c == mark[0];
+        if (!matched && used + 1 < size)
+        {
+            text[used++] = c;
+        }
+    }
+    text[used] = '\0';
+    return 0;
+}
+
+static int batch_failed_text(const char *text)
+{
+    const char *failures[] = {"Error", "BUSY", "Unknown", "Invalid", "Unsupported", "Usage"};
+    for (size_t i = 0; i < sizeof(failures) / sizeof(failures[0]); i++)
+    {
+        if (strncmp(text, failures[i], strlen(failures[i])) == 0)
+        {
+            return 1;
+        }
+    }
+    return strstr(text, "not found") != NULL;
+}
+
+// reads the reply to c into text (a download is saved, its bytes added to *bytes);
+// returns 1 if the command succeeded, 0 if it failed and -1 if the connection was lost
+static int batch_reply(struct batch_reader *r, const struct batch_command *c, char *text, long *bytes)
+{
+    char command[20], argument[512] = "";
+    sscanf(c->line, "%19s %511s", command, argument);
+    int download = strcmp(command, "downlf") == 0 || strcmp(command, "downltar") == 0;
+    int report = strcmp(command, "stats") == 0 || strcmp(command, "selftest") == 0;
+    if (!download && !report)
+    {
+        if (batch_text(r, text, BATCH_TEXT_MAX) < 0)
+        {
+            return -1;
+        }
+        return !batch_failed_text(text);
+    }
+
+    // a download or report has its size in front, a busy or failed one -1 or 0 and a message
+    int size;
+    if (batch_take(r, &size, NULL, sizeof(int)) < 0)
+    {
+        return -1;
+    }
+    if (size <= 0)
+    {
+        if (batch_text(r, text, BATCH_TEXT_MAX) < 0)
+        {
+            return -1;
+        }
+        if (text[0] == '\0')
+        {
+            snprintf(text, BATCH_TEXT_MAX, "%s", download ? "Error: File not found or empty" : "Error: No report");
+        }
+        return 0;
+    }
+    if (report)
+    {
+        int keep = size < BATCH_TEXT_MAX ? size : BATCH_TEXT_MAX - 1;
+        if (batch_take(r, text, NULL, keep) < 0 || batch_take(r, NULL, NULL, size - keep) < 0)
+        {
+            return -1;
+        }
+        text[keep] = '\0';
+    }
+    else
+    {
+        char local_filepath[512];
+        if (strcmp(command, "downlf") == 0)
+        {
+            get_actual_filename(argument, local_filepath, sizeof(local_filepath));
+        }
+        else
+        {
+            get_tar_filename(argument, local_filepath, sizeof(local_filepath));
+        }
+        FILE *fp = fopen(local_filepath, "wb");
+        int taken = batch_take(r, NULL, fp, size);
+        if (fp != NULL)
+        {
+            fclose(fp);
+        }
+        if (taken < 0)
+        {
+            return -1;
+        }
+        *bytes += size;
+        snprintf(text, BATCH_TEXT_MAX, fp != NULL ? "Saved %s (%d bytes)" : "Error: cannot write %s (%d bytes dropped)",
+                 local_filepath, size);
+    }
+    char trailer[8];
+    if (batch_text(r, trailer, sizeof(trailer)) < 0)
+    {
+        return -1;
+    }
+    return strncmp(text, "Error", 5) != 0;
+}
+
+// one status line per command, ending with the first line of the reply; the rest of a
+// reply of several lines (a listing, a report) follows it
+static void batch_status(int index, int ok, long latency_us, const char *text)
+{
+    char latency[32] = "-";
+    if (latency_us >= 0)
+    {
+        snprintf(latency, sizeof(latency), "%.1f ms", latency_us / 1000.0);
+    }
+    int first_line = strcspn(text, "\n");
+    printf("%-4s %6d %10s  %s: %.*s\n", ok ? "ok" : "FAIL", index + 1, latency, batch[index].line, first_line,
+           text);
+    const char *rest = text[first_line] == '\n' ? text + first_line + 1 : "";
+    if (*rest != '\0')
+    {
+        printf("%s%s", rest, rest[strlen(rest) - 1] == '\n' ? "" : "\n");
+    }
+    fflush(stdout);
+    __atomic_fetch_add(ok ? &totals->ok : &totals->failed, 1, __ATOMIC_RELAXED);
+}
+
+// runs commands first, first + step, ... over one connection to S1
+static void batch_connection(int first, int step, int window)
+{
+    int sock = dfs_connect_port(SERVER_PORT);
+    int credits[2], sent[2];
+    if (sock < 0 || pipe(credits) < 0 || pipe(sent) < 0)
+    {
+        for (int i = first; i < batch_count; i += step)
+        {
+            batch_status(i, 0, -1, batch[i].error != NULL ? batch[i].error : "cannot connect to S1");
+        }
+        return;
+    }
+
+    pid_t writer = fork();
+    if (writer == 0)
+    {
+        // sends a command whenever fewer than window are waiting for their replies
+        close(credits[1]);
+        close(sent[0]);
+        int in_flight = 0;
+        char credit;
+        for (int i = first; i < batch_count; i += step)
+        {
+            if (batch[i].error != NULL)
+            {
+                continue;
+            }
+            if (in_flight == window)
+            {
+                // a credit comes back with every reply read
+                if (read(credits[0], &credit, 1) != 1)
+                {
+                    break;
+                }
+                in_flight--;
+            }
+            long started = dfs_now_us();
+            if (batch_send(sock, &batch[i]) < 0 || write(sent[1], &started, sizeof(started)) != sizeof(started))
+            {
+                break;
+            }
+            in_flight++;
+        }
+        _exit(0);
+    }
+    close(credits[0]);
+    close(sent[1]);
+
+    struct batch_reader *r = malloc(sizeof(*r));
+    char *text = malloc(BATCH_TEXT_MAX);
+    int lost = writer < 0 || r == NULL || text == NULL;
+    if (!lost)
+    {
+        r->sock = sock;
+        r->start = r->end = 0;
+    }
+    for (int i = first; i < batch_count; i += step)
+    {
+        struct batch_command *c = &batch[i];
+        long started;
+        if (c->error != NULL)
+        {
+            batch_status(i, 0, -1, c->error);
+            continue;
+        }
+        if (lost || read(sent[0], &started, sizeof(started)) != sizeof(started))
+        {
+            // S1 may have run what it read of the commands sent so far; none is sent again
+            lost = 1;
+            batch_status(i, 0, -1, "Error: connection to S1 lost");
+            continue;
+        }
+        long down = 0;
+        int ok = batch_reply(r, c, text, &down);
+        if (ok < 0)
+        {
+            lost = 1;
+            char detail[300];
+            snprintf(detail, sizeof(detail), "Error: connection to S1 lost%s%.200s", text[0] != '\0' ? " after: " : "",
+                     text);
+            batch_status(i, 0, dfs_now_us() - started, detail);
+            continue;
+        }
+        batch_status(i, ok, dfs_now_us() - started, text);
+        if (ok)
+        {
+            __atomic_fetch_add(&totals->bytes_down, down, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&totals->bytes_up, (long)c->filesize, __ATOMIC_RELAXED);
+        }
+        if (write(credits[1], "", 1) != 1)
+        {
+            // the writer has sent all its commands and is gone
+        }
+    }
+    if (writer > 0)
+    {
+        kill(writer, SIGKILL); // only still running if the connection was lost
+        waitpid(writer, NULL, 0);
+    }
+    close(sock);
+    free(r);
+    free(text);
+}
+
+static int run_batch(int argc, char *argv[])
+{
+    const char *path = NULL;
+    int connections = 1, window = 16;
+    int opt, bad = 0;
+    while ((opt = getopt(argc, argv, "b:c:w:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            path = optarg;
+            break;
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || path == NULL || optind != argc || connections < 1 || window < 1)
+    {
+        fprintf(stderr, "Usage: %s -b <command file|-> [-c connections (1)] [-w commands in flight (16)]\n",
+                argv[0]);
+        return 2;
+    }
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (in == NULL || batch_load(in) < 0)
+    {
+        perror(path);
+        return 2;
+    }
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+    totals = mmap(NULL, sizeof(*totals), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (totals == MAP_FAILED)
+    {
+        perror("mmap");
+        return 2;
+    }
+    memset(totals, 0, sizeof(*totals));
+    signal(SIGPIPE, SIG_IGN);
+    if (connections > batch_count && batch_count > 0)
+    {
+        connections = batch_count;
+    }
+
+    long started = dfs_now_us();
+    fflush(stdout);
+    for (int c = 0; c < connections; c++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            batch_connection(c, connections, window);
+            _exit(0);
+        }
+        if (pid < 0)
+        {
+            perror("fork");
+            break;
+        }
+    }
+    while (wait(NULL) > 0)
+    {
+    }
+    double seconds = (dfs_now_us() - started) / 1e6;
+    if (seconds <= 0)
+    {
+        seconds = 1e-6;
+    }
+    long done = totals->ok + totals->failed;
+    printf("\n%d commands over %d connection%s (%d in flight each): %ld ok, %ld failed in %.2f s\n", batch_count,
+           connections, connections == 1 ? "" : "s", window, totals->ok, totals->failed, seconds);
+    printf("%.1f commands/s, uploaded %.2f MB at %.2f MB/s, downloaded %.2f MB at %.2f MB/s\n", done / seconds,
+           totals->bytes_up / 1e6, totals->bytes_up / 1e6 / seconds, totals->bytes_down / 1e6,
+           totals->bytes_down / 1e6 / seconds);
+    return totals->failed > 0 || done < batch_count ? 1 : 0;
+}
+
 // entry point of the client side code...
-int main()
+int main(int argc, char *argv[])
 {
+    if (argc > 1)
+    {
+        return run_batch(argc, argv);
+    }
     int sock = connect_to_server();
 
     printf("============================================\n");
@@ -468,6 +1050,13 @@ int main()
             display_extension_error(command);
             continue;
         }
+
+        // every command carries a fresh trace id; DFS_TRACE=1 asks the servers to trace it
+        unsigned long trace_id = dfs_trace_new();
+        if (dfs_env_int("DFS_TRACE", 0))
+        {
+            printf("Trace id: %016lx\n", trace_id);
+        }
         char *command_array[MAX_ARGS];
         char temp_command[MAX_COMMAND_LENGTH];
         strcpy(temp_command, command);
@@ -497,9 +1086,13 @@ int main()
             // Call our separate function to download a tar file.
             download_tar(sock, command_array[1]);
         }
+        else if (strcmp(command_array[0], "stats") == 0 || strcmp(command_array[0], "selftest") == 0)
+        {
+            show_stats(sock, command);
+        }
         else if (strcmp(command_array[0], "removef") == 0)
         {
-            send(sock, command, strlen(command), 0);
+            dfs_trace_send(sock, command);
             memset(command, 0, sizeof(command));
             recv(sock, command, sizeof(command), 0);
             printf("S1 response: %s\n", command);
@@ -509,7 +1102,7 @@ int main()
             // to display all the files with same folder structure
             command[strcspn(command, "\n")] = 0;
 
-            send(sock, command, strlen(command), 0);
+            dfs_trace_send(sock, command);
             memset(command, 0, sizeof(command));
             char answer[BUFFER_SIZE * 5];
             memset(answer, 0, sizeof(answer));
@@ -537,7 +1130,7 @@ int main()
         else
         {
             // For any other commands, send to S1.
-            send(sock, command, strlen(command), 0);
+            dfs_trace_send(sock, command);
             memset(command, 0, sizeof(command));
             recv(sock, command, sizeof(command), 0);
             printf("S1 response: %s\n", command);